@@ -12,9 +12,7 @@ void btc_alarm_handler(btc_msg_t *msg)
 {
     btc_alarm_args_t *arg = (btc_alarm_args_t *)msg->arg;
 
-    BTC_TRACE_DEBUG("%s act %d\n", __FUNCTION__, msg->act);
+    BTC_TRACE_DEBUG("%s act %d num %d\n", __FUNCTION__, msg->act, arg->num);
 
-    if (arg->cb) {
-        arg->cb(arg->cb_data);
-    }
+    osi_alarm_dispatch(arg->expired, arg->num);
 }
@@ -11,10 +11,10 @@
 #include <stdint.h>
 #include "osi/alarm.h"
 
-/* btc_alarm_args_t */
+/* btc_alarm_args_t, only the first |num| entries of |expired| are posted */
 typedef struct {
-    osi_alarm_callback_t cb;
-    void *cb_data;
+    uint16_t num;
+    osi_alarm_expiry_t expired[ALARM_CBS_NUM];
 } btc_alarm_args_t;
 
 void btc_alarm_handler(btc_msg_t *msg);
@@ -60,6 +60,12 @@
 #define HEAP_MEMORY_DEBUG   FALSE
 #endif
 
+#if UC_BT_BLUEDROID_MEM_PROFILE
+#define HEAP_MEMORY_PROFILE TRUE
+#else
+#define HEAP_MEMORY_PROFILE FALSE
+#endif
+
 #ifndef BT_BLE_DYNAMIC_ENV_MEMORY
 #define BT_BLE_DYNAMIC_ENV_MEMORY  FALSE
 #endif
@@ -91,6 +91,13 @@
 #define UC_BT_BLUFI_ENABLE                  FALSE
 #endif
 
+//OSI LIST NODE POOL
+#ifdef CONFIG_BT_OSI_LIST_NODE_POOL_SIZE
+#define UC_BT_OSI_LIST_NODE_POOL_SIZE CONFIG_BT_OSI_LIST_NODE_POOL_SIZE
+#else
+#define UC_BT_OSI_LIST_NODE_POOL_SIZE 64
+#endif
+
 //MEMORY DEBUG
 #ifdef CONFIG_BT_BLUEDROID_MEM_DEBUG
 #define UC_BT_BLUEDROID_MEM_DEBUG TRUE
@@ -98,4 +105,11 @@
 #define UC_BT_BLUEDROID_MEM_DEBUG FALSE
 #endif
 
+//MEMORY PROFILE
+#ifdef CONFIG_BT_BLUEDROID_MEM_PROFILE
+#define UC_BT_BLUEDROID_MEM_PROFILE TRUE
+#else
+#define UC_BT_BLUEDROID_MEM_PROFILE FALSE
+#endif
+
 #endif /* __BT_USER_CONFIG_H__ */
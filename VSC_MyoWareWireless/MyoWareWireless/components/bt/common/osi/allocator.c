@@ -15,11 +15,13 @@
  *  limitations under the License.
  *
  ******************************************************************************/
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "bt_common.h"
 #include "osi/allocator.h"
+#include "osi/list.h"
 
 extern void *pvPortZalloc(size_t size);
 extern void vPortFree(void *pv);
@@ -142,6 +144,13 @@ void osi_mem_dbg_show(void)
     }
     OSI_TRACE_ERROR("--> count %d\n", mem_dbg_count);
     OSI_TRACE_ERROR("--> size %dB\n--> max size %dB\n", mem_dbg_current_size, mem_dbg_max_size);
+
+    osi_pool_stats_t stats;
+    list_get_node_pool_stats(&stats);
+    OSI_TRACE_ERROR("--> list nodes: pool %" PRIu32 ", heap %" PRIu32 ", failed %" PRIu32 ", freed %" PRIu32
+                    ", in use %" PRIu32 ", max in use %" PRIu32 "\n",
+                    stats.pool_allocs, stats.heap_allocs, stats.failed_allocs, stats.frees,
+                    stats.in_use, stats.max_in_use);
 }
 
 uint32_t osi_mem_dbg_get_max_size(void)
@@ -222,6 +231,8 @@ void *osi_malloc_func(size_t size)
 #endif /* #if HEAP_ALLOCATION_FROM_SPIRAM_FIRST */
     osi_mem_dbg_record(p, size, __func__, __LINE__);
     return p;
+#elif HEAP_MEMORY_PROFILE
+    return osi_malloc(size);
 #else
 #if HEAP_ALLOCATION_FROM_SPIRAM_FIRST
     return heap_caps_malloc_prefer(size, 2, MALLOC_CAP_DEFAULT|MALLOC_CAP_SPIRAM, MALLOC_CAP_DEFAULT|MALLOC_CAP_INTERNAL);
@@ -242,6 +253,8 @@ void *osi_calloc_func(size_t size)
 #endif /* #if HEAP_ALLOCATION_FROM_SPIRAM_FIRST */
     osi_mem_dbg_record(p, size, __func__, __LINE__);
     return p;
+#elif HEAP_MEMORY_PROFILE
+    return osi_calloc(size);
 #else
 #if HEAP_ALLOCATION_FROM_SPIRAM_FIRST
     return heap_caps_calloc_prefer(1, size, 2, MALLOC_CAP_DEFAULT|MALLOC_CAP_SPIRAM, MALLOC_CAP_DEFAULT|MALLOC_CAP_INTERNAL);
@@ -255,6 +268,8 @@ void osi_free_func(void *ptr)
 {
 #if HEAP_MEMORY_DEBUG
     osi_mem_dbg_clean(ptr, __func__, __LINE__);
+#elif HEAP_MEMORY_PROFILE
+    osi_mem_prof_free(ptr);
 #endif
     free(ptr);
 }
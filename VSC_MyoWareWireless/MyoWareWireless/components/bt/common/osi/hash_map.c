@@ -16,20 +16,40 @@
  *
  ******************************************************************************/
 
+#include <string.h>
+
 #include "bt_common.h"
-#include "osi/list.h"
 #include "osi/hash_map.h"
 #include "osi/allocator.h"
 
-struct hash_map_t;
+// Smallest number of slots of a table.
+#define HASH_MAP_MIN_SLOTS        8
+
+// A slot holds its entry inline. |hash| is the mixed hash of the key, 0 if the
+// slot is empty. Entries are placed by Robin Hood linear probing: an entry
+// further from its home slot than the one in its way takes that slot over, so
+// the probe lengths stay short and a lookup can stop at the first entry closer
+// to its home than the key would be.
+typedef struct {
+    uint32_t hash;
+    hash_map_entry_t entry;
+} hash_map_slot_t;
+
+typedef struct {
+    hash_map_slot_t *slots;
+    uint32_t mask;            // number of slots - 1
+} hash_map_table_t;
 
-typedef struct hash_map_bucket_t {
-    list_t *list;
-} hash_map_bucket_t;
+struct hash_map_t;
 
 typedef struct hash_map_t {
-    hash_map_bucket_t *bucket;
-    size_t num_bucket;
+    hash_map_table_t table;   // where new entries go
+    hash_map_table_t old;     // the table being moved to |table| while growing
+    uint32_t migrated;        // slots of |old| moved so far
+    hash_map_table_t next;    // the table |table| is moved to next, being cleared
+    uint32_t cleared;         // slots of |next| cleared so far
+    uint32_t step_slots;      // slots cleared or moved by the current set or erase
+    uint32_t max_step_slots;  // the most |step_slots| so far
     size_t hash_size;
     hash_index_fn hash_fn;
     key_free_fn key_fn;
@@ -37,13 +57,220 @@ typedef struct hash_map_t {
     key_equality_fn keys_are_equal;
 } hash_map_t;
 
-// Hidden constructor for list, only to be used by us.
-list_t *list_new_internal(list_free_cb callback);
-
-static void bucket_free_(void *data);
 static bool default_key_equality(const void *x, const void *y);
-static hash_map_entry_t *find_bucket_entry_(list_t *hash_bucket_list,
-        const void *key);
+
+// Spreads the bits of the user hash so pointers and small integers don't pile
+// up in a few slots. Never returns 0, which marks an empty slot.
+static uint32_t mix_hash_(hash_index_t hash_index)
+{
+    uint32_t hash = (uint32_t)hash_index;
+    hash ^= hash >> 16;
+    hash *= 0x7feb352d;
+    hash ^= hash >> 15;
+    return hash ? hash : 1;
+}
+
+static uint32_t slot_distance_(const hash_map_table_t *table, uint32_t index)
+{
+    return (index - table->slots[index].hash) & table->mask;
+}
+
+static bool table_new_(hash_map_table_t *table, uint32_t num_slots)
+{
+    table->slots = osi_calloc(sizeof(hash_map_slot_t) * num_slots);
+    table->mask = num_slots - 1;
+    return table->slots != NULL;
+}
+
+static void table_insert_(hash_map_table_t *table, uint32_t hash, hash_map_entry_t entry)
+{
+    uint32_t index = hash & table->mask;
+    uint32_t distance = 0;
+
+    for (;;) {
+        hash_map_slot_t *slot = &table->slots[index];
+        if (slot->hash == 0) {
+            slot->hash = hash;
+            slot->entry = entry;
+            return;
+        }
+        uint32_t slot_distance = slot_distance_(table, index);
+        if (slot_distance < distance) {
+            uint32_t displaced_hash = slot->hash;
+            hash_map_entry_t displaced_entry = slot->entry;
+            slot->hash = hash;
+            slot->entry = entry;
+            hash = displaced_hash;
+            entry = displaced_entry;
+            distance = slot_distance;
+        }
+        index = (index + 1) & table->mask;
+        distance++;
+    }
+}
+
+// Returns the slot of |key| in |table| or NULL. Slots whose entry has no map
+// are erased entries of the old table and are skipped.
+static hash_map_slot_t *table_find_(const hash_map_t *hash_map, const hash_map_table_t *table,
+                                    uint32_t hash, const void *key)
+{
+    uint32_t index = hash & table->mask;
+
+    for (uint32_t distance = 0; ; distance++) {
+        hash_map_slot_t *slot = &table->slots[index];
+        if (slot->hash == 0 || slot_distance_(table, index) < distance) {
+            return NULL;
+        }
+        if (slot->hash == hash && slot->entry.hash_map != NULL &&
+                hash_map->keys_are_equal(slot->entry.key, key)) {
+            return slot;
+        }
+        index = (index + 1) & table->mask;
+    }
+}
+
+// Empties |slot| and shifts the entries after it back towards their home slots,
+// so no probe sequence is broken by the gap.
+static void table_remove_(hash_map_table_t *table, hash_map_slot_t *slot)
+{
+    uint32_t index = slot - table->slots;
+    uint32_t next = (index + 1) & table->mask;
+
+    while (table->slots[next].hash != 0 && slot_distance_(table, next) > 0) {
+        table->slots[index] = table->slots[next];
+        index = next;
+        next = (next + 1) & table->mask;
+    }
+    table->slots[index].hash = 0;
+}
+
+static hash_map_slot_t *find_slot_(const hash_map_t *hash_map, uint32_t hash, const void *key,
+                                   bool *in_old)
+{
+    hash_map_slot_t *slot = table_find_(hash_map, &hash_map->table, hash, key);
+    *in_old = false;
+    if (slot == NULL && hash_map->old.slots != NULL) {
+        // Slots of the old table below |migrated| were copied to the new one
+        // already, what is left there is stale.
+        slot = table_find_(hash_map, &hash_map->old, hash, key);
+        if (slot != NULL && (uint32_t)(slot - hash_map->old.slots) < hash_map->migrated) {
+            slot = NULL;
+        }
+        *in_old = slot != NULL;
+    }
+    return slot;
+}
+
+// Moves up to |num_slots| slots of the old table, returns how many it moved.
+static uint32_t migrate_(hash_map_t *hash_map, uint32_t num_slots)
+{
+    hash_map_table_t *old = &hash_map->old;
+    uint32_t start = hash_map->migrated;
+
+    if (old->slots == NULL) {
+        return 0;
+    }
+    for (; num_slots > 0 && hash_map->migrated <= old->mask; num_slots--, hash_map->migrated++) {
+        const hash_map_slot_t *slot = &old->slots[hash_map->migrated];
+        if (slot->hash != 0 && slot->entry.hash_map != NULL) {
+            table_insert_(&hash_map->table, slot->hash, slot->entry);
+        }
+    }
+    uint32_t moved = hash_map->migrated - start;
+    if (hash_map->migrated > old->mask) {
+        osi_free(old->slots);
+        old->slots = NULL;
+        hash_map->migrated = 0;
+    }
+    return moved;
+}
+
+// Clears up to |num_slots| slots of the next table, returns how many it
+// cleared. Once it is cleared the entries start moving to it.
+static uint32_t clear_(hash_map_t *hash_map, uint32_t num_slots)
+{
+    hash_map_table_t *next = &hash_map->next;
+
+    if (next->slots == NULL) {
+        return 0;
+    }
+    if (num_slots > next->mask + 1 - hash_map->cleared) {
+        num_slots = next->mask + 1 - hash_map->cleared;
+    }
+    memset(&next->slots[hash_map->cleared], 0, sizeof(hash_map_slot_t) * num_slots);
+    hash_map->cleared += num_slots;
+    if (hash_map->cleared > next->mask) {
+        hash_map->old = hash_map->table;
+        hash_map->table = *next;
+        hash_map->migrated = 0;
+        next->slots = NULL;
+        hash_map->cleared = 0;
+    }
+    return num_slots;
+}
+
+// Allocates the next table of |num_slots| slots. Unlike |table_new_| it leaves
+// the slots to |clear_|, which clears them over the following calls.
+static bool next_new_(hash_map_t *hash_map, uint32_t num_slots)
+{
+    hash_map->next.slots = osi_malloc(sizeof(hash_map_slot_t) * num_slots);
+    hash_map->next.mask = num_slots - 1;
+    hash_map->cleared = 0;
+    return hash_map->next.slots != NULL;
+}
+
+static void note_step_(hash_map_t *hash_map, uint32_t num_slots)
+{
+    hash_map->step_slots += num_slots;
+    if (hash_map->step_slots > hash_map->max_step_slots) {
+        hash_map->max_step_slots = hash_map->step_slots;
+    }
+}
+
+// The share of growing done by every set and erase.
+static void step_(hash_map_t *hash_map)
+{
+    hash_map->step_slots = 0;
+    note_step_(hash_map, migrate_(hash_map, HASH_MAP_MIGRATE_SLOTS));
+    note_step_(hash_map, clear_(hash_map, HASH_MAP_CLEAR_SLOTS));
+}
+
+// Allocates a table twice the size once the map is half full. It is cleared by
+// the following sets and erases, then the entries move to it before the next
+// one is needed, so no call touches more than a few slots. Only if the table
+// couldn't be allocated before the map is 3/4 full does the whole growth
+// happen in the set that finds it full.
+static bool grow_if_needed_(hash_map_t *hash_map)
+{
+    uint32_t num_slots = hash_map->table.mask + 1;
+
+    if (hash_map->hash_size + 1 <= num_slots / 2) {
+        return true;
+    }
+    if (hash_map->next.slots == NULL && hash_map->old.slots == NULL) {
+        next_new_(hash_map, num_slots * 2);
+    }
+    if (hash_map->hash_size + 1 <= num_slots / 4 * 3) {
+        return true;
+    }
+
+    note_step_(hash_map, migrate_(hash_map, UINT32_MAX));
+    if (hash_map->next.slots == NULL && !next_new_(hash_map, num_slots * 2)) {
+        return false;
+    }
+    note_step_(hash_map, clear_(hash_map, UINT32_MAX));
+    return true;
+}
+
+static void free_entry_(const hash_map_t *hash_map, hash_map_entry_t *entry)
+{
+    if (hash_map->key_fn) {
+        hash_map->key_fn((void *)entry->key);
+    }
+    if (hash_map->data_fn) {
+        hash_map->data_fn(entry->data);
+    }
+}
 
 // Hidden constructor, only to be used by the allocation tracker. Behaves the same as
 // |hash_map_new|, except you get to specify the allocator.
@@ -66,9 +293,11 @@ hash_map_t *hash_map_new_internal(
     hash_map->data_fn = data_fn;
     hash_map->keys_are_equal = equality_fn ? equality_fn : default_key_equality;
 
-    hash_map->num_bucket = num_bucket;
-    hash_map->bucket = osi_calloc(sizeof(hash_map_bucket_t) * num_bucket);
-    if (hash_map->bucket == NULL) {
+    uint32_t num_slots = HASH_MAP_MIN_SLOTS;
+    while (num_slots < num_bucket / 2 && num_slots < (UINT32_MAX >> 2)) {
+        num_slots <<= 1;
+    }
+    if (!table_new_(&hash_map->table, num_slots)) {
         osi_free(hash_map);
         return NULL;
     }
@@ -91,7 +320,7 @@ void hash_map_free(hash_map_t *hash_map)
         return;
     }
     hash_map_clear(hash_map);
-    osi_free(hash_map->bucket);
+    osi_free(hash_map->table.slots);
     osi_free(hash_map);
 }
 
@@ -108,7 +337,7 @@ size_t hash_map_size(const hash_map_t *hash_map) {
 
 size_t hash_map_num_buckets(const hash_map_t *hash_map) {
   assert(hash_map != NULL);
-  return hash_map->num_bucket;
+  return hash_map->table.mask + 1;
 }
 */
 
@@ -116,11 +345,8 @@ bool hash_map_has_key(const hash_map_t *hash_map, const void *key)
 {
     assert(hash_map != NULL);
 
-    hash_index_t hash_key = hash_map->hash_fn(key) % hash_map->num_bucket;
-    list_t *hash_bucket_list = hash_map->bucket[hash_key].list;
-
-    hash_map_entry_t *hash_map_entry = find_bucket_entry_(hash_bucket_list, key);
-    return (hash_map_entry != NULL);
+    bool in_old;
+    return find_slot_(hash_map, mix_hash_(hash_map->hash_fn(key)), key, &in_old) != NULL;
 }
 
 bool hash_map_set(hash_map_t *hash_map, const void *key, void *data)
@@ -128,70 +354,62 @@ bool hash_map_set(hash_map_t *hash_map, const void *key, void *data)
     assert(hash_map != NULL);
     assert(data != NULL);
 
-    hash_index_t hash_key = hash_map->hash_fn(key) % hash_map->num_bucket;
-
-    if (hash_map->bucket[hash_key].list == NULL) {
-        hash_map->bucket[hash_key].list = list_new_internal(bucket_free_);
-        if (hash_map->bucket[hash_key].list == NULL) {
-            return false;
-        }
+    step_(hash_map);
+
+    uint32_t hash = mix_hash_(hash_map->hash_fn(key));
+    bool in_old;
+    hash_map_slot_t *slot = find_slot_(hash_map, hash, key, &in_old);
+    if (slot != NULL) {
+        // Like an erase followed by an insert, the old key and data are freed.
+        hash_map_entry_t old_entry = slot->entry;
+        slot->entry.key = key;
+        slot->entry.data = data;
+        free_entry_(hash_map, &old_entry);
+        return true;
     }
-    list_t *hash_bucket_list = hash_map->bucket[hash_key].list;
-
-    hash_map_entry_t *hash_map_entry = find_bucket_entry_(hash_bucket_list, key);
 
-    if (hash_map_entry) {
-        // Calls hash_map callback to delete the hash_map_entry.
-        bool rc = list_remove(hash_bucket_list, hash_map_entry);
-        assert(rc == true);
-        (void)rc;
-    } else {
-        hash_map->hash_size++;
-    }
-    hash_map_entry = osi_calloc(sizeof(hash_map_entry_t));
-    if (hash_map_entry == NULL) {
+    if (!grow_if_needed_(hash_map)) {
         return false;
     }
-
-    hash_map_entry->key = key;
-    hash_map_entry->data = data;
-    hash_map_entry->hash_map = hash_map;
-
-    return list_append(hash_bucket_list, hash_map_entry);
+    hash_map_entry_t entry = { .key = key, .data = data, .hash_map = hash_map };
+    table_insert_(&hash_map->table, hash, entry);
+    hash_map->hash_size++;
+    return true;
 }
 
 bool hash_map_erase(hash_map_t *hash_map, const void *key)
 {
     assert(hash_map != NULL);
 
-    hash_index_t hash_key = hash_map->hash_fn(key) % hash_map->num_bucket;
-    list_t *hash_bucket_list = hash_map->bucket[hash_key].list;
+    step_(hash_map);
 
-    hash_map_entry_t *hash_map_entry = find_bucket_entry_(hash_bucket_list, key);
-    if (hash_map_entry == NULL) {
+    bool in_old;
+    hash_map_slot_t *slot = find_slot_(hash_map, mix_hash_(hash_map->hash_fn(key)), key, &in_old);
+    if (slot == NULL) {
         return false;
     }
 
-    hash_map->hash_size--;
-    bool remove = list_remove(hash_bucket_list, hash_map_entry);
-    if(list_is_empty(hash_map->bucket[hash_key].list)) {
-        list_free(hash_map->bucket[hash_key].list);
-        hash_map->bucket[hash_key].list = NULL;
+    hash_map_entry_t entry = slot->entry;
+    if (in_old) {
+        // The old table keeps its layout until it is moved, the slot stays
+        // taken but no longer matches.
+        slot->entry.hash_map = NULL;
+    } else {
+        table_remove_(&hash_map->table, slot);
     }
-
-    return remove;
+    hash_map->hash_size--;
+    free_entry_(hash_map, &entry);
+    return true;
 }
 
 void *hash_map_get(const hash_map_t *hash_map, const void *key)
 {
     assert(hash_map != NULL);
 
-    hash_index_t hash_key = hash_map->hash_fn(key) % hash_map->num_bucket;
-    list_t *hash_bucket_list = hash_map->bucket[hash_key].list;
-
-    hash_map_entry_t *hash_map_entry = find_bucket_entry_(hash_bucket_list, key);
-    if (hash_map_entry != NULL) {
-        return hash_map_entry->data;
+    bool in_old;
+    hash_map_slot_t *slot = find_slot_(hash_map, mix_hash_(hash_map->hash_fn(key)), key, &in_old);
+    if (slot != NULL) {
+        return slot->entry.data;
     }
 
     return NULL;
@@ -201,13 +419,20 @@ void hash_map_clear(hash_map_t *hash_map)
 {
     assert(hash_map != NULL);
 
-    for (hash_index_t i = 0; i < hash_map->num_bucket; i++) {
-        if (hash_map->bucket[i].list == NULL) {
-            continue;
+    migrate_(hash_map, UINT32_MAX);
+    if (hash_map->next.slots != NULL) {
+        osi_free(hash_map->next.slots);
+        hash_map->next.slots = NULL;
+        hash_map->cleared = 0;
+    }
+    for (uint32_t i = 0; i <= hash_map->table.mask; i++) {
+        hash_map_slot_t *slot = &hash_map->table.slots[i];
+        if (slot->hash != 0) {
+            free_entry_(hash_map, &slot->entry);
+            slot->hash = 0;
         }
-        list_free(hash_map->bucket[i].list);
-        hash_map->bucket[i].list = NULL;
     }
+    hash_map->hash_size = 0;
 }
 
 void hash_map_foreach(hash_map_t *hash_map, hash_map_iter_cb callback, void *context)
@@ -215,53 +440,27 @@ void hash_map_foreach(hash_map_t *hash_map, hash_map_iter_cb callback, void *con
     assert(hash_map != NULL);
     assert(callback != NULL);
 
-    for (hash_index_t i = 0; i < hash_map->num_bucket; ++i) {
-        if (hash_map->bucket[i].list == NULL) {
-            continue;
-        }
-        for (const list_node_t *iter = list_begin(hash_map->bucket[i].list);
-                iter != list_end(hash_map->bucket[i].list);
-                iter = list_next(iter)) {
-            hash_map_entry_t *hash_map_entry = (hash_map_entry_t *)list_node(iter);
-            if (!callback(hash_map_entry, context)) {
-                return;
-            }
+    for (uint32_t i = 0; i <= hash_map->table.mask; i++) {
+        hash_map_slot_t *slot = &hash_map->table.slots[i];
+        if (slot->hash != 0 && !callback(&slot->entry, context)) {
+            return;
         }
     }
-}
-
-static void bucket_free_(void *data)
-{
-    assert(data != NULL);
-    hash_map_entry_t *hash_map_entry = (hash_map_entry_t *)data;
-    const hash_map_t *hash_map = hash_map_entry->hash_map;
-
-    if (hash_map->key_fn) {
-        hash_map->key_fn((void *)hash_map_entry->key);
+    if (hash_map->old.slots == NULL) {
+        return;
     }
-    if (hash_map->data_fn) {
-        hash_map->data_fn(hash_map_entry->data);
+    for (uint32_t i = hash_map->migrated; i <= hash_map->old.mask; i++) {
+        hash_map_slot_t *slot = &hash_map->old.slots[i];
+        if (slot->hash != 0 && slot->entry.hash_map != NULL && !callback(&slot->entry, context)) {
+            return;
+        }
     }
-    osi_free(hash_map_entry);
 }
 
-static hash_map_entry_t *find_bucket_entry_(list_t *hash_bucket_list,
-        const void *key)
+size_t hash_map_max_step_slots(const hash_map_t *hash_map)
 {
-
-    if (hash_bucket_list == NULL) {
-        return NULL;
-    }
-
-    for (const list_node_t *iter = list_begin(hash_bucket_list);
-            iter != list_end(hash_bucket_list);
-            iter = list_next(iter)) {
-        hash_map_entry_t *hash_map_entry = (hash_map_entry_t *)list_node(iter);
-        if (hash_map_entry->hash_map->keys_are_equal(hash_map_entry->key, key)) {
-            return hash_map_entry;
-        }
-    }
-    return NULL;
+    assert(hash_map != NULL);
+    return hash_map->max_step_slots;
 }
 
 static bool default_key_equality(const void *x, const void *y)
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include "osi/pool.h"
 struct list_node_t;
 typedef struct list_node_t list_node_t;
 
@@ -118,4 +119,8 @@ list_node_t *list_next(const list_node_t *node);
 // |node| must not equal the value returned by |list_end|.
 void *list_node(const list_node_t *node);
 
+// Copies the allocation counters of the pool all list nodes are taken from to
+// |stats|. |stats| may not be NULL.
+void list_get_node_pool_stats(osi_pool_stats_t *stats);
+
 #endif /* _LIST_H_ */
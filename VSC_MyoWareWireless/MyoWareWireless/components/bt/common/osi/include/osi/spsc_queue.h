@@ -0,0 +1,82 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _SPSC_QUEUE_H_
+#define _SPSC_QUEUE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SPSC_QUEUE_MAX_TIMEOUT            0xffffffffUL
+
+struct spsc_queue_t;
+
+typedef struct spsc_queue_t spsc_queue_t;
+
+typedef void (*spsc_queue_free_cb)(void *data);
+typedef void (*spsc_queue_cb)(spsc_queue_t *queue);
+
+// A bounded queue like fixed_queue_t for exactly one producer and one consumer.
+// The elements are kept in a ring of pointers with atomic read and write
+// positions, so neither side takes a lock. A side only blocks when the queue is
+// empty or full, on the notification of its FreeRTOS task, and must not wait
+// for other notifications of that task at the same time.
+//
+// The producer and the consumer may each be a different task over time, as
+// long as a lock or another ordering point lies between the changes of roles.
+// The functions marked "consumer" may only be called on the consumer side.
+
+// Creates a new queue which holds up to |capacity| elements. Returns NULL on
+// failure. The caller must free the returned queue with |spsc_queue_free|.
+spsc_queue_t *spsc_queue_new(size_t capacity);
+
+// Frees |queue|, calling |free_cb| for each element left in it if |free_cb| is
+// not NULL. Neither side may use |queue| any more. |queue| may be NULL.
+void spsc_queue_free(spsc_queue_t *queue, spsc_queue_free_cb free_cb);
+
+// Returns a value indicating whether |queue| is empty. If |queue| is NULL, the
+// return value is true.
+bool spsc_queue_is_empty(spsc_queue_t *queue);
+
+// Returns the number of elements in |queue|, which may be out of date as soon as
+// it is returned if the other side works on the queue. If |queue| is NULL, the
+// return value is 0.
+size_t spsc_queue_length(spsc_queue_t *queue);
+
+// Returns the maximum number of elements |queue| may hold. |queue| may not be
+// NULL.
+size_t spsc_queue_capacity(spsc_queue_t *queue);
+
+// Producer. Enqueues |data|, which may not be NULL, into |queue|. If the queue is
+// full, waits up to |timeout| milliseconds for room, or forever with
+// SPSC_QUEUE_MAX_TIMEOUT. Returns false if there was no room in time.
+bool spsc_queue_enqueue(spsc_queue_t *queue, void *data, uint32_t timeout);
+
+// Consumer. Dequeues the next element from |queue|. If the queue is empty, waits
+// up to |timeout| milliseconds for an element, or forever with
+// SPSC_QUEUE_MAX_TIMEOUT. Returns NULL if there was none in time.
+void *spsc_queue_dequeue(spsc_queue_t *queue, uint32_t timeout);
+
+// Consumer. Dequeues the next element from |queue| without blocking. Returns NULL
+// if the queue is empty or NULL.
+void *spsc_queue_try_dequeue(spsc_queue_t *queue);
+
+// Consumer. Returns the next element from |queue|, if present, without
+// dequeuing it. Returns NULL if the queue is empty or NULL.
+void *spsc_queue_try_peek_first(spsc_queue_t *queue);
+
+// Registers |ready_cb| to be called by |spsc_queue_process|. Neither |queue| nor
+// |ready_cb| may be NULL.
+void spsc_queue_register_dequeue(spsc_queue_t *queue, spsc_queue_cb ready_cb);
+
+// Unregisters the dequeue ready callback of |queue|, if any. This function is
+// idempotent.
+void spsc_queue_unregister_dequeue(spsc_queue_t *queue);
+
+void spsc_queue_process(spsc_queue_t *queue);
+
+#endif /* _SPSC_QUEUE_H_ */
@@ -3,12 +3,27 @@
 #include "osi/allocator.h"
 #include "osi/list.h"
 #include "osi/osi.h"
+#include "osi/pool.h"
 
 struct list_node_t {
     struct list_node_t *next;
     void *data;
 };
 
+// Every element of a list or fixed queue takes a node, the nodes in flight come
+// from this pool instead of the heap.
+#if UC_BT_OSI_LIST_NODE_POOL_SIZE > 0
+static list_node_t list_node_blocks[UC_BT_OSI_LIST_NODE_POOL_SIZE];
+static osi_pool_t list_node_pool = OSI_POOL_INITIALIZER(list_node_blocks, UC_BT_OSI_LIST_NODE_POOL_SIZE);
+#else
+static osi_pool_t list_node_pool = { { 0 }, 0, NULL, sizeof(list_node_t), 0, { 0 } };
+#endif
+
+static list_node_t *list_node_alloc(void)
+{
+    return (list_node_t *)osi_pool_alloc(&list_node_pool);
+}
+
 typedef struct list_t {
     list_node_t *head;
     list_node_t *tail;
@@ -115,9 +130,9 @@ bool list_insert_after(list_t *list, list_node_t *prev_node, void *data) {
     assert(list != NULL);
     assert(prev_node != NULL);
     assert(data != NULL);
-    list_node_t *node = (list_node_t *)osi_calloc(sizeof(list_node_t));
+    list_node_t *node = list_node_alloc();
     if (!node) {
-        OSI_TRACE_ERROR("%s osi_calloc failed.\n", __FUNCTION__ );
+        OSI_TRACE_ERROR("%s list_node_alloc failed.\n", __FUNCTION__ );
         return false;
     }
     node->next = prev_node->next;
@@ -134,9 +149,9 @@ bool list_prepend(list_t *list, void *data)
 {
     assert(list != NULL);
     assert(data != NULL);
-    list_node_t *node = (list_node_t *)osi_calloc(sizeof(list_node_t));
+    list_node_t *node = list_node_alloc();
     if (!node) {
-        OSI_TRACE_ERROR("%s osi_calloc failed.\n", __FUNCTION__ );
+        OSI_TRACE_ERROR("%s list_node_alloc failed.\n", __FUNCTION__ );
         return false;
     }
     node->next = list->head;
@@ -153,9 +168,9 @@ bool list_append(list_t *list, void *data)
 {
     assert(list != NULL);
     assert(data != NULL);
-    list_node_t *node = (list_node_t *)osi_calloc(sizeof(list_node_t));
+    list_node_t *node = list_node_alloc();
     if (!node) {
-        OSI_TRACE_ERROR("%s osi_calloc failed.\n", __FUNCTION__ );
+        OSI_TRACE_ERROR("%s list_node_alloc failed.\n", __FUNCTION__ );
         return false;
     }
     node->next = NULL;
@@ -291,7 +306,7 @@ list_node_t *list_free_node(list_t *list, list_node_t *node)
     if (list->free_cb) {
         list->free_cb(node->data);
     }
-    osi_free(node);
+    osi_pool_free(&list_node_pool, node);
     --list->length;
 
     return next;
@@ -305,8 +320,13 @@ list_node_t *list_delete_node(list_t *list, list_node_t *node)
 
     list_node_t *next = node->next;
 
-    osi_free(node);
+    osi_pool_free(&list_node_pool, node);
     --list->length;
 
     return next;
 }
+
+void list_get_node_pool_stats(osi_pool_stats_t *stats)
+{
+    osi_pool_get_stats(&list_node_pool, stats);
+}
@@ -0,0 +1,213 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "bt_common.h"
+#include "osi/allocator.h"
+#include "osi/spsc_queue.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// |head| only moves on the consumer side and |tail| only on the producer side.
+// Both count up forever, |tail - head| is the length even after they wrap.
+typedef struct spsc_queue_t {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t mask;
+    size_t capacity;
+    TaskHandle_t waiting_consumer;
+    TaskHandle_t waiting_producer;
+    spsc_queue_cb dequeue_ready;
+    void *slots[];
+} spsc_queue_t;
+
+typedef bool (*spsc_ready_fn)(spsc_queue_t *queue);
+
+static bool spsc_has_element(spsc_queue_t *queue)
+{
+    return __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) != queue->head;
+}
+
+static bool spsc_has_room(spsc_queue_t *queue)
+{
+    return queue->tail - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) < queue->capacity;
+}
+
+// Waits until |ready| is true, for up to |timeout| milliseconds. The waiting
+// task is published in |waiter| before |ready| is checked again, and the other
+// side checks |waiter| after its change, so one of them always sees the other.
+// A notification left over from an earlier wait only causes another round.
+static bool spsc_wait(spsc_queue_t *queue, TaskHandle_t *waiter, spsc_ready_fn ready, uint32_t timeout)
+{
+    if (ready(queue)) {
+        return true;
+    }
+    if (timeout == 0) {
+        return false;
+    }
+
+    const TickType_t ticks = timeout == SPSC_QUEUE_MAX_TIMEOUT ? portMAX_DELAY : timeout / portTICK_PERIOD_MS;
+    const TickType_t start = xTaskGetTickCount();
+    for (;;) {
+        __atomic_store_n(waiter, xTaskGetCurrentTaskHandle(), __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (ready(queue)) {
+            break;
+        }
+
+        TickType_t wait = portMAX_DELAY;
+        if (ticks != portMAX_DELAY) {
+            const TickType_t elapsed = xTaskGetTickCount() - start;
+            if (elapsed >= ticks) {
+                break;
+            }
+            wait = ticks - elapsed;
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+    __atomic_store_n(waiter, NULL, __ATOMIC_RELAXED);
+    return ready(queue);
+}
+
+static void spsc_wake(TaskHandle_t *waiter)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiter, __ATOMIC_RELAXED) != NULL) {
+        TaskHandle_t task = __atomic_exchange_n(waiter, NULL, __ATOMIC_RELAXED);
+        if (task != NULL) {
+            xTaskNotifyGive(task);
+        }
+    }
+}
+
+spsc_queue_t *spsc_queue_new(size_t capacity)
+{
+    if (capacity == 0 || capacity > (UINT32_MAX >> 1)) {
+        return NULL;
+    }
+
+    uint32_t slots = 1;
+    while (slots < capacity) {
+        slots <<= 1;
+    }
+
+    spsc_queue_t *ret = osi_calloc(sizeof(spsc_queue_t) + slots * sizeof(void *));
+    if (!ret) {
+        return NULL;
+    }
+    ret->mask = slots - 1;
+    ret->capacity = capacity;
+    return ret;
+}
+
+void spsc_queue_free(spsc_queue_t *queue, spsc_queue_free_cb free_cb)
+{
+    if (queue == NULL) {
+        return;
+    }
+
+    if (free_cb) {
+        for (uint32_t i = queue->head; i != queue->tail; i++) {
+            free_cb(queue->slots[i & queue->mask]);
+        }
+    }
+    osi_free(queue);
+}
+
+bool spsc_queue_is_empty(spsc_queue_t *queue)
+{
+    return spsc_queue_length(queue) == 0;
+}
+
+size_t spsc_queue_length(spsc_queue_t *queue)
+{
+    if (queue == NULL) {
+        return 0;
+    }
+
+    uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    return tail - head;
+}
+
+size_t spsc_queue_capacity(spsc_queue_t *queue)
+{
+    assert(queue != NULL);
+
+    return queue->capacity;
+}
+
+bool spsc_queue_enqueue(spsc_queue_t *queue, void *data, uint32_t timeout)
+{
+    assert(queue != NULL);
+    assert(data != NULL);
+
+    if (!spsc_wait(queue, &queue->waiting_producer, spsc_has_room, timeout)) {
+        return false;
+    }
+
+    const uint32_t tail = queue->tail;
+    queue->slots[tail & queue->mask] = data;
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+    spsc_wake(&queue->waiting_consumer);
+    return true;
+}
+
+void *spsc_queue_dequeue(spsc_queue_t *queue, uint32_t timeout)
+{
+    assert(queue != NULL);
+
+    if (!spsc_wait(queue, &queue->waiting_consumer, spsc_has_element, timeout)) {
+        return NULL;
+    }
+
+    const uint32_t head = queue->head;
+    void *ret = queue->slots[head & queue->mask];
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    spsc_wake(&queue->waiting_producer);
+    return ret;
+}
+
+void *spsc_queue_try_dequeue(spsc_queue_t *queue)
+{
+    if (queue == NULL) {
+        return NULL;
+    }
+
+    return spsc_queue_dequeue(queue, 0);
+}
+
+void *spsc_queue_try_peek_first(spsc_queue_t *queue)
+{
+    if (queue == NULL || !spsc_has_element(queue)) {
+        return NULL;
+    }
+
+    return queue->slots[queue->head & queue->mask];
+}
+
+void spsc_queue_register_dequeue(spsc_queue_t *queue, spsc_queue_cb ready_cb)
+{
+    assert(queue != NULL);
+    assert(ready_cb != NULL);
+
+    queue->dequeue_ready = ready_cb;
+}
+
+void spsc_queue_unregister_dequeue(spsc_queue_t *queue)
+{
+    assert(queue != NULL);
+
+    queue->dequeue_ready = NULL;
+}
+
+void spsc_queue_process(spsc_queue_t *queue)
+{
+    assert(queue != NULL);
+
+    if (queue->dequeue_ready) {
+        queue->dequeue_ready(queue);
+    }
+}
@@ -23,6 +23,7 @@
 #include "hci/hci_internals.h"
 #include "hci/hci_layer.h"
 #include "hci/hci_trans_int.h"
+#include "hci/packet_fragmenter.h"
 #include "osi/thread.h"
 #include "osi/pkt_queue.h"
 #if (BLE_ADV_REPORT_FLOW_CONTROL == TRUE)
@@ -554,17 +555,12 @@ static int host_recv_pkt_cb(uint8_t *data, uint16_t len)
     bool is_adv_rpt = host_recv_adv_packet(data);
 
     if (!is_adv_rpt) {
-        pkt_size = BT_HDR_SIZE + len;
-        pkt = (BT_HDR *) osi_calloc(pkt_size);
+        // The only copy of the data, it stays in this buffer up to the profile
+        pkt = packet_fragmenter_new_inbound(data, len);
         if (!pkt) {
             HCI_TRACE_ERROR("%s couldn't aquire memory for inbound data buffer.\n", __func__);
             assert(0);
         }
-
-        pkt->offset = 0;
-        pkt->len = len;
-        pkt->layer_specific = 0;
-        memcpy(pkt->data, data, len);
         fixed_queue_enqueue(hci_hal_env.rx_q, pkt, FIXED_QUEUE_MAX_TIMEOUT);
     } else {
 #if !BLE_ADV_REPORT_FLOW_CONTROL
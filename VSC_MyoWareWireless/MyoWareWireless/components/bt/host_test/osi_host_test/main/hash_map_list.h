@@ -0,0 +1,24 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "osi/hash_map.h"
+
+/* hash_map_* on a list per bucket, the implementation before the open addressed table */
+typedef struct list_hash_map_t list_hash_map_t;
+
+list_hash_map_t *list_hash_map_new(size_t num_bucket, hash_index_fn hash_fn, key_free_fn key_fn,
+                                   data_free_fn data_fn, key_equality_fn equality_fn);
+void list_hash_map_free(list_hash_map_t *hash_map);
+bool list_hash_map_has_key(const list_hash_map_t *hash_map, const void *key);
+bool list_hash_map_set(list_hash_map_t *hash_map, const void *key, void *data);
+bool list_hash_map_erase(list_hash_map_t *hash_map, const void *key);
+void *list_hash_map_get(const list_hash_map_t *hash_map, const void *key);
+void list_hash_map_clear(list_hash_map_t *hash_map);
+void list_hash_map_foreach(list_hash_map_t *hash_map, hash_map_iter_cb callback, void *context);
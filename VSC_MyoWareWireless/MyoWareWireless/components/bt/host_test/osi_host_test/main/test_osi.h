@@ -0,0 +1,26 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+/* Each test file runs its cases with RUN_TEST from one of these */
+void run_pool_tests(void);
+void run_spsc_queue_tests(void);
+void run_hash_map_tests(void);
+void run_timer_wheel_tests(void);
+void run_thread_tests(void);
+void run_mem_prof_tests(void);
+void run_packet_fragmenter_tests(void);
+
+static inline uint64_t test_osi_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
@@ -0,0 +1,23 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdlib.h>
+#include "unity.h"
+#include "test_osi.h"
+
+/* The Linux FreeRTOS port runs app_main in a task, which the queue tests need */
+void app_main(void)
+{
+    UNITY_BEGIN();
+    run_pool_tests();
+    run_spsc_queue_tests();
+    run_hash_map_tests();
+    run_timer_wheel_tests();
+    run_thread_tests();
+    run_mem_prof_tests();
+    run_packet_fragmenter_tests();
+    exit(UNITY_END());
+}
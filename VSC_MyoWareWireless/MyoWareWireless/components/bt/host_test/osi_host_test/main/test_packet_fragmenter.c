@@ -0,0 +1,235 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "unity.h"
+#include "device/controller.h"
+#include "hci/hci_hal.h"
+#include "hci/hci_internals.h"
+#include "hci/packet_fragmenter.h"
+#include "test_osi.h"
+
+#define L2CAP_HEADER_SIZE   4
+/* address, control and a one byte length in front, the FCS behind */
+#define RFCOMM_HEADER_SIZE  3
+#define RFCOMM_FCS_SIZE     1
+#define LOOPBACK_HANDLE     0x0081
+#define LOOPBACK_CID        0x0040
+#define MAX_FRAME_SIZE      1024
+#define BENCH_FRAMES        20000
+
+/* the loopback only receives, so the fragmenter never asks the controller */
+const controller_t *controller_get_interface(void)
+{
+    return NULL;
+}
+
+static const packet_fragmenter_t *s_fragmenter;
+static uint8_t s_received[MAX_FRAME_SIZE];
+static uint16_t s_received_len;
+static uint32_t s_frames;
+
+/* what the SPP callback of the application sees */
+static void spp_data_ind(const uint8_t *data, uint16_t len)
+{
+    memcpy(s_received, data, len);
+    s_received_len = len;
+    s_frames++;
+}
+
+/* L2CAP and RFCOMM only move the offset past their headers, as l2c_rcv_acl_data
+ * and the RFCOMM frame parser do, and the buffer goes up to SPP as it is */
+static void reassembled(BT_HDR *packet)
+{
+    packet->offset += HCI_ACL_PREAMBLE_SIZE + L2CAP_HEADER_SIZE + RFCOMM_HEADER_SIZE;
+    packet->len -= HCI_ACL_PREAMBLE_SIZE + L2CAP_HEADER_SIZE + RFCOMM_HEADER_SIZE + RFCOMM_FCS_SIZE;
+    spp_data_ind(packet->data + packet->offset, packet->len);
+    osi_free(packet);
+}
+
+static const packet_fragmenter_callbacks_t s_callbacks = {
+    .reassembled = reassembled,
+};
+
+/* The controller side of the loopback: hands |packet| to the host as
+ * host_recv_pkt_cb does, then the HCI thread takes it like hci_hal_h4 */
+static void loopback_recv(const uint8_t *packet, uint16_t len)
+{
+    BT_HDR *buf = packet_fragmenter_new_inbound(packet, len);
+    buf->offset++;
+    buf->len--;
+    buf->event = MSG_HC_TO_STACK_HCI_ACL;
+    s_fragmenter->reassemble_and_dispatch(buf);
+}
+
+/* Sends an SPP frame of |size| bytes in ACL fragments carrying at most
+ * |acl_size| bytes each */
+static void loopback_send_frame(uint16_t size, uint16_t acl_size, uint8_t seed)
+{
+    static uint8_t pdu[MAX_FRAME_SIZE + 16];
+    static uint8_t packet[MAX_FRAME_SIZE + 16];
+    uint16_t pdu_len = L2CAP_HEADER_SIZE + RFCOMM_HEADER_SIZE + size + RFCOMM_FCS_SIZE;
+
+    uint8_t *p = pdu;
+    UINT16_TO_STREAM(p, pdu_len - L2CAP_HEADER_SIZE);
+    UINT16_TO_STREAM(p, LOOPBACK_CID);
+    p += RFCOMM_HEADER_SIZE;
+    for (int i = 0; i < size; i++) {
+        *p++ = (uint8_t)(seed + i);
+    }
+
+    for (uint16_t sent = 0; sent < pdu_len;) {
+        uint16_t chunk = pdu_len - sent < acl_size ? pdu_len - sent : acl_size;
+        uint16_t flags = sent == 0 ? 0x2000 : 0x1000;
+        p = packet;
+        UINT8_TO_STREAM(p, DATA_TYPE_ACL);
+        UINT16_TO_STREAM(p, LOOPBACK_HANDLE | flags);
+        UINT16_TO_STREAM(p, chunk);
+        memcpy(p, pdu + sent, chunk);
+        loopback_recv(packet, 1 + HCI_ACL_PREAMBLE_SIZE + chunk);
+        sent += chunk;
+    }
+}
+
+static bool frame_received(uint16_t size, uint8_t seed)
+{
+    if (s_received_len != size) {
+        return false;
+    }
+    for (int i = 0; i < size; i++) {
+        if (s_received[i] != (uint8_t)(seed + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void start_loopback(void)
+{
+    s_fragmenter = packet_fragmenter_get_interface();
+    s_fragmenter->init(&s_callbacks);
+    packet_fragmenter_reset_stats();
+    s_frames = 0;
+}
+
+static void test_fragmenter_small_frame_copied_once(void)
+{
+    packet_fragmenter_stats_t stats;
+    start_loopback();
+
+    for (int i = 0; i < 10; i++) {
+        loopback_send_frame(32, 339, (uint8_t)i);
+        TEST_ASSERT_TRUE(frame_received(32, (uint8_t)i));
+    }
+    packet_fragmenter_get_stats(&stats);
+    TEST_ASSERT_EQUAL(10, s_frames);
+    TEST_ASSERT_EQUAL(10, stats.packets);
+    TEST_ASSERT_EQUAL(0, stats.reassembled);
+    TEST_ASSERT_EQUAL(10, stats.copies);
+    /* H4 type, ACL, L2CAP and RFCOMM headers and the FCS come along */
+    TEST_ASSERT_EQUAL(10 * (32 + 13), stats.bytes_copied);
+    s_fragmenter->cleanup();
+}
+
+static void test_fragmenter_reassembles_in_place(void)
+{
+    packet_fragmenter_stats_t stats;
+    start_loopback();
+
+    /* 1000 bytes in fragments of a DH5 packet, 339 bytes */
+    loopback_send_frame(1000, 339, 7);
+    TEST_ASSERT_EQUAL(1, s_frames);
+    TEST_ASSERT_TRUE(frame_received(1000, 7));
+
+    packet_fragmenter_get_stats(&stats);
+    TEST_ASSERT_EQUAL(3, stats.packets);
+    TEST_ASSERT_EQUAL(1, stats.reassembled);
+    /* the start fragment stays where it was copied to, the two continuations
+     * are appended to it */
+    TEST_ASSERT_EQUAL(5, stats.copies);
+    TEST_ASSERT_EQUAL(3 * 5 + 1008 + 1008 - 339, stats.bytes_copied);
+
+    /* a start fragment without room is copied into a new buffer, it carries
+     * the L2CAP header and two bytes of RFCOMM header of a one byte frame */
+    static const uint8_t start[] = { 0x81, 0x20, 0x06, 0x00, 0x05, 0x00, 0x40, 0x00, 0x00, 0x00 };
+    static const uint8_t rest[] = { DATA_TYPE_ACL, 0x81, 0x10, 0x03, 0x00, 0x00, 0x2a, 0x00 };
+    BT_HDR *packet = osi_malloc(BT_HDR_SIZE + sizeof(start));
+    packet->event = MSG_HC_TO_STACK_HCI_ACL;
+    packet->len = sizeof(start);
+    packet->offset = 0;
+    packet->layer_specific = 0;
+    memcpy(packet->data, start, sizeof(start));
+    s_fragmenter->reassemble_and_dispatch(packet);
+    loopback_recv(rest, sizeof(rest));
+    TEST_ASSERT_EQUAL(2, s_frames);
+    TEST_ASSERT_TRUE(frame_received(1, 0x2a));
+    s_fragmenter->cleanup();
+}
+
+static void test_fragmenter_drops_broken_sequences(void)
+{
+    static uint8_t packet[16];
+    start_loopback();
+
+    /* a continuation without a start */
+    uint8_t *p = packet;
+    UINT8_TO_STREAM(p, DATA_TYPE_ACL);
+    UINT16_TO_STREAM(p, LOOPBACK_HANDLE | 0x1000);
+    UINT16_TO_STREAM(p, 4);
+    UINT32_TO_STREAM(p, 0);
+    loopback_recv(packet, 9);
+    TEST_ASSERT_EQUAL(0, s_frames);
+
+    /* a start which is never finished is dropped for the next one */
+    p = packet;
+    UINT8_TO_STREAM(p, DATA_TYPE_ACL);
+    UINT16_TO_STREAM(p, LOOPBACK_HANDLE | 0x2000);
+    UINT16_TO_STREAM(p, 4);
+    UINT16_TO_STREAM(p, 100);
+    UINT16_TO_STREAM(p, LOOPBACK_CID);
+    loopback_recv(packet, 9);
+    loopback_send_frame(200, 64, 3);
+    TEST_ASSERT_EQUAL(1, s_frames);
+    TEST_ASSERT_TRUE(frame_received(200, 3));
+    s_fragmenter->cleanup();
+}
+
+/* Copies and bytes moved per received SPP frame, from the controller up to
+ * the callback of the application */
+static void bench_fragmenter_copies(void)
+{
+    const uint16_t sizes[] = { 16, 64, 300, 1000 };
+
+    for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        packet_fragmenter_stats_t stats;
+        start_loopback();
+
+        uint64_t start = test_osi_now_ns();
+        for (int i = 0; i < BENCH_FRAMES; i++) {
+            loopback_send_frame(sizes[s], 339, (uint8_t)i);
+        }
+        uint64_t ns = test_osi_now_ns() - start;
+        TEST_ASSERT_EQUAL(BENCH_FRAMES, s_frames);
+
+        packet_fragmenter_get_stats(&stats);
+        printf("{\"bench\": \"hci_rx_copies\", \"frame\": %u, \"fragments_per_frame\": %.2f, "
+               "\"copies_per_frame\": %.2f, \"bytes_moved_per_payload_byte\": %.3f, \"ns_per_frame\": %.1f}\n",
+               sizes[s], (double)stats.packets / BENCH_FRAMES, (double)stats.copies / BENCH_FRAMES,
+               (double)stats.bytes_copied / ((double)sizes[s] * BENCH_FRAMES), (double)ns / BENCH_FRAMES);
+        s_fragmenter->cleanup();
+    }
+}
+
+void run_packet_fragmenter_tests(void)
+{
+    RUN_TEST(test_fragmenter_small_frame_copied_once);
+    RUN_TEST(test_fragmenter_reassembles_in_place);
+    RUN_TEST(test_fragmenter_drops_broken_sequences);
+    RUN_TEST(bench_fragmenter_copies);
+}
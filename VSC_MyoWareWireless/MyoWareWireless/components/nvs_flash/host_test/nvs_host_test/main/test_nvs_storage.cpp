@@ -43,3 +43,123 @@ TEST_CASE("Storage iterator recognizes blob with VerOffset::VER_1_OFFSET", "[nvs
 
     REQUIRE(nvs::NVSPartitionManager::get_instance()->deinit_partition("test") == ESP_OK);
 }
+
+static esp_err_t collect_all_garbage(nvs::Storage &storage)
+{
+    esp_err_t err;
+    while ((err = storage.collectGarbage()) == ESP_OK) {
+    }
+    return (err == ESP_ERR_NVS_NOT_FOUND) ? ESP_OK : err;
+}
+
+TEST_CASE("Storage with background erase doesn't erase while writing", "[nvs_storage]")
+{
+    PartitionEmulationFixture f(0, 4);
+    const int KEYS = 10;
+    char key[16];
+
+    nvs::Storage storage(f.part());
+    REQUIRE(storage.init(0, 4) == ESP_OK);
+    storage.setBackgroundErase(true);
+
+    size_t collected = 0;
+    for (int i = 0; i < 2000; ++i) {
+        snprintf(key, sizeof(key), "key%d", i % KEYS);
+        esp_partition_clear_stats();
+        REQUIRE(storage.writeItem(1, key, i) == ESP_OK);
+        CHECK(esp_partition_get_erase_ops() == 0);
+
+        // the idle time between two writes
+        REQUIRE(collect_all_garbage(storage) == ESP_OK);
+        collected += esp_partition_get_erase_ops();
+    }
+    // the same number of pages had to be freed as without background erase
+    CHECK(collected > 10);
+
+    nvs::Storage reloaded(f.part());
+    REQUIRE(reloaded.init(0, 4) == ESP_OK);
+    for (int i = 0; i < KEYS; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        int value = -1;
+        CHECK(reloaded.readItem(1, key, value) == ESP_OK);
+        CHECK(value == 1990 + i);
+    }
+
+    // without garbage collection the writes fall back to erasing a page themselves
+    reloaded.setBackgroundErase(true);
+    esp_partition_clear_stats();
+    for (int i = 0; i < 2000; ++i) {
+        snprintf(key, sizeof(key), "key%d", i % KEYS);
+        REQUIRE(reloaded.writeItem(1, key, i) == ESP_OK);
+    }
+    CHECK(esp_partition_get_erase_ops() > 0);
+    CHECK(reloaded.collectGarbage() == ESP_OK);
+}
+
+TEST_CASE("Storage with background erase recovers from power-off", "[nvs_storage]")
+{
+    const int KEYS = 10;
+    const int WRITES = 600;
+    char key[16];
+
+    for (size_t errDelay = 0; ; errDelay += 7) {
+        INFO(errDelay);
+        PartitionEmulationFixture f(0, 3);
+        int stored[KEYS];
+        std::fill_n(stored, KEYS, -1);
+        int pending = -1;
+        bool done = false;
+
+        esp_partition_fail_after(errDelay, ESP_PARTITION_FAIL_AFTER_MODE_BOTH);
+        {
+            nvs::Storage storage(f.part());
+            if (storage.init(0, 3) == ESP_OK) {
+                storage.setBackgroundErase(true);
+                done = true;
+                for (int i = 0; i < WRITES; ++i) {
+                    snprintf(key, sizeof(key), "key%d", i % KEYS);
+                    pending = i;
+                    if (storage.writeItem(1, key, i) != ESP_OK) {
+                        done = false;
+                        break;
+                    }
+                    stored[i % KEYS] = i;
+                    pending = -1;
+                    // collect now and then, so pages are freed both by writes and in the background
+                    if (i % 7 == 0 && collect_all_garbage(storage) != ESP_OK) {
+                        done = false;
+                        break;
+                    }
+                }
+            }
+        }
+        esp_partition_fail_after(SIZE_MAX, ESP_PARTITION_FAIL_AFTER_MODE_BOTH);
+
+        nvs::Storage storage(f.part());
+        REQUIRE(storage.init(0, 3) == ESP_OK);
+        for (int i = 0; i < KEYS; ++i) {
+            snprintf(key, sizeof(key), "key%d", i);
+            int value = -1;
+            esp_err_t err = storage.readItem(1, key, value);
+            // the write cut off by the power loss may or may not have made it
+            const bool cutOff = pending != -1 && pending % KEYS == i;
+            if (err == ESP_ERR_NVS_NOT_FOUND) {
+                CHECK(stored[i] == -1);
+                continue;
+            }
+            CHECK(err == ESP_OK);
+            CHECK((value == stored[i] || (cutOff && value == pending)));
+        }
+        // the old copy of an overwritten value is never left behind
+        nvs_stats_t stats;
+        REQUIRE(storage.fillStats(stats) == ESP_OK);
+        CHECK(stats.used_entries <= (size_t) KEYS);
+
+        REQUIRE(collect_all_garbage(storage) == ESP_OK);
+        REQUIRE(storage.writeItem(1, "key0", -2) == ESP_OK);
+
+        if (done) {
+            break;
+        }
+    }
+}
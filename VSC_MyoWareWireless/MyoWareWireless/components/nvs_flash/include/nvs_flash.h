@@ -130,6 +130,42 @@ esp_err_t nvs_flash_deinit(void);
  */
 esp_err_t nvs_flash_deinit_partition(const char* partition_label);
 
+/**
+ * @brief Move sector erases of the given NVS partition out of the write functions
+ *
+ * Normally, a write which fills the last free page copies the live items of another page and
+ * erases that page before it returns. With background erase enabled, the freed page is only
+ * marked and erased later by \c nvs_flash_collect_garbage, so writes don't wait for an erase as
+ * long as erased pages are left. The power loss guarantees of NVS are the same in both modes.
+ *
+ * @param[in]  partition_label   Label of the partition, NULL for the default NVS partition
+ * @param[in]  enable            Whether freed pages are left for nvs_flash_collect_garbage
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NVS_NOT_INITIALIZED if the storage for given partition is not initialized
+ */
+esp_err_t nvs_flash_set_background_erase(const char* partition_label, bool enable);
+
+/**
+ * @brief Do one step of garbage collection on the given NVS partition
+ *
+ * Erases one freed page or frees one page without live items. A step takes at most one sector
+ * erase, call it from a low priority task or an idle hook until it returns ESP_ERR_NVS_NOT_FOUND.
+ * Pages which were found corrupted on init are erased as well. While another free page is
+ * left, the sector erase runs without the NVS lock, so reads and writes from other tasks don't
+ * wait for it. Deinit and erase of the partition wait until the step is done.
+ *
+ * @param[in]  partition_label   Label of the partition, NULL for the default NVS partition
+ *
+ * @return
+ *      - ESP_OK if a page was erased or freed
+ *      - ESP_ERR_NVS_NOT_FOUND if there is nothing left to collect
+ *      - ESP_ERR_NVS_NOT_INITIALIZED if the storage for given partition is not initialized
+ *      - other error codes from the underlying storage driver
+ */
+esp_err_t nvs_flash_collect_garbage(const char* partition_label);
+
 /**
  * @brief Erase the default NVS partition
  *
@@ -25,6 +25,7 @@ enum class ItemType : uint8_t {
     BLOB = 0x41,
     BLOB_DATA = NVS_TYPE_BLOB,
     BLOB_IDX  = 0x48,
+    COUNTER = NVS_TYPE_COUNTER,
     ANY  = NVS_TYPE_ANY
 };
 
@@ -6,10 +6,13 @@
 #include <cstdlib>
 #include "nvs_handle.hpp"
 #include "nvs_partition_manager.hpp"
+#include "nvs_blob_view.hpp"
+#include "nvs_blob_stream.hpp"
 
 namespace nvs {
 
 NVSHandleSimple::~NVSHandleSimple() {
+    clear_transaction();
     NVSPartitionManager::get_instance()->close_handle(this);
 }
 
@@ -18,6 +21,8 @@ esp_err_t NVSHandleSimple::set_typed_item(ItemType datatype, const char *key, co
     if (!valid) return ESP_ERR_NVS_INVALID_HANDLE;
     if (mReadOnly) return ESP_ERR_NVS_READ_ONLY;
 
+    if (mInTransaction) return stage_item(datatype, key, data, dataSize);
+
     return mStoragePtr->writeItem(mNsIndex, datatype, key, data, dataSize);
 }
 
@@ -33,6 +38,8 @@ esp_err_t NVSHandleSimple::set_string(const char *key, const char* str)
     if (!valid) return ESP_ERR_NVS_INVALID_HANDLE;
     if (mReadOnly) return ESP_ERR_NVS_READ_ONLY;
 
+    if (mInTransaction) return stage_item(nvs::ItemType::SZ, key, str, strlen(str) + 1);
+
     return mStoragePtr->writeItem(mNsIndex, nvs::ItemType::SZ, key, str, strlen(str) + 1);
 }
 
@@ -41,6 +48,8 @@ esp_err_t NVSHandleSimple::set_blob(const char *key, const void* blob, size_t le
     if (!valid) return ESP_ERR_NVS_INVALID_HANDLE;
     if (mReadOnly) return ESP_ERR_NVS_READ_ONLY;
 
+    if (mInTransaction) return ESP_ERR_NOT_SUPPORTED;
+
     return mStoragePtr->writeItem(mNsIndex, nvs::ItemType::BLOB, key, blob, len);
 }
 
@@ -58,6 +67,41 @@ esp_err_t NVSHandleSimple::get_blob(const char *key, void* out_blob, size_t len)
     return mStoragePtr->readItem(mNsIndex, nvs::ItemType::BLOB, key, out_blob, len);
 }
 
+esp_err_t NVSHandleSimple::open_blob_view(const char *key, NVSBlobView &view)
+{
+    if (!valid) return ESP_ERR_NVS_INVALID_HANDLE;
+
+    return view.open(mStoragePtr, mNsIndex, key);
+}
+
+esp_err_t NVSHandleSimple::open_blob_writer(const char *key, size_t bufferSize, NVSBlobWriter &writer)
+{
+    if (!valid) return ESP_ERR_NVS_INVALID_HANDLE;
+    if (mReadOnly) return ESP_ERR_NVS_READ_ONLY;
+
+    if (mInTransaction) return ESP_ERR_NOT_SUPPORTED;
+
+    return writer.open(mStoragePtr, mNsIndex, key, bufferSize);
+}
+
+esp_err_t NVSHandleSimple::open_blob_reader(const char *key, NVSBlobReader &reader)
+{
+    if (!valid) return ESP_ERR_NVS_INVALID_HANDLE;
+
+    return reader.open(mStoragePtr, mNsIndex, key);
+}
+
+esp_err_t NVSHandleSimple::counter_inc(const char *key, uint32_t &value)
+{
+    if (!valid) return ESP_ERR_NVS_INVALID_HANDLE;
+    if (mReadOnly) return ESP_ERR_NVS_READ_ONLY;
+
+    if (mInTransaction) return ESP_ERR_NVS_INVALID_STATE;
+    if (strlen(key) > Item::MAX_KEY_LENGTH) return ESP_ERR_NVS_KEY_TOO_LONG;
+
+    return mStoragePtr->incrementCounter(mNsIndex, key, value);
+}
+
 esp_err_t NVSHandleSimple::get_item_size(ItemType datatype, const char *key, size_t &size)
 {
     if (!valid) return ESP_ERR_NVS_INVALID_HANDLE;
@@ -87,6 +131,8 @@ esp_err_t NVSHandleSimple::erase_item(const char* key)
     if (!valid) return ESP_ERR_NVS_INVALID_HANDLE;
     if (mReadOnly) return ESP_ERR_NVS_READ_ONLY;
 
+    if (mInTransaction) return ESP_ERR_NVS_INVALID_STATE;
+
     return mStoragePtr->eraseItem(mNsIndex, key);
 }
 
@@ -95,16 +141,86 @@ esp_err_t NVSHandleSimple::erase_all()
     if (!valid) return ESP_ERR_NVS_INVALID_HANDLE;
     if (mReadOnly) return ESP_ERR_NVS_READ_ONLY;
 
+    if (mInTransaction) return ESP_ERR_NVS_INVALID_STATE;
+
     return mStoragePtr->eraseNamespace(mNsIndex);
 }
 
+esp_err_t NVSHandleSimple::begin_transaction()
+{
+    if (!valid) return ESP_ERR_NVS_INVALID_HANDLE;
+    if (mReadOnly) return ESP_ERR_NVS_READ_ONLY;
+    if (mInTransaction) return ESP_ERR_NVS_INVALID_STATE;
+
+    mInTransaction = true;
+    return ESP_OK;
+}
+
+esp_err_t NVSHandleSimple::abort_transaction()
+{
+    if (!valid) return ESP_ERR_NVS_INVALID_HANDLE;
+    if (!mInTransaction) return ESP_ERR_NVS_INVALID_STATE;
+
+    clear_transaction();
+    return ESP_OK;
+}
+
 esp_err_t NVSHandleSimple::commit()
 {
     if (!valid) return ESP_ERR_NVS_INVALID_HANDLE;
+    if (!mInTransaction) return ESP_OK;
 
+    esp_err_t err = mStoragePtr->writeItems(mNsIndex, mTransaction);
+    clear_transaction();
+    return err;
+}
+
+esp_err_t NVSHandleSimple::stage_item(ItemType datatype, const char *key, const void* data, size_t dataSize)
+{
+    if (strlen(key) > Item::MAX_KEY_LENGTH) return ESP_ERR_NVS_KEY_TOO_LONG;
+    if (dataSize > Page::CHUNK_MAX_SIZE) return ESP_ERR_NVS_VALUE_TOO_LONG;
+
+    // a key set twice keeps the last value only
+    PendingItem* previous = nullptr;
+    size_t entries = Page::getEntriesForItem(datatype, dataSize);
+    for (auto it = mTransaction.begin(); it != mTransaction.end(); ++it) {
+        if (strcmp(it->key, key) == 0) {
+            previous = it;
+        } else {
+            entries += Page::getEntriesForItem(it->datatype, it->dataSize);
+        }
+    }
+    if (entries > Page::ENTRY_COUNT) return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+
+    PendingItem* item = new (std::nothrow) PendingItem;
+    if (!item) return ESP_ERR_NO_MEM;
+    item->data = new (std::nothrow) uint8_t[dataSize];
+    if (!item->data) {
+        delete item;
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(item->data, data, dataSize);
+    item->dataSize = dataSize;
+    item->datatype = datatype;
+    strncpy(item->key, key, sizeof(item->key) - 1);
+    item->key[sizeof(item->key) - 1] = 0;
+
+    if (previous) {
+        mTransaction.insert(previous, item);
+        mTransaction.erase(previous);
+        delete previous;
+    } else {
+        mTransaction.push_back(item);
+    }
     return ESP_OK;
 }
 
+void NVSHandleSimple::clear_transaction()
+{
+    mTransaction.clearAndFreeNodes();
+    mInTransaction = false;
+}
+
 esp_err_t NVSHandleSimple::get_used_entry_count(size_t& used_entries)
 {
     used_entries = 0;
@@ -15,6 +15,10 @@
 
 namespace nvs {
 
+class NVSBlobView;
+class NVSBlobWriter;
+class NVSBlobReader;
+
 /**
  * @brief This class implements NVSHandle according to the ESP32's flash and partitioning scheme.
  *
@@ -49,6 +53,28 @@ public:
 
     esp_err_t get_blob(const char *key, void *out_blob, size_t len) override;
 
+    /**
+     * Open view on the blob stored under key, see NVSBlobView.
+     */
+    esp_err_t open_blob_view(const char *key, NVSBlobView &view);
+
+    /**
+     * Start writing the blob stored under key in pieces, see NVSBlobWriter. Not possible
+     * during a transaction.
+     */
+    esp_err_t open_blob_writer(const char *key, size_t bufferSize, NVSBlobWriter &writer);
+
+    /**
+     * Start reading the blob stored under key in pieces, see NVSBlobReader.
+     */
+    esp_err_t open_blob_reader(const char *key, NVSBlobReader &reader);
+
+    /**
+     * Add one to the counter stored under key, see nvs_counter_inc(). Not possible during a
+     * transaction.
+     */
+    esp_err_t counter_inc(const char *key, uint32_t &value);
+
     esp_err_t get_item_size(ItemType datatype, const char *key, size_t &size) override;
 
     esp_err_t find_key(const char *key, nvs_type_t &nvstype) override;
@@ -57,6 +83,21 @@ public:
 
     esp_err_t erase_all() override;
 
+    /**
+     * Start collecting set_typed_item and set_string calls instead of writing them.
+     *
+     * commit() writes all collected values with a single flash write into one page, after
+     * a power loss either all or none of them are stored. Reads still return the values
+     * stored in flash. Blobs can't be part of a transaction and erasing is not possible
+     * until it ends. The values of one transaction have to fit into one page.
+     */
+    esp_err_t begin_transaction();
+
+    /**
+     * Drop the values collected since begin_transaction() without writing them.
+     */
+    esp_err_t abort_transaction();
+
     esp_err_t commit() override;
 
     esp_err_t get_used_entry_count(size_t &usedEntries) override;
@@ -80,6 +121,10 @@ public:
     Storage *get_storage() const;
 
 private:
+    esp_err_t stage_item(ItemType datatype, const char *key, const void *data, size_t dataSize);
+
+    void clear_transaction();
+
     /**
      * The underlying storage's object.
      */
@@ -101,6 +146,13 @@ private:
      * Upon opening, a handle is valid. It becomes invalid if the underlying storage is de-initialized.
      */
     uint8_t valid;
+
+    /**
+     * Values collected since begin_transaction(), written by commit().
+     */
+    TPendingItemList mTransaction;
+
+    bool mInTransaction = false;
 };
 
 } // nvs
@@ -0,0 +1,90 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef nvs_handle_table_hpp
+#define nvs_handle_table_hpp
+
+#include "nvs.h"
+#include "nvs_handle_simple.hpp"
+
+namespace nvs
+{
+
+/**
+ * Table from the nvs_handle_t values of the C API to the handle objects it owns.
+ *
+ * The lower 16 bits of a handle are the index of its slot, the upper 16 bits the generation
+ * of the slot. Closing a handle frees its slot and bumps the generation, so a closed handle
+ * which is used again doesn't match the handle reusing the slot. Generations skip 0, no
+ * handle has the value 0. Lookup, insert and erase don't depend on the number of open
+ * handles, free slots are kept in a list threaded through the slot array.
+ *
+ * Like the rest of the C API the table relies on nvs::Lock being held.
+ */
+class HandleTable
+{
+public:
+    HandleTable() { }
+    ~HandleTable();
+
+    /**
+     * Take ownership of handle and store its C API value in outHandle.
+     */
+    esp_err_t insert(NVSHandleSimple* handle, nvs_handle_t& outHandle);
+
+    NVSHandleSimple* find(nvs_handle_t handle) const
+    {
+        const size_t index = handle & INDEX_MASK;
+        if (index >= mCapacity || mSlots[index].mGeneration != (handle >> GENERATION_SHIFT)) {
+            return nullptr;
+        }
+        return mSlots[index].mHandle;
+    }
+
+    /**
+     * Delete the handle and free its slot, returns false for unknown or closed handles.
+     */
+    bool erase(nvs_handle_t handle);
+
+    /**
+     * Delete all handles of storage in a single pass, returns their number.
+     */
+    size_t eraseStorage(const Storage* storage);
+
+    size_t size() const
+    {
+        return mCount;
+    }
+
+    static const size_t MAX_HANDLES = 0xffff;
+
+private:
+    HandleTable(const HandleTable& other);
+    const HandleTable& operator= (const HandleTable& rhs);
+
+protected:
+    struct Slot {
+        NVSHandleSimple* mHandle;
+        uint16_t mGeneration;
+        uint16_t mNextFree;
+    };
+
+    static const uint32_t INDEX_MASK = 0xffff;
+    static const uint32_t GENERATION_SHIFT = 16;
+    static const uint16_t NO_SLOT = 0xffff;
+    static const size_t MIN_CAPACITY = 8;
+
+    esp_err_t grow();
+    void release(size_t index);
+
+    Slot* mSlots = nullptr;
+    size_t mCapacity = 0;
+    size_t mCount = 0;
+    uint16_t mFirstFree = NO_SLOT;
+}; // class HandleTable
+
+} // namespace nvs
+
+#endif /* nvs_handle_table_hpp */
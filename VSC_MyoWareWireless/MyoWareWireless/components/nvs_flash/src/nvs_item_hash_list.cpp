@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include "nvs_item_hash_list.hpp"
+#include <algorithm>
 
 namespace nvs
 {
@@ -23,11 +24,19 @@ HashList::HashList()
 
 void HashList::clear()
 {
-    for (auto it = mBlockList.begin(); it != mBlockList.end();) {
-        auto tmp = it;
-        ++it;
-        mBlockList.erase(tmp);
-        delete static_cast<HashListBlock*>(tmp);
+    delete[] mHashes;
+    mHashes = nullptr;
+    mIndices = nullptr;
+    mCapacity = 0;
+    mCount = 0;
+}
+
+void HashList::markIndices(uint8_t* bitmap) const
+{
+    for (size_t i = 0; i < mCapacity; ++i) {
+        if (mIndices[i] != EMPTY) {
+            bitmap[mIndices[i] / 8] |= static_cast<uint8_t>(1 << (mIndices[i] % 8));
+        }
     }
 }
 
@@ -36,65 +45,90 @@ HashList::~HashList()
     clear();
 }
 
-HashList::HashListBlock::HashListBlock()
+esp_err_t HashList::resize(size_t capacity)
 {
-    static_assert(sizeof(HashListBlock) == HashListBlock::BYTE_SIZE,
-                  "cache block size calculation incorrect");
+    // one allocation, the index bytes follow the hashes
+    uint32_t* hashes = new (std::nothrow) uint32_t[(capacity * SLOT_SIZE + sizeof(uint32_t) - 1) / sizeof(uint32_t)];
+
+    if (!hashes) return ESP_ERR_NO_MEM;
+
+    uint8_t* indices = reinterpret_cast<uint8_t*>(hashes + capacity);
+    std::fill_n(indices, capacity, EMPTY);
+
+    uint32_t* oldHashes = mHashes;
+    uint8_t* oldIndices = mIndices;
+    size_t oldCapacity = mCapacity;
+    mHashes = hashes;
+    mIndices = indices;
+    mCapacity = capacity;
+    for (size_t i = 0; i < oldCapacity; ++i) {
+        if (oldIndices[i] == EMPTY) {
+            continue;
+        }
+        size_t pos = home(oldHashes[i]);
+        while (mIndices[pos] != EMPTY) {
+            pos = next(pos);
+        }
+        mHashes[pos] = oldHashes[i];
+        mIndices[pos] = oldIndices[i];
+    }
+    delete[] oldHashes;
+    return ESP_OK;
 }
 
 esp_err_t HashList::insert(const Item& item, size_t index)
 {
-    const uint32_t hash_24 = item.calculateCrc32WithoutValue() & 0xffffff;
-    // add entry to the end of last block if possible
-    if (mBlockList.size()) {
-        auto& block = mBlockList.back();
-        if (block.mCount < HashListBlock::ENTRY_COUNT) {
-            block.mNodes[block.mCount++] = HashListNode(hash_24, index);
-            return ESP_OK;
+    const uint32_t hash = item.calculateCrc32WithoutValue();
+    const size_t limit = (mCapacity < PAGE_CAPACITY) ? mCapacity * 3 / 4 : mCapacity * 7 / 8;
+    if (mCount + 1 > limit) {
+        size_t capacity = mCapacity ? mCapacity * 2 : MIN_CAPACITY;
+        if (mCapacity < PAGE_CAPACITY && capacity > PAGE_CAPACITY) {
+            capacity = PAGE_CAPACITY;
+        }
+        esp_err_t err = resize(capacity);
+        if (err != ESP_OK) {
+            return err;
         }
     }
-    // if the above failed, create a new block and add entry to it
-    HashListBlock* newBlock = new (std::nothrow) HashListBlock;
-
-    if (!newBlock) return ESP_ERR_NO_MEM;
-
-    mBlockList.push_back(newBlock);
-    newBlock->mNodes[0] = HashListNode(hash_24, index);
-    newBlock->mCount++;
 
+    size_t pos = home(hash);
+    while (mIndices[pos] != EMPTY) {
+        pos = next(pos);
+    }
+    mHashes[pos] = hash;
+    mIndices[pos] = static_cast<uint8_t>(index);
+    ++mCount;
     return ESP_OK;
 }
 
+void HashList::eraseAt(size_t pos)
+{
+    // backward shift deletion: move up every entry of the cluster which would no
+    // longer be reachable from its home slot
+    size_t hole = pos;
+    for (size_t i = next(hole); mIndices[i] != EMPTY; i = next(i)) {
+        size_t h = home(mHashes[i]);
+        size_t distEntry = (i + mCapacity - h) % mCapacity;
+        size_t distHole = (i + mCapacity - hole) % mCapacity;
+        if (distEntry >= distHole) {
+            mHashes[hole] = mHashes[i];
+            mIndices[hole] = mIndices[i];
+            hole = i;
+        }
+    }
+    mIndices[hole] = EMPTY;
+    --mCount;
+}
+
 bool HashList::erase(size_t index)
 {
-    for (auto it = mBlockList.begin(); it != mBlockList.end();) {
-        bool haveEntries = false;
-        bool foundIndex = false;
-        for (size_t i = 0; i < it->mCount; ++i) {
-            if (it->mNodes[i].mIndex == index) {
-                it->mNodes[i].mIndex = 0xff;
-                foundIndex = true;
-                /* found the item and removed it */
-            }
-            if (it->mNodes[i].mIndex != 0xff) {
-                haveEntries = true;
+    for (size_t pos = 0; pos < mCapacity; ++pos) {
+        if (mIndices[pos] == index) {
+            eraseAt(pos);
+            /* release the table together with the last entry */
+            if (mCount == 0) {
+                clear();
             }
-            if (haveEntries && foundIndex) {
-                /* item was found, and HashListBlock still has some items */
-                return true;
-            }
-        }
-        /* no items left in HashListBlock, can remove */
-        if (!haveEntries) {
-            auto tmp = it;
-            ++it;
-            mBlockList.erase(tmp);
-            delete static_cast<HashListBlock*>(tmp);
-        } else {
-            ++it;
-        }
-        if (foundIndex) {
-            /* item was found and empty HashListBlock was removed */
             return true;
         }
     }
@@ -105,18 +139,18 @@ bool HashList::erase(size_t index)
 
 size_t HashList::find(size_t start, const Item& item)
 {
-    const uint32_t hash_24 = item.calculateCrc32WithoutValue() & 0xffffff;
-    for (auto it = mBlockList.begin(); it != mBlockList.end(); ++it) {
-        for (size_t index = 0; index < it->mCount; ++index) {
-            HashListNode& e = it->mNodes[index];
-            if (e.mIndex >= start &&
-                    e.mHash == hash_24 &&
-                    e.mIndex != 0xff) {
-                return e.mIndex;
-            }
+    if (mCount == 0) {
+        return SIZE_MAX;
+    }
+
+    const uint32_t hash = item.calculateCrc32WithoutValue();
+    size_t found = SIZE_MAX;
+    for (size_t pos = home(hash); mIndices[pos] != EMPTY; pos = next(pos)) {
+        if (mHashes[pos] == hash && mIndices[pos] >= start && mIndices[pos] < found) {
+            found = mIndices[pos];
         }
     }
-    return SIZE_MAX;
+    return found;
 }
 
 
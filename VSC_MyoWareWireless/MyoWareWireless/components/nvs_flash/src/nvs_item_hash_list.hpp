@@ -10,11 +10,21 @@
 #include "nvs.h"
 #include "nvs_types.hpp"
 #include "nvs_memory_management.hpp"
-#include "intrusive_list.h"
 
 namespace nvs
 {
 
+/**
+ * Per page table from item hash to entry index.
+ *
+ * The hash is the full 32-bit CRC of namespace index, key and chunk index, so two items
+ * collide far less often than with the 24 bits kept before, and every collision costs
+ * Page::findItem reads of all entries between the false hit and the real one.
+ *
+ * All slots live in a single allocation: the hashes, followed by one byte of entry index
+ * per slot. The table uses open addressing with linear probing and grows up to the size
+ * of a full page, it is freed as soon as the last entry is erased.
+ */
 class HashList
 {
 public:
@@ -26,39 +36,48 @@ public:
     size_t find(size_t start, const Item& item);
     void clear();
 
+    /**
+     * Set the bit of every entry index in the table in a bitmap of Page::ENTRY_COUNT bits
+     */
+    void markIndices(uint8_t* bitmap) const;
+
+    /**
+     * Bytes allocated for the table
+     */
+    size_t getMemorySize() const
+    {
+        return mCapacity * SLOT_SIZE;
+    }
+
 private:
     HashList(const HashList& other);
     const HashList& operator= (const HashList& rhs);
 
 protected:
-
-    struct HashListNode {
-        HashListNode() :
-            mIndex(0xff), mHash(0)
-        {
-        }
-
-        HashListNode(uint32_t hash, size_t index) :
-            mIndex((uint32_t) index), mHash(hash)
-        {
-        }
-
-        uint32_t mIndex : 8;
-        uint32_t mHash  : 24;
-    };
-
-    struct HashListBlock : public intrusive_list_node<HashList::HashListBlock>, public ExceptionlessAllocatable {
-        HashListBlock();
-
-        static const size_t BYTE_SIZE = 128;
-        static const size_t ENTRY_COUNT = (BYTE_SIZE - sizeof(intrusive_list_node<HashListBlock>) - sizeof(size_t)) / 4;
-
-        size_t mCount = 0;
-        HashListNode mNodes[ENTRY_COUNT];
-    };
-
-    typedef intrusive_list<HashListBlock> TBlockList;
-    TBlockList mBlockList;
+    static const uint8_t EMPTY = 0xff;
+    static const size_t SLOT_SIZE = sizeof(uint32_t) + sizeof(uint8_t);
+    static const size_t MIN_CAPACITY = 16;
+    // holds the Page::ENTRY_COUNT entries of a full page at a load factor of 7/8, smaller
+    // tables grow at 3/4
+    static const size_t PAGE_CAPACITY = 144;
+
+    size_t home(uint32_t hash) const
+    {
+        return static_cast<size_t>((static_cast<uint64_t>(hash) * mCapacity) >> 32);
+    }
+
+    size_t next(size_t pos) const
+    {
+        return (pos + 1 == mCapacity) ? 0 : pos + 1;
+    }
+
+    esp_err_t resize(size_t capacity);
+    void eraseAt(size_t pos);
+
+    uint32_t* mHashes = nullptr;
+    uint8_t* mIndices = nullptr;
+    size_t mCapacity = 0;
+    size_t mCount = 0;
 }; // class HashList
 
 } // namespace nvs
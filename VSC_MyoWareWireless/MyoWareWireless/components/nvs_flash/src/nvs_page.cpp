@@ -3,12 +3,13 @@
  *
  * SPDX-License-Identifier: Apache-2.0
  */
+#include "sdkconfig.h"
 #include "nvs_page.hpp"
 #include <inttypes.h>
-#include <esp_rom_crc.h>
 #include <cstdio>
 #include <cstring>
 #include "nvs_internal.h"
+#include "nvs_crc.hpp"
 
 namespace nvs
 {
@@ -17,21 +18,56 @@ Page::Page() : mPartition(nullptr) { }
 
 uint32_t Page::Header::calculateCrc32()
 {
-    return esp_rom_crc32_le(0xffffffff,
-                    reinterpret_cast<uint8_t*>(this) + offsetof(Header, mSeqNumber),
+    // the summary is written later into the reserved bytes, which were 0xff for the crc
+    Header header = *this;
+    std::fill_n(reinterpret_cast<uint8_t*>(&header.mSummary), sizeof(header.mSummary), UINT8_MAX);
+    return Crc32::calculate(0xffffffff,
+                    reinterpret_cast<uint8_t*>(&header) + offsetof(Header, mSeqNumber),
                     offsetof(Header, mCrc32) - offsetof(Header, mSeqNumber));
 }
 
-esp_err_t Page::load(Partition *partition, uint32_t sectorNumber)
+uint32_t Page::Summary::calculateCrc32() const
+{
+    return Crc32::calculate(0xffffffff, mItemStarts, sizeof(mItemStarts));
+}
+
+void Page::Summary::updateCrc()
+{
+    uint32_t crc32 = calculateCrc32();
+    for (size_t i = 0; i < sizeof(mCrc); ++i) {
+        mCrc[i] = static_cast<uint8_t>(crc32 >> (8 * i));
+    }
+}
+
+bool Page::Summary::isValid() const
+{
+    // the bits past the last entry tell a written summary from an erased one
+    for (size_t i = ENTRY_COUNT; i < sizeof(mItemStarts) * 8; ++i) {
+        if (isItemStart(i)) {
+            return false;
+        }
+    }
+    uint32_t crc32 = calculateCrc32();
+    for (size_t i = 0; i < sizeof(mCrc); ++i) {
+        if (mCrc[i] != static_cast<uint8_t>(crc32 >> (8 * i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+esp_err_t Page::load(Partition *partition, uint32_t sectorNumber, ItemIndex *itemIndex)
 {
     if (partition == nullptr) {
         return ESP_ERR_INVALID_ARG;
     }
 
     mPartition = partition;
+    mItemIndex = itemIndex;
     mBaseAddress = sectorNumber * SEC_SIZE;
     mUsedEntryCount = 0;
     mErasedEntryCount = 0;
+    mItemKinds = 0;
 
     Header header;
     auto rc = mPartition->read_raw(mBaseAddress, &header, sizeof(header));
@@ -81,7 +117,7 @@ esp_err_t Page::load(Partition *partition, uint32_t sectorNumber)
     case PageState::FULL:
     case PageState::ACTIVE:
     case PageState::FREEING:
-        return mLoadEntryTable();
+        return mLoadEntryTable(header.mSummary);
         break;
 
     default:
@@ -186,17 +222,38 @@ esp_err_t Page::writeItem(uint8_t nsIndex, ItemType datatype, const char* key, c
         size_t roundedSize = (dataSize + ENTRY_SIZE - 1) & ~(ENTRY_SIZE - 1);
         totalSize += roundedSize;
         entriesCount += roundedSize / ENTRY_SIZE;
+    } else if (datatype == ItemType::COUNTER && !mPartition->get_encrypted()) {
+        totalSize += COUNTER_DATA_ENTRIES * ENTRY_SIZE;
+        entriesCount += COUNTER_DATA_ENTRIES;
     }
 
     // primitive types should fit into one entry
     NVS_ASSERT_OR_RETURN(totalSize == ENTRY_SIZE ||
-       isVariableLengthType(datatype), ESP_ERR_NVS_VALUE_TOO_LONG);
+       hasDataEntries(datatype), ESP_ERR_NVS_VALUE_TOO_LONG);
 
     if (mNextFreeEntry == INVALID_ENTRY || mNextFreeEntry + entriesCount > ENTRY_COUNT) {
         // page will not fit this amount of data
         return ESP_ERR_NVS_PAGE_FULL;
     }
 
+    if (datatype == ItemType::COUNTER && entriesCount > 1) {
+        // a half written entry left by a power failure would add to the count,
+        // the counter takes a single entry then
+        uint8_t counterData[COUNTER_DATA_ENTRIES * ENTRY_SIZE];
+        uint32_t address;
+        err = getEntryAddress(mNextFreeEntry + 1, &address);
+        if (err == ESP_OK) {
+            err = mPartition->read_raw(address, counterData, sizeof(counterData));
+        }
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (std::any_of(counterData, counterData + sizeof(counterData), [](uint8_t b) -> bool { return b != 0xff; })) {
+            totalSize = ENTRY_SIZE;
+            entriesCount = 1;
+        }
+    }
+
     // write first item
     size_t span = (totalSize + ENTRY_SIZE - 1) / ENTRY_SIZE;
     item = Item(nsIndex, datatype, span, key, chunkIdx);
@@ -206,6 +263,11 @@ esp_err_t Page::writeItem(uint8_t nsIndex, ItemType datatype, const char* key, c
         return err;
     }
 
+    if (mItemIndex) {
+        mItemIndex->insert(item, this);
+    }
+    mItemKinds |= itemKind(nsIndex, datatype);
+
     if (!isVariableLengthType(datatype)) {
         memcpy(item.data, data, dataSize);
         item.crc32 = item.calculateCrc32();
@@ -213,6 +275,16 @@ esp_err_t Page::writeItem(uint8_t nsIndex, ItemType datatype, const char* key, c
         if (err != ESP_OK) {
             return err;
         }
+
+        if (span > 1) {
+            // the data entries of a counter stay erased, increments program their bits
+            err = alterEntryRangeState(mNextFreeEntry, mNextFreeEntry + span - 1, EntryState::WRITTEN);
+            if (err != ESP_OK) {
+                return err;
+            }
+            mUsedEntryCount += span - 1;
+            mNextFreeEntry += span - 1;
+        }
     } else {
         const uint8_t* src = reinterpret_cast<const uint8_t*>(data);
         item.varLength.dataCrc32 = Item::calculateCrc32(src, dataSize);
@@ -247,6 +319,121 @@ esp_err_t Page::writeItem(uint8_t nsIndex, ItemType datatype, const char* key, c
     return ESP_OK;
 }
 
+size_t Page::getEntriesForItem(ItemType datatype, size_t dataSize)
+{
+    if (!isVariableLengthType(datatype)) {
+        return 1;
+    }
+    return 1 + (dataSize + ENTRY_SIZE - 1) / ENTRY_SIZE;
+}
+
+esp_err_t Page::writeItems(uint8_t nsIndex, TPendingItemList& items)
+{
+    esp_err_t err;
+
+    if (mState == PageState::INVALID) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+
+    if (mState == PageState::UNINITIALIZED) {
+        err = initialize();
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    if (mState == PageState::FULL) {
+        return ESP_ERR_NVS_PAGE_FULL;
+    }
+
+    size_t entriesCount = 0;
+    for (auto it = items.begin(); it != items.end(); ++it) {
+        if (it->unchanged) {
+            continue;
+        }
+        if (it->dataSize > CHUNK_MAX_SIZE) {
+            return ESP_ERR_NVS_VALUE_TOO_LONG;
+        }
+        if (!isVariableLengthType(it->datatype) && it->dataSize > 8) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        entriesCount += getEntriesForItem(it->datatype, it->dataSize);
+    }
+
+    if (entriesCount == 0) {
+        return ESP_OK;
+    }
+
+    if (mNextFreeEntry == INVALID_ENTRY || mNextFreeEntry + entriesCount > ENTRY_COUNT) {
+        // page will not fit this amount of data
+        return ESP_ERR_NVS_PAGE_FULL;
+    }
+
+    Item* entries = new (std::nothrow) Item[entriesCount];
+    if (!entries) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // lay out all items in RAM, the same way writeItem puts them into flash
+    size_t index = 0;
+    for (auto it = items.begin(); it != items.end(); ++it) {
+        if (it->unchanged) {
+            continue;
+        }
+        size_t span = getEntriesForItem(it->datatype, it->dataSize);
+        Item& item = entries[index];
+        item = Item(nsIndex, it->datatype, span, it->key);
+        if (!isVariableLengthType(it->datatype)) {
+            memcpy(item.data, it->data, it->dataSize);
+        } else {
+            item.varLength.dataCrc32 = Item::calculateCrc32(it->data, it->dataSize);
+            item.varLength.dataSize = it->dataSize;
+            item.varLength.reserved = 0xffff;
+            uint8_t* dst = entries[index + 1].rawData;
+            std::fill_n(dst, (span - 1) * ENTRY_SIZE, 0xff);
+            memcpy(dst, it->data, it->dataSize);
+        }
+        item.crc32 = item.calculateCrc32();
+
+        err = mHashList.insert(item, mNextFreeEntry + index);
+        if (err != ESP_OK) {
+            delete[] entries;
+            return err;
+        }
+        if (mItemIndex) {
+            mItemIndex->insert(item, this);
+        }
+        mItemKinds |= itemKind(nsIndex, it->datatype);
+        index += span;
+    }
+
+    uint32_t phyAddr;
+    err = getEntryAddress(mNextFreeEntry, &phyAddr);
+    if (err == ESP_OK) {
+        // the buffer is ours, an encrypted partition encrypts it in place
+        err = mPartition->write_in_place(phyAddr, entries, entriesCount * ENTRY_SIZE);
+    }
+    delete[] entries;
+    if (err != ESP_OK) {
+        mState = PageState::INVALID;
+        return err;
+    }
+
+    // the range is marked from its end, the items become visible with the word of the first entry
+    err = alterEntryRangeState(mNextFreeEntry, mNextFreeEntry + entriesCount, EntryState::WRITTEN);
+    if (err != ESP_OK) {
+        mState = PageState::INVALID;
+        return err;
+    }
+
+    if (mFirstUsedEntry == INVALID_ENTRY) {
+        mFirstUsedEntry = mNextFreeEntry;
+    }
+    mUsedEntryCount += entriesCount;
+    mNextFreeEntry += entriesCount;
+    return ESP_OK;
+}
+
 esp_err_t Page::readItem(uint8_t nsIndex, ItemType datatype, const char* key, void* data, size_t dataSize, uint8_t chunkIdx, VerOffset chunkStart)
 {
     size_t index = 0;
@@ -261,6 +448,20 @@ esp_err_t Page::readItem(uint8_t nsIndex, ItemType datatype, const char* key, vo
         return rc;
     }
 
+    if (datatype == ItemType::COUNTER) {
+        if (dataSize != sizeof(uint32_t)) {
+            return ESP_ERR_NVS_TYPE_MISMATCH;
+        }
+
+        uint32_t value, nextAddress, nextWord;
+        rc = readCounter(index, item, value, nextAddress, nextWord);
+        if (rc != ESP_OK) {
+            return rc;
+        }
+        memcpy(data, &value, sizeof(value));
+        return ESP_OK;
+    }
+
     if (!isVariableLengthType(datatype)) {
         if (dataSize != getAlignmentForType(datatype)) {
             return ESP_ERR_NVS_TYPE_MISMATCH;
@@ -276,15 +477,16 @@ esp_err_t Page::readItem(uint8_t nsIndex, ItemType datatype, const char* key, vo
 
     uint8_t* dst = reinterpret_cast<uint8_t*>(data);
     size_t left = item.varLength.dataSize;
-    for (size_t i = index + 1; i < index + item.span; ++i) {
-        Item ditem;
-        rc = readEntry(i, ditem);
+    Item ditems[READ_AHEAD_ENTRIES];
+    for (size_t i = index + 1; i < index + item.span; i += READ_AHEAD_ENTRIES) {
+        size_t count = index + item.span - i;
+        count = (count < READ_AHEAD_ENTRIES) ? count : READ_AHEAD_ENTRIES;
+        rc = readEntries(i, ditems, count);
         if (rc != ESP_OK) {
             return rc;
         }
-        size_t willCopy = ENTRY_SIZE;
-        willCopy = (left < willCopy)?left:willCopy;
-        memcpy(dst, ditem.rawData, willCopy);
+        size_t willCopy = std::min(left, count * ENTRY_SIZE);
+        memcpy(dst, ditems, willCopy);
         left -= willCopy;
         dst += willCopy;
     }
@@ -312,6 +514,22 @@ esp_err_t Page::cmpItem(uint8_t nsIndex, ItemType datatype, const char* key, con
         return rc;
     }
 
+    if (datatype == ItemType::COUNTER) {
+        if (dataSize != sizeof(uint32_t)) {
+            return ESP_ERR_NVS_TYPE_MISMATCH;
+        }
+
+        uint32_t value, nextAddress, nextWord;
+        rc = readCounter(index, item, value, nextAddress, nextWord);
+        if (rc != ESP_OK) {
+            return rc;
+        }
+        if (memcmp(data, &value, sizeof(value))) {
+            return ESP_ERR_NVS_CONTENT_DIFFERS;
+        }
+        return ESP_OK;
+    }
+
     if (!isVariableLengthType(datatype)) {
         if (dataSize != getAlignmentForType(datatype)) {
             return ESP_ERR_NVS_TYPE_MISMATCH;
@@ -329,15 +547,16 @@ esp_err_t Page::cmpItem(uint8_t nsIndex, ItemType datatype, const char* key, con
 
     const uint8_t* dst = reinterpret_cast<const uint8_t*>(data);
     size_t left = item.varLength.dataSize;
-    for (size_t i = index + 1; i < index + item.span; ++i) {
-        Item ditem;
-        rc = readEntry(i, ditem);
+    Item ditems[READ_AHEAD_ENTRIES];
+    for (size_t i = index + 1; i < index + item.span; i += READ_AHEAD_ENTRIES) {
+        size_t count = index + item.span - i;
+        count = (count < READ_AHEAD_ENTRIES) ? count : READ_AHEAD_ENTRIES;
+        rc = readEntries(i, ditems, count);
         if (rc != ESP_OK) {
             return rc;
         }
-        size_t willCopy = ENTRY_SIZE;
-        willCopy = (left < willCopy)?left:willCopy;
-        if (memcmp(dst, ditem.rawData, willCopy)) {
+        size_t willCopy = std::min(left, count * ENTRY_SIZE);
+        if (memcmp(dst, ditems, willCopy)) {
             return ESP_ERR_NVS_CONTENT_DIFFERS;
         }
         left -= willCopy;
@@ -361,6 +580,67 @@ esp_err_t Page::eraseItem(uint8_t nsIndex, ItemType datatype, const char* key, u
     return eraseEntryAndSpan(index);
 }
 
+esp_err_t Page::incrementCounter(uint8_t nsIndex, const char* key, uint32_t& value)
+{
+    size_t index = 0;
+    Item item;
+
+    if (mState == PageState::INVALID) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+
+    esp_err_t rc = findItem(nsIndex, ItemType::COUNTER, key, index, item);
+    if (rc != ESP_OK) {
+        return rc;
+    }
+
+    uint32_t nextAddress, nextWord;
+    rc = readCounter(index, item, value, nextAddress, nextWord);
+    if (rc != ESP_OK) {
+        return rc;
+    }
+    if (nextAddress == INVALID_ENTRY) {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+
+    // programming a single bit either happens or not, a power failure loses this increment only
+    nextWord &= nextWord - 1;
+    rc = mPartition->write_raw(nextAddress, &nextWord, sizeof(nextWord));
+    if (rc != ESP_OK) {
+        mState = PageState::INVALID;
+        return rc;
+    }
+    ++value;
+    return ESP_OK;
+}
+
+esp_err_t Page::readCounter(size_t index, const Item& item, uint32_t& value, uint32_t& nextAddress, uint32_t& nextWord) const
+{
+    NVS_ASSERT_OR_RETURN(item.span > 0 && index + item.span <= ENTRY_COUNT, ESP_FAIL);
+
+    memcpy(&value, item.data, sizeof(value));
+    nextAddress = INVALID_ENTRY;
+    for (size_t i = index + 1; i < index + item.span; ++i) {
+        uint32_t words[ENTRY_SIZE / sizeof(uint32_t)];
+        uint32_t address;
+        esp_err_t rc = getEntryAddress(i, &address);
+        if (rc == ESP_OK) {
+            rc = mPartition->read_raw(address, words, sizeof(words));
+        }
+        if (rc != ESP_OK) {
+            return rc;
+        }
+        for (size_t j = 0; j < sizeof(words) / sizeof(words[0]); ++j) {
+            value += __builtin_popcount(~words[j]);
+            if (nextAddress == INVALID_ENTRY && words[j] != 0) {
+                nextAddress = address + j * sizeof(uint32_t);
+                nextWord = words[j];
+            }
+        }
+    }
+    return ESP_OK;
+}
+
 esp_err_t Page::findItem(uint8_t nsIndex, ItemType datatype, const char* key, uint8_t chunkIdx, VerOffset chunkStart)
 {
     size_t index = 0;
@@ -368,6 +648,18 @@ esp_err_t Page::findItem(uint8_t nsIndex, ItemType datatype, const char* key, ui
     return findItem(nsIndex, datatype, key, index, item, chunkIdx, chunkStart);
 }
 
+esp_err_t Page::findItemData(uint8_t nsIndex, ItemType datatype, const char* key, uint32_t& dataOffset, Item& item, uint8_t chunkIdx, VerOffset chunkStart)
+{
+    NVS_ASSERT_OR_RETURN(isVariableLengthType(datatype), ESP_ERR_NVS_TYPE_MISMATCH);
+
+    size_t index = 0;
+    esp_err_t rc = findItem(nsIndex, datatype, key, index, item, chunkIdx, chunkStart);
+    if (rc != ESP_OK) {
+        return rc;
+    }
+    return getEntryAddress(index + 1, &dataOffset);
+}
+
 esp_err_t Page::eraseEntryAndSpan(size_t index)
 {
     uint32_t seq_num;
@@ -396,6 +688,9 @@ esp_err_t Page::eraseEntryAndSpan(size_t index)
             }
         } else {
             mHashList.erase(index);
+            if (mItemIndex) {
+                mItemIndex->erase(item, this);
+            }
             span = item.span;
             for (ptrdiff_t i = index + span - 1; i >= static_cast<ptrdiff_t>(index); --i) {
                 rc = mEntryTable.get(i, &state);
@@ -498,6 +793,11 @@ esp_err_t Page::copyItems(Page& other)
             return err;
         }
 
+        if (other.mItemIndex) {
+            other.mItemIndex->insert(entry, &other);
+        }
+        other.mItemKinds |= itemKind(entry.nsIndex, entry.datatype);
+
         err = other.writeEntry(entry);
         if (err != ESP_OK) {
             return err;
@@ -520,7 +820,7 @@ esp_err_t Page::copyItems(Page& other)
     return ESP_OK;
 }
 
-esp_err_t Page::mLoadEntryTable()
+esp_err_t Page::mLoadEntryTable(const Summary& summary)
 {
     // for states where we actually care about data in the page, read entry state table
     if (mState == PageState::ACTIVE ||
@@ -612,6 +912,7 @@ esp_err_t Page::mLoadEntryTable()
         if (end > ENTRY_COUNT) {
             end = ENTRY_COUNT;
         }
+        EntryReader reader(*this, end);
         size_t span;
         for (size_t i = 0; i < end; i += span) {
             span = 1;
@@ -636,7 +937,7 @@ esp_err_t Page::mLoadEntryTable()
 
             lastItemIndex = i;
 
-            auto err = readEntry(i, item);
+            auto err = reader.read(i, item);
             if (err != ESP_OK) {
                 mState = PageState::INVALID;
                 return err;
@@ -657,10 +958,15 @@ esp_err_t Page::mLoadEntryTable()
                 return err;
             }
 
+            if (mItemIndex) {
+                mItemIndex->insert(item, this);
+            }
+            mItemKinds |= itemKind(item.nsIndex, item.datatype);
+
             // search for potential duplicate item
             size_t duplicateIndex = mHashList.find(0, item);
 
-            if (isVariableLengthType(item.datatype)) {
+            if (hasDataEntries(item.datatype)) {
                 span = item.span;
                 bool needErase = false;
                 for (size_t j = i; j < i + span; ++j) {
@@ -704,9 +1010,16 @@ esp_err_t Page::mLoadEntryTable()
             }
         }
     } else if (mState == PageState::FULL || mState == PageState::FREEING) {
+        bool loaded = false;
+        err = loadSummarizedItems(summary, loaded);
+        if (err != ESP_OK || loaded) {
+            return err;
+        }
+
         // We have already filled mHashList for page in active state.
         // Do the same for the case when page is in full or freeing state.
         Item item;
+        EntryReader reader(*this, ENTRY_COUNT);
         for (size_t i = mFirstUsedEntry; i < ENTRY_COUNT; ++i) {
             auto err = mEntryTable.get(i, &state);
             if (err != ESP_OK) {
@@ -716,7 +1029,7 @@ esp_err_t Page::mLoadEntryTable()
                 continue;
             }
 
-            err = readEntry(i, item);
+            err = reader.read(i, item);
             if (err != ESP_OK) {
                 mState = PageState::INVALID;
                 return err;
@@ -739,9 +1052,14 @@ esp_err_t Page::mLoadEntryTable()
                 return err;
             }
 
+            if (mItemIndex) {
+                mItemIndex->insert(item, this);
+            }
+            mItemKinds |= itemKind(item.nsIndex, item.datatype);
+
             size_t span = item.span;
 
-            if (isVariableLengthType(item.datatype)) {
+            if (hasDataEntries(item.datatype)) {
                 for (size_t j = i + 1; j < i + span; ++j) {
                     err = mEntryTable.get(j, &state);
                     if (err != ESP_OK) {
@@ -762,6 +1080,132 @@ esp_err_t Page::mLoadEntryTable()
     return ESP_OK;
 }
 
+esp_err_t Page::loadSummarizedItems(const Summary& summary, bool& loaded)
+{
+    loaded = false;
+    if (!summary.isValid()) {
+        return ESP_OK;
+    }
+
+    size_t first = INVALID_ENTRY;
+    size_t last = INVALID_ENTRY;
+    EntryState state;
+    for (size_t i = 0; i < ENTRY_COUNT; ++i) {
+        if (!summary.isItemStart(i)) {
+            continue;
+        }
+        esp_err_t err = mEntryTable.get(i, &state);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (state == EntryState::WRITTEN) {
+            if (first == INVALID_ENTRY) {
+                first = i;
+            }
+            last = i;
+        } else if (state != EntryState::ERASED) {
+            return ESP_OK;
+        }
+    }
+    if (first == INVALID_ENTRY) {
+        loaded = (mUsedEntryCount == 0);
+        return ESP_OK;
+    }
+
+    // one read from the first to the last item header, unless the partition reads single entries only
+    const size_t count = last - first + 1;
+    Item* items = new (std::nothrow) Item[count];
+    if (!items) {
+        return ESP_OK;
+    }
+    uint32_t address;
+    esp_err_t err = getEntryAddress(first, &address);
+    if (err == ESP_OK) {
+        err = mPartition->read(address, items, count * ENTRY_SIZE);
+    }
+    if (err == ESP_ERR_INVALID_SIZE) {
+        err = ESP_OK;
+        for (size_t i = first; i <= last && err == ESP_OK; ++i) {
+            if (summary.isItemStart(i)) {
+                err = readEntry(i, items[i - first]);
+            }
+        }
+    }
+    if (err != ESP_OK) {
+        delete[] items;
+        mState = PageState::INVALID;
+        return err;
+    }
+
+    // every written entry has to belong to a marked item, check that before touching the hash list
+    size_t usedEntries = 0;
+    bool consistent = true;
+    for (size_t i = first; i <= last && consistent; ++i) {
+        err = mEntryTable.get(i, &state);
+        if (err != ESP_OK) {
+            delete[] items;
+            return err;
+        }
+        if (!summary.isItemStart(i) || state != EntryState::WRITTEN) {
+            continue;
+        }
+        const Item& item = items[i - first];
+        consistent = item.crc32 == item.calculateCrc32() && item.span > 0 && i + item.span <= ENTRY_COUNT;
+        for (size_t j = i; consistent && j < i + item.span; ++j) {
+            err = mEntryTable.get(j, &state);
+            if (err != ESP_OK) {
+                delete[] items;
+                return err;
+            }
+            consistent = (state == EntryState::WRITTEN);
+            ++usedEntries;
+        }
+    }
+    if (!consistent || usedEntries != mUsedEntryCount) {
+        delete[] items;
+        return ESP_OK;
+    }
+
+    for (size_t i = first; i <= last; ++i) {
+        mEntryTable.get(i, &state);
+        if (!summary.isItemStart(i) || state != EntryState::WRITTEN) {
+            continue;
+        }
+        const Item& item = items[i - first];
+        err = mHashList.insert(item, i);
+        if (err != ESP_OK) {
+            delete[] items;
+            mState = PageState::INVALID;
+            return err;
+        }
+        if (mItemIndex) {
+            mItemIndex->insert(item, this);
+        }
+        mItemKinds |= itemKind(item.nsIndex, item.datatype);
+    }
+
+    delete[] items;
+    loaded = true;
+    return ESP_OK;
+}
+
+esp_err_t Page::writeSummary()
+{
+    Header header;
+    std::fill_n(header.mSummary.mItemStarts, sizeof(header.mSummary.mItemStarts), 0);
+    mHashList.markIndices(header.mSummary.mItemStarts);
+    header.mSummary.updateCrc();
+
+    // the summary starts in the word of the version, which is written again unchanged
+    header.mVersion = mVersion;
+    const size_t offset = offsetof(Header, mVersion);
+    auto rc = mPartition->write_raw(mBaseAddress + offset, reinterpret_cast<uint8_t*>(&header) + offset,
+                                    offsetof(Header, mCrc32) - offset);
+    if (rc != ESP_OK) {
+        mState = PageState::INVALID;
+    }
+    return rc;
+}
 
 esp_err_t Page::initialize()
 {
@@ -792,9 +1236,7 @@ esp_err_t Page::alterEntryState(size_t index, EntryState state)
         return err;
     }
     size_t wordToWrite = mEntryTable.getWordIndex(index);
-    uint32_t word = mEntryTable.data()[wordToWrite];
-    err = mPartition->write_raw(mBaseAddress + ENTRY_TABLE_OFFSET + static_cast<uint32_t>(wordToWrite) * 4,
-            &word, sizeof(word));
+    err = writeEntryStateWord(wordToWrite);
     if (err != ESP_OK) {
         mState = PageState::INVALID;
         return err;
@@ -820,9 +1262,7 @@ esp_err_t Page::alterEntryRangeState(size_t begin, size_t end, EntryState state)
             nextWordIndex = mEntryTable.getWordIndex(i - 1);
         }
         if (nextWordIndex != wordIndex) {
-            uint32_t word = mEntryTable.data()[wordIndex];
-            auto rc = mPartition->write_raw(mBaseAddress + ENTRY_TABLE_OFFSET + static_cast<uint32_t>(wordIndex) * 4,
-                    &word, 4);
+            auto rc = writeEntryStateWord(wordIndex);
             if (rc != ESP_OK) {
                 return rc;
             }
@@ -832,6 +1272,40 @@ esp_err_t Page::alterEntryRangeState(size_t begin, size_t end, EntryState state)
     return ESP_OK;
 }
 
+esp_err_t Page::writeEntryStateWord(size_t wordIndex)
+{
+    if (mDeferEntryStates) {
+        mDeferredWords |= 1U << wordIndex;
+        return ESP_OK;
+    }
+    uint32_t word = mEntryTable.data()[wordIndex];
+    return mPartition->write_raw(mBaseAddress + ENTRY_TABLE_OFFSET + static_cast<uint32_t>(wordIndex) * 4,
+            &word, sizeof(word));
+}
+
+void Page::deferEntryStates()
+{
+    mDeferEntryStates = true;
+}
+
+esp_err_t Page::writeDeferredEntryStates()
+{
+    mDeferEntryStates = false;
+    for (size_t wordIndex = 0; mDeferredWords != 0; ++wordIndex) {
+        if (!(mDeferredWords & (1U << wordIndex))) {
+            continue;
+        }
+        mDeferredWords &= ~(1U << wordIndex);
+        auto rc = writeEntryStateWord(wordIndex);
+        if (rc != ESP_OK) {
+            mDeferredWords = 0;
+            mState = PageState::INVALID;
+            return rc;
+        }
+    }
+    return ESP_OK;
+}
+
 esp_err_t Page::alterPageState(PageState state)
 {
     uint32_t state_val = static_cast<uint32_t>(state);
@@ -858,6 +1332,39 @@ esp_err_t Page::readEntry(size_t index, Item& dst) const
     return ESP_OK;
 }
 
+esp_err_t Page::readEntries(size_t index, Item* dst, size_t count) const
+{
+    NVS_ASSERT_OR_RETURN(index + count <= ENTRY_COUNT, ESP_FAIL);
+    uint32_t phyAddr;
+    esp_err_t rc = getEntryAddress(index, &phyAddr);
+    if (rc != ESP_OK) {
+        return rc;
+    }
+    rc = mPartition->read(phyAddr, dst, count * ENTRY_SIZE);
+    if (rc == ESP_ERR_INVALID_SIZE) {
+        rc = ESP_OK;
+        for (size_t i = 0; i < count && rc == ESP_OK; ++i) {
+            rc = readEntry(index + i, dst[i]);
+        }
+    }
+    return rc;
+}
+
+esp_err_t Page::EntryReader::read(size_t index, Item& item)
+{
+    if (index < mFirst || index >= mFirst + mCount) {
+        mFirst = index;
+        mCount = (mEnd - index < READ_AHEAD_ENTRIES) ? mEnd - index : READ_AHEAD_ENTRIES;
+        esp_err_t err = mPage.readEntries(mFirst, mItems, mCount);
+        if (err != ESP_OK) {
+            mCount = 0;
+            return err;
+        }
+    }
+    item = mItems[index - mFirst];
+    return ESP_OK;
+}
+
 esp_err_t Page::findItem(uint8_t nsIndex, ItemType datatype, const char* key, size_t &itemIndex, Item& item, uint8_t chunkIdx, VerOffset chunkStart)
 {
     if (mState == PageState::CORRUPT || mState == PageState::INVALID || mState == PageState::UNINITIALIZED) {
@@ -879,6 +1386,17 @@ esp_err_t Page::findItem(uint8_t nsIndex, ItemType datatype, const char* key, si
         end = ENTRY_COUNT;
     }
 
+    // the brute force searches of Storage::init skip pages without such items
+    if (key == nullptr) {
+        uint8_t kind = itemKind(nsIndex, datatype);
+        if (nsIndex != NS_INDEX && (nsIndex != NS_ANY || chunkIdx != CHUNK_ANY)) {
+            kind = 0;
+        }
+        if (kind != 0 && (mItemKinds & kind) == 0) {
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+    }
+
     if (nsIndex != NS_ANY && key != NULL) {
         size_t cachedIndex = mHashList.find(start, Item(nsIndex, datatype, 0, key, chunkIdx));
         if (cachedIndex < ENTRY_COUNT) {
@@ -917,7 +1435,7 @@ esp_err_t Page::findItem(uint8_t nsIndex, ItemType datatype, const char* key, si
             continue;
         }
 
-        if (isVariableLengthType(item.datatype)) {
+        if (hasDataEntries(item.datatype)) {
             next = i + item.span;
         }
 
@@ -993,19 +1511,36 @@ esp_err_t Page::setVersion(uint8_t ver)
 }
 
 esp_err_t Page::erase()
+{
+    auto rc = eraseSector();
+    if (rc != ESP_OK) {
+        return rc;
+    }
+    markErased();
+    return ESP_OK;
+}
+
+esp_err_t Page::eraseSector()
 {
     auto rc = mPartition->erase_range(mBaseAddress, SPI_FLASH_SEC_SIZE);
     if (rc != ESP_OK) {
         mState = PageState::INVALID;
-        return rc;
     }
+    return rc;
+}
+
+void Page::markErased()
+{
     mUsedEntryCount = 0;
     mErasedEntryCount = 0;
     mFirstUsedEntry = INVALID_ENTRY;
     mNextFreeEntry = INVALID_ENTRY;
     mState = PageState::UNINITIALIZED;
+    mItemKinds = 0;
     mHashList.clear();
-    return ESP_OK;
+    if (mItemIndex) {
+        mItemIndex->erasePage(this);
+    }
 }
 
 esp_err_t Page::markFreeing()
@@ -1021,7 +1556,36 @@ esp_err_t Page::markFull()
     if (mState != PageState::ACTIVE) {
         return ESP_ERR_NVS_INVALID_STATE;
     }
-    return alterPageState(PageState::FULL);
+    auto err = alterPageState(PageState::FULL);
+#ifdef CONFIG_NVS_PAGE_SUMMARY
+    if (err == ESP_OK) {
+        err = writeSummary();
+    }
+#endif
+    return err;
+}
+
+esp_err_t Page::markForErase()
+{
+    // the items of a freeing page were copied to another page, other pages must be empty
+    bool empty = (mState == PageState::FULL || mState == PageState::ACTIVE) && mUsedEntryCount == 0;
+    if (mState != PageState::FREEING && !empty) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+    auto err = alterPageState(PageState::CORRUPT);
+    if (err != ESP_OK) {
+        return err;
+    }
+    mUsedEntryCount = 0;
+    mErasedEntryCount = 0;
+    mFirstUsedEntry = INVALID_ENTRY;
+    mNextFreeEntry = INVALID_ENTRY;
+    mItemKinds = 0;
+    mHashList.clear();
+    if (mItemIndex) {
+        mItemIndex->erasePage(this);
+    }
+    return ESP_OK;
 }
 
 size_t Page::getVarDataTailroom() const
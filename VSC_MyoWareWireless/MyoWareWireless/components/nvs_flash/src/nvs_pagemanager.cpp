@@ -7,6 +7,8 @@
 
 namespace nvs
 {
+std::atomic<uint32_t> PageManager::mRelocationEpoch;
+
 esp_err_t PageManager::load(Partition *partition, uint32_t baseSector, uint32_t sectorCount)
 {
     if (partition == nullptr) {
@@ -17,12 +19,14 @@ esp_err_t PageManager::load(Partition *partition, uint32_t baseSector, uint32_t
     mPageCount = sectorCount;
     mPageList.clear();
     mFreePageList.clear();
+    // the index points into mPages, drop it before the pages go away
+    mItemIndex.clear();
     mPages.reset(new (nothrow) Page[sectorCount]);
 
     if (!mPages) return ESP_ERR_NO_MEM;
 
     for (uint32_t i = 0; i < sectorCount; ++i) {
-        auto err = mPages[i].load(partition, baseSector + i);
+        auto err = mPages[i].load(partition, baseSector + i, &mItemIndex);
         if (err != ESP_OK) {
             return err;
         }
@@ -54,21 +58,22 @@ esp_err_t PageManager::load(Partition *partition, uint32_t baseSector, uint32_t
         mSeqNumber = lastSeqNo + 1;
     }
 
-    // if power went out after a new item for the given key was written,
-    // but before the old one was erased, we end up with a duplicate item
+    // if power went out after new items were written, but before the old ones were erased,
+    // we end up with duplicate items. Storage::writeItems puts several items into the last
+    // page at once, so every item of it may still have a copy on an older page.
     Page& lastPage = back();
-    size_t lastItemIndex = SIZE_MAX;
+    auto last = PageManager::TPageListIterator(&lastPage);
     Item item;
     size_t itemIndex = 0;
     while (lastPage.findItem(Page::NS_ANY, ItemType::ANY, nullptr, itemIndex, item) == ESP_OK) {
         itemIndex += item.span;
-        lastItemIndex = itemIndex;
-    }
 
-    if (lastItemIndex != SIZE_MAX) {
-        auto last = PageManager::TPageListIterator(&lastPage);
-        TPageListIterator it;
+        // the index always has the last page, a single page means there is no copy
+        if (mItemIndex.isValid() && mItemIndex.find(item, nullptr, 0) < 2) {
+            continue;
+        }
 
+        TPageListIterator it;
         for (it = begin(); it != last; ++it) {
 
             if ((it->state() != Page::PageState::FREEING) &&
@@ -180,7 +185,12 @@ esp_err_t PageManager::requestNewPage()
         return err;
     }
 
-    err = erasedPage->erase();
+    bumpRelocationEpoch();
+    if (mBackgroundErase) {
+        err = erasedPage->markForErase();
+    } else {
+        err = erasedPage->erase();
+    }
     if (err != ESP_OK) {
         return err;
     }
@@ -200,20 +210,89 @@ esp_err_t PageManager::activatePage()
     if (mFreePageList.empty()) {
         return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
     }
-    Page* p = &mFreePageList.front();
+    // prefer a page which is erased already
+    auto it = std::find_if(std::begin(mFreePageList), std::end(mFreePageList), [](const Page& page) -> bool {
+        return page.state() != Page::PageState::CORRUPT;
+    });
+    Page* p = (it != mFreePageList.end()) ? static_cast<Page*>(it) : &mFreePageList.front();
     if (p->state() == Page::PageState::CORRUPT) {
+        bumpRelocationEpoch();
         auto err = p->erase();
         if (err != ESP_OK) {
             return err;
         }
     }
-    mFreePageList.pop_front();
+    mFreePageList.erase(p);
     mPageList.push_back(p);
     p->setSeqNumber(mSeqNumber);
     ++mSeqNumber;
     return ESP_OK;
 }
 
+esp_err_t PageManager::collectGarbage()
+{
+    for (auto it = mFreePageList.begin(); it != mFreePageList.end(); ++it) {
+        if (it->state() == Page::PageState::CORRUPT) {
+            bumpRelocationEpoch();
+            return it->erase();
+        }
+    }
+
+    // a page whose items were all erased needs no copy, only the active page keeps taking writes
+    for (auto it = begin(); it != end(); ++it) {
+        Page* page = it;
+        if (page == &back() || page->getUsedEntryCount() != 0 ||
+                (page->state() != Page::PageState::FULL && page->state() != Page::PageState::ACTIVE)) {
+            continue;
+        }
+        bumpRelocationEpoch();
+        auto err = page->markForErase();
+        if (err != ESP_OK) {
+            return err;
+        }
+        mPageList.erase(page);
+        mFreePageList.push_back(page);
+        return ESP_OK;
+    }
+
+    return ESP_ERR_NVS_NOT_FOUND;
+}
+
+Page* PageManager::takePageToErase()
+{
+    if (mErasingPage != nullptr || mFreePageList.size() < 2) {
+        return nullptr;
+    }
+    for (auto it = mFreePageList.begin(); it != mFreePageList.end(); ++it) {
+        if (it->state() == Page::PageState::CORRUPT) {
+            Page* page = it;
+            mFreePageList.erase(it);
+            mErasingPage = page;
+            bumpRelocationEpoch();
+            return page;
+        }
+    }
+    return nullptr;
+}
+
+esp_err_t PageManager::returnErasedPage(Page* page, esp_err_t err)
+{
+    NVS_ASSERT_OR_RETURN(page != nullptr && page == mErasingPage, ESP_ERR_NVS_INVALID_STATE);
+    mErasingPage = nullptr;
+    if (err == ESP_OK) {
+        page->markErased();
+    }
+    mFreePageList.push_back(page);
+    return err;
+}
+
+size_t PageManager::getErasedPageCount()
+{
+    return std::count_if(std::begin(mFreePageList), std::end(mFreePageList), [](const Page& page) -> bool {
+        return page.state() == Page::PageState::UNINITIALIZED;
+    });
+}
+
 esp_err_t PageManager::fillStats(nvs_stats_t& nvsStats)
 {
     nvsStats.used_entries      = 0;
@@ -14,6 +14,7 @@
 #ifndef nvs_pagemanager_hpp
 #define nvs_pagemanager_hpp
 
+#include <atomic>
 #include <memory>
 #include <list>
 #include "nvs_types.hpp"
@@ -54,6 +55,41 @@ public:
 
     esp_err_t requestNewPage();
 
+    /**
+     * Leave pages freed by requestNewPage to collectGarbage instead of erasing them right away,
+     * so switching to a new page only waits for an erase if no erased page is left.
+     */
+    void setBackgroundErase(bool enable)
+    {
+        mBackgroundErase = enable;
+    }
+
+    /**
+     * Do one step of garbage collection: erase one freed page, or free one page without live
+     * items. A step costs at most one sector erase.
+     * Returns ESP_ERR_NVS_NOT_FOUND if there is nothing left to do.
+     */
+    esp_err_t collectGarbage();
+
+    /**
+     * Take a page which waits for its erase off the free list and flag it as erasing, so
+     * collectGarbage's sector erase can run without nvs::Lock, see Page::eraseSector.
+     * Only done while another free page is left for requestNewPage.
+     * Returns nullptr if there is no such page, collectGarbage does the remaining work.
+     */
+    Page* takePageToErase();
+
+    /**
+     * Put the page taken by takePageToErase back on the free list. err is the result of its
+     * sector erase, the page only counts as erased if it is ESP_OK.
+     */
+    esp_err_t returnErasedPage(Page* page, esp_err_t err);
+
+    /**
+     * Number of free pages which can be used without erasing them first
+     */
+    size_t getErasedPageCount();
+
     esp_err_t fillStats(nvs_stats_t& nvsStats);
 
     uint32_t getBaseSector()
@@ -61,17 +97,43 @@ public:
         return mBaseSector;
     }
 
+    const ItemIndex& itemIndex() const
+    {
+        return mItemIndex;
+    }
+
+    /**
+     * Counter of pages erased or left for erasing, in all partitions. Garbage collection moves
+     * the live items of any namespace when another one is written, so whatever points into
+     * flash must check this besides the generation of its namespace.
+     */
+    static uint32_t getRelocationEpoch()
+    {
+        return mRelocationEpoch.load(std::memory_order_acquire);
+    }
+
 protected:
     friend class Iterator;
 
     esp_err_t activatePage();
 
+    // called before the data of a page goes away
+    static void bumpRelocationEpoch()
+    {
+        mRelocationEpoch.fetch_add(1, std::memory_order_acq_rel);
+    }
+
     TPageList mPageList;
     TPageList mFreePageList;
     std::unique_ptr<Page[]> mPages;
+    ItemIndex mItemIndex;
     uint32_t mBaseSector;
     uint32_t mPageCount;
     uint32_t mSeqNumber;
+    bool mBackgroundErase = false;
+    Page* mErasingPage = nullptr;
+
+    static std::atomic<uint32_t> mRelocationEpoch;
 }; // class PageManager
 
 
@@ -14,19 +14,52 @@
 #pragma once
 
 #ifdef LINUX_TARGET
+#include <mutex>
+
 namespace nvs
 {
 class Lock
 {
 public:
-    Lock() { }
-    ~Lock() { }
+    Lock()
+    {
+        mMutex.lock();
+    }
+
+    ~Lock()
+    {
+        mMutex.unlock();
+    }
+
     static esp_err_t init()
     {
         return ESP_OK;
     }
 
     static void uninit() {}
+
+    static std::mutex mMutex;
+};
+
+/**
+ * Held by nvs_flash_collect_garbage across the sector erase it does without Lock, and by the
+ * functions which deinit a partition, so the storage can't go away under the erase.
+ * Always taken before Lock.
+ */
+class GcLock
+{
+public:
+    GcLock()
+    {
+        mMutex.lock();
+    }
+
+    ~GcLock()
+    {
+        mMutex.unlock();
+    }
+
+    static std::mutex mMutex;
 };
 } // namespace nvs
 
@@ -38,6 +71,31 @@ public:
 namespace nvs
 {
 
+/**
+ * Held by nvs_flash_collect_garbage across the sector erase it does without Lock, and by the
+ * functions which deinit a partition, so the storage can't go away under the erase.
+ * Always taken before Lock, created and deleted along with it.
+ */
+class GcLock
+{
+public:
+    GcLock()
+    {
+        if (mSemaphore) {
+            xSemaphoreTake(mSemaphore, portMAX_DELAY);
+        }
+    }
+
+    ~GcLock()
+    {
+        if (mSemaphore) {
+            xSemaphoreGive(mSemaphore);
+        }
+    }
+
+    static SemaphoreHandle_t mSemaphore;
+};
+
 class Lock
 {
 public:
@@ -60,6 +118,12 @@ public:
         if (mSemaphore) {
             return ESP_OK;
         }
+        if (!GcLock::mSemaphore) {
+            GcLock::mSemaphore = xSemaphoreCreateMutex();
+            if (!GcLock::mSemaphore) {
+                return ESP_ERR_NO_MEM;
+            }
+        }
         mSemaphore = xSemaphoreCreateMutex();
         if (!mSemaphore) {
             return ESP_ERR_NO_MEM;
@@ -73,6 +137,10 @@ public:
             vSemaphoreDelete(mSemaphore);
         }
         mSemaphore = nullptr;
+        if (GcLock::mSemaphore) {
+            vSemaphoreDelete(GcLock::mSemaphore);
+        }
+        GcLock::mSemaphore = nullptr;
     }
 
     static SemaphoreHandle_t mSemaphore;
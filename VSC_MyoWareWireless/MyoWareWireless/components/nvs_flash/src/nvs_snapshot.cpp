@@ -0,0 +1,198 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include "nvs_snapshot.hpp"
+#include "nvs_partition_manager.hpp"
+#if __has_include(<bsd/string.h>)
+// for strlcpy
+#include <bsd/string.h>
+#endif
+
+namespace nvs {
+
+NVSSnapshot::NVSSnapshot(const char *partName, const char *nsName)
+{
+    strlcpy(mPartName, partName, sizeof(mPartName));
+    strlcpy(mNsName, nsName, sizeof(mNsName));
+}
+
+NVSSnapshot::~NVSSnapshot()
+{
+    clear();
+}
+
+void NVSSnapshot::clear()
+{
+    delete [] mEntries;
+    mEntries = nullptr;
+    mEntryCount = 0;
+    free(mData);
+    mData = nullptr;
+    mValid = false;
+}
+
+esp_err_t NVSSnapshot::refresh()
+{
+    clear();
+
+    Storage *storage = NVSPartitionManager::get_instance()->lookup_storage_from_name(mPartName);
+    if (storage == nullptr) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    esp_err_t err = storage->createOrOpenNamespace(mNsName, false, mNsIndex);
+    if (err != ESP_OK) {
+        return err;
+    }
+    // nothing can be written while the caller holds the lock, the copy matches this generation
+    mGeneration = Storage::getGeneration(mNsIndex);
+
+    nvs_opaque_iterator_t it;
+    it.type = NVS_TYPE_ANY;
+    it.storage = storage;
+
+    // the first pass sizes the arrays, the second one reads the values
+    size_t count = 0;
+    for (bool found = storage->findEntryNs(&it, mNsIndex); found; found = storage->nextEntry(&it)) {
+        ++count;
+    }
+
+    if (count > 0) {
+        mEntries = new (std::nothrow) Entry[count];
+        if (mEntries == nullptr) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    size_t dataSize = 0;
+    for (bool found = storage->findEntryNs(&it, mNsIndex); found && mEntryCount < count; found = storage->nextEntry(&it)) {
+        Entry &entry = mEntries[mEntryCount];
+        strlcpy(entry.key, it.entry_info.key, sizeof(entry.key));
+        entry.datatype = (it.entry_info.type == NVS_TYPE_BLOB) ? ItemType::BLOB : static_cast<ItemType>(it.entry_info.type);
+
+        if (isVariableLengthType(entry.datatype)) {
+            err = storage->getItemDataSize(mNsIndex, entry.datatype, entry.key, entry.size);
+            entry.offset = dataSize;
+            dataSize += entry.size;
+        } else {
+            entry.size = static_cast<uint8_t>(entry.datatype) & 0x0f;
+            err = storage->readItem(mNsIndex, entry.datatype, entry.key, entry.value, entry.size);
+        }
+        if (err != ESP_OK) {
+            clear();
+            return err;
+        }
+        ++mEntryCount;
+    }
+
+    if (dataSize > 0) {
+        mData = static_cast<uint8_t*>(malloc(dataSize));
+        if (mData == nullptr) {
+            clear();
+            return ESP_ERR_NO_MEM;
+        }
+        for (size_t i = 0; i < mEntryCount; ++i) {
+            Entry &entry = mEntries[i];
+            if (!isVariableLengthType(entry.datatype)) {
+                continue;
+            }
+            err = storage->readItem(mNsIndex, entry.datatype, entry.key, mData + entry.offset, entry.size);
+            if (err != ESP_OK) {
+                clear();
+                return err;
+            }
+        }
+    }
+
+    std::sort(mEntries, mEntries + mEntryCount, [](const Entry &a, const Entry &b) {
+        return strcmp(a.key, b.key) < 0;
+    });
+
+    mValid = true;
+    return ESP_OK;
+}
+
+bool NVSSnapshot::is_current() const
+{
+    return mValid && Storage::getGeneration(mNsIndex) == mGeneration;
+}
+
+const NVSSnapshot::Entry *NVSSnapshot::find(const char *key) const
+{
+    size_t low = 0;
+    size_t high = mEntryCount;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        int cmp = strcmp(mEntries[mid].key, key);
+        if (cmp == 0) {
+            return &mEntries[mid];
+        } else if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return nullptr;
+}
+
+esp_err_t NVSSnapshot::get_typed_item(ItemType datatype, const char *key, void *data, size_t dataSize) const
+{
+    if (!is_current()) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+
+    const Entry *entry = find(key);
+    if (entry == nullptr) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (entry->datatype != datatype) {
+        return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+    if (dataSize != entry->size) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+
+    if (dataSize > 0) {
+        memcpy(data, isVariableLengthType(datatype) ? mData + entry->offset : entry->value, dataSize);
+    }
+    return ESP_OK;
+}
+
+esp_err_t NVSSnapshot::get_str_or_blob(ItemType datatype, const char *key, void *out_value, size_t *length) const
+{
+    if (!is_current()) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+
+    const Entry *entry = find(key);
+    if (entry == nullptr) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (entry->datatype != datatype) {
+        return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+
+    if (length == nullptr) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    } else if (out_value == nullptr) {
+        *length = entry->size;
+        return ESP_OK;
+    } else if (*length < entry->size) {
+        *length = entry->size;
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+
+    *length = entry->size;
+    if (entry->size > 0) {
+        memcpy(out_value, mData + entry->offset, entry->size);
+    }
+    return ESP_OK;
+}
+
+} // nvs
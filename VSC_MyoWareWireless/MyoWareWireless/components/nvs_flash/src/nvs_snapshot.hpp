@@ -0,0 +1,98 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef NVS_SNAPSHOT_HPP_
+#define NVS_SNAPSHOT_HPP_
+
+#include "nvs.h"
+#include "nvs_handle.hpp"
+#include "nvs_types.hpp"
+#include "nvs_memory_management.hpp"
+
+namespace nvs {
+
+/**
+ * @brief Copy of all values of one namespace which can be read without taking nvs::Lock.
+ *
+ * refresh() reads every item of the namespace into RAM and remembers the generation of the
+ * namespace (see Storage::getGeneration). Reads are served from that copy, as long as no
+ * write, erase, init or deinit happened since. Once the generation moved on, reads return
+ * ESP_ERR_NVS_INVALID_STATE and the owner calls refresh() again.
+ *
+ * Any number of threads may read the same snapshot at the same time, but refresh() must
+ * not run while another thread reads it. The caller of refresh() holds nvs::Lock.
+ */
+class NVSSnapshot : public ExceptionlessAllocatable {
+public:
+    NVSSnapshot(const char *partName, const char *nsName);
+
+    ~NVSSnapshot();
+
+    esp_err_t refresh();
+
+    bool is_current() const;
+
+    esp_err_t get_typed_item(ItemType datatype, const char *key, void *data, size_t dataSize) const;
+
+    template<typename T>
+    esp_err_t get_item(const char *key, T &value) const
+    {
+        return get_typed_item(itemTypeOf(value), key, &value, sizeof(value));
+    }
+
+    /**
+     * Read a string or blob with the semantics of nvs_get_str() and nvs_get_blob().
+     */
+    esp_err_t get_str_or_blob(ItemType datatype, const char *key, void *out_value, size_t *length) const;
+
+    size_t get_entry_count() const
+    {
+        return mEntryCount;
+    }
+
+private:
+    struct Entry {
+        char key[NVS_KEY_NAME_MAX_SIZE];
+        ItemType datatype;
+        size_t size;
+        union {
+            uint8_t value[sizeof(uint64_t)];
+            size_t offset;
+        };
+    };
+
+    NVSSnapshot(const NVSSnapshot &other);
+    const NVSSnapshot &operator=(const NVSSnapshot &rhs);
+
+    const Entry *find(const char *key) const;
+
+    void clear();
+
+    char mPartName[NVS_PART_NAME_MAX_SIZE + 1];
+
+    char mNsName[NVS_NS_NAME_MAX_SIZE];
+
+    /**
+     * Entries sorted by key, strings and blobs point into mData.
+     */
+    Entry *mEntries = nullptr;
+
+    size_t mEntryCount = 0;
+
+    uint8_t *mData = nullptr;
+
+    uint8_t mNsIndex = 0;
+
+    uint32_t mGeneration = 0;
+
+    /**
+     * False until the first successful refresh() and after a failed one.
+     */
+    bool mValid = false;
+};
+
+} // nvs
+
+#endif // NVS_SNAPSHOT_HPP_
@@ -13,37 +13,23 @@
 // limitations under the License.
 #include "nvs_types.hpp"
 
-#include "esp_rom_crc.h"
+#include "nvs_crc.hpp"
 
 namespace nvs
 {
 uint32_t Item::calculateCrc32() const
 {
-    uint32_t result = 0xffffffff;
-    const uint8_t* p = reinterpret_cast<const uint8_t*>(this);
-    result = esp_rom_crc32_le(result, p + offsetof(Item, nsIndex),
-                      offsetof(Item, crc32) - offsetof(Item, nsIndex));
-    result = esp_rom_crc32_le(result, p + offsetof(Item, key), sizeof(key));
-    result = esp_rom_crc32_le(result, p + offsetof(Item, data), sizeof(data));
-    return result;
+    return Crc32::calculateEntry(rawData);
 }
 
 uint32_t Item::calculateCrc32WithoutValue() const
 {
-    uint32_t result = 0xffffffff;
-    const uint8_t* p = reinterpret_cast<const uint8_t*>(this);
-    result = esp_rom_crc32_le(result, p + offsetof(Item, nsIndex),
-                      offsetof(Item, datatype) - offsetof(Item, nsIndex));
-    result = esp_rom_crc32_le(result, p + offsetof(Item, key), sizeof(key));
-    result = esp_rom_crc32_le(result, p + offsetof(Item, chunkIndex), sizeof(chunkIndex));
-    return result;
+    return Crc32::calculateEntryKey(rawData);
 }
 
 uint32_t Item::calculateCrc32(const uint8_t* data, size_t size)
 {
-    uint32_t result = 0xffffffff;
-    result = esp_rom_crc32_le(result, data, size);
-    return result;
+    return Crc32::calculate(0xffffffff, data, size);
 }
 
 } // namespace nvs
@@ -39,6 +39,14 @@ inline bool isVariableLengthType(ItemType type)
             type == ItemType::BLOB_DATA);
 }
 
+/**
+ * Items which are followed by data entries, their span covers the header entry and the data.
+ */
+inline bool hasDataEntries(ItemType type)
+{
+    return isVariableLengthType(type) || type == ItemType::COUNTER;
+}
+
 class Item
 {
 public:
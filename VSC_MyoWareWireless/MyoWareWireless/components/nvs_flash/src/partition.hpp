@@ -33,8 +33,31 @@ public:
 
     virtual esp_err_t write(size_t dst_offset, const void* src, size_t size) = 0;
 
+    /**
+     * Like write(), but src may be used as scratch space and its content is undefined afterwards.
+     * The encrypted partition encrypts the data there instead of copying it first.
+     */
+    virtual esp_err_t write_in_place(size_t dst_offset, void* src, size_t size)
+    {
+        return write(dst_offset, src, size);
+    }
+
     virtual esp_err_t erase_range(size_t dst_offset, size_t size) = 0;
 
+    /**
+     * Map size bytes from src_offset into the data address space for reading in place.
+     * Partitions which can't hand out their plain data without a copy return ESP_ERR_NOT_SUPPORTED.
+     */
+    virtual esp_err_t mmap(size_t src_offset, size_t size, const void** out_ptr, uint32_t* out_handle)
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    /**
+     * Release a region obtained from mmap().
+     */
+    virtual void munmap(uint32_t handle) { }
+
     /**
      * Return the address of the beginning of the partition.
      */
@@ -49,6 +72,15 @@ public:
      * Return true if the partition is read-only.
      */
     virtual bool get_readonly() = 0;
+
+    /**
+     * Return true if write() encrypts the data, so that single bits of it can't be programmed
+     * with write_raw().
+     */
+    virtual bool get_encrypted()
+    {
+        return false;
+    }
 };
 
 } // nvs
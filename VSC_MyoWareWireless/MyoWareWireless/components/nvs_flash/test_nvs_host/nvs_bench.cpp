@@ -0,0 +1,567 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Benchmarks of Storage on the flash emulator, built as a program of its own by "make bench".
+ *
+ * Every measurement is printed as one JSON object per line, so that runs before and after a
+ * change can be compared by a script. If NVS_BENCH_JSON names a file, the lines are appended
+ * to it instead. Flash numbers (operations, bytes, modelled time) don't depend on the host,
+ * host times and heap usage do.
+ */
+#include "catch.hpp"
+#include "esp_rom_crc.h"
+#include "nvs_blob_stream.hpp"
+#include "nvs_crc.hpp"
+#include "nvs_storage.hpp"
+#include "spi_flash_emulation.h"
+#include "test_fixtures.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+using namespace nvs;
+
+namespace {
+
+class Record
+{
+public:
+    explicit Record(const char* bench)
+    {
+        mLine << "{\"bench\": \"" << bench << "\"";
+    }
+
+    Record& add(const char* name, long long value)
+    {
+        mLine << ", \"" << name << "\": " << value;
+        return *this;
+    }
+
+    Record& add(const char* name, double value)
+    {
+        char text[32];
+        snprintf(text, sizeof(text), "%.3f", value);
+        mLine << ", \"" << name << "\": " << text;
+        return *this;
+    }
+
+    Record& add(const char* name, const char* value)
+    {
+        mLine << ", \"" << name << "\": \"" << value << "\"";
+        return *this;
+    }
+
+    void emit()
+    {
+        mLine << "}";
+        const char* path = getenv("NVS_BENCH_JSON");
+        if (path != nullptr && path[0] != '\0') {
+            std::ofstream file(path, std::ios::app);
+            file << mLine.str() << std::endl;
+        } else {
+            std::cout << mLine.str() << std::endl;
+        }
+    }
+
+private:
+    std::ostringstream mLine;
+};
+
+/* Bytes allocated with malloc, which all NVS allocations go through. 0 if the libc can't tell. */
+size_t heap_in_use()
+{
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2, 33)
+    return mallinfo2().uordblks;
+#else
+    return static_cast<size_t>(mallinfo().uordblks);
+#endif
+#else
+    return 0;
+#endif
+}
+
+/* Flash statistics and host time of one measured phase. */
+class Phase
+{
+public:
+    explicit Phase(SpiFlashEmulator& emu) : mEmu(emu)
+    {
+        mEmu.clearStats();
+        mStart = std::chrono::steady_clock::now();
+    }
+
+    void stop()
+    {
+        mHostNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - mStart).count();
+        mReads = mEmu.getReadOps();
+        mWriteBytes = mEmu.getWriteBytes();
+        mErases = mEmu.getEraseOps();
+        mFlashUs = mEmu.getTotalTime();
+    }
+
+    long long mHostNs = 0;
+    size_t mReads = 0;
+    size_t mWriteBytes = 0;
+    size_t mErases = 0;
+    size_t mFlashUs = 0;
+
+private:
+    SpiFlashEmulator& mEmu;
+    std::chrono::steady_clock::time_point mStart;
+};
+
+void key_name(char* key, size_t size, unsigned i)
+{
+    snprintf(key, size, "k%05u", i);
+}
+
+size_t used_entries(Storage& storage)
+{
+    nvs_stats_t stats;
+    REQUIRE(storage.fillStats(stats) == ESP_OK);
+    return stats.used_entries;
+}
+
+/* Mount the partition into storage and record time, flash reads and the heap it keeps. */
+void mount(Storage& storage, SpiFlashEmulator& emu, uint32_t sectors, Record& record)
+{
+    const size_t heapBefore = heap_in_use();
+    Phase phase(emu);
+    REQUIRE(storage.init(0, sectors) == ESP_OK);
+    phase.stop();
+    record.add("mount_host_us", phase.mHostNs / 1000)
+          .add("mount_flash_us", static_cast<long long>(phase.mFlashUs))
+          .add("mount_reads", static_cast<long long>(phase.mReads))
+          .add("heap_bytes", static_cast<long long>(heap_in_use() - heapBefore));
+}
+
+/* A value of the given size which differs for every round. */
+struct Value {
+    ItemType type;
+    std::vector<uint8_t> data;
+
+    Value(size_t size) : data(size)
+    {
+        switch (size) {
+        case 1: type = ItemType::U8; break;
+        case 2: type = ItemType::U16; break;
+        case 4: type = ItemType::U32; break;
+        case 8: type = ItemType::U64; break;
+        default: type = ItemType::SZ; break;
+        }
+    }
+
+    void set(uint32_t round)
+    {
+        if (type == ItemType::SZ) {
+            char hex[9];
+            snprintf(hex, sizeof(hex), "%08x", static_cast<unsigned>(round));
+            std::fill(data.begin(), data.end(), 'a' + round % 26);
+            memcpy(data.data(), hex, std::min(data.size() - 1, strlen(hex)));
+            data.back() = 0;
+        } else {
+            for (size_t i = 0; i < data.size(); ++i) {
+                data[i] = static_cast<uint8_t>(round >> (i % 4 * 8));
+            }
+        }
+    }
+};
+
+} // namespace
+
+TEST_CASE("bench: lookup latency and mount by key and namespace count", "[bench][lookup]")
+{
+    const unsigned keyCounts[] = { 16, 128, 1024 };
+    const unsigned nsCounts[] = { 1, 4, 16 };
+    const int ROUNDS = 20;
+
+    for (unsigned keys : keyCounts) {
+        for (unsigned namespaces : nsCounts) {
+            // about half of the pages filled, one entry per key
+            const uint32_t sectors = keys / 64 + 4;
+            PartitionEmulationFixture f(0, sectors);
+            char key[16];
+            std::vector<uint8_t> nsIndices(namespaces);
+            {
+                Storage storage(&f.part);
+                REQUIRE(storage.init(0, sectors) == ESP_OK);
+                for (unsigned n = 0; n < namespaces; ++n) {
+                    char name[16];
+                    snprintf(name, sizeof(name), "ns%02u", n);
+                    REQUIRE(storage.createOrOpenNamespace(name, true, nsIndices[n]) == ESP_OK);
+                }
+                for (unsigned i = 0; i < keys; ++i) {
+                    key_name(key, sizeof(key), i);
+                    REQUIRE(storage.writeItem(nsIndices[i % namespaces], key, static_cast<uint32_t>(i)) == ESP_OK);
+                }
+            }
+
+            Record record("lookup");
+            record.add("keys", static_cast<long long>(keys))
+                  .add("namespaces", static_cast<long long>(namespaces))
+                  .add("sectors", static_cast<long long>(sectors));
+            Storage storage(&f.part);
+            mount(storage, f.emu, sectors, record);
+
+            std::vector<unsigned> order(keys);
+            for (unsigned i = 0; i < keys; ++i) {
+                order[i] = i;
+            }
+            std::shuffle(order.begin(), order.end(), std::mt19937(keys + namespaces));
+
+            // results are checked after the timed loops, the assertion macros cost more than a lookup
+            uint32_t value = 0;
+            unsigned failed = 0;
+            Phase hits(f.emu);
+            for (int r = 0; r < ROUNDS; ++r) {
+                for (unsigned i : order) {
+                    key_name(key, sizeof(key), i);
+                    failed += storage.readItem(nsIndices[i % namespaces], key, value) != ESP_OK;
+                }
+            }
+            hits.stop();
+
+            Phase misses(f.emu);
+            for (int r = 0; r < ROUNDS; ++r) {
+                for (unsigned i : order) {
+                    key_name(key, sizeof(key), keys + i);
+                    failed += storage.readItem(nsIndices[i % namespaces], key, value) != ESP_ERR_NVS_NOT_FOUND;
+                }
+            }
+            misses.stop();
+            REQUIRE(failed == 0);
+
+            const double lookups = static_cast<double>(ROUNDS) * keys;
+            record.add("hit_host_ns", hits.mHostNs / lookups)
+                  .add("hit_flash_us", hits.mFlashUs / lookups)
+                  .add("hit_reads", hits.mReads / lookups)
+                  .add("miss_host_ns", misses.mHostNs / lookups)
+                  .add("miss_flash_us", misses.mFlashUs / lookups)
+                  .add("miss_reads", misses.mReads / lookups)
+                  .emit();
+        }
+    }
+}
+
+TEST_CASE("bench: write amplification by value size and fill level", "[bench][write]")
+{
+    const size_t valueSizes[] = { 1, 4, 8, 32, 128, 512 };
+    const unsigned fillLevels[] = { 25, 50, 75, 90 };
+    const uint32_t SECTORS = 16;
+    const unsigned HOT_KEYS = 16;
+    const uint32_t WRITES = 2000;
+
+    for (size_t size : valueSizes) {
+        for (unsigned fill : fillLevels) {
+            PartitionEmulationFixture f(0, SECTORS);
+            Value value(size);
+            char key[16];
+            uint8_t ns;
+
+            Storage storage(&f.part);
+            REQUIRE(storage.init(0, SECTORS) == ESP_OK);
+            REQUIRE(storage.createOrOpenNamespace("bench", true, ns) == ESP_OK);
+            for (unsigned i = 0; i < HOT_KEYS; ++i) {
+                key_name(key, sizeof(key), i);
+                value.set(i);
+                REQUIRE(storage.writeItem(ns, value.type, key, value.data.data(), value.data.size()) == ESP_OK);
+            }
+
+            // values which are never changed again take the rest up to the fill level,
+            // one page has to stay free for the garbage collection
+            const size_t target = (SECTORS - 1) * Page::ENTRY_COUNT * fill / 100;
+            for (unsigned i = HOT_KEYS; used_entries(storage) < target; ++i) {
+                key_name(key, sizeof(key), i);
+                REQUIRE(storage.writeItem(ns, key, static_cast<uint32_t>(i)) == ESP_OK);
+            }
+            const size_t used = used_entries(storage);
+
+            Phase writes(f.emu);
+            for (uint32_t w = 0; w < WRITES; ++w) {
+                key_name(key, sizeof(key), w % HOT_KEYS);
+                value.set(HOT_KEYS + w);
+                REQUIRE(storage.writeItem(ns, value.type, key, value.data.data(), value.data.size()) == ESP_OK);
+            }
+            writes.stop();
+
+            Record record("write");
+            record.add("value_size", static_cast<long long>(size))
+                  .add("fill_percent", static_cast<long long>(fill))
+                  .add("used_entries", static_cast<long long>(used))
+                  .add("writes", static_cast<long long>(WRITES))
+                  .add("write_amplification", static_cast<double>(writes.mWriteBytes) / (static_cast<double>(WRITES) * size))
+                  .add("erases_per_write", static_cast<double>(writes.mErases) / WRITES)
+                  .add("write_host_ns", static_cast<double>(writes.mHostNs) / WRITES)
+                  .add("write_flash_us", static_cast<double>(writes.mFlashUs) / WRITES);
+
+            Storage remounted(&f.part);
+            mount(remounted, f.emu, SECTORS, record);
+            record.emit();
+        }
+    }
+}
+
+TEST_CASE("bench: blob writes and reads by blob size", "[bench][blob]")
+{
+    const size_t blobSizes[] = { 256, 2048, 8192, 32768 };
+    const uint32_t SECTORS = 48;
+    const uint32_t WRITES = 40;
+
+    for (size_t size : blobSizes) {
+        PartitionEmulationFixture f(0, SECTORS);
+        uint8_t ns;
+        std::vector<uint8_t> blob(size);
+
+        Storage storage(&f.part);
+        REQUIRE(storage.init(0, SECTORS) == ESP_OK);
+        REQUIRE(storage.createOrOpenNamespace("bench", true, ns) == ESP_OK);
+
+        Phase writes(f.emu);
+        for (uint32_t w = 0; w < WRITES; ++w) {
+            for (size_t i = 0; i < size; ++i) {
+                blob[i] = static_cast<uint8_t>(w * 31 + i);
+            }
+            REQUIRE(storage.writeItem(ns, ItemType::BLOB, "blob", blob.data(), blob.size()) == ESP_OK);
+        }
+        writes.stop();
+
+        std::vector<uint8_t> read(size);
+        Phase reads(f.emu);
+        for (uint32_t r = 0; r < WRITES; ++r) {
+            REQUIRE(storage.readItem(ns, ItemType::BLOB, "blob", read.data(), read.size()) == ESP_OK);
+        }
+        reads.stop();
+        CHECK(read == blob);
+
+        Record record("blob");
+        record.add("blob_size", static_cast<long long>(size))
+              .add("writes", static_cast<long long>(WRITES))
+              .add("write_amplification", static_cast<double>(writes.mWriteBytes) / (static_cast<double>(WRITES) * size))
+              .add("erases_per_write", static_cast<double>(writes.mErases) / WRITES)
+              .add("write_host_ns", static_cast<double>(writes.mHostNs) / WRITES)
+              .add("write_flash_us", static_cast<double>(writes.mFlashUs) / WRITES)
+              .add("read_host_ns", static_cast<double>(reads.mHostNs) / WRITES)
+              .add("read_flash_us", static_cast<double>(reads.mFlashUs) / WRITES)
+              .add("read_reads", static_cast<double>(reads.mReads) / WRITES);
+
+        Storage remounted(&f.part);
+        mount(remounted, f.emu, SECTORS, record);
+        record.emit();
+    }
+}
+
+TEST_CASE("bench: streamed blob writes and reads by buffer size", "[bench][stream]")
+{
+    const size_t bufferSizes[] = { 256, 1024, 4000 };
+    const size_t BLOB_SIZE = 100000;
+    const size_t PIECE_SIZE = 100;
+    const uint32_t SECTORS = 64;
+
+    std::vector<uint8_t> blob(BLOB_SIZE);
+    for (size_t i = 0; i < BLOB_SIZE; ++i) {
+        blob[i] = static_cast<uint8_t>(i * 13);
+    }
+
+    for (size_t bufferSize : bufferSizes) {
+        PartitionEmulationFixture f(0, SECTORS);
+        uint8_t ns;
+        Storage storage(&f.part);
+        REQUIRE(storage.init(0, SECTORS) == ESP_OK);
+        REQUIRE(storage.createOrOpenNamespace("bench", true, ns) == ESP_OK);
+
+        // the writer holds its buffer, nvs_set_blob would need all of the blob in RAM
+        const size_t heapBefore = heap_in_use();
+        size_t heapPeak = 0;
+        NVSBlobWriter writer;
+        Phase writes(f.emu);
+        REQUIRE(writer.open(&storage, ns, "blob", bufferSize) == ESP_OK);
+        esp_err_t err = ESP_OK;
+        for (size_t pos = 0; pos < BLOB_SIZE && err == ESP_OK; pos += PIECE_SIZE) {
+            err = writer.write(blob.data() + pos, PIECE_SIZE);
+            heapPeak = std::max(heapPeak, heap_in_use() - heapBefore);
+        }
+        if (err == ESP_OK) {
+            err = writer.commit();
+        }
+        writes.stop();
+
+        Record record("stream");
+        record.add("buffer_size", static_cast<long long>(bufferSize))
+              .add("blob_size", static_cast<long long>(BLOB_SIZE));
+        if (err != ESP_OK) {
+            // a small buffer makes too many chunks for the blob
+            record.add("error", static_cast<long long>(err));
+            record.emit();
+            continue;
+        }
+
+        NVSBlobReader reader;
+        std::vector<uint8_t> read(BLOB_SIZE);
+        Phase reads(f.emu);
+        REQUIRE(reader.open(&storage, ns, "blob") == ESP_OK);
+        for (size_t pos = 0; pos < BLOB_SIZE; pos += PIECE_SIZE) {
+            size_t length = 0;
+            REQUIRE(reader.read(read.data() + pos, PIECE_SIZE, length) == ESP_OK);
+        }
+        reads.stop();
+        CHECK(read == blob);
+
+        record.add("heap_peak_bytes", static_cast<long long>(heapPeak))
+              .add("write_mb_s", BLOB_SIZE * 1e3 / writes.mHostNs)
+              .add("write_flash_us", static_cast<long long>(writes.mFlashUs))
+              .add("write_amplification", static_cast<double>(writes.mWriteBytes) / BLOB_SIZE)
+              .add("read_mb_s", BLOB_SIZE * 1e3 / reads.mHostNs)
+              .add("read_reads", static_cast<long long>(reads.mReads));
+        record.emit();
+    }
+}
+
+TEST_CASE("bench: crc throughput of the rom routine and slice-by-8", "[bench][crc]")
+{
+    const size_t sizes[] = { 32, 256, 4000 };
+    const size_t TOTAL = 16 * 1024 * 1024;
+
+    std::vector<uint8_t> data(4000);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<uint8_t>(i * 29);
+    }
+
+    // a checksum of all results keeps the loops from being optimized away
+    uint32_t sink = 0;
+    for (size_t size : sizes) {
+        const size_t rounds = TOTAL / size;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < rounds; ++r) {
+            sink ^= esp_rom_crc32_le(static_cast<uint32_t>(r), data.data(), size);
+        }
+        const double romNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < rounds; ++r) {
+            sink ^= Crc32::calculate(static_cast<uint32_t>(r), data.data(), size);
+        }
+        const double sliceNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+        Record("crc").add("size", static_cast<long long>(size))
+                     .add("rom_mb_s", TOTAL * 1e3 / romNs)
+                     .add("slice_by_8_mb_s", TOTAL * 1e3 / sliceNs)
+                     .emit();
+    }
+
+    // item headers, one call per field before, one pass now
+    const size_t ITEMS = 1000 * 1000;
+    std::vector<Item> items(256);
+    for (size_t i = 0; i < items.size(); ++i) {
+        std::copy(data.begin() + i, data.begin() + i + sizeof(Item), items[i].rawData);
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ITEMS; ++i) {
+        const uint8_t* p = items[i % items.size()].rawData;
+        uint32_t crc = esp_rom_crc32_le(0xffffffff, p, offsetof(Item, crc32));
+        crc = esp_rom_crc32_le(crc, p + offsetof(Item, key), sizeof(Item) - offsetof(Item, key));
+        sink ^= crc;
+    }
+    const double fieldsNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ITEMS; ++i) {
+        sink ^= items[i % items.size()].calculateCrc32();
+    }
+    const double fusedNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    Record("crc_item").add("rom_fields_ns", fieldsNs / ITEMS)
+                      .add("fused_ns", fusedNs / ITEMS)
+                      .add("sink", static_cast<long long>(sink & 1))
+                      .emit();
+}
+
+namespace {
+
+/* Mount a partition of mostly integers and some strings and look all of them up once. */
+void bench_partition(const char* name, Partition* part, SpiFlashEmulator& emu, uint32_t sectors, unsigned keys)
+{
+    const char str[] = "gain and offset of the channel";
+    char key[16];
+    uint8_t ns;
+    {
+        Storage storage(part);
+        REQUIRE(storage.init(0, sectors) == ESP_OK);
+        REQUIRE(storage.createOrOpenNamespace("bench", true, ns) == ESP_OK);
+        for (unsigned i = 0; i < keys; ++i) {
+            key_name(key, sizeof(key), i);
+            esp_err_t err = (i % 8 == 0)
+                            ? storage.writeItem(ns, ItemType::SZ, key, str, sizeof(str))
+                            : storage.writeItem(ns, key, static_cast<uint32_t>(i));
+            REQUIRE(err == ESP_OK);
+        }
+    }
+
+    Record record("encryption");
+    record.add("partition", name)
+          .add("keys", static_cast<long long>(keys))
+          .add("sectors", static_cast<long long>(sectors));
+    Storage storage(part);
+    mount(storage, emu, sectors, record);
+
+    uint32_t value = 0;
+    char read[sizeof(str)];
+    unsigned failed = 0;
+    Phase lookups(emu);
+    for (unsigned i = 0; i < keys; ++i) {
+        key_name(key, sizeof(key), i);
+        failed += ((i % 8 == 0)
+                   ? storage.readItem(ns, ItemType::SZ, key, read, sizeof(read))
+                   : storage.readItem(ns, key, value)) != ESP_OK;
+    }
+    lookups.stop();
+    REQUIRE(failed == 0);
+
+    record.add("lookup_host_ns", static_cast<double>(lookups.mHostNs) / keys)
+          .add("lookup_flash_us", static_cast<double>(lookups.mFlashUs) / keys)
+          .add("lookup_reads", static_cast<double>(lookups.mReads) / keys)
+          .emit();
+}
+
+} // namespace
+
+TEST_CASE("bench: mount and lookup of encrypted and plain partitions", "[bench][encryption]")
+{
+    const unsigned keyCounts[] = { 128, 1024 };
+
+    nvs_sec_cfg_t cfg;
+    for (int i = 0; i < NVS_KEY_SIZE; ++i) {
+        cfg.eky[i] = 0x11;
+        cfg.tky[i] = 0x22;
+    }
+
+    for (unsigned keys : keyCounts) {
+        const uint32_t sectors = keys / 64 + 4;
+        {
+            PartitionEmulationFixture f(0, sectors);
+            bench_partition("plain", &f.part, f.emu, sectors, keys);
+        }
+        {
+            EncryptedPartitionFixture f(&cfg, 0, sectors);
+            for (uint32_t i = 0; i < sectors; ++i) {
+                f.emu.erase(i);
+            }
+            bench_partition("encrypted", &f.part, f.emu, sectors, keys);
+        }
+    }
+}
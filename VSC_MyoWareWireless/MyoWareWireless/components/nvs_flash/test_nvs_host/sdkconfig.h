@@ -3,3 +3,4 @@
 #define CONFIG_LOG_TIMESTAMP_SOURCE_RTOS 1
 #define CONFIG_IDF_TARGET_LINUX 1
 #define CONFIG_NVS_ASSERT_ERROR_CHECK 1
+#define CONFIG_NVS_PAGE_SUMMARY 1
@@ -57,6 +57,15 @@ public:
         return true;
     }
 
+    // like a region mapped by the flash MMU, reads through it aren't counted
+    const uint8_t* map(size_t srcAddr, size_t size) const
+    {
+        if (srcAddr + size > mData.size() * 4) {
+            return nullptr;
+        }
+        return bytes() + srcAddr;
+    }
+
     bool write(size_t dstAddr, const uint32_t* src, size_t size)
     {
         uint32_t sectorNumber = dstAddr/SPI_FLASH_SEC_SIZE;
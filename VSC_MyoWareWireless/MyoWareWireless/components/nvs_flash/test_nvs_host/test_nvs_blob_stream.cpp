@@ -0,0 +1,314 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "catch.hpp"
+#include "nvs.hpp"
+#include "nvs_blob_stream.hpp"
+#include "nvs_partition_manager.hpp"
+#include "nvs_storage.hpp"
+#include "spi_flash_emulation.h"
+#include "test_fixtures.hpp"
+#include <cstring>
+#include <vector>
+
+#define TEST_ESP_ERR(rc, res) CHECK((rc) == (res))
+#define TEST_ESP_OK(rc) CHECK((rc) == ESP_OK)
+
+using namespace nvs;
+
+static std::vector<uint8_t> make_blob(size_t size, uint8_t seed)
+{
+    std::vector<uint8_t> blob(size);
+    for (size_t i = 0; i < size; ++i) {
+        blob[i] = static_cast<uint8_t>(seed + i * 7);
+    }
+    return blob;
+}
+
+/* Write blob in pieces of the given sizes, repeated until all of it is written. */
+static esp_err_t write_pieces(nvs_blob_writer_t writer, const std::vector<uint8_t>& blob,
+                              const std::vector<size_t>& pieces)
+{
+    size_t written = 0;
+    for (size_t i = 0; written < blob.size(); ++i) {
+        size_t piece = pieces[i % pieces.size()];
+        piece = (piece < blob.size() - written) ? piece : blob.size() - written;
+        esp_err_t err = nvs_blob_writer_write(writer, blob.data() + written, piece);
+        if (err != ESP_OK) {
+            return err;
+        }
+        written += piece;
+    }
+    return ESP_OK;
+}
+
+/* Read a whole blob through a reader in pieces of the given sizes. */
+static std::vector<uint8_t> read_pieces(nvs_blob_reader_t reader, const std::vector<size_t>& pieces)
+{
+    std::vector<uint8_t> data;
+    for (size_t i = 0; ; ++i) {
+        std::vector<uint8_t> piece(pieces[i % pieces.size()]);
+        size_t length = 0;
+        REQUIRE(nvs_blob_reader_read(reader, piece.data(), piece.size(), &length) == ESP_OK);
+        data.insert(data.end(), piece.begin(), piece.begin() + length);
+        if (length < piece.size()) {
+            return data;
+        }
+    }
+}
+
+TEST_CASE("blob writer and reader round trip pieces of any size", "[nvs][blob_stream]")
+{
+    const uint32_t NVS_FLASH_SECTOR = 0;
+    const uint32_t NVS_FLASH_SECTOR_COUNT = 8;
+    PartitionEmulationFixture f(NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT);
+    REQUIRE(NVSPartitionManager::get_instance()->init_custom(&f.part, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT)
+            == ESP_OK);
+
+    nvs_handle_t handle;
+    TEST_ESP_OK(nvs_open("emg", NVS_READWRITE, &handle));
+    nvs_blob_writer_t writer;
+    TEST_ESP_ERR(nvs_blob_writer_open(handle, "template", 0, nullptr), ESP_ERR_INVALID_ARG);
+    TEST_ESP_ERR(nvs_blob_writer_open(handle, "a_very_long_key_name", 0, &writer), ESP_ERR_NVS_KEY_TOO_LONG);
+    CHECK(writer == nullptr);
+    TEST_ESP_ERR(nvs_blob_writer_open(handle, "template", NVS_BLOB_WRITER_MIN_BUFFER_SIZE - 1, &writer),
+                 ESP_ERR_INVALID_ARG);
+    CHECK(writer == nullptr);
+
+    // pieces smaller than, equal to and larger than the buffer, the chunks cross pages
+    const std::vector<uint8_t> blob = make_blob(12345, 3);
+    TEST_ESP_OK(nvs_blob_writer_open(handle, "template", 700, &writer));
+    TEST_ESP_OK(write_pieces(writer, blob, {1, 33, 700, 2500, 5, 699}));
+    TEST_ESP_OK(nvs_blob_writer_commit(writer));
+
+    std::vector<uint8_t> copy(blob.size());
+    size_t size = copy.size();
+    TEST_ESP_OK(nvs_get_blob(handle, "template", copy.data(), &size));
+    CHECK(copy == blob);
+
+    nvs_blob_reader_t reader;
+    TEST_ESP_ERR(nvs_blob_reader_open(handle, "missing", &reader), ESP_ERR_NVS_NOT_FOUND);
+    CHECK(reader == nullptr);
+    TEST_ESP_OK(nvs_blob_reader_open(handle, "template", &reader));
+    CHECK(nvs_blob_reader_get_size(reader) == blob.size());
+    CHECK(read_pieces(reader, {3, 64, 1, 1000, 31}) == blob);
+    nvs_blob_reader_release(reader);
+
+    // blobs written in one go are read the same way, the legacy format too
+    TEST_ESP_OK(nvs_set_blob(handle, "small", blob.data(), 100));
+    TEST_ESP_OK(nvs_blob_reader_open(handle, "small", &reader));
+    CHECK(read_pieces(reader, {7}) == std::vector<uint8_t>(blob.begin(), blob.begin() + 100));
+    nvs_blob_reader_release(reader);
+
+    TEST_ESP_OK(nvs_blob_writer_open(handle, "empty", 0, &writer));
+    TEST_ESP_OK(nvs_blob_writer_commit(writer));
+    size = 1;
+    TEST_ESP_OK(nvs_get_blob(handle, "empty", nullptr, &size));
+    CHECK(size == 0);
+
+    nvs_close(handle);
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+}
+
+TEST_CASE("blob writer keeps the stored blob until it commits", "[nvs][blob_stream]")
+{
+    const uint32_t NVS_FLASH_SECTOR = 0;
+    const uint32_t NVS_FLASH_SECTOR_COUNT = 6;
+    PartitionEmulationFixture f(NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT);
+    REQUIRE(NVSPartitionManager::get_instance()->init_custom(&f.part, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT)
+            == ESP_OK);
+
+    nvs_handle_t handle;
+    TEST_ESP_OK(nvs_open("emg", NVS_READWRITE, &handle));
+    const std::vector<uint8_t> old = make_blob(5000, 1);
+    TEST_ESP_OK(nvs_set_blob(handle, "template", old.data(), old.size()));
+
+    nvs_blob_writer_t writer;
+    TEST_ESP_OK(nvs_blob_writer_open(handle, "template", 512, &writer));
+    const std::vector<uint8_t> blob = make_blob(7000, 2);
+    TEST_ESP_OK(write_pieces(writer, blob, {300}));
+
+    // the key is reserved for the writer, the old blob is still there
+    nvs_blob_writer_t other;
+    TEST_ESP_ERR(nvs_blob_writer_open(handle, "template", 0, &other), ESP_ERR_NVS_INVALID_STATE);
+    TEST_ESP_ERR(nvs_set_blob(handle, "template", old.data(), 10), ESP_ERR_NVS_INVALID_STATE);
+    std::vector<uint8_t> copy(blob.size());
+    size_t size = copy.size();
+    TEST_ESP_OK(nvs_get_blob(handle, "template", copy.data(), &size));
+    CHECK(size == old.size());
+    CHECK(std::equal(old.begin(), old.end(), copy.begin()));
+
+    TEST_ESP_OK(nvs_blob_writer_commit(writer));
+    size = copy.size();
+    TEST_ESP_OK(nvs_get_blob(handle, "template", copy.data(), &size));
+    CHECK(copy == blob);
+
+    // an aborted writer leaves neither chunks nor the reservation behind
+    size_t used = 0;
+    TEST_ESP_OK(nvs_get_used_entry_count(handle, &used));
+    TEST_ESP_OK(nvs_blob_writer_open(handle, "template", 0, &writer));
+    TEST_ESP_OK(write_pieces(writer, old, {4096}));
+    nvs_blob_writer_abort(writer);
+    nvs_blob_writer_abort(nullptr);
+    size_t usedAfter = 0;
+    TEST_ESP_OK(nvs_get_used_entry_count(handle, &usedAfter));
+    CHECK(usedAfter == used);
+    TEST_ESP_OK(nvs_set_blob(handle, "template", old.data(), old.size()));
+
+    // a blob which doesn't fit fails, the writer erases what it wrote and the stored blob stays
+    TEST_ESP_OK(nvs_blob_writer_open(handle, "template", 4000, &writer));
+    const std::vector<uint8_t> huge = make_blob(NVS_FLASH_SECTOR_COUNT * SPI_FLASH_SEC_SIZE, 4);
+    esp_err_t err = write_pieces(writer, huge, {4000});
+    CHECK((err == ESP_ERR_NVS_NOT_ENOUGH_SPACE || err == ESP_ERR_NVS_VALUE_TOO_LONG));
+    TEST_ESP_ERR(nvs_blob_writer_write(writer, huge.data(), 1), ESP_ERR_NVS_INVALID_STATE);
+    TEST_ESP_ERR(nvs_blob_writer_commit(writer), ESP_ERR_NVS_INVALID_STATE);
+    size = copy.size();
+    TEST_ESP_OK(nvs_get_blob(handle, "template", copy.data(), &size));
+    CHECK(size == old.size());
+    CHECK(std::equal(old.begin(), old.end(), copy.begin()));
+
+    nvs_handle_t readOnly;
+    TEST_ESP_OK(nvs_open("emg", NVS_READONLY, &readOnly));
+    TEST_ESP_ERR(nvs_blob_writer_open(readOnly, "template", 0, &writer), ESP_ERR_NVS_READ_ONLY);
+    nvs_close(readOnly);
+
+    // writers outlive the partition, committing fails then
+    TEST_ESP_OK(nvs_blob_writer_open(handle, "late", 0, &writer));
+    TEST_ESP_OK(nvs_blob_writer_write(writer, blob.data(), 100));
+    nvs_close(handle);
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+    TEST_ESP_ERR(nvs_blob_writer_commit(writer), ESP_ERR_NVS_INVALID_STATE);
+}
+
+TEST_CASE("blob reader detects changes and damaged chunks", "[nvs][blob_stream]")
+{
+    const uint32_t NVS_FLASH_SECTOR = 0;
+    const uint32_t NVS_FLASH_SECTOR_COUNT = 4;
+    PartitionEmulationFixture f(NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT);
+    Storage storage(&f.part);
+    REQUIRE(storage.init(NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT) == ESP_OK);
+    uint8_t ns;
+    REQUIRE(storage.createOrOpenNamespace("emg", true, ns) == ESP_OK);
+    const std::vector<uint8_t> blob = make_blob(6000, 5);
+    REQUIRE(storage.writeItem(ns, ItemType::BLOB, "template", blob.data(), blob.size()) == ESP_OK);
+
+    NVSBlobReader reader;
+    REQUIRE(reader.open(&storage, ns, "template") == ESP_OK);
+    std::vector<uint8_t> data(100);
+    size_t length = 0;
+    TEST_ESP_OK(reader.read(data.data(), data.size(), length));
+    CHECK(length == data.size());
+    CHECK(std::equal(data.begin(), data.end(), blob.begin()));
+
+    // garbage collection leaves the reader valid, writing to the namespace doesn't
+    uint8_t otherNs;
+    REQUIRE(storage.createOrOpenNamespace("other", true, otherNs) == ESP_OK);
+    for (uint32_t i = 0; i < 300; ++i) {
+        REQUIRE(storage.writeItem(otherNs, "count", i) == ESP_OK);
+    }
+    CHECK(reader.is_valid());
+    TEST_ESP_OK(reader.read(data.data(), data.size(), length));
+    CHECK(std::equal(data.begin(), data.end(), blob.begin() + 100));
+
+    REQUIRE(storage.writeItem(ns, "version", static_cast<uint8_t>(1)) == ESP_OK);
+    CHECK_FALSE(reader.is_valid());
+    TEST_ESP_ERR(reader.read(data.data(), data.size(), length), ESP_ERR_NVS_INVALID_STATE);
+    CHECK(length == 0);
+
+    // a bit flipped in the data of the second chunk is reported at its end
+    Storage::BlobChunk chunk;
+    REQUIRE(storage.findBlobChunk(ns, "template", 1, chunk) == ESP_OK);
+    const uint32_t zero = 0;
+    REQUIRE(f.emu.write(chunk.offset + 64, &zero, sizeof(zero)));
+    REQUIRE(reader.open(&storage, ns, "template") == ESP_OK);
+    Storage::BlobChunk first;
+    REQUIRE(storage.findBlobChunk(ns, "template", 0, first) == ESP_OK);
+    data.resize(first.size);
+    TEST_ESP_OK(reader.read(data.data(), data.size(), length));
+    data.resize(chunk.size);
+    TEST_ESP_ERR(reader.read(data.data(), data.size(), length), ESP_ERR_INVALID_CRC);
+}
+
+TEST_CASE("blob reader reads an encrypted partition", "[nvs][blob_stream]")
+{
+    const uint32_t NVS_FLASH_SECTOR = 6;
+    const uint32_t NVS_FLASH_SECTOR_COUNT = 4;
+
+    nvs_sec_cfg_t xts_cfg;
+    for (int count = 0; count < NVS_KEY_SIZE; count++) {
+        xts_cfg.eky[count] = 0x11;
+        xts_cfg.tky[count] = 0x22;
+    }
+    EncryptedPartitionFixture fixture(&xts_cfg, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT);
+    for (uint32_t i = NVS_FLASH_SECTOR; i < NVS_FLASH_SECTOR + NVS_FLASH_SECTOR_COUNT; ++i) {
+        fixture.emu.erase(i);
+    }
+    REQUIRE(NVSPartitionManager::get_instance()->init_custom(&fixture.part, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT)
+            == ESP_OK);
+
+    nvs_handle_t handle;
+    TEST_ESP_OK(nvs_open("emg", NVS_READWRITE, &handle));
+    const std::vector<uint8_t> blob = make_blob(5000, 9);
+    nvs_blob_writer_t writer;
+    TEST_ESP_OK(nvs_blob_writer_open(handle, "template", 1024, &writer));
+    TEST_ESP_OK(write_pieces(writer, blob, {17, 2000}));
+    TEST_ESP_OK(nvs_blob_writer_commit(writer));
+
+    nvs_blob_reader_t reader;
+    TEST_ESP_OK(nvs_blob_reader_open(handle, "template", &reader));
+    CHECK(read_pieces(reader, {5, 96, 1500}) == blob);
+
+    // readers outlive the partition, reading fails then
+    nvs_close(handle);
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+    std::vector<uint8_t> data(10);
+    size_t length = 0;
+    TEST_ESP_ERR(nvs_blob_reader_read(reader, data.data(), data.size(), &length), ESP_ERR_NVS_INVALID_STATE);
+    nvs_blob_reader_release(reader);
+}
+
+TEST_CASE("blob writer survives power loss with either blob intact", "[nvs][blob_stream]")
+{
+    const uint32_t SECTORS = 4;
+    const std::vector<uint8_t> old = make_blob(3000, 1);
+    const std::vector<uint8_t> blob = make_blob(3500, 2);
+
+    for (uint32_t failAfter = 0; failAfter < 1400; failAfter += 11) {
+        PartitionEmulationFixture f(0, SECTORS);
+        uint8_t ns;
+        {
+            Storage storage(&f.part);
+            REQUIRE(storage.init(0, SECTORS) == ESP_OK);
+            REQUIRE(storage.createOrOpenNamespace("emg", true, ns) == ESP_OK);
+            REQUIRE(storage.writeItem(ns, ItemType::BLOB, "template", old.data(), old.size()) == ESP_OK);
+
+            f.emu.failAfter(failAfter);
+            NVSBlobWriter writer;
+            if (writer.open(&storage, ns, "template", 1000) == ESP_OK
+                    && writer.write(blob.data(), 1234) == ESP_OK
+                    && writer.write(blob.data() + 1234, blob.size() - 1234) == ESP_OK) {
+                writer.commit();
+            }
+            // the power is gone, nothing is cleaned up
+            writer.release();
+            f.emu.failAfter(UINT32_MAX);
+        }
+
+        Storage storage(&f.part);
+        REQUIRE(storage.init(0, SECTORS) == ESP_OK);
+        REQUIRE(storage.createOrOpenNamespace("emg", false, ns) == ESP_OK);
+        size_t size = 0;
+        REQUIRE(storage.getItemDataSize(ns, ItemType::BLOB, "template", size) == ESP_OK);
+        std::vector<uint8_t> data(size);
+        REQUIRE(storage.readItem(ns, ItemType::BLOB, "template", data.data(), data.size()) == ESP_OK);
+        CHECK((data == old || data == blob));
+
+        // no chunk of either blob is left behind
+        REQUIRE(storage.eraseItem(ns, ItemType::BLOB, "template") == ESP_OK);
+        size_t used = 1;
+        REQUIRE(storage.calcEntriesInNamespace(ns, used) == ESP_OK);
+        CHECK(used == 0);
+    }
+}
@@ -0,0 +1,198 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "catch.hpp"
+#include "nvs.hpp"
+#include "nvs_partition_manager.hpp"
+#include "spi_flash_emulation.h"
+#include "test_fixtures.hpp"
+#include <cstring>
+#include <vector>
+
+#define TEST_ESP_ERR(rc, res) CHECK((rc) == (res))
+#define TEST_ESP_OK(rc) CHECK((rc) == ESP_OK)
+
+static std::vector<uint8_t> make_blob(size_t size, uint8_t seed)
+{
+    std::vector<uint8_t> blob(size);
+    for (size_t i = 0; i < size; ++i) {
+        blob[i] = static_cast<uint8_t>(seed + i * 7);
+    }
+    return blob;
+}
+
+/* Concatenate the spans of a view, checking that they point into the emulated flash if mapped. */
+static std::vector<uint8_t> read_view(nvs_blob_view_t view, const SpiFlashEmulator* emu)
+{
+    std::vector<uint8_t> data;
+    for (size_t i = 0; i < nvs_blob_view_get_span_count(view); ++i) {
+        const void* span = nullptr;
+        size_t length = 0;
+        REQUIRE(nvs_blob_view_get_span(view, i, &span, &length) == ESP_OK);
+        const uint8_t* bytes = static_cast<const uint8_t*>(span);
+        if (emu != nullptr) {
+            CHECK(bytes >= emu->bytes());
+            CHECK(bytes + length <= emu->bytes() + emu->size());
+        }
+        data.insert(data.end(), bytes, bytes + length);
+    }
+    const void* span = nullptr;
+    size_t length = 0;
+    CHECK(nvs_blob_view_get_span(view, nvs_blob_view_get_span_count(view), &span, &length) == ESP_ERR_NVS_NOT_FOUND);
+    return data;
+}
+
+TEST_CASE("blob view reads a multi page blob in place", "[nvs][blob_view]")
+{
+    const uint32_t NVS_FLASH_SECTOR = 0;
+    const uint32_t NVS_FLASH_SECTOR_COUNT = 8;
+    PartitionEmulationFixture f(NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT);
+    REQUIRE(nvs::NVSPartitionManager::get_instance()->init_custom(&f.part, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT)
+            == ESP_OK);
+
+    nvs_handle_t handle;
+    TEST_ESP_OK(nvs_open("model", NVS_READWRITE, &handle));
+    const std::vector<uint8_t> lut = make_blob(10000, 3);
+    TEST_ESP_OK(nvs_set_blob(handle, "lut", lut.data(), lut.size()));
+    TEST_ESP_OK(nvs_set_u8(handle, "version", 1));
+
+    TEST_ESP_ERR(nvs_get_blob_view(handle, "missing", nullptr), ESP_ERR_INVALID_ARG);
+    nvs_blob_view_t view;
+    TEST_ESP_ERR(nvs_get_blob_view(handle, "missing", &view), ESP_ERR_NVS_NOT_FOUND);
+    CHECK(view == nullptr);
+
+    // opening reads the item headers and checks the data CRC through the mapping
+    f.emu.clearStats();
+    TEST_ESP_OK(nvs_get_blob_view(handle, "lut", &view));
+    CHECK(f.emu.getReadBytes() < lut.size() / 4);
+    CHECK(nvs_blob_view_is_valid(view));
+    CHECK(nvs_blob_view_is_mapped(view));
+    CHECK(nvs_blob_view_get_size(view) == lut.size());
+    CHECK(nvs_blob_view_get_span_count(view) > 1);
+
+    f.emu.clearStats();
+    CHECK(read_view(view, &f.emu) == lut);
+    CHECK(f.emu.getReadOps() == 0);
+
+    // reading other values keeps the view valid, any change of the namespace invalidates it
+    uint8_t version = 0;
+    TEST_ESP_OK(nvs_get_u8(handle, "version", &version));
+    CHECK(nvs_blob_view_is_valid(view));
+    TEST_ESP_OK(nvs_set_u8(handle, "version", 2));
+    CHECK_FALSE(nvs_blob_view_is_valid(view));
+    const void* span = nullptr;
+    size_t length = 0;
+    TEST_ESP_ERR(nvs_blob_view_get_span(view, 0, &span, &length), ESP_ERR_NVS_INVALID_STATE);
+    nvs_blob_view_release(view);
+
+    // a view opened after the blob is rewritten sees the new data, the old one is invalid
+    TEST_ESP_OK(nvs_get_blob_view(handle, "lut", &view));
+    const std::vector<uint8_t> lut2 = make_blob(6000, 5);
+    TEST_ESP_OK(nvs_set_blob(handle, "lut", lut2.data(), lut2.size()));
+    TEST_ESP_ERR(nvs_blob_view_get_span(view, 0, &span, &length), ESP_ERR_NVS_INVALID_STATE);
+    nvs_blob_view_t view2;
+    TEST_ESP_OK(nvs_get_blob_view(handle, "lut", &view2));
+    CHECK(read_view(view2, &f.emu) == lut2);
+    nvs_blob_view_release(view);
+
+    TEST_ESP_OK(nvs_erase_key(handle, "lut"));
+    CHECK_FALSE(nvs_blob_view_is_valid(view2));
+    TEST_ESP_ERR(nvs_get_blob_view(handle, "lut", &view), ESP_ERR_NVS_NOT_FOUND);
+
+    TEST_ESP_OK(nvs_set_blob(handle, "empty", nullptr, 0));
+    TEST_ESP_OK(nvs_get_blob_view(handle, "empty", &view));
+    CHECK(nvs_blob_view_get_size(view) == 0);
+    CHECK(read_view(view, &f.emu).empty());
+
+    // the views outlive the partition, their mappings don't
+    nvs_close(handle);
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+    CHECK_FALSE(nvs_blob_view_is_valid(view));
+    CHECK_FALSE(nvs_blob_view_is_mapped(view2));
+    nvs_blob_view_release(view);
+    nvs_blob_view_release(view2);
+    nvs_blob_view_release(nullptr);
+}
+
+TEST_CASE("blob view is invalidated when writes to another namespace relocate its page", "[nvs][blob_view]")
+{
+    const uint32_t NVS_FLASH_SECTOR = 0;
+    const uint32_t NVS_FLASH_SECTOR_COUNT = 4;
+    PartitionEmulationFixture f(NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT);
+    REQUIRE(nvs::NVSPartitionManager::get_instance()->init_custom(&f.part, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT)
+            == ESP_OK);
+
+    nvs_handle_t model;
+    nvs_handle_t other;
+    TEST_ESP_OK(nvs_open("model", NVS_READWRITE, &model));
+    TEST_ESP_OK(nvs_open("other", NVS_READWRITE, &other));
+    const std::vector<uint8_t> lut = make_blob(1000, 11);
+    TEST_ESP_OK(nvs_set_blob(model, "lut", lut.data(), lut.size()));
+
+    nvs_blob_view_t view;
+    TEST_ESP_OK(nvs_get_blob_view(model, "lut", &view));
+    REQUIRE(nvs_blob_view_is_mapped(view));
+
+    // keys of their own fill the pages until the one holding the blob is collected
+    char key[16];
+    size_t writes = 0;
+    f.emu.clearStats();
+    while (f.emu.getEraseOps() == 0) {
+        snprintf(key, sizeof(key), "k%u", static_cast<unsigned>(writes % 200));
+        REQUIRE(nvs_set_u32(other, key, static_cast<uint32_t>(writes)) == ESP_OK);
+        ++writes;
+        REQUIRE(writes < 5000);
+    }
+    CHECK_FALSE(nvs_blob_view_is_valid(view));
+    const void* span = nullptr;
+    size_t length = 0;
+    TEST_ESP_ERR(nvs_blob_view_get_span(view, 0, &span, &length), ESP_ERR_NVS_INVALID_STATE);
+    nvs_blob_view_release(view);
+
+    // the blob was moved, a new view finds it
+    TEST_ESP_OK(nvs_get_blob_view(model, "lut", &view));
+    CHECK(read_view(view, &f.emu) == lut);
+    nvs_blob_view_release(view);
+
+    nvs_close(model);
+    nvs_close(other);
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+}
+
+TEST_CASE("blob view copies the blob of an encrypted partition", "[nvs][blob_view]")
+{
+    const uint32_t NVS_FLASH_SECTOR = 6;
+    const uint32_t NVS_FLASH_SECTOR_COUNT = 4;
+
+    nvs_sec_cfg_t xts_cfg;
+    for (int count = 0; count < NVS_KEY_SIZE; count++) {
+        xts_cfg.eky[count] = 0x11;
+        xts_cfg.tky[count] = 0x22;
+    }
+    EncryptedPartitionFixture fixture(&xts_cfg, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT);
+    for (uint32_t i = NVS_FLASH_SECTOR; i < NVS_FLASH_SECTOR + NVS_FLASH_SECTOR_COUNT; ++i) {
+        fixture.emu.erase(i);
+    }
+    REQUIRE(nvs::NVSPartitionManager::get_instance()->init_custom(&fixture.part, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT)
+            == ESP_OK);
+
+    nvs_handle_t handle;
+    TEST_ESP_OK(nvs_open("model", NVS_READWRITE, &handle));
+    const std::vector<uint8_t> lut = make_blob(5000, 9);
+    TEST_ESP_OK(nvs_set_blob(handle, "lut", lut.data(), lut.size()));
+
+    nvs_blob_view_t view;
+    TEST_ESP_OK(nvs_get_blob_view(handle, "lut", &view));
+    CHECK_FALSE(nvs_blob_view_is_mapped(view));
+    CHECK(nvs_blob_view_get_span_count(view) == 1);
+    CHECK(read_view(view, nullptr) == lut);
+
+    TEST_ESP_OK(nvs_set_u8(handle, "version", 1));
+    CHECK_FALSE(nvs_blob_view_is_valid(view));
+    nvs_blob_view_release(view);
+
+    nvs_close(handle);
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+}
@@ -0,0 +1,334 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "unity.h"
+#include "power_policy.h"
+
+/* CPU time per sample block: DMA conversion of 128 samples at 20 kHz plus processing */
+#define BLOCK_AWAKE_US      7000
+/* Bluedroid puts an idle SPP link into sniff after this long without traffic */
+#define SNIFF_IDLE_MS       5000
+/* The firmware before the power policy sampled and sent every 250 ms */
+#define LEGACY_PERIOD_MS    250
+#define MAX_TRACE_LEN       16
+
+typedef struct {
+    uint32_t start_ms;
+    uint32_t end_ms;
+    uint16_t level;
+} activity_t;
+
+typedef struct {
+    uint32_t max_wake_latency_ms;   /**< Longest time from activity onset to the first ACTIVE block */
+    uint32_t activity_sent;         /**< Blocks sent while the trace was active */
+} trace_result_t;
+
+static uint16_t envelope_at(const activity_t *trace, size_t n, uint32_t t_ms)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (t_ms >= trace[i].start_ms && t_ms < trace[i].end_ms) {
+            return trace[i].level;
+        }
+    }
+    return 3;
+}
+
+/* Runs the policy over a trace, with a link model that enters sniff after SNIFF_IDLE_MS without a send */
+static void run_trace(power_policy_t *pp, const activity_t *trace, size_t n, uint32_t duration_ms, trace_result_t *result)
+{
+    uint32_t now = 0;
+    uint32_t last_tx = 0;
+    bool sniff = false;
+    bool seen[MAX_TRACE_LEN] = { 0 };
+    TEST_ASSERT_TRUE(n <= MAX_TRACE_LEN);
+    memset(result, 0, sizeof(*result));
+
+    power_policy_set_radio(pp, 0, POWER_RADIO_ACTIVE);
+    while (now < duration_ms) {
+        uint16_t env = envelope_at(trace, n, now);
+        power_policy_action_t action;
+        power_policy_update(pp, now, env, BLOCK_AWAKE_US, &action);
+
+        for (size_t i = 0; i < n; i++) {
+            if (now >= trace[i].start_ms && now < trace[i].end_ms) {
+                TEST_ASSERT_EQUAL(POWER_STATE_ACTIVE, action.state);
+                TEST_ASSERT_TRUE(action.send);
+                if (!seen[i]) {
+                    // The first block of a burst measures the wakeup latency
+                    seen[i] = true;
+                    if (now - trace[i].start_ms > result->max_wake_latency_ms) {
+                        result->max_wake_latency_ms = now - trace[i].start_ms;
+                    }
+                }
+                result->activity_sent++;
+            }
+        }
+
+        if (action.send) {
+            last_tx = now;
+            if (sniff) {
+                sniff = false;
+                power_policy_set_radio(pp, now, POWER_RADIO_ACTIVE);
+            }
+        } else if (!sniff && now - last_tx >= SNIFF_IDLE_MS) {
+            sniff = true;
+            power_policy_set_radio(pp, now, POWER_RADIO_SNIFF);
+        }
+        now += action.next_period_ms;
+    }
+}
+
+/* Residency of the firmware without power management: always awake, link always active, a frame every 250 ms */
+static void legacy_residency(uint32_t duration_ms, power_residency_t *res)
+{
+    memset(res, 0, sizeof(*res));
+    res->total_us = (uint64_t)duration_ms * 1000;
+    res->state_us[POWER_STATE_ACTIVE] = res->total_us;
+    res->radio_us[POWER_RADIO_ACTIVE] = res->total_us;
+    res->cpu_awake_us = res->total_us;
+    res->blocks = duration_ms / LEGACY_PERIOD_MS;
+    res->sent = res->blocks;
+}
+
+static void print_residency(const char *name, const power_residency_t *res, float ma, float legacy_ma)
+{
+    printf("[%s] active=%.1f%% rest=%.1f%% dormant=%.1f%% sniff=%.1f%% awake=%.1f%% sent=%u/%u wakeups=%u "
+           "est=%.2fmA legacy=%.2fmA\n",
+           name,
+           100.0 * res->state_us[POWER_STATE_ACTIVE] / res->total_us,
+           100.0 * res->state_us[POWER_STATE_REST] / res->total_us,
+           100.0 * res->state_us[POWER_STATE_DORMANT] / res->total_us,
+           100.0 * res->radio_us[POWER_RADIO_SNIFF] / res->total_us,
+           100.0 * res->cpu_awake_us / res->total_us,
+           (unsigned)res->sent, (unsigned)res->blocks, (unsigned)res->wakeups, ma, legacy_ma);
+}
+
+static void init_default(power_policy_t *pp)
+{
+    power_policy_config_t cfg = POWER_POLICY_DEFAULT_CONFIG();
+    TEST_ASSERT_EQUAL(ESP_OK, power_policy_init(pp, &cfg, 0));
+}
+
+void test_init_rejects_invalid_config(void)
+{
+    power_policy_t pp;
+    power_policy_config_t cfg = POWER_POLICY_DEFAULT_CONFIG();
+
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, power_policy_init(NULL, &cfg, 0));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, power_policy_init(&pp, NULL, 0));
+
+    cfg.rest_threshold = cfg.wake_threshold + 1;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, power_policy_init(&pp, &cfg, 0));
+
+    cfg = (power_policy_config_t)POWER_POLICY_DEFAULT_CONFIG();
+    cfg.period_ms[POWER_STATE_REST] = 0;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, power_policy_init(&pp, &cfg, 0));
+}
+
+void test_rest_and_dormant_transitions(void)
+{
+    power_policy_t pp;
+    power_policy_action_t action;
+    init_default(&pp);
+
+    uint32_t now = 0;
+    power_policy_update(&pp, now, 3, 0, &action);
+    TEST_ASSERT_EQUAL(POWER_STATE_ACTIVE, action.state);
+    TEST_ASSERT_EQUAL(pp.cfg.period_ms[POWER_STATE_ACTIVE], action.next_period_ms);
+
+    now = pp.cfg.rest_enter_ms;
+    power_policy_update(&pp, now, 3, 0, &action);
+    TEST_ASSERT_EQUAL(POWER_STATE_REST, action.state);
+    TEST_ASSERT_EQUAL(pp.cfg.period_ms[POWER_STATE_REST], action.next_period_ms);
+
+    // A level between the thresholds keeps REST but restarts the rest period
+    now += 1000;
+    power_policy_update(&pp, now, pp.cfg.rest_threshold + 1, 0, &action);
+    TEST_ASSERT_EQUAL(POWER_STATE_REST, action.state);
+    now += pp.cfg.dormant_enter_ms - 1;
+    power_policy_update(&pp, now, 3, 0, &action);
+    TEST_ASSERT_EQUAL(POWER_STATE_REST, action.state);
+    now += pp.cfg.dormant_enter_ms;
+    power_policy_update(&pp, now, 3, 0, &action);
+    TEST_ASSERT_EQUAL(POWER_STATE_DORMANT, action.state);
+    TEST_ASSERT_EQUAL(pp.cfg.period_ms[POWER_STATE_DORMANT], action.next_period_ms);
+}
+
+void test_activity_wakes_up_immediately(void)
+{
+    power_policy_t pp;
+    power_policy_action_t action;
+    init_default(&pp);
+
+    uint32_t now = 0;
+    power_policy_update(&pp, now, 3, 0, &action);
+    now += pp.cfg.dormant_enter_ms;
+    power_policy_update(&pp, now, 3, 0, &action);
+    TEST_ASSERT_EQUAL(POWER_STATE_DORMANT, action.state);
+
+    // The very first block above the wake threshold is sent and switches to the fast period
+    now += action.next_period_ms;
+    power_policy_update(&pp, now, pp.cfg.wake_threshold, 0, &action);
+    TEST_ASSERT_EQUAL(POWER_STATE_ACTIVE, action.state);
+    TEST_ASSERT_TRUE(action.send);
+    TEST_ASSERT_EQUAL(pp.cfg.period_ms[POWER_STATE_ACTIVE], action.next_period_ms);
+    TEST_ASSERT_EQUAL(1, pp.res.wakeups);
+}
+
+void test_rest_sends_changes_and_heartbeats_only(void)
+{
+    power_policy_t pp;
+    power_policy_action_t action;
+    init_default(&pp);
+
+    uint32_t now = 0;
+    power_policy_update(&pp, now, 3, 0, &action);
+    TEST_ASSERT_TRUE(action.send);
+    now = pp.cfg.rest_enter_ms;
+    power_policy_update(&pp, now, 3, 0, &action);
+    TEST_ASSERT_EQUAL(POWER_STATE_REST, action.state);
+    TEST_ASSERT_FALSE(action.send);
+
+    now += 100;
+    power_policy_update(&pp, now, 3 + pp.cfg.report_delta, 0, &action);
+    TEST_ASSERT_TRUE(action.send);
+    now += 100;
+    power_policy_update(&pp, now, 3 + pp.cfg.report_delta, 0, &action);
+    TEST_ASSERT_FALSE(action.send);
+
+    now += pp.cfg.heartbeat_ms;
+    power_policy_update(&pp, now, 3 + pp.cfg.report_delta, 0, &action);
+    TEST_ASSERT_TRUE(action.send);
+}
+
+void test_residency_adds_up(void)
+{
+    power_policy_t pp;
+    power_residency_t res;
+    trace_result_t result;
+    const activity_t trace[] = {
+        { 10000, 15000, 80 },
+        { 60000, 61000, 40 },
+    };
+    init_default(&pp);
+
+    run_trace(&pp, trace, 2, 120000, &result);
+    power_policy_get_residency(&pp, 120000, &res);
+
+    TEST_ASSERT_EQUAL(120000ULL * 1000, res.total_us);
+    uint64_t states = 0, radio = 0;
+    for (int i = 0; i < POWER_STATE_MAX; i++) {
+        states += res.state_us[i];
+    }
+    for (int i = 0; i < POWER_RADIO_MAX; i++) {
+        radio += res.radio_us[i];
+    }
+    TEST_ASSERT_EQUAL(res.total_us, states);
+    TEST_ASSERT_EQUAL(res.total_us, radio);
+    // An active link counts as awake, outside of it only the blocks do
+    TEST_ASSERT_TRUE(res.cpu_awake_us >= res.radio_us[POWER_RADIO_ACTIVE]);
+    TEST_ASSERT_TRUE(res.cpu_awake_us <= res.radio_us[POWER_RADIO_ACTIVE] + res.blocks * (uint64_t)BLOCK_AWAKE_US);
+    TEST_ASSERT_EQUAL(2, res.wakeups);
+}
+
+void test_mostly_resting_trace_saves_energy(void)
+{
+    power_policy_t pp;
+    power_residency_t res, legacy;
+    trace_result_t result;
+    power_energy_model_t model = POWER_ENERGY_MODEL_DEFAULT();
+    // Ten minutes with a grip every minute or so, mostly relaxed
+    const activity_t trace[] = {
+        { 15000, 19000, 60 },   { 70000, 72000, 90 },   { 130000, 140000, 45 },
+        { 200000, 203000, 70 }, { 290000, 291000, 30 }, { 360000, 380000, 100 },
+        { 450000, 452000, 50 }, { 540000, 546000, 80 },
+    };
+    const uint32_t duration = 600000;
+    init_default(&pp);
+
+    run_trace(&pp, trace, sizeof(trace) / sizeof(trace[0]), duration, &result);
+    power_policy_get_residency(&pp, duration, &res);
+    legacy_residency(duration, &legacy);
+    float ma = power_energy_estimate_ma(&model, &res);
+    float legacy_ma = power_energy_estimate_ma(&model, &legacy);
+    print_residency("mostly rest", &res, ma, legacy_ma);
+
+    TEST_ASSERT_EQUAL(8, res.wakeups);
+    // A grip is noticed within one dormant sample period
+    TEST_ASSERT_TRUE(result.max_wake_latency_ms <= pp.cfg.period_ms[POWER_STATE_DORMANT]);
+    TEST_ASSERT_TRUE(res.radio_us[POWER_RADIO_SNIFF] > res.total_us / 2);
+    // Sniff mode and the low idle clock save more than a third, the radio and the CPU can't
+    // light sleep while Bluetooth is enabled
+    TEST_ASSERT_TRUE(ma * 3 < legacy_ma * 2);
+    // Activity is still streamed at the full rate
+    TEST_ASSERT_TRUE(result.activity_sent * pp.cfg.period_ms[POWER_STATE_ACTIVE] > 40000);
+}
+
+void test_continuous_activity_costs_only_the_extra_frames(void)
+{
+    power_policy_t pp;
+    power_residency_t res, legacy;
+    trace_result_t result;
+    power_energy_model_t model = POWER_ENERGY_MODEL_DEFAULT();
+    const activity_t trace[] = { { 0, 60000, 120 } };
+    init_default(&pp);
+
+    run_trace(&pp, trace, 1, 60000, &result);
+    power_policy_get_residency(&pp, 60000, &res);
+    legacy_residency(60000, &legacy);
+    float ma = power_energy_estimate_ma(&model, &res);
+    float legacy_ma = power_energy_estimate_ma(&model, &legacy);
+    print_residency("always active", &res, ma, legacy_ma);
+
+    TEST_ASSERT_EQUAL(res.total_us, res.state_us[POWER_STATE_ACTIVE]);
+    TEST_ASSERT_EQUAL(0, res.radio_us[POWER_RADIO_SNIFF]);
+    TEST_ASSERT_EQUAL(res.blocks, res.sent);
+    // The active link keeps the CPU at full speed like the old firmware did, streaming at the
+    // full rate only costs the charge of the additional frames
+    TEST_ASSERT_EQUAL(res.total_us, res.cpu_awake_us);
+    float extra_ma = model.tx_uc * (float)(res.sent - legacy.sent) / (float)res.total_us * 1000.0f;
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, legacy_ma + extra_ma, ma);
+}
+
+void test_energy_model(void)
+{
+    power_energy_model_t model = {
+        .cpu_awake_ma = 30.0f,
+        .cpu_idle_ma = 1.0f,
+        .radio_ma = { 0.0f, 20.0f, 2.0f },
+        .tx_uc = 100.0f,
+        .sensor_ma = 5.0f,
+    };
+    power_residency_t res;
+    memset(&res, 0, sizeof(res));
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, power_energy_estimate_ma(&model, &res));
+
+    // One second: half awake, half of it in sniff, ten frames of 100 uC
+    res.total_us = 1000000;
+    res.cpu_awake_us = 500000;
+    res.radio_us[POWER_RADIO_ACTIVE] = 500000;
+    res.radio_us[POWER_RADIO_SNIFF] = 500000;
+    res.sent = 10;
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 5.0f + 15.0f + 0.5f + 10.0f + 1.0f + 1.0f, power_energy_estimate_ma(&model, &res));
+}
+
+/* The Linux FreeRTOS port provides main and runs app_main in a task */
+void app_main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_init_rejects_invalid_config);
+    RUN_TEST(test_rest_and_dormant_transitions);
+    RUN_TEST(test_activity_wakes_up_immediately);
+    RUN_TEST(test_rest_sends_changes_and_heartbeats_only);
+    RUN_TEST(test_residency_adds_up);
+    RUN_TEST(test_mostly_resting_trace_saves_energy);
+    RUN_TEST(test_continuous_activity_costs_only_the_extra_frames);
+    RUN_TEST(test_energy_model);
+    exit(UNITY_END());
+}
@@ -0,0 +1,10 @@
+# SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+# SPDX-License-Identifier: Unlicense OR CC0-1.0
+import pytest
+from pytest_embedded import Dut
+
+
+@pytest.mark.linux
+@pytest.mark.host_test
+def test_power_policy_linux(dut: Dut) -> None:
+    dut.expect_unity_test_output(timeout=60)
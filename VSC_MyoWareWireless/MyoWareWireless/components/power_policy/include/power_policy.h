@@ -0,0 +1,182 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _POWER_POLICY_H_
+#define _POWER_POLICY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+/**
+ * @brief Operating state of the sender
+ *
+ */
+typedef enum {
+    POWER_STATE_ACTIVE = 0,   /**< Muscle activity, sample and send every block at the full rate */
+    POWER_STATE_REST,         /**< Hand at rest, slower blocks, only changes and heartbeats are sent */
+    POWER_STATE_DORMANT,      /**< Long rest, slowest blocks, the idle link drops into sniff mode */
+    POWER_STATE_MAX,
+} power_state_t;
+
+/**
+ * @brief Link power mode, as reported by ESP_BT_GAP_MODE_CHG_EVT
+ *
+ */
+typedef enum {
+    POWER_RADIO_OFF = 0,      /**< Not connected */
+    POWER_RADIO_ACTIVE,       /**< Connected, active mode */
+    POWER_RADIO_SNIFF,        /**< Connected, sniff mode */
+    POWER_RADIO_MAX,
+} power_radio_mode_t;
+
+/**
+ * @brief Configuration of the power policy
+ *
+ */
+typedef struct {
+    uint16_t wake_threshold;       /**< Envelope above this is activity and wakes the sender up immediately */
+    uint16_t rest_threshold;       /**< Envelope below this counts as rest, must not exceed wake_threshold */
+    uint32_t rest_enter_ms;        /**< Time at rest before ACTIVE falls back to REST */
+    uint32_t dormant_enter_ms;     /**< Time at rest before REST falls back to DORMANT */
+    uint32_t period_ms[POWER_STATE_MAX];  /**< Sample block period per state */
+    uint16_t report_delta;         /**< Outside ACTIVE, a block is sent if the envelope moved this much since the last send */
+    uint32_t heartbeat_ms;         /**< Outside ACTIVE, a block is sent at least this often */
+} power_policy_config_t;
+
+#define POWER_POLICY_DEFAULT_CONFIG() {                \
+    .wake_threshold = 12,                              \
+    .rest_threshold = 8,                               \
+    .rest_enter_ms = 2000,                             \
+    .dormant_enter_ms = 30000,                         \
+    .period_ms = { 20, 100, 250 },                     \
+    .report_delta = 4,                                 \
+    .heartbeat_ms = 30000,                             \
+}
+
+/**
+ * @brief What to do with the current sample block
+ *
+ */
+typedef struct {
+    power_state_t state;           /**< State after this block */
+    bool send;                     /**< Transmit the block */
+    uint32_t next_period_ms;       /**< Sleep until the next block */
+} power_policy_action_t;
+
+/**
+ * @brief Time spent per state, the input of the energy model
+ *
+ */
+typedef struct {
+    uint64_t total_us;                       /**< Time since power_policy_init() */
+    uint64_t state_us[POWER_STATE_MAX];      /**< Time per power_state_t */
+    uint64_t radio_us[POWER_RADIO_MAX];      /**< Time per power_radio_mode_t */
+    uint64_t cpu_awake_us;                   /**< Time at full CPU speed: all time with an active link plus the block CPU time outside it, the rest is idle (no light sleep while BT is enabled) */
+    uint32_t blocks;                         /**< Sample blocks processed */
+    uint32_t sent;                           /**< Sample blocks transmitted */
+    uint32_t wakeups;                        /**< Transitions into ACTIVE */
+} power_residency_t;
+
+/**
+ * @brief Average supply current per state, in mA
+ *
+ */
+typedef struct {
+    float cpu_awake_ma;            /**< CPU running (sampling, BT host stack) */
+    float cpu_idle_ma;             /**< CPU idle at the crystal frequency between blocks */
+    float radio_ma[POWER_RADIO_MAX];  /**< Additional controller current per link mode */
+    float tx_uc;                   /**< Charge per transmitted frame, in uC */
+    float sensor_ma;               /**< Constant load of the sensor board */
+} power_energy_model_t;
+
+/* Rough ESP32 datasheet figures at 160 MHz and 40 MHz plus a MyoWare 2.0 board */
+#define POWER_ENERGY_MODEL_DEFAULT() {                 \
+    .cpu_awake_ma = 32.0f,                             \
+    .cpu_idle_ma = 15.0f,                              \
+    .radio_ma = { 0.0f, 28.0f, 3.5f },                 \
+    .tx_uc = 40.0f,                                    \
+    .sensor_ma = 9.0f,                                 \
+}
+
+/**
+ * @brief Power policy state
+ *
+ */
+typedef struct {
+    power_policy_config_t cfg;
+    power_state_t state;
+    power_radio_mode_t radio;
+    uint32_t last_ms;              /**< Time of the last accounting update */
+    uint32_t rest_since_ms;        /**< Start of the current rest period */
+    bool resting;
+    uint32_t last_send_ms;
+    uint16_t last_sent;            /**< Envelope of the last transmitted block */
+    bool sent_once;
+    power_residency_t res;
+} power_policy_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Initialize the power policy, starting in ACTIVE with the radio off
+ *
+ * @param pp Power policy to initialize
+ * @param config Pointer of power policy configure struct
+ * @param now_ms Current time
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_ARG Parameter error
+ */
+esp_err_t power_policy_init(power_policy_t *pp, const power_policy_config_t *config, uint32_t now_ms);
+
+/**
+ * @brief Feed one sample block and decide whether to send it and when to sample next
+ *
+ * @param pp Power policy
+ * @param now_ms Time the block was completed
+ * @param envelope Envelope of the block
+ * @param awake_us CPU time spent on the block since the last call, not added while the link is active, that time counts as awake already
+ * @param[out] action Decision for this block
+ */
+void power_policy_update(power_policy_t *pp, uint32_t now_ms, uint16_t envelope, uint32_t awake_us, power_policy_action_t *action);
+
+/**
+ * @brief Record a link mode change
+ *
+ * @param pp Power policy
+ * @param now_ms Time of the change
+ * @param mode New link mode
+ */
+void power_policy_set_radio(power_policy_t *pp, uint32_t now_ms, power_radio_mode_t mode);
+
+/**
+ * @brief Read the state residency up to now_ms
+ *
+ * @param pp Power policy
+ * @param now_ms Current time
+ * @param[out] res Residency
+ */
+void power_policy_get_residency(power_policy_t *pp, uint32_t now_ms, power_residency_t *res);
+
+/**
+ * @brief Estimate the average supply current from a residency
+ *
+ * @param model Current per state
+ * @param res Residency
+ *
+ * @return Average current in mA, 0 if no time has passed
+ */
+float power_energy_estimate_ma(const power_energy_model_t *model, const power_residency_t *res);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _POWER_POLICY_H_ */
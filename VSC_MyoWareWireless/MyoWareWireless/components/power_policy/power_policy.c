@@ -0,0 +1,129 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+#include "power_policy.h"
+
+static void account(power_policy_t *pp, uint32_t now_ms)
+{
+    // uint32_t arithmetic keeps the elapsed time right across the 49 day wrap
+    uint64_t elapsed_us = (uint64_t)(uint32_t)(now_ms - pp->last_ms) * 1000;
+    pp->res.total_us += elapsed_us;
+    pp->res.state_us[pp->state] += elapsed_us;
+    pp->res.radio_us[pp->radio] += elapsed_us;
+    // The BT controller holds the CPU at full speed while the link is active
+    if (pp->radio == POWER_RADIO_ACTIVE) {
+        pp->res.cpu_awake_us += elapsed_us;
+    }
+    pp->last_ms = now_ms;
+}
+
+esp_err_t power_policy_init(power_policy_t *pp, const power_policy_config_t *config, uint32_t now_ms)
+{
+    if (pp == NULL || config == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (config->rest_threshold > config->wake_threshold
+            || config->rest_enter_ms > config->dormant_enter_ms) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int i = 0; i < POWER_STATE_MAX; i++) {
+        if (config->period_ms[i] == 0) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    memset(pp, 0, sizeof(*pp));
+    pp->cfg = *config;
+    pp->state = POWER_STATE_ACTIVE;
+    pp->radio = POWER_RADIO_OFF;
+    pp->last_ms = now_ms;
+    return ESP_OK;
+}
+
+void power_policy_update(power_policy_t *pp, uint32_t now_ms, uint16_t envelope, uint32_t awake_us, power_policy_action_t *action)
+{
+    account(pp, now_ms);
+    if (pp->radio != POWER_RADIO_ACTIVE) {
+        pp->res.cpu_awake_us += awake_us;
+    }
+    pp->res.blocks++;
+
+    if (envelope >= pp->cfg.wake_threshold) {
+        if (pp->state != POWER_STATE_ACTIVE) {
+            pp->res.wakeups++;
+        }
+        pp->state = POWER_STATE_ACTIVE;
+        pp->resting = false;
+    } else if (envelope <= pp->cfg.rest_threshold) {
+        if (!pp->resting) {
+            pp->resting = true;
+            pp->rest_since_ms = now_ms;
+        }
+        uint32_t rest_ms = now_ms - pp->rest_since_ms;
+        if (rest_ms >= pp->cfg.dormant_enter_ms) {
+            pp->state = POWER_STATE_DORMANT;
+        } else if (rest_ms >= pp->cfg.rest_enter_ms && pp->state == POWER_STATE_ACTIVE) {
+            pp->state = POWER_STATE_REST;
+        }
+    } else {
+        // Between the thresholds the state is kept, but the rest period starts over
+        pp->resting = false;
+    }
+
+    bool send;
+    if (pp->state == POWER_STATE_ACTIVE || !pp->sent_once) {
+        send = true;
+    } else {
+        int delta = (int)envelope - (int)pp->last_sent;
+        send = (delta < 0 ? -delta : delta) >= pp->cfg.report_delta
+               || (uint32_t)(now_ms - pp->last_send_ms) >= pp->cfg.heartbeat_ms;
+    }
+    if (send) {
+        pp->last_send_ms = now_ms;
+        pp->last_sent = envelope;
+        pp->sent_once = true;
+        pp->res.sent++;
+    }
+
+    action->state = pp->state;
+    action->send = send;
+    action->next_period_ms = pp->cfg.period_ms[pp->state];
+}
+
+void power_policy_set_radio(power_policy_t *pp, uint32_t now_ms, power_radio_mode_t mode)
+{
+    if (mode >= POWER_RADIO_MAX) {
+        return;
+    }
+    account(pp, now_ms);
+    pp->radio = mode;
+}
+
+void power_policy_get_residency(power_policy_t *pp, uint32_t now_ms, power_residency_t *res)
+{
+    account(pp, now_ms);
+    *res = pp->res;
+}
+
+float power_energy_estimate_ma(const power_energy_model_t *model, const power_residency_t *res)
+{
+    if (res->total_us == 0) {
+        return 0.0f;
+    }
+
+    float total = (float)res->total_us;
+    uint64_t awake_us = res->cpu_awake_us < res->total_us ? res->cpu_awake_us : res->total_us;
+    float ma = model->sensor_ma;
+    ma += model->cpu_awake_ma * (float)awake_us / total;
+    ma += model->cpu_idle_ma * (float)(res->total_us - awake_us) / total;
+    for (int i = 0; i < POWER_RADIO_MAX; i++) {
+        ma += model->radio_ma[i] * (float)res->radio_us[i] / total;
+    }
+    // uC per us is A, times 1000 for mA
+    ma += model->tx_uc * (float)res->sent / total * 1000.0f;
+    return ma;
+}
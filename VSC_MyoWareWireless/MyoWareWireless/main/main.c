@@ -10,13 +10,30 @@
 #include "esp_log.h"
 #include "driver/gpio.h"
 #include "driver/adc.h"
+#include "esp_timer.h"
+#include "esp_pm.h"
+#include "power_policy.h"
 
 #define SPP_TAG "SPP_SENDER"
 // #define SPP_SERVER_NAME "SPP_SERVER"
 #define DEVICE_NAME "SPP_SENDER"
 
 #define STATUS_LED_PIN 13
-#define SPP_DATA_LEN 1
+// SPP frame layout, has to match the receiver. All fields little endian:
+// [0..1] sequence number, [2..5] sender timestamp in ms, [6] envelope value
+#define SPP_DATA_LEN 7
+
+// ENV pin, sampled in DMA blocks. 128 samples at 20 kHz take 6.4 ms, the CPU idles between the blocks
+#define ADC_ENV_CHANNEL     ADC1_CHANNEL_3
+#define ADC_SAMPLE_FREQ_HZ  20000
+#define ADC_BLOCK_SAMPLES   128
+#define ADC_BLOCK_BYTES     (ADC_BLOCK_SAMPLES * SOC_ADC_DIGI_DATA_BYTES_PER_CONV)
+#define ADC_READ_TIMEOUT_MS 50
+// Scale of the raw envelope to the transmitted value
+#define ADC_MAX             950
+#define ADC_D_MAX           4095
+// Log the residency and the estimated current this often
+#define POWER_LOG_PERIOD_MS 60000
 
 static uint32_t spp_handle = 0;
 
@@ -39,6 +56,124 @@ static bool server_found = false;
 
 static uint8_t spp_data[SPP_DATA_LEN];
 static uint8_t *s_p_data = NULL; /* data pointer of spp_data */
+static uint16_t spp_seq = 0;
+
+static power_policy_t power_policy;
+// power_policy is updated by the main loop and by the GAP callback on the BTC task
+static portMUX_TYPE power_policy_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t adc_block[ADC_BLOCK_BYTES];
+
+static uint32_t now_ms(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static void power_radio_set(power_radio_mode_t mode)
+{
+    portENTER_CRITICAL(&power_policy_lock);
+    power_policy_set_radio(&power_policy, now_ms(), mode);
+    portEXIT_CRITICAL(&power_policy_lock);
+}
+
+// Configure the ADC DMA for the ENV pin, the conversion is only started for each block
+static void adc_dma_init(void)
+{
+    adc_digi_init_config_t init_cfg = {
+        .max_store_buf_size = 2 * ADC_BLOCK_BYTES,
+        .conv_num_each_intr = ADC_BLOCK_BYTES,
+        .adc1_chan_mask = BIT(ADC_ENV_CHANNEL),
+        .adc2_chan_mask = 0,
+    };
+    ESP_ERROR_CHECK(adc_digi_initialize(&init_cfg));
+
+    adc_digi_pattern_config_t pattern = {
+        .atten = ADC_ATTEN_DB_0,
+        .channel = ADC_ENV_CHANNEL,
+        .unit = ADC_UNIT_1,
+        .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH,
+    };
+    adc_digi_configuration_t dig_cfg = {
+        .pattern_num = 1,
+        .adc_pattern = &pattern,
+        .sample_freq_hz = ADC_SAMPLE_FREQ_HZ,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_DIGI_OUTPUT_FORMAT_TYPE1,
+    };
+    ESP_ERROR_CHECK(adc_digi_controller_configure(&dig_cfg));
+}
+
+/*
+ * Sample one block and average it. The ADC holds a power management lock only while started,
+ * so stopping it after each block lets the CPU clock drop until the next one.
+ */
+static esp_err_t adc_read_envelope(uint16_t *envelope)
+{
+    uint32_t len = 0;
+    uint32_t got = 0;
+    uint32_t sum = 0;
+    uint32_t count = 0;
+
+    // Drop conversions left over from the end of the previous block
+    while (adc_digi_read_bytes(adc_block, ADC_BLOCK_BYTES, &len, 0) == ESP_OK) {
+    }
+    ESP_ERROR_CHECK(adc_digi_start());
+    esp_err_t ret = ESP_OK;
+    while (got < ADC_BLOCK_BYTES && ret == ESP_OK) {
+        ret = adc_digi_read_bytes(adc_block + got, ADC_BLOCK_BYTES - got, &len, ADC_READ_TIMEOUT_MS);
+        got += len;
+    }
+    adc_digi_stop();
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    for (uint32_t i = 0; i < got; i += SOC_ADC_DIGI_DATA_BYTES_PER_CONV) {
+        adc_digi_output_data_t *p = (adc_digi_output_data_t *)&adc_block[i];
+        if (p->type1.channel == ADC_ENV_CHANNEL) {
+            sum += p->type1.data;
+            count++;
+        }
+    }
+    if (count == 0) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    uint32_t value = sum / count * ADC_MAX / ADC_D_MAX;
+    *envelope = value > UINT8_MAX ? UINT8_MAX : value;
+    return ESP_OK;
+}
+
+static void power_log(void)
+{
+    power_residency_t res;
+    power_energy_model_t model = POWER_ENERGY_MODEL_DEFAULT();
+
+    portENTER_CRITICAL(&power_policy_lock);
+    power_policy_get_residency(&power_policy, now_ms(), &res);
+    portEXIT_CRITICAL(&power_policy_lock);
+    ESP_LOGI(SPP_TAG, "Power: active %"PRIu64"%% rest %"PRIu64"%% dormant %"PRIu64"%% sniff %"PRIu64"%% awake %"PRIu64"%%, "
+             "sent %"PRIu32"/%"PRIu32", wakeups %"PRIu32", estimate %.1f mA",
+             res.state_us[POWER_STATE_ACTIVE] * 100 / res.total_us,
+             res.state_us[POWER_STATE_REST] * 100 / res.total_us,
+             res.state_us[POWER_STATE_DORMANT] * 100 / res.total_us,
+             res.radio_us[POWER_RADIO_SNIFF] * 100 / res.total_us,
+             res.cpu_awake_us * 100 / res.total_us,
+             res.sent, res.blocks, res.wakeups, power_energy_estimate_ma(&model, &res));
+}
+
+// Stamp the frame so the receiver can undo the radio jitter
+static void spp_data_fill(uint8_t value)
+{
+    uint32_t timestamp_ms = (uint32_t)(esp_timer_get_time() / 1000);
+
+    spp_data[0] = spp_seq & 0xff;
+    spp_data[1] = spp_seq >> 8;
+    spp_data[2] = timestamp_ms & 0xff;
+    spp_data[3] = (timestamp_ms >> 8) & 0xff;
+    spp_data[4] = (timestamp_ms >> 16) & 0xff;
+    spp_data[5] = timestamp_ms >> 24;
+    spp_data[6] = value;
+    spp_seq++;
+}
 
 static void esp_gap_cb(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *param);
 
@@ -132,6 +267,7 @@ static void esp_spp_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param) {
                 ESP_LOGI(SPP_TAG, "ESP_SPP_OPEN_EVT handle:%"PRIu32" rem_bda:[%s]", param->open.handle,
                         bda2str(param->open.rem_bda, bda_str, sizeof(bda_str)));
                 spp_handle = param->start.handle;
+                power_radio_set(POWER_RADIO_ACTIVE);
                 /*   Start to write the first data packet */
                 esp_spp_write(param->open.handle, SPP_DATA_LEN, spp_data);
                 s_p_data = spp_data;
@@ -141,6 +277,10 @@ static void esp_spp_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param) {
                 ESP_LOGE(SPP_TAG, "ESP_SPP_OPEN_EVT status:%d", param->open.status);
             }
             break;
+        case ESP_SPP_CLOSE_EVT:
+            ESP_LOGI(SPP_TAG, "ESP_SPP_CLOSE_EVT");
+            power_radio_set(POWER_RADIO_OFF);
+            break;
         case ESP_SPP_START_EVT:
             ESP_LOGI(SPP_TAG, "ESP_SPP_START_EVT");
             break;
@@ -264,6 +404,8 @@ static void esp_gap_cb(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *param
         break;
     case ESP_BT_GAP_MODE_CHG_EVT:
         ESP_LOGI(SPP_TAG, "ESP_BT_GAP_MODE_CHG_EVT mode:%d", param->mode_chg.mode);
+        // Bluedroid parks the idle SPP link in sniff, the first write brings it back to active
+        power_radio_set(param->mode_chg.mode == ESP_BT_PM_MD_SNIFF ? POWER_RADIO_SNIFF : POWER_RADIO_ACTIVE);
         break;
     
     default:
@@ -273,9 +415,10 @@ static void esp_gap_cb(esp_bt_gap_cb_event_t event, esp_bt_gap_cb_param_t *param
 
 void app_main(void)
 {
-    int v_out = 0;
-    int adc_max = 950;
-    int d_max = 4095;
+    uint16_t v_out = 0;
+    power_policy_action_t action;
+    uint32_t last_log_ms;
+    uint32_t awake_us = 0;
 
     char bda_str[18] = {0};
     esp_err_t ret = nvs_flash_init();
@@ -285,6 +428,20 @@ void app_main(void)
     }
     ESP_ERROR_CHECK( ret );
 
+#if CONFIG_PM_ENABLE
+    // Scale the CPU down to the crystal frequency whenever all tasks are blocked between sample
+    // blocks. No light sleep: the BT controller clocks its sleep timer from the main crystal
+    // (CONFIG_BTDM_CTRL_LPCLK_SEL_MAIN_XTAL, the board has no 32 kHz crystal) and holds a
+    // no-light-sleep lock as long as it is enabled. It also keeps the CPU at full speed while the
+    // link is active, so only sniff mode and the time before a connection idle at the low clock.
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = CONFIG_XTAL_FREQ,
+        .light_sleep_enable = false,
+    };
+    ESP_ERROR_CHECK(esp_pm_configure(&pm_config));
+#endif
+
     //zero-initialize the GPIO config structure.
     gpio_config_t io_conf = {};
     io_conf.intr_type = GPIO_INTR_DISABLE;
@@ -330,8 +487,10 @@ void app_main(void)
     esp_bt_gap_set_security_param(param_type, &iocap, sizeof(uint8_t));
 
     // Configure ADC
-    adc1_config_width(ADC_WIDTH_BIT_12);
-    adc1_config_channel_atten(ADC1_CHANNEL_3, ADC_ATTEN_DB_0);
+    adc_dma_init();
+    power_policy_config_t power_cfg = POWER_POLICY_DEFAULT_CONFIG();
+    ESP_ERROR_CHECK(power_policy_init(&power_policy, &power_cfg, now_ms()));
+    last_log_ms = now_ms();
 
     gpio_set_level(GPIO_OUTPUT_IO_0, 0);
 
@@ -346,16 +505,25 @@ void app_main(void)
     ESP_LOGI(SPP_TAG, "Own address:[%s]", bda2str((uint8_t *)esp_bt_dev_get_address(), bda_str, sizeof(bda_str)));
     // Main loop to read and send ADC values
     while (1) {
+        int64_t block_start = esp_timer_get_time();
         //TODO: adjust poti to stabilize value and add poti to calculation:
-        v_out = adc1_get_raw(ADC1_CHANNEL_3) * adc_max / d_max;
-        spp_data[0] = v_out;
-        
+        if (adc_read_envelope(&v_out) != ESP_OK) {
+            ESP_LOGW(SPP_TAG, "ADC block incomplete");
+        }
+
+        // Awake time is only known after the send, it is accounted with the next block
+        portENTER_CRITICAL(&power_policy_lock);
+        power_policy_update(&power_policy, now_ms(), v_out, awake_us, &action);
+        portEXIT_CRITICAL(&power_policy_lock);
+
         if (server_found) {
-            esp_spp_write(spp_handle, SPP_DATA_LEN, spp_data);
-            // Toggle Status LED each time message is sent
-            ESP_LOGI(SPP_TAG, "Analog value: %d", spp_data[0]);
-            //ESP_LOGI(SPP_TAG, "handle: %lu", spp_handle);
-            gpio_set_level(GPIO_OUTPUT_IO_0, !(gpio_get_level(GPIO_OUTPUT_IO_0)));
+            if (action.send) {
+                spp_data_fill(v_out);
+                esp_spp_write(spp_handle, SPP_DATA_LEN, spp_data);
+                ESP_LOGD(SPP_TAG, "Analog value: %d", spp_data[6]);
+            }
+            // Status LED is lit while the hand is active
+            gpio_set_level(GPIO_OUTPUT_IO_0, action.state == POWER_STATE_ACTIVE);
         }
         else
         {
@@ -364,7 +532,13 @@ void app_main(void)
             //esp_spp_start_discovery(SPP_SERVER_NAME);
             vTaskDelay(pdMS_TO_TICKS(1000)); // Send every 1 second
         }
-        vTaskDelay(pdMS_TO_TICKS(250)); // Send every 1 second
+
+        if (now_ms() - last_log_ms >= POWER_LOG_PERIOD_MS) {
+            last_log_ms = now_ms();
+            power_log();
+        }
+        awake_us = (uint32_t)(esp_timer_get_time() - block_start);
+        vTaskDelay(pdMS_TO_TICKS(action.next_period_ms));
     }
     
 }
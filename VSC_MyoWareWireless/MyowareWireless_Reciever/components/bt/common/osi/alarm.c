@@ -15,26 +15,50 @@
  *  limitations under the License.
  *
  ******************************************************************************/
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include "osi/alarm.h"
 #include "osi/allocator.h"
-#include "osi/list.h"
+#include "osi/timer_wheel.h"
 #include "esp_timer.h"
 #include "btc/btc_task.h"
 #include "btc/btc_alarm.h"
 #include "osi/mutex.h"
 #include "bt_common.h"
 
+// All alarms share one wheel with millisecond ticks and one one-shot esp_timer,
+// which is armed for the next tick the wheel has work on. The expiries of a tick
+// are posted to the BTC task in one message.
 typedef struct alarm_t {
-    /* timer id point to here */
-    esp_timer_handle_t alarm_hdl;
+    /* first member, the wheel hands the entry back on expiry */
+    timer_wheel_entry_t entry;
     osi_alarm_callback_t cb;
     void *cb_data;
     int64_t deadline_us;
+    period_ms_t period_ms;
+    /* changes when the alarm is set, cancelled or freed, so an expiry already
+     * posted to the BTC task can tell that it is out of date */
+    uint32_t generation;
+    bool in_use;
+    struct alarm_t *next_free;
 } osi_alarm_t;
 
+typedef struct {
+    struct alarm_t cbs[ALARM_CBS_NUM];
+    struct alarm_t *free_list;
+    timer_wheel_t wheel;
+    esp_timer_handle_t timer;
+    /* tick the timer is armed for, UINT64_MAX if it isn't */
+    uint64_t timer_tick;
+} alarm_env_t;
+
+typedef struct {
+    btc_alarm_args_t *batch;
+    uint64_t now;
+} alarm_expiry_ctx_t;
+
 enum {
     ALARM_STATE_IDLE,
     ALARM_STATE_OPEN,
@@ -44,13 +68,13 @@ static osi_mutex_t alarm_mutex;
 static int alarm_state;
 
 #if (BT_BLE_DYNAMIC_ENV_MEMORY == FALSE)
-static struct alarm_t alarm_cbs[ALARM_CBS_NUM];
+static alarm_env_t alarm_env;
 #else
-static struct alarm_t *alarm_cbs;
+static alarm_env_t *alarm_env_ptr;
+#define alarm_env (*alarm_env_ptr)
 #endif
 
-static osi_alarm_err_t alarm_free(osi_alarm_t *alarm);
-static osi_alarm_err_t alarm_set(osi_alarm_t *alarm, period_ms_t timeout, bool is_periodic);
+static void alarm_timer_cb(void *arg);
 
 int osi_alarm_create_mux(void)
 {
@@ -72,6 +96,11 @@ int osi_alarm_delete_mux(void)
     return 0;
 }
 
+static uint64_t alarm_now_tick(void)
+{
+    return (uint64_t)esp_timer_get_time() / 1000;
+}
+
 void osi_alarm_init(void)
 {
     assert(alarm_mutex != NULL);
@@ -82,13 +111,35 @@ void osi_alarm_init(void)
         goto end;
     }
 #if (BT_BLE_DYNAMIC_ENV_MEMORY == TRUE)
-    if ((alarm_cbs = (osi_alarm_t *)osi_malloc(sizeof(osi_alarm_t) * ALARM_CBS_NUM)) == NULL) {
+    if ((alarm_env_ptr = (alarm_env_t *)osi_malloc(sizeof(alarm_env_t))) == NULL) {
         OSI_TRACE_ERROR("%s, malloc failed\n", __func__);
         goto end;
     }
 #endif
 
-    memset(alarm_cbs, 0x00, sizeof(osi_alarm_t) * ALARM_CBS_NUM);
+    memset(&alarm_env, 0x00, sizeof(alarm_env_t));
+    for (int i = ALARM_CBS_NUM - 1; i >= 0; i--) {
+        alarm_env.cbs[i].next_free = alarm_env.free_list;
+        alarm_env.free_list = &alarm_env.cbs[i];
+    }
+    timer_wheel_init(&alarm_env.wheel, alarm_now_tick());
+    alarm_env.timer_tick = UINT64_MAX;
+
+    esp_timer_create_args_t tca = {0};
+    tca.callback = alarm_timer_cb;
+    tca.dispatch_method = ESP_TIMER_TASK;
+    tca.name = "osi_alarm";
+
+    esp_err_t stat = esp_timer_create(&tca, &alarm_env.timer);
+    if (stat != ESP_OK) {
+        OSI_TRACE_ERROR("%s failed to create timer, err 0x%x\n", __func__, stat);
+#if (BT_BLE_DYNAMIC_ENV_MEMORY == TRUE)
+        osi_free(alarm_env_ptr);
+        alarm_env_ptr = NULL;
+#endif
+        goto end;
+    }
+
     alarm_state = ALARM_STATE_OPEN;
 
 end:
@@ -105,15 +156,12 @@ void osi_alarm_deinit(void)
         goto end;
     }
 
-    for (int i = 0; i < ALARM_CBS_NUM; i++) {
-        if (alarm_cbs[i].alarm_hdl != NULL) {
-            alarm_free(&alarm_cbs[i]);
-        }
-    }
+    esp_timer_stop(alarm_env.timer);
+    esp_timer_delete(alarm_env.timer);
 
 #if (BT_BLE_DYNAMIC_ENV_MEMORY == TRUE)
-    osi_free(alarm_cbs);
-    alarm_cbs = NULL;
+    osi_free(alarm_env_ptr);
+    alarm_env_ptr = NULL;
 #endif
 
     alarm_state = ALARM_STATE_IDLE;
@@ -122,34 +170,99 @@ end:
     osi_mutex_unlock(&alarm_mutex);
 }
 
-static struct alarm_t *alarm_cbs_lookfor_available(void)
+// Arms the timer for the next tick of the wheel if that is earlier than the
+// tick it is armed for. A timer which fires for nothing because its alarm was
+// cancelled only advances the wheel, so cancelling never touches the timer.
+static void alarm_timer_update(void)
 {
-    int i;
+    const uint64_t next_tick = timer_wheel_next_tick(&alarm_env.wheel);
+    if (next_tick >= alarm_env.timer_tick) {
+        return;
+    }
 
-    for (i = 0; i < ALARM_CBS_NUM; i++) {
-        if (alarm_cbs[i].alarm_hdl == NULL) { //available
-            OSI_TRACE_DEBUG("%s %d %p\n", __func__, i, &alarm_cbs[i]);
-            return &alarm_cbs[i];
-        }
+    int64_t delay_us = (int64_t)(next_tick * 1000) - esp_timer_get_time();
+    esp_timer_stop(alarm_env.timer);
+    esp_err_t stat = esp_timer_start_once(alarm_env.timer, delay_us > 0 ? (uint64_t)delay_us : 0);
+    if (stat != ESP_OK) {
+        OSI_TRACE_ERROR("%s failed to start timer, err 0x%x\n", __func__, stat);
+        return;
     }
+    alarm_env.timer_tick = next_tick;
+}
 
-    return NULL;
+static void alarm_expired(timer_wheel_entry_t *entry, void *context)
+{
+    alarm_expiry_ctx_t *ctx = (alarm_expiry_ctx_t *)context;
+    struct alarm_t *alarm = (struct alarm_t *)entry;
+
+    assert(ctx->batch->num < ALARM_CBS_NUM);
+    ctx->batch->expired[ctx->batch->num].alarm = alarm;
+    ctx->batch->expired[ctx->batch->num].generation = alarm->generation;
+    ctx->batch->num++;
+
+    if (alarm->period_ms) {
+        // keep the phase, but skip the periods which were missed, so each
+        // alarm expires at most once per batch
+        uint64_t next = entry->expiry + alarm->period_ms;
+        if (next <= ctx->now) {
+            next += ((ctx->now - next) / alarm->period_ms + 1) * alarm->period_ms;
+        }
+        timer_wheel_add(&alarm_env.wheel, entry, next);
+    }
 }
 
-static void alarm_cb_handler(struct alarm_t *alarm)
+static void alarm_timer_cb(void *arg)
 {
-    OSI_TRACE_DEBUG("TimerID %p\n", alarm);
+    btc_alarm_args_t batch;
+    batch.num = 0;
+
+    osi_mutex_lock(&alarm_mutex, OSI_MUTEX_MAX_TIMEOUT);
     if (alarm_state != ALARM_STATE_OPEN) {
         OSI_TRACE_WARNING("%s, invalid state %d\n", __func__, alarm_state);
+        osi_mutex_unlock(&alarm_mutex);
+        return;
+    }
+    alarm_expiry_ctx_t ctx = {
+        .batch = &batch,
+        .now = alarm_now_tick(),
+    };
+    alarm_env.timer_tick = UINT64_MAX;
+    timer_wheel_advance(&alarm_env.wheel, ctx.now, alarm_expired, &ctx);
+    alarm_timer_update();
+    osi_mutex_unlock(&alarm_mutex);
+
+    if (batch.num == 0) {
         return;
     }
+    OSI_TRACE_DEBUG("%s %d alarms expired\n", __func__, batch.num);
+
     btc_msg_t msg = {0};
-    btc_alarm_args_t arg;
     msg.sig = BTC_SIG_API_CALL;
     msg.pid = BTC_PID_ALARM;
-    arg.cb = alarm->cb;
-    arg.cb_data = alarm->cb_data;
-    btc_transfer_context(&msg, &arg, sizeof(btc_alarm_args_t), NULL, NULL);
+    btc_transfer_context(&msg, &batch, offsetof(btc_alarm_args_t, expired) + batch.num * sizeof(osi_alarm_expiry_t),
+                         NULL, NULL);
+}
+
+void osi_alarm_dispatch(const osi_alarm_expiry_t *expired, size_t num)
+{
+    assert(alarm_mutex != NULL);
+
+    for (size_t i = 0; i < num; i++) {
+        osi_alarm_callback_t cb = NULL;
+        void *cb_data = NULL;
+
+        osi_mutex_lock(&alarm_mutex, OSI_MUTEX_MAX_TIMEOUT);
+        if (alarm_state == ALARM_STATE_OPEN && expired[i].alarm->in_use &&
+                expired[i].alarm->generation == expired[i].generation) {
+            cb = expired[i].alarm->cb;
+            cb_data = expired[i].alarm->cb_data;
+        }
+        osi_mutex_unlock(&alarm_mutex);
+
+        if (cb) {
+            cb(cb_data);
+        }
+    }
 }
 
 osi_alarm_t *osi_alarm_new(const char *alarm_name, osi_alarm_callback_t callback, void *data, period_ms_t timer_expire)
@@ -165,30 +278,23 @@ osi_alarm_t *osi_alarm_new(const char *alarm_name, osi_alarm_callback_t callback
         goto end;
     }
 
-    timer_id = alarm_cbs_lookfor_available();
+    timer_id = alarm_env.free_list;
 
     if (!timer_id) {
         OSI_TRACE_ERROR("%s alarm_cbs exhausted\n", __func__);
         timer_id = NULL;
         goto end;
     }
+    alarm_env.free_list = timer_id->next_free;
+    OSI_TRACE_DEBUG("%s %s %p\n", __func__, alarm_name ? alarm_name : "", timer_id);
 
-    esp_timer_create_args_t tca = {0};
-    tca.callback = (esp_timer_cb_t)alarm_cb_handler;
-    tca.arg = timer_id;
-    tca.dispatch_method = ESP_TIMER_TASK;
-    tca.name = alarm_name;
-
+    timer_wheel_entry_init(&timer_id->entry);
     timer_id->cb = callback;
     timer_id->cb_data = data;
     timer_id->deadline_us = 0;
-
-    esp_err_t stat = esp_timer_create(&tca, &timer_id->alarm_hdl);
-    if (stat != ESP_OK) {
-        OSI_TRACE_ERROR("%s failed to create timer, err 0x%x\n", __func__, stat);
-        timer_id = NULL;
-        goto end;
-    }
+    timer_id->period_ms = 0;
+    timer_id->in_use = true;
+    timer_id->next_free = NULL;
 
 end:
     osi_mutex_unlock(&alarm_mutex);
@@ -197,18 +303,19 @@ end:
 
 static osi_alarm_err_t alarm_free(osi_alarm_t *alarm)
 {
-    if (!alarm || alarm->alarm_hdl == NULL) {
+    if (!alarm || !alarm->in_use) {
         OSI_TRACE_ERROR("%s null\n", __func__);
         return OSI_ALARM_ERR_INVALID_ARG;
     }
-    esp_timer_stop(alarm->alarm_hdl);
-    esp_err_t stat = esp_timer_delete(alarm->alarm_hdl);
-    if (stat != ESP_OK) {
-        OSI_TRACE_ERROR("%s failed to delete timer, err 0x%x\n", __func__, stat);
-        return OSI_ALARM_ERR_FAIL;
-    }
-
-    memset(alarm, 0, sizeof(osi_alarm_t));
+    timer_wheel_remove(&alarm_env.wheel, &alarm->entry);
+
+    alarm->cb = NULL;
+    alarm->cb_data = NULL;
+    alarm->deadline_us = 0;
+    alarm->generation++;
+    alarm->in_use = false;
+    alarm->next_free = alarm_env.free_list;
+    alarm_env.free_list = alarm;
     return OSI_ALARM_ERR_PASS;
 }
 
@@ -240,25 +347,22 @@ static osi_alarm_err_t alarm_set(osi_alarm_t *alarm, period_ms_t timeout, bool i
         goto end;
     }
 
-    if (!alarm || alarm->alarm_hdl == NULL) {
+    if (!alarm || !alarm->in_use || (is_periodic && timeout == 0)) {
         OSI_TRACE_ERROR("%s null\n", __func__);
         ret = OSI_ALARM_ERR_INVALID_ARG;
         goto end;
     }
 
-    int64_t timeout_us = 1000 * (int64_t)timeout;
-    esp_err_t stat;
-    if (is_periodic) {
-        stat = esp_timer_start_periodic(alarm->alarm_hdl, (uint64_t)timeout_us);
-    } else {
-        stat = esp_timer_start_once(alarm->alarm_hdl, (uint64_t)timeout_us);
-    }
-    if (stat != ESP_OK) {
-        OSI_TRACE_ERROR("%s failed to start timer, err 0x%x\n", __func__, stat);
-        ret = OSI_ALARM_ERR_FAIL;
-        goto end;
-    }
-    alarm->deadline_us = is_periodic ? 0 : (timeout_us + esp_timer_get_time());
+    // round up to the next tick, so the alarm never expires early
+    const int64_t now_us = esp_timer_get_time();
+    const int64_t timeout_us = 1000 * (int64_t)timeout;
+    timer_wheel_remove(&alarm_env.wheel, &alarm->entry);
+    timer_wheel_add(&alarm_env.wheel, &alarm->entry, (uint64_t)(now_us + timeout_us + 999) / 1000);
+    alarm->period_ms = is_periodic ? timeout : 0;
+    alarm->generation++;
+    alarm_timer_update();
+
+    alarm->deadline_us = is_periodic ? 0 : (timeout_us + now_us);
 
 end:
     osi_mutex_unlock(&alarm_mutex);
@@ -285,18 +389,22 @@ osi_alarm_err_t osi_alarm_cancel(osi_alarm_t *alarm)
         goto end;
     }
 
-    if (!alarm || alarm->alarm_hdl == NULL) {
+    if (!alarm || !alarm->in_use) {
         OSI_TRACE_ERROR("%s null\n", __func__);
         ret = OSI_ALARM_ERR_INVALID_ARG;
         goto end;
     }
 
-    esp_err_t stat = esp_timer_stop(alarm->alarm_hdl);
-    if (stat != ESP_OK) {
-        OSI_TRACE_DEBUG("%s failed to stop timer, err 0x%x\n", __func__, stat);
+    // an expiry already on its way to the BTC task is dropped as well
+    alarm->generation++;
+    alarm->deadline_us = 0;
+    if (!timer_wheel_entry_is_pending(&alarm->entry)) {
+        OSI_TRACE_DEBUG("%s alarm %p not set\n", __func__, alarm);
         ret = OSI_ALARM_ERR_FAIL;
         goto end;
     }
+    timer_wheel_remove(&alarm_env.wheel, &alarm->entry);
+
 end:
     osi_mutex_unlock(&alarm_mutex);
     return ret;
@@ -323,9 +431,5 @@ bool osi_alarm_is_active(osi_alarm_t *alarm)
 {
     assert(alarm != NULL);
 
-    if (alarm->alarm_hdl != NULL) {
-        return esp_timer_is_active(alarm->alarm_hdl);
-    }
-
-    return false;
+    return alarm->in_use && timer_wheel_entry_is_pending(&alarm->entry);
 }
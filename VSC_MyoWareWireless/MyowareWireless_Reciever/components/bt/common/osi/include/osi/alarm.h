@@ -19,6 +19,7 @@
 #ifndef _ALARM_H_
 #define _ALARM_H_
 
+#include <stddef.h>
 #include <stdint.h>
 #include "esp_timer.h"
 
@@ -72,6 +73,16 @@ osi_alarm_err_t osi_alarm_cancel(osi_alarm_t *alarm);
 // TODO: Remove this function once PM timers can be re-factored
 period_ms_t osi_alarm_get_remaining_ms(const osi_alarm_t *alarm);
 
+// An alarm which expired, as the alarm timer posts it to the BTC task.
+typedef struct {
+    osi_alarm_t *alarm;
+    uint32_t generation;
+} osi_alarm_expiry_t;
+
+// Calls the callbacks of the |num| alarms in |expired| which were not set,
+// cancelled or freed since they expired. Only for the BTC alarm handler.
+void osi_alarm_dispatch(const osi_alarm_expiry_t *expired, size_t num);
+
 // Alarm-related state cleanup
 //void alarm_cleanup(void);
 
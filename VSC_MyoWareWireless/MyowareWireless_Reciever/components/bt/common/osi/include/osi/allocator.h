@@ -120,6 +120,58 @@ do {                                                    \
     free(tmp_point);                                    \
 } while (0)
 
+#elif HEAP_MEMORY_PROFILE
+
+#include "osi/mem_prof.h"
+
+#if HEAP_ALLOCATION_FROM_SPIRAM_FIRST
+#define osi_malloc(size)                                \
+({                                                      \
+    void *p;                                            \
+    p = heap_caps_malloc_prefer(size, 2,                \
+        MALLOC_CAP_DEFAULT|MALLOC_CAP_SPIRAM,           \
+        MALLOC_CAP_DEFAULT|MALLOC_CAP_INTERNAL);        \
+    osi_mem_prof_alloc(p, size, __func__, __LINE__);    \
+    (void *)p;                                          \
+})
+
+#define osi_calloc(size)                                \
+({                                                      \
+    void *p;                                            \
+    p = heap_caps_calloc_prefer(1, size, 2,             \
+        MALLOC_CAP_DEFAULT|MALLOC_CAP_SPIRAM,           \
+        MALLOC_CAP_DEFAULT|MALLOC_CAP_INTERNAL);        \
+    osi_mem_prof_alloc(p, size, __func__, __LINE__);    \
+    (void *)p;                                          \
+})
+
+#else
+
+#define osi_malloc(size)                                \
+({                                                      \
+    void *p;                                            \
+    p = malloc((size));                                 \
+    osi_mem_prof_alloc(p, size, __func__, __LINE__);    \
+    (void *)p;                                          \
+})
+
+#define osi_calloc(size)                                \
+({                                                      \
+    void *p;                                            \
+    p = calloc(1, (size));                              \
+    osi_mem_prof_alloc(p, size, __func__, __LINE__);    \
+    (void *)p;                                          \
+})
+
+#endif /* #if HEAP_ALLOCATION_FROM_SPIRAM_FIRST */
+
+#define osi_free(ptr)                                   \
+do {                                                    \
+    void *tmp_point = (void *)(ptr);                    \
+    osi_mem_prof_free(tmp_point);                       \
+    free(tmp_point);                                    \
+} while (0)
+
 #else
 
 #if HEAP_ALLOCATION_FROM_SPIRAM_FIRST
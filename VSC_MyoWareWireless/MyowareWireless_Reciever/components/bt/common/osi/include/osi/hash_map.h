@@ -33,6 +33,17 @@ typedef struct hash_map_entry_t {
 
 typedef size_t hash_index_t;
 
+// Old table slots moved to the new table by each |hash_map_set| and
+// |hash_map_erase| while the map grows.
+#define HASH_MAP_MIGRATE_SLOTS    8
+
+// Slots of the next table cleared by each |hash_map_set| and |hash_map_erase|.
+// The next table is allocated at half load and has twice the slots, clearing
+// its 2N slots in the N/4 sets until 3/4 load takes 8 per call, 16 leave a
+// margin. Moving the N old slots then takes N/8 calls, well before the bigger
+// table is half full in turn.
+#define HASH_MAP_CLEAR_SLOTS      16
+
 // Takes a key structure and returns a hash value.
 typedef hash_index_t (*hash_index_fn)(const void *key);
 typedef bool (*hash_map_iter_cb)(hash_map_entry_t *hash_entry, void *context);
@@ -44,8 +55,12 @@ typedef void (*data_free_fn)(void *data);
 
 // Returns a new, empty hash_map. Returns NULL if not enough memory could be allocated
 // for the hash_map structure. The returned hash_map must be freed with |hash_map_free|.
-// The |num_bucket| specifies the number of hashable buckets for the map and must not
-// be zero.  The |hash_fn| specifies a hash function to be used and must not be NULL.
+// The |size| hints at the number of elements and must not be zero. The entries are kept
+// inline in an open addressed table of about |size| / 2 slots at first. The table twice
+// the size is allocated at half load, and each set or erase clears a few of its slots,
+// then moves a few entries to it, so no call walks the whole table unless allocating
+// the bigger one failed until the map was 3/4 full.
+// The |hash_fn| specifies a hash function to be used and must not be NULL.
 // The |key_fn| and |data_fn| are called whenever a hash_map element is removed from
 // the hash_map. They can be used to release resources held by the hash_map element,
 // e.g.  memory or file descriptor.  |key_fn| and |data_fn| may be NULL if no cleanup
@@ -107,4 +122,10 @@ void hash_map_clear(hash_map_t *hash_map);
 // If |callback| returns false, the iteration loop will immediately exit.
 void hash_map_foreach(hash_map_t *hash_map, hash_map_iter_cb callback, void *context);
 
+// Returns the most table slots a single |hash_map_set| or |hash_map_erase| on
+// |hash_map| cleared or moved while growing. Stays within HASH_MAP_CLEAR_SLOTS
+// plus HASH_MAP_MIGRATE_SLOTS unless the bigger table couldn't be allocated in
+// time. |hash_map| may not be NULL.
+size_t hash_map_max_step_slots(const hash_map_t *hash_map);
+
 #endif /* _HASH_MAP_H_ */
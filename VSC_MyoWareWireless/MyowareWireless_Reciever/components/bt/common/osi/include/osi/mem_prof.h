@@ -0,0 +1,96 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _OSI_MEM_PROF_H_
+#define _OSI_MEM_PROF_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of call sites the profiler tells apart. Further sites are counted
+// together in one site without a function.
+#define OSI_MEM_PROF_MAX_SITES          64
+
+// Size classes of the histogram. Class 0 holds allocations of up to 8 bytes,
+// each further class up to twice the size of the one before, the last class
+// everything larger than 64 KiB.
+#define OSI_MEM_PROF_SIZE_CLASSES       15
+
+// Allocations freed within this time count as short lived in the churn report.
+#define OSI_MEM_PROF_SHORT_LIVED_US     1000
+
+typedef struct {
+    const char *func;           // NULL for the sites which didn't fit the table
+    uint32_t line;
+    uint32_t allocs;
+    uint32_t frees;             // of the allocations which were followed
+    uint32_t bytes;             // allocated in total
+    uint32_t live;              // allocations which weren't freed yet
+    uint32_t live_bytes;
+    uint32_t peak_live_bytes;
+    uint32_t short_lived;       // allocations freed within OSI_MEM_PROF_SHORT_LIVED_US
+} osi_mem_prof_site_t;
+
+typedef struct {
+    bool running;
+    uint64_t elapsed_us;        // since the start, up to the stop if stopped
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t failed;            // allocations which returned NULL
+    uint32_t untracked;         // allocations not followed to their free, the table was full
+    uint32_t live_bytes;
+    uint32_t peak_live_bytes;
+    uint32_t sites;
+    uint32_t size_classes[OSI_MEM_PROF_SIZE_CLASSES];
+} osi_mem_prof_stats_t;
+
+// The heap allocation profiler of the stack. With BT_BLUEDROID_MEM_PROFILE set,
+// osi_malloc, osi_calloc and osi_free report to it. It keeps nothing and costs
+// one load per call until it's started, so it may be built into field builds
+// and started when needed.
+//
+// Allocations are counted per call site, by the |__func__| and |__LINE__| of
+// osi_malloc, and per size class. Up to |max_live| allocations are followed to
+// their free, for the live and peak bytes, the frees per site and their
+// lifetime. Allocations made before the start are not followed.
+
+// Starts a new profile, dropping the one before, and follows up to |max_live|
+// allocations at a time. The tables take about 20 bytes per live allocation and
+// 36 per site, they are taken from the heap and kept until the next start.
+// Returns false if they can't be allocated.
+bool osi_mem_prof_start(uint16_t max_live);
+
+// Stops recording. The profile is kept until the next start.
+void osi_mem_prof_stop(void);
+
+// Returns true while the profiler records.
+bool osi_mem_prof_is_running(void);
+
+// Records the allocation of |size| bytes at |ptr| from |func| at |line|. |ptr|
+// is NULL if the allocation failed.
+void osi_mem_prof_alloc(void *ptr, size_t size, const char *func, int line);
+
+// Records the free of |ptr|, before the memory is given back. Accepts NULL.
+void osi_mem_prof_free(void *ptr);
+
+// Copies the totals of the profile to |stats|.
+void osi_mem_prof_get_stats(osi_mem_prof_stats_t *stats);
+
+// Copies up to |max_sites| call sites to |sites|, the ones with the most bytes
+// allocated first, and returns how many were copied.
+size_t osi_mem_prof_get_sites(osi_mem_prof_site_t *sites, size_t max_sites);
+
+// Copies up to |max_sites| call sites which had short lived allocations to
+// |sites|, the ones with the most first, and returns how many were copied.
+size_t osi_mem_prof_get_churn(osi_mem_prof_site_t *sites, size_t max_sites);
+
+// Prints the profile on the console as JSON lines starting with
+// {"mem_prof": ...}: the totals, the size classes, every site and the churn
+// report. Meant for a host reading the UART.
+void osi_mem_prof_dump(void);
+
+#endif /* _OSI_MEM_PROF_H_ */
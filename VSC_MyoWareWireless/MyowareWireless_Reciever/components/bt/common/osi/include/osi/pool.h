@@ -0,0 +1,72 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _OSI_POOL_H_
+#define _OSI_POOL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of free lists a pool keeps, one per core.
+#define OSI_POOL_MAX_CORES                2
+
+// Largest number of blocks a pool may hold.
+#define OSI_POOL_MAX_BLOCKS               0xfffe
+
+typedef struct {
+    uint32_t pool_allocs;   // blocks handed out from the pool
+    uint32_t heap_allocs;   // blocks taken from the heap because the pool was empty
+    uint32_t failed_allocs; // allocations which failed on the heap, too
+    uint32_t frees;         // blocks given back, to the pool or the heap
+    uint32_t in_use;        // pool blocks handed out right now
+    uint32_t max_in_use;    // largest |in_use| seen
+} osi_pool_stats_t;
+
+// A pool of fixed size blocks in memory given by its owner. Blocks never used
+// before are handed out in order, freed blocks are kept on a lock-free free list
+// per core and handed out again from there. If the pool is empty, blocks come
+// from the heap and go back there when freed. The fields are private.
+typedef struct {
+    uint32_t free_head[OSI_POOL_MAX_CORES]; // tag << 16 | (index + 1), 0 if empty
+    uint32_t unused;                        // index of the first block never handed out
+    uint8_t *blocks;
+    size_t block_size;
+    size_t block_count;
+    struct {
+        uint32_t pool_allocs;
+        uint32_t heap_allocs;
+        uint32_t failed_allocs;
+        uint32_t pool_frees;
+        uint32_t heap_frees;
+        uint32_t max_in_use;
+    } counters;
+} osi_pool_t;
+
+// Initializer of a pool over the array |storage| of |count| blocks, for pools
+// defined statically. The blocks must be at least 4 bytes and aligned to 4 bytes.
+#define OSI_POOL_INITIALIZER(storage, count) \
+    { { 0 }, 0, (uint8_t *)(storage), sizeof((storage)[0]), (count), { 0 } }
+
+// Initializes |pool| over |block_count| blocks of |block_size| bytes at
+// |storage|. |block_size| must be a multiple of 4 and |storage| 4 byte aligned.
+// |storage| may be NULL if |block_count| is 0, all blocks come from the heap then.
+void osi_pool_init(osi_pool_t *pool, void *storage, size_t block_size, size_t block_count);
+
+// Returns a block of the pool, or of the heap if the pool is empty. The block
+// isn't cleared. Returns NULL if there is no memory left.
+void *osi_pool_alloc(osi_pool_t *pool);
+
+// Gives |block| back to |pool|, which it was allocated from. Accepts NULL.
+void osi_pool_free(osi_pool_t *pool, void *block);
+
+// Returns true if |block| lies in the memory of |pool| rather than the heap.
+bool osi_pool_owns(const osi_pool_t *pool, const void *block);
+
+// Copies the allocation counters of |pool| to |stats|.
+void osi_pool_get_stats(const osi_pool_t *pool, osi_pool_stats_t *stats);
+
+#endif /* _OSI_POOL_H_ */
@@ -17,6 +17,10 @@
 
 #define OSI_THREAD_MAX_TIMEOUT OSI_SEM_MAX_TIMEOUT
 
+/* Most work items the thread takes off a queue at once, before it looks at the higher priority queues again */
+#define OSI_THREAD_BATCH_SIZE   8
+#define OSI_THREAD_HIST_BUCKETS 16
+
 struct osi_thread;
 struct osi_event;
 
@@ -24,6 +28,19 @@ typedef struct osi_thread osi_thread_t;
 
 typedef void (*osi_thread_func_t)(void *context);
 
+/*
+ * Counters of a work queue, kept by its thread. Bucket 0 of a histogram counts the value 0, bucket i
+ * the values from 2^(i-1) to 2^i - 1, and the last bucket also all larger values.
+ */
+typedef struct {
+    uint32_t items;                                     /*!< Work items run */
+    uint32_t batches;                                   /*!< Batches taken off the queue, one lock each */
+    uint32_t max_depth;                                 /*!< Most items waiting when a batch was taken */
+    uint32_t max_latency_us;                            /*!< Longest time from post to run */
+    uint32_t depth_hist[OSI_THREAD_HIST_BUCKETS];       /*!< Items waiting when a batch was taken */
+    uint32_t latency_hist[OSI_THREAD_HIST_BUCKETS];     /*!< Microseconds from post to run of each item */
+} osi_thread_queue_stats_t;
+
 typedef enum {
     OSI_THREAD_CORE_0 = 0,
     OSI_THREAD_CORE_1,
@@ -36,7 +53,9 @@ typedef enum {
  * param stack_size: thread stack size
  * param priority: thread priority
  * param core: the CPU core which this thread run, OSI_THREAD_CORE_AFFINITY means unspecific CPU core
- * param work_queue_num: speicify queue number, the queue[0] has highest priority, and the priority is decrease by index
+ * param work_queue_num: speicify queue number, the queue[0] has highest priority, and the priority is decrease by index.
+ *                       At most 31 queues. The thread runs up to OSI_THREAD_BATCH_SIZE items of a queue before it
+ *                       looks at the higher priority queues again.
  * return : if create successfully, return thread handler; otherwise return NULL.
  */
 osi_thread_t *osi_thread_create(const char *name, size_t stack_size, int priority, osi_thread_core_t core, uint8_t work_queue_num, const size_t work_queue_len[]);
@@ -79,6 +98,25 @@ const char *osi_thread_name(osi_thread_t *thread);
  */
 int osi_thread_queue_wait_size(osi_thread_t *thread, int wq_idx);
 
+/* brief: Get the counters of a work queue, which may be slightly out of date while the thread runs
+ * param thread: point of thread handler
+ * param wq_idx: the queue index of the thread
+ * param stats: filled with the counters
+ * return: true on success, false if wq_idx is out of range
+ */
+bool osi_thread_get_queue_stats(osi_thread_t *thread, int wq_idx, osi_thread_queue_stats_t *stats);
+
+/* brief: Get the number of times the thread blocked for work and was woken up
+ * param thread: point of thread handler
+ * return: number of wakeups
+ */
+uint32_t osi_thread_get_wakeups(osi_thread_t *thread);
+
+/* brief: Clear the wakeups and the counters of all work queues of the thread
+ * param thread: point of thread handler
+ */
+void osi_thread_reset_stats(osi_thread_t *thread);
+
 /*
  * brief: Create an osi_event struct and register the handler function and its argument
  *        An osi_event is a kind of work that can be posted to the workqueue of osi_thread to process,
@@ -0,0 +1,79 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TIMER_WHEEL_LEVEL_BITS      6
+#define TIMER_WHEEL_SLOTS           (1 << TIMER_WHEEL_LEVEL_BITS)
+#define TIMER_WHEEL_LEVELS          6
+
+// An entry is embedded in the object which is timed, e.g. an alarm, and
+// initialised with |timer_wheel_entry_init|. It belongs to the wheel while it is
+// pending.
+typedef struct timer_wheel_entry_t {
+    struct timer_wheel_entry_t *next;
+    struct timer_wheel_entry_t **pprev;
+    uint64_t expiry;
+    uint8_t level;
+    uint8_t slot;
+} timer_wheel_entry_t;
+
+// A hierarchical timing wheel. Level 0 has one slot per tick, each further level
+// one slot per full turn of the level below. An entry sits on the level of the
+// highest digit in which its expiry differs from the current tick and moves down
+// when the wheel reaches its slot, so it expires on the exact tick. Setting and
+// removing an entry is O(1). The occupied slots of each level are kept in a
+// bitmap, so the next tick with work is found without walking the slots.
+// Entries past the current turn of the top level, 2^36 ticks, wait in
+// |overflow| for the next turn.
+//
+// The wheel does no locking and knows no clock. The owner advances it to the
+// current tick and uses |timer_wheel_next_tick| to know when to do that again.
+typedef struct {
+    uint64_t now;
+    size_t count;
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+    timer_wheel_entry_t *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    timer_wheel_entry_t *overflow;
+} timer_wheel_t;
+
+// Called for each entry which expires. The entry is no longer pending and may be
+// added again, also from inside the callback.
+typedef void (*timer_wheel_cb)(timer_wheel_entry_t *entry, void *context);
+
+// Initialises |wheel| empty at tick |now|.
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now);
+
+// Initialises |entry| as not pending.
+void timer_wheel_entry_init(timer_wheel_entry_t *entry);
+
+// Returns true if |entry| is in a wheel.
+bool timer_wheel_entry_is_pending(const timer_wheel_entry_t *entry);
+
+// Adds |entry| to |wheel| to expire at the absolute tick |expiry|. An expiry
+// which isn't after the current tick of the wheel expires on the next tick.
+// |entry| may not be pending.
+void timer_wheel_add(timer_wheel_t *wheel, timer_wheel_entry_t *entry, uint64_t expiry);
+
+// Removes |entry| from |wheel| if it is pending. This function is idempotent.
+void timer_wheel_remove(timer_wheel_t *wheel, timer_wheel_entry_t *entry);
+
+// Moves |wheel| forward to tick |now| and calls |expired_cb| with |context| for
+// each entry which expires on the way, in the order of their expiries. |now| may
+// not be before the current tick of the wheel.
+void timer_wheel_advance(timer_wheel_t *wheel, uint64_t now, timer_wheel_cb expired_cb, void *context);
+
+// Returns the tick by which |timer_wheel_advance| has to be called next, or
+// UINT64_MAX if |wheel| is empty. This may be a tick on which entries only move
+// to a lower level, it is never after the first expiry.
+uint64_t timer_wheel_next_tick(const timer_wheel_t *wheel);
+
+#endif /* _TIMER_WHEEL_H_ */
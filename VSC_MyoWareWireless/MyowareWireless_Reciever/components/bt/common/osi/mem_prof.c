@@ -0,0 +1,377 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bt_common.h"
+#include "esp_timer.h"
+#include "osi/hash_functions.h"
+#include "osi/mem_prof.h"
+#include "osi/mutex.h"
+
+// Index of the site which takes the allocations of the sites which don't fit.
+#define OTHER_SITE              OSI_MEM_PROF_MAX_SITES
+#define SITE_INDEX_SIZE         (2 * OSI_MEM_PROF_MAX_SITES)
+
+typedef struct {
+    void *ptr;                  // NULL if the slot is empty
+    uint32_t size;
+    uint32_t alloc_us;          // wraps after 71 minutes, lifetimes are compared as differences
+    uint8_t site;
+} live_entry_t;
+
+// The tables are taken from the heap by malloc and calloc directly, the
+// profiler doesn't see its own memory.
+typedef struct {
+    osi_mutex_t lock;
+    bool lock_created;
+    bool running;
+    int64_t start_us;
+    int64_t stop_us;
+    osi_mem_prof_stats_t stats;
+    osi_mem_prof_site_t *sites;             // OSI_MEM_PROF_MAX_SITES + 1, the last one is OTHER_SITE
+    uint8_t site_index[SITE_INDEX_SIZE];    // site + 1, 0 if empty
+    live_entry_t *live;                     // open addressing with linear probing
+    size_t live_size;
+    size_t live_count;
+    size_t live_max;
+} mem_prof_t;
+
+static mem_prof_t prof;
+
+static inline uint32_t now_us(void)
+{
+    return (uint32_t)esp_timer_get_time();
+}
+
+static inline int size_class(size_t size)
+{
+    if (size <= 8) {
+        return 0;
+    }
+    // smallest class whose limit, 8 << class, isn't below |size|
+    int cls = (int)(sizeof(unsigned long) * 8) - __builtin_clzl((unsigned long)(size - 1)) - 3;
+    return cls < OSI_MEM_PROF_SIZE_CLASSES ? cls : OSI_MEM_PROF_SIZE_CLASSES - 1;
+}
+
+static uint8_t find_site(const char *func, int line)
+{
+    uint32_t hash = (uint32_t)hash_function_pointer(func) ^ ((uint32_t)line * 2654435761u);
+
+    for (size_t probe = 0; probe < SITE_INDEX_SIZE; probe++) {
+        uint8_t *slot = &prof.site_index[(hash + probe) % SITE_INDEX_SIZE];
+        if (*slot == 0) {
+            if (prof.stats.sites == OSI_MEM_PROF_MAX_SITES) {
+                return OTHER_SITE;
+            }
+            uint8_t site = (uint8_t)prof.stats.sites++;
+            prof.sites[site].func = func;
+            prof.sites[site].line = line;
+            *slot = site + 1;
+            return site;
+        }
+        osi_mem_prof_site_t *candidate = &prof.sites[*slot - 1];
+        if (candidate->func == func && candidate->line == line) {
+            return *slot - 1;
+        }
+    }
+    return OTHER_SITE;
+}
+
+static inline size_t live_home(const void *ptr)
+{
+    return hash_function_pointer(ptr) % prof.live_size;
+}
+
+static live_entry_t *find_live(const void *ptr)
+{
+    for (size_t i = live_home(ptr);; i = (i + 1) % prof.live_size) {
+        if (prof.live[i].ptr == ptr) {
+            return &prof.live[i];
+        }
+        if (prof.live[i].ptr == NULL) {
+            return NULL;
+        }
+    }
+}
+
+static bool insert_live(void *ptr, uint32_t size, uint8_t site)
+{
+    if (prof.live_count == prof.live_max) {
+        return false;
+    }
+    size_t i = live_home(ptr);
+    while (prof.live[i].ptr != NULL) {
+        i = (i + 1) % prof.live_size;
+    }
+    prof.live[i].ptr = ptr;
+    prof.live[i].size = size;
+    prof.live[i].alloc_us = now_us();
+    prof.live[i].site = site;
+    prof.live_count++;
+    return true;
+}
+
+// Moves the entries after |entry| back, so no probe sequence runs into the gap.
+static void remove_live(live_entry_t *entry)
+{
+    size_t gap = entry - prof.live;
+
+    for (size_t i = (gap + 1) % prof.live_size; prof.live[i].ptr != NULL; i = (i + 1) % prof.live_size) {
+        size_t home = live_home(prof.live[i].ptr);
+        // distance from home to |i| and to the gap, both along the probe sequence
+        size_t to_i = (i + prof.live_size - home) % prof.live_size;
+        size_t to_gap = (gap + prof.live_size - home) % prof.live_size;
+        if (to_gap < to_i) {
+            prof.live[gap] = prof.live[i];
+            gap = i;
+        }
+    }
+    prof.live[gap].ptr = NULL;
+    prof.live_count--;
+}
+
+bool osi_mem_prof_start(uint16_t max_live)
+{
+    if (!prof.lock_created) {
+        if (osi_mutex_new(&prof.lock) != 0) {
+            return false;
+        }
+        prof.lock_created = true;
+    }
+
+    size_t live_size = max_live + max_live / 4 + 1;
+    osi_mem_prof_site_t *sites = calloc(OSI_MEM_PROF_MAX_SITES + 1, sizeof(osi_mem_prof_site_t));
+    live_entry_t *live = calloc(live_size, sizeof(live_entry_t));
+    if (!sites || !live) {
+        free(sites);
+        free(live);
+        return false;
+    }
+
+    osi_mutex_lock(&prof.lock, OSI_MUTEX_MAX_TIMEOUT);
+    free(prof.sites);
+    free(prof.live);
+    prof.sites = sites;
+    prof.live = live;
+    prof.live_size = live_size;
+    prof.live_count = 0;
+    prof.live_max = max_live;
+    memset(prof.site_index, 0, sizeof(prof.site_index));
+    memset(&prof.stats, 0, sizeof(prof.stats));
+    prof.start_us = esp_timer_get_time();
+    __atomic_store_n(&prof.running, true, __ATOMIC_RELEASE);
+    osi_mutex_unlock(&prof.lock);
+    return true;
+}
+
+void osi_mem_prof_stop(void)
+{
+    if (!prof.lock_created) {
+        return;
+    }
+
+    osi_mutex_lock(&prof.lock, OSI_MUTEX_MAX_TIMEOUT);
+    if (prof.running) {
+        __atomic_store_n(&prof.running, false, __ATOMIC_RELAXED);
+        prof.stop_us = esp_timer_get_time();
+    }
+    osi_mutex_unlock(&prof.lock);
+}
+
+bool osi_mem_prof_is_running(void)
+{
+    return __atomic_load_n(&prof.running, __ATOMIC_ACQUIRE);
+}
+
+void osi_mem_prof_alloc(void *ptr, size_t size, const char *func, int line)
+{
+    if (!__atomic_load_n(&prof.running, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    osi_mutex_lock(&prof.lock, OSI_MUTEX_MAX_TIMEOUT);
+    if (!prof.running) {
+        osi_mutex_unlock(&prof.lock);
+        return;
+    }
+
+    osi_mem_prof_stats_t *stats = &prof.stats;
+    if (!ptr) {
+        stats->failed++;
+        osi_mutex_unlock(&prof.lock);
+        return;
+    }
+
+    uint8_t site_idx = find_site(func, line);
+    osi_mem_prof_site_t *site = &prof.sites[site_idx];
+    stats->allocs++;
+    stats->size_classes[size_class(size)]++;
+    site->allocs++;
+    site->bytes += size;
+
+    if (insert_live(ptr, size, site_idx)) {
+        site->live++;
+        site->live_bytes += size;
+        if (site->live_bytes > site->peak_live_bytes) {
+            site->peak_live_bytes = site->live_bytes;
+        }
+        stats->live_bytes += size;
+        if (stats->live_bytes > stats->peak_live_bytes) {
+            stats->peak_live_bytes = stats->live_bytes;
+        }
+    } else {
+        stats->untracked++;
+    }
+    osi_mutex_unlock(&prof.lock);
+}
+
+void osi_mem_prof_free(void *ptr)
+{
+    if (!ptr || !__atomic_load_n(&prof.running, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    osi_mutex_lock(&prof.lock, OSI_MUTEX_MAX_TIMEOUT);
+    live_entry_t *entry = prof.running ? find_live(ptr) : NULL;
+    if (entry) {
+        osi_mem_prof_site_t *site = &prof.sites[entry->site];
+        site->frees++;
+        site->live--;
+        site->live_bytes -= entry->size;
+        if (now_us() - entry->alloc_us < OSI_MEM_PROF_SHORT_LIVED_US) {
+            site->short_lived++;
+        }
+        prof.stats.frees++;
+        prof.stats.live_bytes -= entry->size;
+        remove_live(entry);
+    }
+    osi_mutex_unlock(&prof.lock);
+}
+
+void osi_mem_prof_get_stats(osi_mem_prof_stats_t *stats)
+{
+    assert(stats != NULL);
+
+    if (!prof.lock_created) {
+        memset(stats, 0, sizeof(osi_mem_prof_stats_t));
+        return;
+    }
+
+    osi_mutex_lock(&prof.lock, OSI_MUTEX_MAX_TIMEOUT);
+    *stats = prof.stats;
+    stats->running = prof.running;
+    stats->elapsed_us = (prof.running ? esp_timer_get_time() : prof.stop_us) - prof.start_us;
+    osi_mutex_unlock(&prof.lock);
+}
+
+// Copies the sites to |out| in falling order of |key|, leaving out the ones
+// with a key of 0.
+static size_t copy_sites(osi_mem_prof_site_t *out, size_t max_sites, uint32_t (*key)(const osi_mem_prof_site_t *))
+{
+    uint8_t taken[OSI_MEM_PROF_MAX_SITES + 1] = { 0 };
+    size_t copied = 0;
+
+    if (!prof.lock_created) {
+        return 0;
+    }
+
+    osi_mutex_lock(&prof.lock, OSI_MUTEX_MAX_TIMEOUT);
+    if (!prof.sites) {
+        osi_mutex_unlock(&prof.lock);
+        return 0;
+    }
+    const size_t count = prof.stats.sites;
+    while (copied < max_sites) {
+        int best = -1;
+        for (size_t i = 0; i <= OSI_MEM_PROF_MAX_SITES; i++) {
+            if ((i < count || (i == OTHER_SITE && prof.sites[i].allocs)) && !taken[i] && key(&prof.sites[i]) &&
+                (best < 0 || key(&prof.sites[i]) > key(&prof.sites[best]))) {
+                best = i;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        taken[best] = 1;
+        out[copied++] = prof.sites[best];
+    }
+    osi_mutex_unlock(&prof.lock);
+    return copied;
+}
+
+static uint32_t site_bytes(const osi_mem_prof_site_t *site)
+{
+    return site->bytes;
+}
+
+static uint32_t site_short_lived(const osi_mem_prof_site_t *site)
+{
+    return site->short_lived;
+}
+
+size_t osi_mem_prof_get_sites(osi_mem_prof_site_t *sites, size_t max_sites)
+{
+    assert(sites != NULL);
+    return copy_sites(sites, max_sites, site_bytes);
+}
+
+size_t osi_mem_prof_get_churn(osi_mem_prof_site_t *sites, size_t max_sites)
+{
+    assert(sites != NULL);
+    return copy_sites(sites, max_sites, site_short_lived);
+}
+
+static void print_site(const char *kind, const osi_mem_prof_site_t *site, uint64_t elapsed_us)
+{
+    printf("{\"mem_prof\": \"%s\", \"func\": \"%s\", \"line\": %" PRIu32 ", \"allocs\": %" PRIu32
+           ", \"allocs_per_s\": %.1f, \"frees\": %" PRIu32 ", \"bytes\": %" PRIu32 ", \"live\": %" PRIu32
+           ", \"live_bytes\": %" PRIu32 ", \"peak_live_bytes\": %" PRIu32 ", \"short_lived\": %" PRIu32 "}\n",
+           kind, site->func ? site->func : "other", site->line, site->allocs,
+           elapsed_us ? site->allocs * 1e6 / elapsed_us : 0.0, site->frees, site->bytes, site->live,
+           site->live_bytes, site->peak_live_bytes, site->short_lived);
+}
+
+void osi_mem_prof_dump(void)
+{
+    osi_mem_prof_stats_t stats;
+    osi_mem_prof_get_stats(&stats);
+
+    printf("{\"mem_prof\": \"totals\", \"running\": %s, \"elapsed_ms\": %" PRIu64 ", \"allocs\": %" PRIu32
+           ", \"allocs_per_s\": %.1f, \"frees\": %" PRIu32 ", \"failed\": %" PRIu32 ", \"untracked\": %" PRIu32
+           ", \"live_bytes\": %" PRIu32 ", \"peak_live_bytes\": %" PRIu32 ", \"sites\": %" PRIu32 "}\n",
+           stats.running ? "true" : "false", stats.elapsed_us / 1000, stats.allocs,
+           stats.elapsed_us ? stats.allocs * 1e6 / stats.elapsed_us : 0.0, stats.frees, stats.failed,
+           stats.untracked, stats.live_bytes, stats.peak_live_bytes, stats.sites);
+
+    printf("{\"mem_prof\": \"size_classes\", \"max_bytes\": [");
+    for (int i = 0; i < OSI_MEM_PROF_SIZE_CLASSES - 1; i++) {
+        printf("%s%u", i ? ", " : "", 8u << i);
+    }
+    printf(", null], \"allocs\": [");
+    for (int i = 0; i < OSI_MEM_PROF_SIZE_CLASSES; i++) {
+        printf("%s%" PRIu32, i ? ", " : "", stats.size_classes[i]);
+    }
+    printf("]}\n");
+
+    osi_mem_prof_site_t *sites = malloc((OSI_MEM_PROF_MAX_SITES + 1) * sizeof(osi_mem_prof_site_t));
+    if (!sites) {
+        return;
+    }
+    size_t count = osi_mem_prof_get_sites(sites, OSI_MEM_PROF_MAX_SITES + 1);
+    for (size_t i = 0; i < count; i++) {
+        print_site("site", &sites[i], stats.elapsed_us);
+    }
+    count = osi_mem_prof_get_churn(sites, OSI_MEM_PROF_MAX_SITES + 1);
+    for (size_t i = 0; i < count; i++) {
+        print_site("churn", &sites[i], stats.elapsed_us);
+    }
+    free(sites);
+}
@@ -0,0 +1,162 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "bt_common.h"
+#include "osi/allocator.h"
+#include "osi/pool.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define POOL_INDEX_MASK     0xffffu
+#define POOL_TAG_STEP       0x10000u
+
+static inline int pool_core(void)
+{
+#if portNUM_PROCESSORS > 1
+    return xPortGetCoreID() % OSI_POOL_MAX_CORES;
+#else
+    return 0;
+#endif
+}
+
+static inline uint8_t *pool_block(const osi_pool_t *pool, uint32_t index)
+{
+    return pool->blocks + index * pool->block_size;
+}
+
+static void pool_count(uint32_t *counter)
+{
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+// The link to the next free block is kept in the first word of a free block. The
+// tag in the upper half of the head changes with every push and pop, so a pop
+// which read a link that changed meanwhile fails its compare and exchange.
+static void *pool_pop(osi_pool_t *pool, int core)
+{
+    uint32_t head = __atomic_load_n(&pool->free_head[core], __ATOMIC_ACQUIRE);
+    while ((head & POOL_INDEX_MASK) != 0) {
+        uint8_t *block = pool_block(pool, (head & POOL_INDEX_MASK) - 1);
+        uint32_t next = __atomic_load_n((uint32_t *)block, __ATOMIC_RELAXED);
+        uint32_t desired = ((head + POOL_TAG_STEP) & ~POOL_INDEX_MASK) | (next & POOL_INDEX_MASK);
+        if (__atomic_compare_exchange_n(&pool->free_head[core], &head, desired, true,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+static void pool_push(osi_pool_t *pool, int core, uint8_t *block)
+{
+    uint32_t index = (uint32_t)((block - pool->blocks) / pool->block_size) + 1;
+    uint32_t head = __atomic_load_n(&pool->free_head[core], __ATOMIC_RELAXED);
+    uint32_t desired;
+    do {
+        __atomic_store_n((uint32_t *)block, head & POOL_INDEX_MASK, __ATOMIC_RELAXED);
+        desired = ((head + POOL_TAG_STEP) & ~POOL_INDEX_MASK) | index;
+    } while (!__atomic_compare_exchange_n(&pool->free_head[core], &head, desired, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static void *pool_take_unused(osi_pool_t *pool)
+{
+    uint32_t unused = __atomic_load_n(&pool->unused, __ATOMIC_RELAXED);
+    while (unused < pool->block_count) {
+        if (__atomic_compare_exchange_n(&pool->unused, &unused, unused + 1, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return pool_block(pool, unused);
+        }
+    }
+    return NULL;
+}
+
+void osi_pool_init(osi_pool_t *pool, void *storage, size_t block_size, size_t block_count)
+{
+    assert(pool != NULL);
+    assert(block_count == 0 || storage != NULL);
+    assert(block_size >= sizeof(uint32_t) && block_size % sizeof(uint32_t) == 0);
+    assert(block_count <= OSI_POOL_MAX_BLOCKS);
+
+    memset(pool, 0, sizeof(*pool));
+    pool->blocks = (uint8_t *)storage;
+    pool->block_size = block_size;
+    pool->block_count = block_count;
+}
+
+void *osi_pool_alloc(osi_pool_t *pool)
+{
+    assert(pool != NULL);
+
+    const int core = pool_core();
+    void *block = pool_pop(pool, core);
+    for (int i = 1; block == NULL && i < OSI_POOL_MAX_CORES; i++) {
+        block = pool_pop(pool, (core + i) % OSI_POOL_MAX_CORES);
+    }
+    if (block == NULL) {
+        block = pool_take_unused(pool);
+    }
+
+    if (block != NULL) {
+        // The allocating side tracks the peak. Frees made after the allocation was
+        // counted are subtracted, too, so |max_in_use| can come out low but never high.
+        int32_t in_use = (int32_t)(__atomic_add_fetch(&pool->counters.pool_allocs, 1, __ATOMIC_RELAXED) -
+                                   __atomic_load_n(&pool->counters.pool_frees, __ATOMIC_RELAXED));
+        uint32_t max_in_use = __atomic_load_n(&pool->counters.max_in_use, __ATOMIC_RELAXED);
+        while (in_use > (int32_t)max_in_use &&
+                !__atomic_compare_exchange_n(&pool->counters.max_in_use, &max_in_use, (uint32_t)in_use, true,
+                                             __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+        return block;
+    }
+
+    block = osi_malloc(pool->block_size);
+    pool_count(block != NULL ? &pool->counters.heap_allocs : &pool->counters.failed_allocs);
+    return block;
+}
+
+void osi_pool_free(osi_pool_t *pool, void *block)
+{
+    assert(pool != NULL);
+
+    if (block == NULL) {
+        return;
+    }
+
+    if (osi_pool_owns(pool, block)) {
+        // Counted before the push, so an allocation getting the block back sees the free.
+        pool_count(&pool->counters.pool_frees);
+        pool_push(pool, pool_core(), (uint8_t *)block);
+    } else {
+        osi_free(block);
+        pool_count(&pool->counters.heap_frees);
+    }
+}
+
+bool osi_pool_owns(const osi_pool_t *pool, const void *block)
+{
+    assert(pool != NULL);
+
+    const uint8_t *p = (const uint8_t *)block;
+    return pool->block_count > 0 && p >= pool->blocks &&
+           p < pool->blocks + pool->block_count * pool->block_size;
+}
+
+void osi_pool_get_stats(const osi_pool_t *pool, osi_pool_stats_t *stats)
+{
+    assert(pool != NULL);
+    assert(stats != NULL);
+
+    const uint32_t pool_frees = __atomic_load_n(&pool->counters.pool_frees, __ATOMIC_RELAXED);
+    stats->pool_allocs = __atomic_load_n(&pool->counters.pool_allocs, __ATOMIC_RELAXED);
+    stats->heap_allocs = __atomic_load_n(&pool->counters.heap_allocs, __ATOMIC_RELAXED);
+    stats->failed_allocs = __atomic_load_n(&pool->counters.failed_allocs, __ATOMIC_RELAXED);
+    stats->frees = pool_frees + __atomic_load_n(&pool->counters.heap_frees, __ATOMIC_RELAXED);
+    stats->in_use = stats->pool_allocs - pool_frees;
+    stats->max_in_use = __atomic_load_n(&pool->counters.max_in_use, __ATOMIC_RELAXED);
+}
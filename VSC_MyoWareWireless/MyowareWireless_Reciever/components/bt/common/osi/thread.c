@@ -20,19 +20,33 @@
 
 #include "osi/allocator.h"
 #include "freertos/FreeRTOS.h"
-#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
 #include "osi/semaphore.h"
 #include "osi/thread.h"
 #include "osi/mutex.h"
 
+/* The thread is woken by a task notification bit per work queue, the last bit stops it */
+#define OSI_THREAD_MAX_WORK_QUEUES  31
+#define OSI_THREAD_STOP_BIT         (1UL << OSI_THREAD_MAX_WORK_QUEUES)
+
 struct work_item {
     osi_thread_func_t func;
     void *context;
+    uint32_t post_us;
 };
 
+/* A ring of work items. Producers put one item at a time, the thread takes up
+ * to a batch per lock. Producers which find the ring full wait on room_sem. */
 struct work_queue {
-    QueueHandle_t queue;
+    osi_mutex_t lock;
+    struct work_item *items;
     size_t capacity;
+    size_t head;
+    size_t count;
+    osi_sem_t room_sem;
+    uint16_t room_waiters;
+    osi_thread_queue_stats_t stats;     /*!< Only written by the thread */
 };
 
 struct osi_thread {
@@ -41,7 +55,7 @@ struct osi_thread {
   bool stop;
   uint8_t work_queue_num;               /*!< Work queue number */
   struct work_queue **work_queues;      /*!< Point to queue array, and the priority inverse array index */
-  osi_sem_t work_sem;
+  uint32_t wakeups;                     /*!< Times the thread blocked for work and woke up */
   osi_sem_t stop_sem;
 };
 
@@ -61,113 +75,188 @@ struct osi_event {
 
 static const size_t DEFAULT_WORK_QUEUE_CAPACITY = 100;
 
+static void osi_work_queue_delete(struct work_queue *wq);
+
 static struct work_queue *osi_work_queue_create(size_t capacity)
 {
     if (capacity == 0) {
         return NULL;
     }
 
-    struct work_queue *wq = (struct work_queue *)osi_malloc(sizeof(struct work_queue));
-    if (wq != NULL) {
-        wq->queue = xQueueCreate(capacity, sizeof(struct work_item));
-        if (wq->queue != 0) {
-            wq->capacity = capacity;
-            return wq;
-        } else {
-            osi_free(wq);
-        }
+    struct work_queue *wq = (struct work_queue *)osi_calloc(sizeof(struct work_queue));
+    if (wq == NULL) {
+        return NULL;
     }
 
-    return NULL;
+    wq->items = (struct work_item *)osi_malloc(sizeof(struct work_item) * capacity);
+    if (wq->items == NULL || osi_mutex_new(&wq->lock) != 0 || osi_sem_new(&wq->room_sem, 1, 0) != 0) {
+        osi_work_queue_delete(wq);
+        return NULL;
+    }
+    wq->capacity = capacity;
+
+    return wq;
 }
 
 static void osi_work_queue_delete(struct work_queue *wq)
 {
     if (wq != NULL) {
-        if (wq->queue != 0) {
-            vQueueDelete(wq->queue);
+        if (wq->lock) {
+            osi_mutex_free(&wq->lock);
         }
-        wq->queue = 0;
+        if (wq->room_sem) {
+            osi_sem_free(&wq->room_sem);
+        }
+        osi_free(wq->items);
+        wq->items = NULL;
         wq->capacity = 0;
         osi_free(wq);
     }
     return;
 }
 
-static bool osi_thead_work_queue_get(struct work_queue *wq, struct work_item *item)
+/* Bucket 0 counts the value 0, bucket i the values in [2^(i-1), 2^i) */
+static void osi_thread_hist_add(uint32_t *hist, uint32_t value)
 {
-    assert (wq != NULL);
-    assert (wq->queue != 0);
-    assert (item != NULL);
+    int bucket = value == 0 ? 0 : 32 - __builtin_clz(value);
+    hist[bucket < OSI_THREAD_HIST_BUCKETS ? bucket : OSI_THREAD_HIST_BUCKETS - 1]++;
+}
 
-    if (pdTRUE == xQueueReceive(wq->queue, item, 0)) {
-        return true;
-    } else {
-        return false;
+/* Takes up to |max| items off |wq| under one lock. Returns the number taken
+ * and in |left| the number still waiting. */
+static size_t osi_thead_work_queue_get(struct work_queue *wq, struct work_item *items, size_t max, size_t *left)
+{
+    assert (wq != NULL);
+    assert (items != NULL);
+
+    osi_mutex_lock(&wq->lock, OSI_MUTEX_MAX_TIMEOUT);
+    const size_t depth = wq->count;
+    const size_t num = depth < max ? depth : max;
+    const size_t first = wq->capacity - wq->head < num ? wq->capacity - wq->head : num;
+    memcpy(items, &wq->items[wq->head], first * sizeof(struct work_item));
+    memcpy(items + first, wq->items, (num - first) * sizeof(struct work_item));
+    wq->head = wq->head + num < wq->capacity ? wq->head + num : wq->head + num - wq->capacity;
+    __atomic_store_n(&wq->count, depth - num, __ATOMIC_RELAXED);
+    const bool wake_producer = num != 0 && wq->room_waiters != 0;
+    osi_mutex_unlock(&wq->lock);
+
+    if (wake_producer) {
+        osi_sem_give(&wq->room_sem);
+    }
+    if (num != 0) {
+        wq->stats.batches++;
+        wq->stats.max_depth = depth > wq->stats.max_depth ? depth : wq->stats.max_depth;
+        osi_thread_hist_add(wq->stats.depth_hist, depth);
     }
+
+    *left = depth - num;
+    return num;
 }
 
 static bool osi_thead_work_queue_put(struct work_queue *wq, const struct work_item *item, uint32_t timeout)
 {
     assert (wq != NULL);
-    assert (wq->queue != 0);
     assert (item != NULL);
 
-    bool ret = true;
-    if (timeout ==  OSI_SEM_MAX_TIMEOUT) {
-        if (xQueueSend(wq->queue, item, portMAX_DELAY) != pdTRUE) {
-            ret = false;
-        }
-    } else {
-        if (xQueueSend(wq->queue, item, timeout / portTICK_PERIOD_MS) != pdTRUE) {
-            ret = false;
+    const TickType_t start = xTaskGetTickCount();
+    osi_mutex_lock(&wq->lock, OSI_MUTEX_MAX_TIMEOUT);
+    while (wq->count == wq->capacity) {
+        uint32_t wait = timeout;
+        if (timeout != OSI_SEM_MAX_TIMEOUT) {
+            const uint32_t elapsed = (xTaskGetTickCount() - start) * portTICK_PERIOD_MS;
+            if (elapsed >= timeout) {
+                osi_mutex_unlock(&wq->lock);
+                return false;
+            }
+            wait = timeout - elapsed;
         }
+        wq->room_waiters++;
+        osi_mutex_unlock(&wq->lock);
+        osi_sem_take(&wq->room_sem, wait);
+        osi_mutex_lock(&wq->lock, OSI_MUTEX_MAX_TIMEOUT);
+        wq->room_waiters--;
     }
 
-    return ret;
+    const size_t tail = wq->head + wq->count < wq->capacity ? wq->head + wq->count : wq->head + wq->count - wq->capacity;
+    wq->items[tail] = *item;
+    __atomic_store_n(&wq->count, wq->count + 1, __ATOMIC_RELAXED);
+    /* the thread wakes one waiting producer per batch, pass it on while there is room */
+    const bool wake_producer = wq->room_waiters != 0 && wq->count < wq->capacity;
+    osi_mutex_unlock(&wq->lock);
+
+    if (wake_producer) {
+        osi_sem_give(&wq->room_sem);
+    }
+    return true;
 }
 
 static size_t osi_thead_work_queue_len(struct work_queue *wq)
 {
     assert (wq != NULL);
-    assert (wq->queue != 0);
-    assert (wq->capacity != 0);
 
-    size_t available_spaces = (size_t)uxQueueSpacesAvailable(wq->queue);
+    return __atomic_load_n(&wq->count, __ATOMIC_RELAXED);
+}
 
-    if (available_spaces <= wq->capacity) {
-        return wq->capacity - available_spaces;
-    } else {
-        assert (0);
+/* Bits of the work queues which have items waiting */
+static uint32_t osi_thread_ready_queues(osi_thread_t *thread)
+{
+    uint32_t ready = 0;
+    for (int i = 0; i < thread->work_queue_num; i++) {
+        if (osi_thead_work_queue_len(thread->work_queues[i]) != 0) {
+            ready |= 1UL << i;
+        }
     }
-    return 0;
+    return ready;
 }
 
 static void osi_thread_run(void *arg)
 {
     struct osi_thread_start_arg *start = (struct osi_thread_start_arg *)arg;
     osi_thread_t *thread = start->thread;
+    const uint32_t queue_bits = (1UL << thread->work_queue_num) - 1;
+    struct work_item batch[OSI_THREAD_BATCH_SIZE];
+    uint32_t pending = 0;
 
     osi_sem_give(&start->start_sem);
 
     while (1) {
-        int idx = 0;
+        uint32_t bits = 0;
 
-        osi_sem_take(&thread->work_sem, OSI_SEM_MAX_TIMEOUT);
+        /* Work run on this task may wait for task notifications of its own and
+         * consume ours, so the queues are looked at before blocking. */
+        if (pending == 0) {
+            pending = osi_thread_ready_queues(thread);
+        }
+        if (pending == 0) {
+            xTaskNotifyWait(0, UINT32_MAX, &bits, portMAX_DELAY);
+            thread->wakeups++;
+        } else {
+            xTaskNotifyWait(0, UINT32_MAX, &bits, 0);
+        }
+        pending |= bits & queue_bits;
 
         if (thread->stop) {
             break;
         }
+        if (pending == 0) {
+            continue;
+        }
 
-        struct work_item item;
-        while (!thread->stop && idx < thread->work_queue_num) {
-            if (osi_thead_work_queue_get(thread->work_queues[idx], &item) == true) {
-                item.func(item.context);
-                idx = 0;
-                continue;
-            } else {
-                idx++;
-            }
+        /* one batch of the highest priority queue with work, then look again */
+        const int idx = __builtin_ctz(pending);
+        struct work_queue *wq = thread->work_queues[idx];
+        size_t left;
+        size_t num = osi_thead_work_queue_get(wq, batch, OSI_THREAD_BATCH_SIZE, &left);
+        if (left == 0) {
+            pending &= ~(1UL << idx);
+        }
+
+        for (size_t i = 0; i < num && !thread->stop; i++) {
+            uint32_t latency_us = (uint32_t)esp_timer_get_time() - batch[i].post_us;
+            wq->stats.items++;
+            wq->stats.max_latency_us = latency_us > wq->stats.max_latency_us ? latency_us : wq->stats.max_latency_us;
+            osi_thread_hist_add(wq->stats.latency_hist, latency_us);
+            batch[i].func(batch[i].context);
         }
     }
 
@@ -191,7 +280,9 @@ static void osi_thread_stop(osi_thread_t *thread)
 
     //stop the thread
     thread->stop = true;
-    osi_sem_give(&thread->work_sem);
+    if (thread->thread_handle) {
+        xTaskNotify(thread->thread_handle, OSI_THREAD_STOP_BIT, eSetBits);
+    }
 
     //join
     ret = osi_thread_join(thread, 1000); //wait 1000ms
@@ -210,7 +301,7 @@ osi_thread_t *osi_thread_create(const char *name, size_t stack_size, int priorit
 
     if (stack_size <= 0 ||
             core < OSI_THREAD_CORE_0 || core > OSI_THREAD_CORE_AFFINITY ||
-            work_queue_num <= 0 || work_queue_len == NULL) {
+            work_queue_num <= 0 || work_queue_num > OSI_THREAD_MAX_WORK_QUEUES || work_queue_len == NULL) {
         return NULL;
     }
 
@@ -234,11 +325,6 @@ osi_thread_t *osi_thread_create(const char *name, size_t stack_size, int priorit
         }
     }
 
-    ret = osi_sem_new(&thread->work_sem, 1, 0);
-    if (ret != 0) {
-        goto _err;
-    }
-
     ret = osi_sem_new(&thread->stop_sem, 1, 0);
     if (ret != 0) {
         goto _err;
@@ -282,10 +368,6 @@ _err:
             thread->work_queues = NULL;
         }
 
-        if (thread->work_sem) {
-            osi_sem_free(&thread->work_sem);
-        }
-
         if (thread->stop_sem) {
             osi_sem_free(&thread->stop_sem);
         }
@@ -315,10 +397,6 @@ void osi_thread_free(osi_thread_t *thread)
         thread->work_queues = NULL;
     }
 
-    if (thread->work_sem) {
-        osi_sem_free(&thread->work_sem);
-    }
-
     if (thread->stop_sem) {
         osi_sem_free(&thread->stop_sem);
     }
@@ -340,12 +418,13 @@ bool osi_thread_post(osi_thread_t *thread, osi_thread_func_t func, void *context
 
     item.func = func;
     item.context = context;
+    item.post_us = (uint32_t)esp_timer_get_time();
 
     if (osi_thead_work_queue_put(thread->work_queues[queue_idx], &item, timeout) == false) {
         return false;
     }
 
-    osi_sem_give(&thread->work_sem);
+    xTaskNotify(thread->thread_handle, 1UL << queue_idx, eSetBits);
 
     return true;
 }
@@ -374,6 +453,36 @@ int osi_thread_queue_wait_size(osi_thread_t *thread, int wq_idx)
     return (int)(osi_thead_work_queue_len(thread->work_queues[wq_idx]));
 }
 
+bool osi_thread_get_queue_stats(osi_thread_t *thread, int wq_idx, osi_thread_queue_stats_t *stats)
+{
+    assert(thread != NULL);
+    assert(stats != NULL);
+
+    if (wq_idx < 0 || wq_idx >= thread->work_queue_num) {
+        return false;
+    }
+
+    memcpy(stats, &thread->work_queues[wq_idx]->stats, sizeof(osi_thread_queue_stats_t));
+    return true;
+}
+
+uint32_t osi_thread_get_wakeups(osi_thread_t *thread)
+{
+    assert(thread != NULL);
+
+    return thread->wakeups;
+}
+
+void osi_thread_reset_stats(osi_thread_t *thread)
+{
+    assert(thread != NULL);
+
+    thread->wakeups = 0;
+    for (int i = 0; i < thread->work_queue_num; i++) {
+        memset(&thread->work_queues[i]->stats, 0, sizeof(osi_thread_queue_stats_t));
+    }
+}
+
 
 struct osi_event *osi_event_create(osi_thread_func_t func, void *context)
 {
@@ -0,0 +1,176 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <assert.h>
+#include <string.h>
+#include "osi/timer_wheel.h"
+
+#define LEVEL_SHIFT(level)      (TIMER_WHEEL_LEVEL_BITS * (level))
+#define SLOT_MASK               (TIMER_WHEEL_SLOTS - 1)
+#define TURN_TICKS              (1ULL << LEVEL_SHIFT(TIMER_WHEEL_LEVELS))
+#define OVERFLOW_LEVEL          TIMER_WHEEL_LEVELS
+
+// The level of an entry is the highest digit in which |expiry| and |now|
+// differ, so on every level all occupied slots lie after the one of |now| and
+// an entry reaches level 0 on the tick its slot starts.
+static void wheel_insert(timer_wheel_t *wheel, timer_wheel_entry_t *entry)
+{
+    const uint64_t diff = entry->expiry ^ wheel->now;
+    const int level = diff == 0 ? 0 : (63 - __builtin_clzll(diff)) / TIMER_WHEEL_LEVEL_BITS;
+
+    timer_wheel_entry_t **head;
+    if (level >= TIMER_WHEEL_LEVELS) {
+        entry->level = OVERFLOW_LEVEL;
+        entry->slot = 0;
+        head = &wheel->overflow;
+    } else {
+        entry->level = level;
+        entry->slot = (entry->expiry >> LEVEL_SHIFT(level)) & SLOT_MASK;
+        head = &wheel->slots[level][entry->slot];
+        wheel->occupied[level] |= 1ULL << entry->slot;
+    }
+
+    entry->next = *head;
+    if (entry->next) {
+        entry->next->pprev = &entry->next;
+    }
+    entry->pprev = head;
+    *head = entry;
+    wheel->count++;
+}
+
+// Places the entries of a slot again, relative to the current tick.
+static void wheel_reinsert(timer_wheel_t *wheel, timer_wheel_entry_t **head)
+{
+    timer_wheel_entry_t *entry = *head;
+    *head = NULL;
+    while (entry) {
+        wheel->count--;
+        timer_wheel_entry_t *next = entry->next;
+        wheel_insert(wheel, entry);
+        entry = next;
+    }
+}
+
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now)
+{
+    assert(wheel != NULL);
+
+    memset(wheel, 0, sizeof(timer_wheel_t));
+    wheel->now = now;
+}
+
+void timer_wheel_entry_init(timer_wheel_entry_t *entry)
+{
+    assert(entry != NULL);
+
+    memset(entry, 0, sizeof(timer_wheel_entry_t));
+}
+
+bool timer_wheel_entry_is_pending(const timer_wheel_entry_t *entry)
+{
+    assert(entry != NULL);
+
+    return entry->pprev != NULL;
+}
+
+void timer_wheel_add(timer_wheel_t *wheel, timer_wheel_entry_t *entry, uint64_t expiry)
+{
+    assert(wheel != NULL);
+    assert(entry != NULL);
+    assert(entry->pprev == NULL);
+
+    entry->expiry = expiry > wheel->now ? expiry : wheel->now + 1;
+    wheel_insert(wheel, entry);
+}
+
+void timer_wheel_remove(timer_wheel_t *wheel, timer_wheel_entry_t *entry)
+{
+    assert(wheel != NULL);
+    assert(entry != NULL);
+
+    if (entry->pprev == NULL) {
+        return;
+    }
+
+    *entry->pprev = entry->next;
+    if (entry->next) {
+        entry->next->pprev = entry->pprev;
+    }
+    if (entry->level != OVERFLOW_LEVEL && wheel->slots[entry->level][entry->slot] == NULL) {
+        wheel->occupied[entry->level] &= ~(1ULL << entry->slot);
+    }
+    entry->next = NULL;
+    entry->pprev = NULL;
+    wheel->count--;
+}
+
+uint64_t timer_wheel_next_tick(const timer_wheel_t *wheel)
+{
+    assert(wheel != NULL);
+
+    if (wheel->count == 0) {
+        return UINT64_MAX;
+    }
+
+    // The first occupied slot of each level starts after the slot of |now|
+    // within the same turn of the level above.
+    uint64_t next = UINT64_MAX;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        const int current = (wheel->now >> LEVEL_SHIFT(level)) & SLOT_MASK;
+        const uint64_t later = current == SLOT_MASK ? 0 : wheel->occupied[level] & (~0ULL << (current + 1));
+        if (later == 0) {
+            continue;
+        }
+        const uint64_t turn = wheel->now & ~((1ULL << LEVEL_SHIFT(level + 1)) - 1);
+        const uint64_t start = turn | ((uint64_t)__builtin_ctzll(later) << LEVEL_SHIFT(level));
+        next = start < next ? start : next;
+    }
+    if (wheel->overflow) {
+        const uint64_t turn = (wheel->now & ~(TURN_TICKS - 1)) + TURN_TICKS;
+        next = turn < next ? turn : next;
+    }
+    return next;
+}
+
+void timer_wheel_advance(timer_wheel_t *wheel, uint64_t now, timer_wheel_cb expired_cb, void *context)
+{
+    assert(wheel != NULL);
+    assert(expired_cb != NULL);
+    assert(now >= wheel->now);
+
+    for (;;) {
+        const uint64_t tick = timer_wheel_next_tick(wheel);
+        if (tick > now) {
+            break;
+        }
+        wheel->now = tick;
+
+        // Move the entries of the slots starting on |tick| down, top level
+        // first, as they may land in a slot of a lower level which starts now.
+        if ((tick & (TURN_TICKS - 1)) == 0) {
+            wheel_reinsert(wheel, &wheel->overflow);
+        }
+        for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+            if (tick & ((1ULL << LEVEL_SHIFT(level)) - 1)) {
+                continue;
+            }
+            const int slot = (tick >> LEVEL_SHIFT(level)) & SLOT_MASK;
+            wheel->occupied[level] &= ~(1ULL << slot);
+            wheel_reinsert(wheel, &wheel->slots[level][slot]);
+        }
+
+        // One entry at a time, the callback may add or remove any entry. What
+        // it adds expires after |tick|, so the slot runs empty.
+        timer_wheel_entry_t **head = &wheel->slots[0][tick & SLOT_MASK];
+        while (*head) {
+            timer_wheel_entry_t *entry = *head;
+            timer_wheel_remove(wheel, entry);
+            expired_cb(entry, context);
+        }
+    }
+    wheel->now = now;
+}
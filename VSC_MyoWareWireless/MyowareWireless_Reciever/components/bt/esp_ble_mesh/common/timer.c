@@ -19,14 +19,6 @@ static hash_map_t *bm_alarm_hash_map;
 static const size_t BLE_MESH_ALARM_HASH_MAP_SIZE = 20 + CONFIG_BLE_MESH_PBA_SAME_TIME +
                                                         CONFIG_BLE_MESH_PBG_SAME_TIME;
 
-typedef struct alarm_t {
-    /* timer id point to here */
-    esp_timer_handle_t alarm_hdl;
-    osi_alarm_callback_t cb;
-    void *cb_data;
-    int64_t deadline_us;
-} osi_alarm_t;
-
 int64_t k_uptime_get(void)
 {
     /* k_uptime_get_32 is in in milliseconds,
@@ -187,7 +179,6 @@ int k_delayed_work_cancel(struct k_delayed_work *work)
     }
 
     osi_alarm_cancel(alarm);
-    alarm->deadline_us = 0;
 
     bt_mesh_alarm_unlock();
 
@@ -14,6 +14,7 @@
 #include "osi/allocator.h"
 #include "esp_spp_api.h"
 #include "osi/list.h"
+#include "osi/spsc_queue.h"
 #include "freertos/ringbuf.h"
 #include "osi/mutex.h"
 #include "osi/alarm.h"
@@ -39,10 +40,13 @@
 #define SLOT_TX_DATA_HIGH_WM (SLOT_TX_QUEUE_SIZE * BTA_JV_DEF_RFC_MTU)
 #define VFS_CLOSE_TIMEOUT (20 * 1000)
 
+/* rx is filled by the BTU task and drained by the BTC task or the VFS reader under
+ * spp_slot_mutex, tx is filled and drained by the BTC task, so each has one producer
+ * and one consumer. */
 typedef struct {
     bool peer_fc;         /* true if flow control is set based on peer's request */
     bool user_fc;         /* true if flow control is set based on user's request  */
-    fixed_queue_t *queue; /* Queue of buffers waiting to be sent */
+    spsc_queue_t *queue;  /* Queue of buffers waiting to be sent */
     uint32_t data_size;   /* Number of data bytes in the queue */
 } slot_data_t;
 
@@ -110,7 +114,7 @@ static void spp_osi_free(void *p)
 static int init_slot_data(slot_data_t *slot_data, size_t queue_size)
 {
     memset(slot_data, 0, sizeof(slot_data_t));
-    if ((slot_data->queue = fixed_queue_new(queue_size)) == NULL) {
+    if ((slot_data->queue = spsc_queue_new(queue_size)) == NULL) {
         return -1;
     }
     slot_data->data_size = 0;
@@ -119,7 +123,7 @@ static int init_slot_data(slot_data_t *slot_data, size_t queue_size)
 
 static void free_slot_data(slot_data_t *slot_data)
 {
-    fixed_queue_free(slot_data->queue, spp_osi_free);
+    spsc_queue_free(slot_data->queue, spp_osi_free);
     slot_data->queue = NULL;
 }
 
@@ -907,7 +911,7 @@ static void btc_spp_write(btc_spp_args_t *arg)
                 BTA_JvRfcommWrite(arg->write.handle, slot->id, item_size, data);
             }
         } else {
-            if (fixed_queue_enqueue(slot->tx.queue, arg->write.p_data, 0)) {
+            if (spsc_queue_enqueue(slot->tx.queue, arg->write.p_data, 0)) {
                 BTA_JvRfcommWrite(arg->write.handle, slot->id, arg->write.len, arg->write.p_data);
             } else {
                 ret = ESP_SPP_NO_RESOURCE;
@@ -1110,7 +1114,7 @@ void btc_spp_cb_handler(btc_msg_t *msg)
             param.write.cong = p_data->rfc_write.cong;
             btc_spp_cb_to_app(ESP_SPP_WRITE_EVT, &param);
             if (slot) {
-                osi_free(fixed_queue_dequeue(slot->tx.queue, FIXED_QUEUE_MAX_TIMEOUT));
+                osi_free(spsc_queue_try_dequeue(slot->tx.queue));
             }
         } else {
             if (slot) {
@@ -1187,7 +1191,7 @@ void btc_spp_cb_handler(btc_msg_t *msg)
                     break;
                 }
                 // if rx still has data, delay free slot
-                if (slot->close_alarm == NULL && slot->rx.queue && fixed_queue_length(slot->rx.queue) > 0) {
+                if (slot->close_alarm == NULL && slot->rx.queue && spsc_queue_length(slot->rx.queue) > 0) {
                     tBTA_JV *p_arg = NULL;
                     if ((p_arg = osi_malloc(sizeof(tBTA_JV))) == NULL) {
                         param.close.status = ESP_SPP_NO_RESOURCE;
@@ -1282,8 +1286,8 @@ void btc_spp_cb_handler(btc_msg_t *msg)
                 osi_mutex_lock(&spp_local_param.spp_slot_mutex, OSI_MUTEX_MAX_TIMEOUT);
                 if ((slot = spp_local_param.spp_slots[serial]) != NULL &&
                     slot->rfc_handle == p_data->data_ind.handle &&
-                    fixed_queue_length(slot->rx.queue) > 0) {
-                    p_buf = (BT_HDR *)fixed_queue_dequeue(slot->rx.queue, FIXED_QUEUE_MAX_TIMEOUT);
+                    spsc_queue_length(slot->rx.queue) > 0) {
+                    p_buf = (BT_HDR *)spsc_queue_try_dequeue(slot->rx.queue);
                 } else {
                     osi_mutex_unlock(&spp_local_param.spp_slot_mutex);
                     break;
@@ -1372,18 +1376,18 @@ int bta_co_rfc_data_incoming(void *user_data, BT_HDR *p_buf)
     p_data.data_ind.p_buf = NULL;
 
     if (spp_local_param.spp_mode == ESP_SPP_MODE_CB) {
-        size_t rx_len = fixed_queue_length(slot->rx.queue);
-        fixed_queue_enqueue(slot->rx.queue, p_buf, FIXED_QUEUE_MAX_TIMEOUT);
+        size_t rx_len = spsc_queue_length(slot->rx.queue);
+        spsc_queue_enqueue(slot->rx.queue, p_buf, SPSC_QUEUE_MAX_TIMEOUT);
         if (rx_len == 0) {
             BTC_TRACE_DEBUG("%s data post! %d, %d", __func__, slot->rfc_handle, rx_len);
             status = btc_transfer_context(&msg, &p_data, sizeof(tBTA_JV), NULL, NULL);
             assert(status == BT_STATUS_SUCCESS);
         }
     } else {
-        fixed_queue_enqueue(slot->rx.queue, p_buf, FIXED_QUEUE_MAX_TIMEOUT);
+        spsc_queue_enqueue(slot->rx.queue, p_buf, SPSC_QUEUE_MAX_TIMEOUT);
     }
     if (--slot->credit_rx == 0) {
-        BTC_TRACE_DEBUG("%s data post stop! %d %d", __func__, slot->rfc_handle, fixed_queue_length(slot->rx.queue));
+        BTC_TRACE_DEBUG("%s data post stop! %d %d", __func__, slot->rfc_handle, spsc_queue_length(slot->rx.queue));
         ret = 0; // reserved for other flow control
     }
     if (slot->credit_rx > BTA_JV_MAX_CREDIT_NUM) {
@@ -1567,14 +1571,14 @@ static ssize_t spp_vfs_read(int fd, void * dst, size_t size)
     while (1) {
         osi_mutex_lock(&spp_local_param.spp_slot_mutex, OSI_MUTEX_MAX_TIMEOUT);
         if ((slot = spp_local_param.spp_slots[serial]) != NULL) {
-            if (fixed_queue_length(slot->rx.queue) > 0) {
+            if (spsc_queue_length(slot->rx.queue) > 0) {
                 // free unused p_buf
-                if ((p_buf = (BT_HDR *)fixed_queue_try_peek_first(slot->rx.queue)) != NULL && p_buf->len == 0) {
-                    osi_free(fixed_queue_dequeue(slot->rx.queue, FIXED_QUEUE_MAX_TIMEOUT));
+                if ((p_buf = (BT_HDR *)spsc_queue_try_peek_first(slot->rx.queue)) != NULL && p_buf->len == 0) {
+                    osi_free(spsc_queue_try_dequeue(slot->rx.queue));
                     p_buf = NULL;
                     count++;
                 }
-                if (size == 0 || (p_buf = (BT_HDR *)fixed_queue_try_peek_first(slot->rx.queue)) == NULL) {
+                if (size == 0 || (p_buf = (BT_HDR *)spsc_queue_try_peek_first(slot->rx.queue)) == NULL) {
                     osi_mutex_unlock(&spp_local_param.spp_slot_mutex);
                     break;
                 }
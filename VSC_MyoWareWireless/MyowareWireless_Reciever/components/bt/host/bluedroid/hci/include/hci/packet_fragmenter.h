@@ -57,6 +57,30 @@ typedef struct packet_fragmenter_t {
     void (*reassemble_and_dispatch)(BT_HDR *packet);
 } packet_fragmenter_t;
 
+typedef struct {
+    // Inbound HCI packets copied out of the controller.
+    uint32_t packets;
+    // Inbound ACL packets completed from more than one fragment.
+    uint32_t reassembled;
+    // Copies of inbound data and the bytes they moved, including the copy out
+    // of the controller.
+    uint32_t copies;
+    uint32_t bytes_copied;
+} packet_fragmenter_stats_t;
+
 const packet_fragmenter_t *packet_fragmenter_get_interface(void);
 
+// Returns a new packet holding a copy of the |len| bytes of the inbound H4
+// packet |data|, which the controller only lends for the duration of the call.
+// If it starts an ACL packet which spans more fragments, the buffer has room
+// for all of it and the continuations are reassembled into it in place.
+// Returns NULL if the buffer can't be allocated.
+BT_HDR *packet_fragmenter_new_inbound(const uint8_t *data, uint16_t len);
+
+// Copies the counters of inbound packets into |stats|.
+void packet_fragmenter_get_stats(packet_fragmenter_stats_t *stats);
+
+// Resets the counters of inbound packets.
+void packet_fragmenter_reset_stats(void);
+
 #endif /* _PACKET_FRAGMENTER_H_ */
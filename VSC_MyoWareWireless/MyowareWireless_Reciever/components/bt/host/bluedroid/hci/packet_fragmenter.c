@@ -19,6 +19,7 @@
 #include "common/bt_trace.h"
 #include "common/bt_defs.h"
 #include "device/controller.h"
+#include "hci/hci_hal.h"
 #include "hci/hci_internals.h"
 #include "hci/hci_layer.h"
 #include "hci/packet_fragmenter.h"
@@ -47,6 +48,67 @@ static const controller_t *controller;
 static const packet_fragmenter_callbacks_t *callbacks;
 static hash_map_t *partial_packets;
 static BT_HDR *current_fragment_packet;
+static packet_fragmenter_stats_t stats;
+
+// Inbound packets are copied on the controller's side, the rest on the HCI
+// thread.
+static void count_copy(uint16_t len)
+{
+    __atomic_fetch_add(&stats.copies, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats.bytes_copied, len, __ATOMIC_RELAXED);
+}
+
+BT_HDR *packet_fragmenter_new_inbound(const uint8_t *data, uint16_t len)
+{
+    uint16_t room = len;
+
+    if (len >= 1 + HCI_ACL_PREAMBLE_SIZE + 2 && data[0] == DATA_TYPE_ACL) {
+        const uint8_t *stream = data + 1;
+        uint16_t handle;
+        uint16_t l2cap_length;
+
+        STREAM_TO_UINT16(handle, stream);
+        STREAM_SKIP_UINT16(stream);
+        STREAM_TO_UINT16(l2cap_length, stream);
+
+        uint32_t full_length = 1 + HCI_ACL_PREAMBLE_SIZE + L2CAP_HEADER_SIZE + l2cap_length;
+        if (GET_BOUNDARY_FLAG(handle) == START_PACKET_BOUNDARY && full_length > len && full_length <= UINT16_MAX) {
+            room = full_length;
+        }
+    }
+
+    // Only the header is cleared, the data is written over right away
+    BT_HDR *packet = (BT_HDR *)osi_malloc(BT_HDR_SIZE + room);
+    if (!packet) {
+        return NULL;
+    }
+    packet->event = 0;
+    packet->len = len;
+    packet->offset = 0;
+    // The reassembly learns the room from here, it's cleared before dispatch
+    packet->layer_specific = room > len ? room : 0;
+    memcpy(packet->data, data, len);
+
+    __atomic_fetch_add(&stats.packets, 1, __ATOMIC_RELAXED);
+    count_copy(len);
+    return packet;
+}
+
+void packet_fragmenter_get_stats(packet_fragmenter_stats_t *out)
+{
+    out->packets = __atomic_load_n(&stats.packets, __ATOMIC_RELAXED);
+    out->reassembled = __atomic_load_n(&stats.reassembled, __ATOMIC_RELAXED);
+    out->copies = __atomic_load_n(&stats.copies, __ATOMIC_RELAXED);
+    out->bytes_copied = __atomic_load_n(&stats.bytes_copied, __ATOMIC_RELAXED);
+}
+
+void packet_fragmenter_reset_stats(void)
+{
+    __atomic_store_n(&stats.packets, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats.reassembled, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats.copies, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats.bytes_copied, 0, __ATOMIC_RELAXED);
+}
 
 static void init(const packet_fragmenter_callbacks_t *result_callbacks)
 {
@@ -142,6 +204,7 @@ static void reassemble_and_dispatch(BT_HDR *packet)
         uint16_t handle;
         uint16_t l2cap_length;
         uint16_t acl_length __attribute__((unused));
+        uint16_t full_length;
 
         STREAM_TO_UINT16(handle, stream);
         STREAM_TO_UINT16(acl_length, stream);
@@ -161,7 +224,7 @@ static void reassemble_and_dispatch(BT_HDR *packet)
                 osi_free(partial_packet);
             }
 
-            uint16_t full_length = l2cap_length + L2CAP_HEADER_SIZE + HCI_ACL_PREAMBLE_SIZE;
+            full_length = l2cap_length + L2CAP_HEADER_SIZE + HCI_ACL_PREAMBLE_SIZE;
             if (full_length <= packet->len) {
                 if (full_length < packet->len) {
                     HCI_TRACE_WARNING("%s found l2cap full length %d less than the hci length %d.\n", __func__, l2cap_length, packet->len);
@@ -170,21 +233,31 @@ static void reassemble_and_dispatch(BT_HDR *packet)
                 callbacks->reassembled(packet);
                 return;
             }
-            partial_packet = (BT_HDR *)osi_calloc(full_length + sizeof(BT_HDR));
-            partial_packet->event = packet->event;
-            partial_packet->len = full_length;
-            partial_packet->offset = packet->len;
+            if (packet->layer_specific >= packet->offset + full_length) {
+                // Sized for the whole packet when it was copied in, so it's
+                // reassembled in place
+                partial_packet = packet;
+                partial_packet->layer_specific = 0;
+            } else {
+                partial_packet = (BT_HDR *)osi_malloc(full_length + sizeof(BT_HDR));
+                partial_packet->event = packet->event;
+                partial_packet->len = packet->len;
+                partial_packet->offset = 0;
+                partial_packet->layer_specific = 0;
 
-            memcpy(partial_packet->data, packet->data + packet->offset, packet->len);
+                memcpy(partial_packet->data, packet->data + packet->offset, packet->len);
+                count_copy(packet->len);
+                // Free the old packet buffer, since we don't need it anymore
+                osi_free(packet);
+            }
 
-            // Update the ACL data size to indicate the full expected length
-            stream = partial_packet->data;
+            // Update the ACL data size to indicate the full expected length,
+            // |len| counts the bytes received so far
+            stream = partial_packet->data + partial_packet->offset;
             STREAM_SKIP_UINT16(stream); // skip the handle
             UINT16_TO_STREAM(stream, full_length - HCI_ACL_PREAMBLE_SIZE);
 
             hash_map_set(partial_packets, (void *)(uintptr_t)handle, partial_packet);
-            // Free the old packet buffer, since we don't need it anymore
-            osi_free(packet);
         } else {
             if (!partial_packet) {
                 HCI_TRACE_ERROR("%s got continuation for unknown packet. Dropping it.\n", __func__);
@@ -192,28 +265,32 @@ static void reassemble_and_dispatch(BT_HDR *packet)
                 return;
             }
 
+            stream = partial_packet->data + partial_packet->offset;
+            STREAM_SKIP_UINT16(stream); // skip the handle
+            STREAM_TO_UINT16(full_length, stream);
+            full_length += HCI_ACL_PREAMBLE_SIZE;
+
             packet->offset += HCI_ACL_PREAMBLE_SIZE; // skip ACL preamble
             packet->len -= HCI_ACL_PREAMBLE_SIZE;
-            uint16_t projected_offset = partial_packet->offset + packet->len;
-            if (projected_offset > partial_packet->len) { // len stores the expected length
-                HCI_TRACE_ERROR("%s got packet which would exceed expected length of %d. Truncating.\n", __func__, partial_packet->len);
-                packet->len = partial_packet->len - partial_packet->offset;
-                projected_offset = partial_packet->len;
+            if (partial_packet->len + packet->len > full_length) {
+                HCI_TRACE_ERROR("%s got packet which would exceed expected length of %d. Truncating.\n", __func__, full_length);
+                packet->len = full_length - partial_packet->len;
             }
 
             memcpy(
-                partial_packet->data + partial_packet->offset,
+                partial_packet->data + partial_packet->offset + partial_packet->len,
                 packet->data + packet->offset,
                 packet->len
             );
+            count_copy(packet->len);
+            partial_packet->len += packet->len;
 
             // Free the old packet buffer, since we don't need it anymore
             osi_free(packet);
-            partial_packet->offset = projected_offset;
 
-            if (partial_packet->offset == partial_packet->len) {
+            if (partial_packet->len == full_length) {
                 hash_map_erase(partial_packets, (void *)(uintptr_t)handle);
-                partial_packet->offset = 0;
+                __atomic_fetch_add(&stats.reassembled, 1, __ATOMIC_RELAXED);
                 callbacks->reassembled(partial_packet);
             }
         }
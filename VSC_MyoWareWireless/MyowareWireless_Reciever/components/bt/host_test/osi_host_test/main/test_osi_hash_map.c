@@ -0,0 +1,298 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <inttypes.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "unity.h"
+#include "osi/hash_functions.h"
+#include "osi/hash_map.h"
+#include "hash_map_list.h"
+#include "test_osi.h"
+
+#define GROW_KEYS           5000
+#define BENCH_LOOKUPS       10
+#define BENCH_ROUNDS        5
+#define BENCH_MAX_KEYS      4096
+
+/* aligned like the alarm and connection pointers the stack uses as keys */
+#define KEY(i)              ((void *)(uintptr_t)(((i) + 1) * 8))
+#define DATA(i)             ((void *)(uintptr_t)((i) + 1))
+
+static int s_hash_calls;
+static int s_keys_freed;
+static int s_data_freed;
+
+static hash_index_t counting_hash(const void *key)
+{
+    s_hash_calls++;
+    return hash_function_pointer(key);
+}
+
+static hash_index_t constant_hash(const void *key)
+{
+    return 42;
+}
+
+static void count_key_free(void *key)
+{
+    s_keys_freed++;
+}
+
+static void count_data_free(void *data)
+{
+    s_data_freed++;
+}
+
+static bool string_equal(const void *x, const void *y)
+{
+    return strcmp((const char *)x, (const char *)y) == 0;
+}
+
+static void test_hash_map_set_get_erase(void)
+{
+    hash_map_t *map = hash_map_new(4, hash_function_pointer, count_key_free, count_data_free, NULL);
+    s_keys_freed = s_data_freed = 0;
+
+    TEST_ASSERT_NULL(hash_map_get(map, KEY(0)));
+    TEST_ASSERT_TRUE(hash_map_set(map, KEY(0), DATA(0)));
+    TEST_ASSERT_TRUE(hash_map_set(map, KEY(1), DATA(1)));
+    TEST_ASSERT_TRUE(hash_map_has_key(map, KEY(0)));
+    TEST_ASSERT_TRUE(hash_map_get(map, KEY(1)) == DATA(1));
+
+    /* replacing frees the old key and data, as erasing does */
+    TEST_ASSERT_TRUE(hash_map_set(map, KEY(1), DATA(7)));
+    TEST_ASSERT_TRUE(hash_map_get(map, KEY(1)) == DATA(7));
+    TEST_ASSERT_EQUAL(1, s_keys_freed);
+    TEST_ASSERT_EQUAL(1, s_data_freed);
+
+    TEST_ASSERT_TRUE(hash_map_erase(map, KEY(0)));
+    TEST_ASSERT_FALSE(hash_map_erase(map, KEY(0)));
+    TEST_ASSERT_FALSE(hash_map_has_key(map, KEY(0)));
+    TEST_ASSERT_EQUAL(2, s_data_freed);
+
+    hash_map_free(map);
+    TEST_ASSERT_EQUAL(3, s_keys_freed);
+    TEST_ASSERT_EQUAL(3, s_data_freed);
+}
+
+static bool count_entry(hash_map_entry_t *entry, void *context)
+{
+    uint32_t *seen = (uint32_t *)context;
+    uint32_t i = (uint32_t)((uintptr_t)entry->key / 8 - 1);
+    if (entry->data == DATA(i) && i < GROW_KEYS) {
+        seen[i]++;
+    }
+    return true;
+}
+
+static void test_hash_map_grows_incrementally(void)
+{
+    hash_map_t *map = hash_map_new(8, counting_hash, NULL, NULL, NULL);
+    s_hash_calls = 0;
+
+    for (int i = 0; i < GROW_KEYS; i++) {
+        TEST_ASSERT_TRUE(hash_map_set(map, KEY(i), DATA(i)));
+        /* keys already moved and keys still in the old table are both found */
+        TEST_ASSERT_TRUE(hash_map_get(map, KEY(i - i / 4)) == DATA(i - i / 4));
+        TEST_ASSERT_TRUE(hash_map_get(map, KEY(i)) == DATA(i));
+        /* drop every third key again, while the table grows */
+        if (i % 3 == 0) {
+            TEST_ASSERT_TRUE(hash_map_erase(map, KEY(i / 3)));
+        }
+    }
+    /* the hash of a key is computed once per call, growing doesn't rehash the keys */
+    TEST_ASSERT_EQUAL(GROW_KEYS * 3 + (GROW_KEYS + 2) / 3, s_hash_calls);
+    /* and no call cleared or moved more than its share of the tables */
+    TEST_ASSERT_TRUE(hash_map_max_step_slots(map) > 0);
+    TEST_ASSERT_LESS_OR_EQUAL(HASH_MAP_CLEAR_SLOTS + HASH_MAP_MIGRATE_SLOTS, hash_map_max_step_slots(map));
+
+    static uint32_t seen[GROW_KEYS];
+    memset(seen, 0, sizeof(seen));
+    hash_map_foreach(map, count_entry, seen);
+    for (int i = 0; i < GROW_KEYS; i++) {
+        bool erased = i <= (GROW_KEYS - 1) / 3;
+        TEST_ASSERT_EQUAL(erased ? 0 : 1, seen[i]);
+        TEST_ASSERT_EQUAL(!erased, hash_map_has_key(map, KEY(i)));
+    }
+
+    hash_map_clear(map);
+    TEST_ASSERT_FALSE(hash_map_has_key(map, KEY(GROW_KEYS - 1)));
+    TEST_ASSERT_TRUE(hash_map_set(map, KEY(0), DATA(0)));
+    TEST_ASSERT_TRUE(hash_map_get(map, KEY(0)) == DATA(0));
+    hash_map_free(map);
+}
+
+static void test_hash_map_colliding_and_string_keys(void)
+{
+    hash_map_t *map = hash_map_new(8, constant_hash, NULL, NULL, NULL);
+    for (int i = 0; i < 200; i++) {
+        TEST_ASSERT_TRUE(hash_map_set(map, KEY(i), DATA(i)));
+    }
+    for (int i = 0; i < 200; i += 2) {
+        TEST_ASSERT_TRUE(hash_map_erase(map, KEY(i)));
+    }
+    for (int i = 0; i < 200; i++) {
+        TEST_ASSERT_TRUE(hash_map_get(map, KEY(i)) == (i % 2 ? DATA(i) : NULL));
+    }
+    hash_map_free(map);
+
+    map = hash_map_new(8, hash_function_string, NULL, NULL, string_equal);
+    char key[] = "device-00";
+    TEST_ASSERT_TRUE(hash_map_set(map, "device-01", DATA(1)));
+    TEST_ASSERT_TRUE(hash_map_set(map, "device-02", DATA(2)));
+    key[8] = '2';
+    TEST_ASSERT_TRUE(hash_map_get(map, key) == DATA(2));
+    key[8] = '3';
+    TEST_ASSERT_NULL(hash_map_get(map, key));
+    hash_map_free(map);
+}
+
+static size_t heap_in_use(void)
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+typedef struct {
+    const char *name;
+    void *(*new_map)(size_t size);
+    bool (*set)(void *map, const void *key, void *data);
+    void *(*get)(void *map, const void *key);
+    bool (*erase)(void *map, const void *key);
+    void (*free_map)(void *map);
+} map_ops_t;
+
+static void *oa_new(size_t size)
+{
+    return hash_map_new(size, hash_function_pointer, NULL, NULL, NULL);
+}
+
+static bool oa_set(void *map, const void *key, void *data)
+{
+    return hash_map_set((hash_map_t *)map, key, data);
+}
+
+static void *oa_get(void *map, const void *key)
+{
+    return hash_map_get((hash_map_t *)map, key);
+}
+
+static bool oa_erase(void *map, const void *key)
+{
+    return hash_map_erase((hash_map_t *)map, key);
+}
+
+static void oa_free(void *map)
+{
+    hash_map_free((hash_map_t *)map);
+}
+
+static void *list_new_map(size_t size)
+{
+    return list_hash_map_new(size, hash_function_pointer, NULL, NULL, NULL);
+}
+
+static bool list_set(void *map, const void *key, void *data)
+{
+    return list_hash_map_set((list_hash_map_t *)map, key, data);
+}
+
+static void *list_get(void *map, const void *key)
+{
+    return list_hash_map_get((list_hash_map_t *)map, key);
+}
+
+static bool list_erase(void *map, const void *key)
+{
+    return list_hash_map_erase((list_hash_map_t *)map, key);
+}
+
+static void list_free_map(void *map)
+{
+    list_hash_map_free((list_hash_map_t *)map);
+}
+
+static const map_ops_t s_maps[] = {
+    { "list_buckets", list_new_map, list_set, list_get, list_erase, list_free_map },
+    { "open_addressing", oa_new, oa_set, oa_get, oa_erase, oa_free },
+};
+
+/* Each run is repeated, the time of a set is the least it took in any round, so
+ * a preemption of the test doesn't pass for a stall */
+static uint64_t s_set_ns[BENCH_MAX_KEYS];
+
+/* |size| is what the stack passes, e.g. 34 for the BTU alarm maps */
+static void bench_map(const map_ops_t *ops, size_t size, int keys)
+{
+    size_t bytes = 0;
+    uint64_t set_ns = 0, get_ns = 0, erase_ns = 0;
+    int found = 0;
+
+    for (int i = 0; i < keys; i++) {
+        s_set_ns[i] = UINT64_MAX;
+    }
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        size_t heap_before = heap_in_use();
+        void *map = ops->new_map(size);
+
+        uint64_t start = test_osi_now_ns();
+        for (int i = 0; i < keys; i++) {
+            uint64_t set_start = test_osi_now_ns();
+            ops->set(map, KEY(i), DATA(i));
+            uint64_t ns = test_osi_now_ns() - set_start;
+            s_set_ns[i] = ns < s_set_ns[i] ? ns : s_set_ns[i];
+        }
+        set_ns += test_osi_now_ns() - start;
+        bytes = heap_in_use() - heap_before;
+
+        start = test_osi_now_ns();
+        for (int lookup = 0; lookup < BENCH_LOOKUPS; lookup++) {
+            for (int i = 0; i < keys; i++) {
+                found += ops->get(map, KEY(i)) != NULL;
+                found += ops->get(map, KEY(i + keys)) != NULL;
+            }
+        }
+        get_ns += test_osi_now_ns() - start;
+
+        start = test_osi_now_ns();
+        for (int i = 0; i < keys; i++) {
+            ops->erase(map, KEY(i));
+        }
+        erase_ns += test_osi_now_ns() - start;
+        ops->free_map(map);
+    }
+
+    uint64_t worst_set_ns = 0;
+    for (int i = 0; i < keys; i++) {
+        worst_set_ns = s_set_ns[i] > worst_set_ns ? s_set_ns[i] : worst_set_ns;
+    }
+    TEST_ASSERT_EQUAL(keys * BENCH_LOOKUPS * BENCH_ROUNDS, found);
+    printf("{\"bench\": \"hash_map\", \"impl\": \"%s\", \"size\": %zu, \"keys\": %d, \"bytes\": %zu, "
+           "\"set_ns\": %.1f, \"worst_set_ns\": %" PRIu64 ", \"get_ns\": %.1f, \"erase_ns\": %.1f}\n",
+           ops->name, size, keys, bytes, (double)set_ns / keys / BENCH_ROUNDS, worst_set_ns,
+           (double)get_ns / (2.0 * keys * BENCH_LOOKUPS * BENCH_ROUNDS), (double)erase_ns / keys / BENCH_ROUNDS);
+}
+
+static void bench_hash_map(void)
+{
+    const int key_counts[] = { 16, 64, BENCH_MAX_KEYS };
+    for (int k = 0; k < sizeof(key_counts) / sizeof(key_counts[0]); k++) {
+        for (int m = 0; m < sizeof(s_maps) / sizeof(s_maps[0]); m++) {
+            bench_map(&s_maps[m], 34, key_counts[k]);
+        }
+    }
+}
+
+void run_hash_map_tests(void)
+{
+    RUN_TEST(test_hash_map_set_get_erase);
+    RUN_TEST(test_hash_map_grows_incrementally);
+    RUN_TEST(test_hash_map_colliding_and_string_keys);
+    RUN_TEST(bench_hash_map);
+}
@@ -0,0 +1,245 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "unity.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "osi/mem_prof.h"
+#include "test_osi.h"
+
+/* aligned like heap blocks, the profiler never touches the memory */
+#define PTR(i)              ((void *)(uintptr_t)(((i) + 1) * 16))
+#define CHURN_PTRS          2000
+#define BENCH_PAIRS         200000
+
+/* each call site is a line of its own, as with osi_malloc */
+static void alloc_small(void *p, size_t size)
+{
+    osi_mem_prof_alloc(p, size, __func__, __LINE__);
+}
+
+static void alloc_large(void *p, size_t size)
+{
+    osi_mem_prof_alloc(p, size, __func__, __LINE__);
+}
+
+static void test_mem_prof_sites_and_size_classes(void)
+{
+    osi_mem_prof_stats_t stats;
+    osi_mem_prof_site_t sites[4];
+
+    TEST_ASSERT_TRUE(osi_mem_prof_start(16));
+    TEST_ASSERT_TRUE(osi_mem_prof_is_running());
+
+    alloc_small(PTR(0), 1);
+    alloc_small(PTR(1), 8);
+    alloc_small(PTR(2), 9);
+    alloc_small(PTR(3), 16);
+    alloc_large(PTR(4), 17);
+    alloc_large(PTR(5), 100000);
+    alloc_small(NULL, 32);
+    osi_mem_prof_free(PTR(1));
+    osi_mem_prof_free(PTR(5));
+    /* allocated before the start, so not followed */
+    osi_mem_prof_free(PTR(9));
+    osi_mem_prof_free(NULL);
+
+    osi_mem_prof_get_stats(&stats);
+    TEST_ASSERT_TRUE(stats.running);
+    TEST_ASSERT_EQUAL(6, stats.allocs);
+    TEST_ASSERT_EQUAL(2, stats.frees);
+    TEST_ASSERT_EQUAL(1, stats.failed);
+    TEST_ASSERT_EQUAL(0, stats.untracked);
+    TEST_ASSERT_EQUAL(2, stats.sites);
+    TEST_ASSERT_EQUAL(1 + 9 + 16 + 17, stats.live_bytes);
+    TEST_ASSERT_EQUAL(1 + 8 + 9 + 16 + 17 + 100000, stats.peak_live_bytes);
+    TEST_ASSERT_EQUAL(2, stats.size_classes[0]);
+    TEST_ASSERT_EQUAL(2, stats.size_classes[1]);
+    TEST_ASSERT_EQUAL(1, stats.size_classes[2]);
+    TEST_ASSERT_EQUAL(1, stats.size_classes[OSI_MEM_PROF_SIZE_CLASSES - 1]);
+
+    /* the site with the most bytes comes first */
+    TEST_ASSERT_EQUAL(2, osi_mem_prof_get_sites(sites, 4));
+    TEST_ASSERT_EQUAL_STRING("alloc_large", sites[0].func);
+    TEST_ASSERT_EQUAL(2, sites[0].allocs);
+    TEST_ASSERT_EQUAL(1, sites[0].frees);
+    TEST_ASSERT_EQUAL(17, sites[0].live_bytes);
+    TEST_ASSERT_EQUAL(100017, sites[0].peak_live_bytes);
+    TEST_ASSERT_EQUAL_STRING("alloc_small", sites[1].func);
+    TEST_ASSERT_EQUAL(4, sites[1].allocs);
+    TEST_ASSERT_EQUAL(3, sites[1].live);
+    TEST_ASSERT_EQUAL(1, osi_mem_prof_get_sites(sites, 1));
+
+    /* nothing is recorded while stopped, the profile stays */
+    osi_mem_prof_stop();
+    TEST_ASSERT_FALSE(osi_mem_prof_is_running());
+    alloc_small(PTR(6), 64);
+    osi_mem_prof_free(PTR(0));
+    osi_mem_prof_get_stats(&stats);
+    TEST_ASSERT_FALSE(stats.running);
+    TEST_ASSERT_EQUAL(6, stats.allocs);
+    TEST_ASSERT_EQUAL(2, stats.frees);
+    osi_mem_prof_dump();
+
+    /* a new start drops it */
+    TEST_ASSERT_TRUE(osi_mem_prof_start(16));
+    osi_mem_prof_get_stats(&stats);
+    TEST_ASSERT_EQUAL(0, stats.allocs);
+    TEST_ASSERT_EQUAL(0, stats.sites);
+    osi_mem_prof_stop();
+}
+
+static void test_mem_prof_follows_up_to_max_live(void)
+{
+    osi_mem_prof_stats_t stats;
+    TEST_ASSERT_TRUE(osi_mem_prof_start(4));
+
+    for (int i = 0; i < 6; i++) {
+        alloc_small(PTR(i), 10);
+    }
+    for (int i = 0; i < 6; i++) {
+        osi_mem_prof_free(PTR(i));
+    }
+    osi_mem_prof_get_stats(&stats);
+    TEST_ASSERT_EQUAL(6, stats.allocs);
+    TEST_ASSERT_EQUAL(2, stats.untracked);
+    TEST_ASSERT_EQUAL(4, stats.frees);
+    TEST_ASSERT_EQUAL(0, stats.live_bytes);
+    TEST_ASSERT_EQUAL(40, stats.peak_live_bytes);
+
+    /* the freed room is used again */
+    alloc_small(PTR(7), 10);
+    osi_mem_prof_get_stats(&stats);
+    TEST_ASSERT_EQUAL(10, stats.live_bytes);
+    osi_mem_prof_stop();
+}
+
+static void test_mem_prof_sites_past_the_table(void)
+{
+    osi_mem_prof_site_t sites[OSI_MEM_PROF_MAX_SITES + 1];
+    osi_mem_prof_stats_t stats;
+    TEST_ASSERT_TRUE(osi_mem_prof_start(128));
+
+    for (int line = 0; line < OSI_MEM_PROF_MAX_SITES + 10; line++) {
+        osi_mem_prof_alloc(PTR(line), 100 + line, "many_sites", line);
+    }
+    osi_mem_prof_get_stats(&stats);
+    TEST_ASSERT_EQUAL(OSI_MEM_PROF_MAX_SITES, stats.sites);
+
+    /* the last ten share the site without a function, which has the most bytes */
+    TEST_ASSERT_EQUAL(OSI_MEM_PROF_MAX_SITES + 1, osi_mem_prof_get_sites(sites, OSI_MEM_PROF_MAX_SITES + 1));
+    TEST_ASSERT_NULL(sites[0].func);
+    TEST_ASSERT_EQUAL(10, sites[0].allocs);
+    TEST_ASSERT_EQUAL_STRING("many_sites", sites[1].func);
+    TEST_ASSERT_EQUAL(OSI_MEM_PROF_MAX_SITES - 1, sites[1].line);
+    osi_mem_prof_stop();
+}
+
+static void test_mem_prof_churn(void)
+{
+    osi_mem_prof_site_t sites[4];
+    TEST_ASSERT_TRUE(osi_mem_prof_start(CHURN_PTRS));
+
+    /* one site frees right away, the other holds on past the short lived time */
+    for (int i = 0; i < 20; i++) {
+        alloc_small(PTR(i), 24);
+        osi_mem_prof_free(PTR(i));
+    }
+    for (int i = 0; i < 5; i++) {
+        alloc_large(PTR(100 + i), 24);
+    }
+    vTaskDelay(2 * OSI_MEM_PROF_SHORT_LIVED_US / 1000 + 1);
+    for (int i = 0; i < 5; i++) {
+        osi_mem_prof_free(PTR(100 + i));
+    }
+
+    TEST_ASSERT_EQUAL(1, osi_mem_prof_get_churn(sites, 4));
+    TEST_ASSERT_EQUAL_STRING("alloc_small", sites[0].func);
+    TEST_ASSERT_EQUAL(20, sites[0].short_lived);
+
+    /* random frees out of order keep the live table consistent */
+    static uint8_t live[CHURN_PTRS];
+    memset(live, 0, sizeof(live));
+    uint32_t live_bytes = 0;
+    srand(1);
+    for (int i = 0; i < 50 * CHURN_PTRS; i++) {
+        int p = rand() % CHURN_PTRS;
+        if (live[p]) {
+            osi_mem_prof_free(PTR(1000 + p));
+            live_bytes -= 1 + p % 200;
+        } else {
+            alloc_small(PTR(1000 + p), 1 + p % 200);
+            live_bytes += 1 + p % 200;
+        }
+        live[p] = !live[p];
+    }
+    osi_mem_prof_stats_t stats;
+    osi_mem_prof_get_stats(&stats);
+    TEST_ASSERT_EQUAL(0, stats.untracked);
+    TEST_ASSERT_EQUAL(live_bytes, stats.live_bytes);
+    osi_mem_prof_stop();
+}
+
+static uint64_t time_pairs(void)
+{
+    void *blocks[16];
+    uint64_t start = test_osi_now_ns();
+    for (int i = 0; i < BENCH_PAIRS / 16; i++) {
+        for (int j = 0; j < 16; j++) {
+            blocks[j] = malloc(32 + j);
+            osi_mem_prof_alloc(blocks[j], 32 + j, __func__, __LINE__);
+        }
+        for (int j = 0; j < 16; j++) {
+            osi_mem_prof_free(blocks[j]);
+            free(blocks[j]);
+        }
+    }
+    return test_osi_now_ns() - start;
+}
+
+/* What the hooks add to an osi_malloc and osi_free pair, stopped and running */
+static void bench_mem_prof_overhead(void)
+{
+    void *blocks[16];
+    uint64_t start = test_osi_now_ns();
+    for (int i = 0; i < BENCH_PAIRS / 16; i++) {
+        for (int j = 0; j < 16; j++) {
+            blocks[j] = malloc(32 + j);
+        }
+        for (int j = 0; j < 16; j++) {
+            free(blocks[j]);
+        }
+    }
+    uint64_t plain_ns = test_osi_now_ns() - start;
+
+    uint64_t stopped_ns = time_pairs();
+    TEST_ASSERT_TRUE(osi_mem_prof_start(512));
+    uint64_t running_ns = time_pairs();
+    osi_mem_prof_stop();
+
+    osi_mem_prof_stats_t stats;
+    osi_mem_prof_get_stats(&stats);
+    TEST_ASSERT_EQUAL(BENCH_PAIRS, stats.allocs);
+    TEST_ASSERT_EQUAL(BENCH_PAIRS, stats.frees);
+
+    printf("{\"bench\": \"mem_prof\", \"pairs\": %d, \"malloc_free_ns\": %.1f, \"stopped_ns\": %.1f, "
+           "\"running_ns\": %.1f}\n",
+           BENCH_PAIRS, (double)plain_ns / BENCH_PAIRS, (double)stopped_ns / BENCH_PAIRS,
+           (double)running_ns / BENCH_PAIRS);
+}
+
+void run_mem_prof_tests(void)
+{
+    RUN_TEST(test_mem_prof_sites_and_size_classes);
+    RUN_TEST(test_mem_prof_follows_up_to_max_live);
+    RUN_TEST(test_mem_prof_sites_past_the_table);
+    RUN_TEST(test_mem_prof_churn);
+    RUN_TEST(bench_mem_prof_overhead);
+}
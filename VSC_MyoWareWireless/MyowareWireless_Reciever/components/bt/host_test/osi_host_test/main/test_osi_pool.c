@@ -0,0 +1,280 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "unity.h"
+#include "bt_common.h"
+#include "osi/allocator.h"
+#include "osi/fixed_queue.h"
+#include "osi/list.h"
+#include "osi/pool.h"
+#include "test_osi.h"
+
+#define TEST_BLOCKS         8
+#define TEST_THREADS        4
+#define TEST_THREAD_ROUNDS  100000
+#define BENCH_ROUNDS        1000000
+
+typedef struct {
+    uint32_t word[4];
+} test_block_t;
+
+/* same layout as a list node */
+typedef struct {
+    void *next;
+    void *data;
+} bench_node_t;
+
+static test_block_t s_blocks[TEST_BLOCKS];
+
+/* keeps the compiler from dropping the allocations of the benchmark */
+static void *volatile s_sink;
+
+static void test_pool_hands_out_each_block_once(void)
+{
+    osi_pool_t pool;
+    osi_pool_init(&pool, s_blocks, sizeof(test_block_t), TEST_BLOCKS);
+
+    void *blocks[TEST_BLOCKS];
+    for (int i = 0; i < TEST_BLOCKS; i++) {
+        blocks[i] = osi_pool_alloc(&pool);
+        TEST_ASSERT_TRUE(osi_pool_owns(&pool, blocks[i]));
+        for (int j = 0; j < i; j++) {
+            TEST_ASSERT_TRUE(blocks[i] != blocks[j]);
+        }
+    }
+
+    /* freed blocks come back last in, first out */
+    osi_pool_free(&pool, blocks[3]);
+    osi_pool_free(&pool, blocks[5]);
+    TEST_ASSERT_TRUE(osi_pool_alloc(&pool) == blocks[5]);
+    TEST_ASSERT_TRUE(osi_pool_alloc(&pool) == blocks[3]);
+
+    osi_pool_stats_t stats;
+    osi_pool_get_stats(&pool, &stats);
+    TEST_ASSERT_EQUAL(TEST_BLOCKS + 2, stats.pool_allocs);
+    TEST_ASSERT_EQUAL(0, stats.heap_allocs);
+    TEST_ASSERT_EQUAL(2, stats.frees);
+    TEST_ASSERT_EQUAL(TEST_BLOCKS, stats.in_use);
+    TEST_ASSERT_EQUAL(TEST_BLOCKS, stats.max_in_use);
+}
+
+static void test_pool_falls_back_to_heap(void)
+{
+    osi_pool_t pool;
+    osi_pool_init(&pool, s_blocks, sizeof(test_block_t), 2);
+
+    void *a = osi_pool_alloc(&pool);
+    void *b = osi_pool_alloc(&pool);
+    void *c = osi_pool_alloc(&pool);
+    TEST_ASSERT_NOT_NULL(c);
+    TEST_ASSERT_TRUE(osi_pool_owns(&pool, a));
+    TEST_ASSERT_TRUE(osi_pool_owns(&pool, b));
+    TEST_ASSERT_FALSE(osi_pool_owns(&pool, c));
+
+    osi_pool_free(&pool, c);
+    osi_pool_free(&pool, a);
+    osi_pool_free(&pool, NULL);
+    TEST_ASSERT_TRUE(osi_pool_alloc(&pool) == a);
+
+    osi_pool_stats_t stats;
+    osi_pool_get_stats(&pool, &stats);
+    TEST_ASSERT_EQUAL(3, stats.pool_allocs);
+    TEST_ASSERT_EQUAL(1, stats.heap_allocs);
+    TEST_ASSERT_EQUAL(0, stats.failed_allocs);
+    TEST_ASSERT_EQUAL(2, stats.frees);
+    TEST_ASSERT_EQUAL(2, stats.in_use);
+
+    /* a pool without blocks is a plain heap allocator */
+    osi_pool_t empty;
+    osi_pool_init(&empty, NULL, sizeof(test_block_t), 0);
+    void *d = osi_pool_alloc(&empty);
+    TEST_ASSERT_NOT_NULL(d);
+    TEST_ASSERT_FALSE(osi_pool_owns(&empty, d));
+    osi_pool_free(&empty, d);
+    osi_pool_get_stats(&empty, &stats);
+    TEST_ASSERT_EQUAL(0, stats.pool_allocs);
+    TEST_ASSERT_EQUAL(1, stats.heap_allocs);
+}
+
+static void test_pool_static_initializer(void)
+{
+    static test_block_t blocks[3];
+    static osi_pool_t pool = OSI_POOL_INITIALIZER(blocks, 3);
+
+    void *a = osi_pool_alloc(&pool);
+    TEST_ASSERT_TRUE(a == &blocks[0]);
+    TEST_ASSERT_TRUE(osi_pool_alloc(&pool) == &blocks[1]);
+    osi_pool_free(&pool, a);
+    TEST_ASSERT_TRUE(osi_pool_alloc(&pool) == a);
+    TEST_ASSERT_TRUE(osi_pool_alloc(&pool) == &blocks[2]);
+}
+
+typedef struct {
+    osi_pool_t *pool;
+    uint32_t id;
+    int errors;
+} thread_arg_t;
+
+static void *pool_thread(void *arg)
+{
+    thread_arg_t *t = (thread_arg_t *)arg;
+    test_block_t *held[2];
+
+    for (int round = 0; round < TEST_THREAD_ROUNDS; round++) {
+        for (int i = 0; i < 2; i++) {
+            held[i] = (test_block_t *)osi_pool_alloc(t->pool);
+            for (int w = 0; w < 4; w++) {
+                held[i]->word[w] = t->id;
+            }
+        }
+        /* another thread holding the same block would have overwritten it */
+        for (int i = 0; i < 2; i++) {
+            for (int w = 0; w < 4; w++) {
+                if (held[i]->word[w] != t->id) {
+                    t->errors++;
+                }
+            }
+            osi_pool_free(t->pool, held[i]);
+        }
+    }
+    return NULL;
+}
+
+static void test_pool_concurrent_alloc_free(void)
+{
+    osi_pool_t pool;
+    osi_pool_init(&pool, s_blocks, sizeof(test_block_t), TEST_BLOCKS);
+
+    pthread_t threads[TEST_THREADS];
+    thread_arg_t args[TEST_THREADS];
+    for (int i = 0; i < TEST_THREADS; i++) {
+        args[i] = (thread_arg_t) { .pool = &pool, .id = i + 1, .errors = 0 };
+        TEST_ASSERT_EQUAL(0, pthread_create(&threads[i], NULL, pool_thread, &args[i]));
+    }
+    for (int i = 0; i < TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        TEST_ASSERT_EQUAL(0, args[i].errors);
+    }
+
+    osi_pool_stats_t stats;
+    osi_pool_get_stats(&pool, &stats);
+    TEST_ASSERT_EQUAL(0, stats.in_use);
+    TEST_ASSERT_EQUAL(TEST_THREADS * TEST_THREAD_ROUNDS * 2, stats.pool_allocs + stats.heap_allocs);
+    TEST_ASSERT_EQUAL(TEST_THREADS * TEST_THREAD_ROUNDS * 2, stats.frees);
+    TEST_ASSERT_LESS_OR_EQUAL(TEST_BLOCKS, stats.max_in_use);
+}
+
+static void test_list_nodes_come_from_pool(void)
+{
+    osi_pool_stats_t before, after;
+    list_get_node_pool_stats(&before);
+
+    list_t *list = list_new(NULL);
+    static int values[4];
+    for (int i = 0; i < 4; i++) {
+        TEST_ASSERT_TRUE(list_append(list, &values[i]));
+    }
+    list_get_node_pool_stats(&after);
+    TEST_ASSERT_EQUAL(before.pool_allocs + 4, after.pool_allocs);
+    TEST_ASSERT_EQUAL(before.heap_allocs, after.heap_allocs);
+    TEST_ASSERT_EQUAL(before.in_use + 4, after.in_use);
+
+    TEST_ASSERT_TRUE(list_remove(list, &values[1]));
+    TEST_ASSERT_EQUAL(3, list_length(list));
+    list_free(list);
+    list_get_node_pool_stats(&after);
+    TEST_ASSERT_EQUAL(before.frees + 4, after.frees);
+    TEST_ASSERT_EQUAL(before.in_use, after.in_use);
+}
+
+static void test_fixed_queue_keeps_order(void)
+{
+    fixed_queue_t *queue = fixed_queue_new(SIZE_MAX);
+    static int values[16];
+    for (int i = 0; i < 16; i++) {
+        TEST_ASSERT_TRUE(fixed_queue_enqueue(queue, &values[i], 0));
+    }
+    for (int i = 0; i < 16; i++) {
+        TEST_ASSERT_TRUE(fixed_queue_dequeue(queue, 0) == &values[i]);
+    }
+    TEST_ASSERT_TRUE(fixed_queue_is_empty(queue));
+    fixed_queue_free(queue, NULL);
+}
+
+static void bench_node_alloc(void)
+{
+    static bench_node_t blocks[1];
+    osi_pool_t pool;
+    osi_pool_init(&pool, blocks, sizeof(bench_node_t), 1);
+
+    uint64_t start = test_osi_now_ns();
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        s_sink = osi_calloc(sizeof(bench_node_t));
+        osi_free(s_sink);
+    }
+    uint64_t heap_ns = test_osi_now_ns() - start;
+
+    start = test_osi_now_ns();
+    for (int i = 0; i < BENCH_ROUNDS; i++) {
+        s_sink = osi_pool_alloc(&pool);
+        osi_pool_free(&pool, s_sink);
+    }
+    uint64_t pool_ns = test_osi_now_ns() - start;
+
+    printf("{\"bench\": \"node_alloc\", \"rounds\": %d, \"heap_ns_per_op\": %.1f, \"pool_ns_per_op\": %.1f}\n",
+           BENCH_ROUNDS, (double)heap_ns / BENCH_ROUNDS, (double)pool_ns / BENCH_ROUNDS);
+}
+
+static void bench_fixed_queue_depth(size_t depth)
+{
+    static int value;
+    fixed_queue_t *queue = fixed_queue_new(SIZE_MAX);
+    osi_pool_stats_t before, after;
+    list_get_node_pool_stats(&before);
+
+    const int rounds = BENCH_ROUNDS / (int)depth;
+    uint64_t start = test_osi_now_ns();
+    for (int r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < depth; i++) {
+            fixed_queue_enqueue(queue, &value, 0);
+        }
+        for (size_t i = 0; i < depth; i++) {
+            fixed_queue_dequeue(queue, 0);
+        }
+    }
+    uint64_t ns = test_osi_now_ns() - start;
+    list_get_node_pool_stats(&after);
+    fixed_queue_free(queue, NULL);
+
+    const double ops = (double)rounds * depth;
+    printf("{\"bench\": \"fixed_queue\", \"depth\": %zu, \"ops\": %.0f, \"mops_per_s\": %.2f, "
+           "\"pool_allocs\": %" PRIu32 ", \"heap_allocs\": %" PRIu32 "}\n",
+           depth, ops, ops * 1000.0 / ns,
+           after.pool_allocs - before.pool_allocs, after.heap_allocs - before.heap_allocs);
+}
+
+static void bench_fixed_queue(void)
+{
+    bench_fixed_queue_depth(8);
+    bench_fixed_queue_depth(UC_BT_OSI_LIST_NODE_POOL_SIZE > 0 ? UC_BT_OSI_LIST_NODE_POOL_SIZE : 1);
+    bench_fixed_queue_depth(4 * (UC_BT_OSI_LIST_NODE_POOL_SIZE > 0 ? UC_BT_OSI_LIST_NODE_POOL_SIZE : 1));
+}
+
+void run_pool_tests(void)
+{
+    RUN_TEST(test_pool_hands_out_each_block_once);
+    RUN_TEST(test_pool_falls_back_to_heap);
+    RUN_TEST(test_pool_static_initializer);
+    RUN_TEST(test_pool_concurrent_alloc_free);
+    RUN_TEST(test_list_nodes_come_from_pool);
+    RUN_TEST(test_fixed_queue_keeps_order);
+    RUN_TEST(bench_node_alloc);
+    RUN_TEST(bench_fixed_queue);
+}
@@ -0,0 +1,280 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include "unity.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "osi/fixed_queue.h"
+#include "osi/semaphore.h"
+#include "osi/spsc_queue.h"
+#include "test_osi.h"
+
+#define STRESS_ITEMS        200000
+#define BENCH_ITEMS         200000
+#define BENCH_PINGS         20000
+#define BENCH_CAPACITY      64
+#define TASK_STACK_SIZE     4096
+#define TASK_PRIORITY       5
+
+/* elements are counters, 0 would be NULL */
+#define ITEM(i)             ((void *)(uintptr_t)((i) + 1))
+#define ITEM_INDEX(p)       ((uint32_t)(uintptr_t)(p) - 1)
+
+static void test_spsc_queue_fifo_and_bounds(void)
+{
+    spsc_queue_t *queue = spsc_queue_new(10);
+    TEST_ASSERT_NOT_NULL(queue);
+    TEST_ASSERT_EQUAL(10, spsc_queue_capacity(queue));
+    TEST_ASSERT_TRUE(spsc_queue_is_empty(queue));
+    TEST_ASSERT_NULL(spsc_queue_try_dequeue(queue));
+    TEST_ASSERT_NULL(spsc_queue_try_peek_first(queue));
+
+    /* go round the ring of 16 slots a few times */
+    uint32_t next_in = 0, next_out = 0;
+    for (int round = 0; round < 10; round++) {
+        while (spsc_queue_enqueue(queue, ITEM(next_in), 0)) {
+            next_in++;
+        }
+        TEST_ASSERT_EQUAL(10, spsc_queue_length(queue));
+        for (int i = 0; i < 7; i++) {
+            TEST_ASSERT_TRUE(spsc_queue_try_peek_first(queue) == ITEM(next_out));
+            TEST_ASSERT_TRUE(spsc_queue_try_dequeue(queue) == ITEM(next_out));
+            next_out++;
+        }
+        TEST_ASSERT_EQUAL(3, spsc_queue_length(queue));
+    }
+    while (!spsc_queue_is_empty(queue)) {
+        TEST_ASSERT_TRUE(spsc_queue_dequeue(queue, 0) == ITEM(next_out));
+        next_out++;
+    }
+    TEST_ASSERT_EQUAL(next_in, next_out);
+    spsc_queue_free(queue, NULL);
+
+    TEST_ASSERT_NULL(spsc_queue_new(0));
+    TEST_ASSERT_EQUAL(0, spsc_queue_length(NULL));
+    TEST_ASSERT_TRUE(spsc_queue_is_empty(NULL));
+}
+
+static void test_spsc_queue_timeout(void)
+{
+    spsc_queue_t *queue = spsc_queue_new(1);
+
+    uint64_t start = test_osi_now_ns();
+    TEST_ASSERT_NULL(spsc_queue_dequeue(queue, 50));
+    TEST_ASSERT_GREATER_OR_EQUAL(40 * 1000000ull, test_osi_now_ns() - start);
+
+    TEST_ASSERT_TRUE(spsc_queue_enqueue(queue, ITEM(0), 50));
+    start = test_osi_now_ns();
+    TEST_ASSERT_FALSE(spsc_queue_enqueue(queue, ITEM(1), 50));
+    TEST_ASSERT_GREATER_OR_EQUAL(40 * 1000000ull, test_osi_now_ns() - start);
+
+    spsc_queue_free(queue, NULL);
+}
+
+static int s_freed;
+
+static void count_free(void *data)
+{
+    s_freed++;
+}
+
+static void test_spsc_queue_free_cb(void)
+{
+    spsc_queue_t *queue = spsc_queue_new(4);
+    for (int i = 0; i < 6; i++) {
+        spsc_queue_enqueue(queue, ITEM(i), 0);
+        if (i % 2) {
+            spsc_queue_try_dequeue(queue);
+        }
+    }
+    s_freed = 0;
+    spsc_queue_free(queue, count_free);
+    TEST_ASSERT_EQUAL(3, s_freed);
+}
+
+/* Moves |count| counters through a queue from a producer task to a consumer task */
+typedef struct {
+    void *queue;
+    bool (*enqueue)(void *queue, void *data, uint32_t timeout);
+    void *(*dequeue)(void *queue, uint32_t timeout);
+    uint32_t count;
+    uint32_t errors;
+    osi_sem_t done;
+} transfer_t;
+
+static bool spsc_enqueue(void *queue, void *data, uint32_t timeout)
+{
+    return spsc_queue_enqueue((spsc_queue_t *)queue, data, timeout);
+}
+
+static void *spsc_dequeue(void *queue, uint32_t timeout)
+{
+    return spsc_queue_dequeue((spsc_queue_t *)queue, timeout);
+}
+
+static bool fixed_enqueue(void *queue, void *data, uint32_t timeout)
+{
+    return fixed_queue_enqueue((fixed_queue_t *)queue, data, timeout);
+}
+
+static void *fixed_dequeue(void *queue, uint32_t timeout)
+{
+    return fixed_queue_dequeue((fixed_queue_t *)queue, timeout);
+}
+
+static void producer_task(void *arg)
+{
+    transfer_t *t = (transfer_t *)arg;
+    for (uint32_t i = 0; i < t->count; i++) {
+        if (!t->enqueue(t->queue, ITEM(i), SPSC_QUEUE_MAX_TIMEOUT)) {
+            t->errors++;
+        }
+        /* now and then let the consumer catch up, so both sides block */
+        if (i % 4096 == 0) {
+            vTaskDelay(1);
+        }
+    }
+    osi_sem_give(&t->done);
+    vTaskDelete(NULL);
+}
+
+static void consumer_task(void *arg)
+{
+    transfer_t *t = (transfer_t *)arg;
+    for (uint32_t i = 0; i < t->count; i++) {
+        void *data = t->dequeue(t->queue, SPSC_QUEUE_MAX_TIMEOUT);
+        if (data == NULL || ITEM_INDEX(data) != i) {
+            t->errors++;
+        }
+        if (i % 5000 == 0) {
+            vTaskDelay(1);
+        }
+    }
+    osi_sem_give(&t->done);
+    vTaskDelete(NULL);
+}
+
+static uint64_t run_transfer(transfer_t *t)
+{
+    osi_sem_new(&t->done, 2, 0);
+    uint64_t start = test_osi_now_ns();
+    xTaskCreate(consumer_task, "consumer", TASK_STACK_SIZE, t, TASK_PRIORITY, NULL);
+    xTaskCreate(producer_task, "producer", TASK_STACK_SIZE, t, TASK_PRIORITY, NULL);
+    osi_sem_take(&t->done, OSI_SEM_MAX_TIMEOUT);
+    osi_sem_take(&t->done, OSI_SEM_MAX_TIMEOUT);
+    uint64_t ns = test_osi_now_ns() - start;
+    osi_sem_free(&t->done);
+    return ns;
+}
+
+static void test_spsc_queue_stress(void)
+{
+    const size_t capacities[] = { 1, 3, 64 };
+    for (int i = 0; i < sizeof(capacities) / sizeof(capacities[0]); i++) {
+        spsc_queue_t *queue = spsc_queue_new(capacities[i]);
+        transfer_t t = {
+            .queue = queue, .enqueue = spsc_enqueue, .dequeue = spsc_dequeue,
+            .count = STRESS_ITEMS,
+        };
+        run_transfer(&t);
+        TEST_ASSERT_EQUAL(0, t.errors);
+        TEST_ASSERT_TRUE(spsc_queue_is_empty(queue));
+        spsc_queue_free(queue, NULL);
+    }
+}
+
+static void bench_throughput(void)
+{
+    spsc_queue_t *spsc = spsc_queue_new(BENCH_CAPACITY);
+    transfer_t t = {
+        .queue = spsc, .enqueue = spsc_enqueue, .dequeue = spsc_dequeue, .count = BENCH_ITEMS,
+    };
+    uint64_t spsc_ns = run_transfer(&t);
+    TEST_ASSERT_EQUAL(0, t.errors);
+    spsc_queue_free(spsc, NULL);
+
+    fixed_queue_t *fixed = fixed_queue_new(BENCH_CAPACITY);
+    t = (transfer_t) {
+        .queue = fixed, .enqueue = fixed_enqueue, .dequeue = fixed_dequeue, .count = BENCH_ITEMS,
+    };
+    uint64_t fixed_ns = run_transfer(&t);
+    TEST_ASSERT_EQUAL(0, t.errors);
+    fixed_queue_free(fixed, NULL);
+
+    printf("{\"bench\": \"queue_throughput\", \"items\": %d, \"capacity\": %d, "
+           "\"fixed_queue_mitems_per_s\": %.3f, \"spsc_queue_mitems_per_s\": %.3f}\n",
+           BENCH_ITEMS, BENCH_CAPACITY,
+           BENCH_ITEMS * 1000.0 / fixed_ns, BENCH_ITEMS * 1000.0 / spsc_ns);
+}
+
+/* Sends each ping back on a second queue, so every element wakes the other task */
+typedef struct {
+    void *ping;
+    void *pong;
+    bool (*enqueue)(void *queue, void *data, uint32_t timeout);
+    void *(*dequeue)(void *queue, uint32_t timeout);
+    osi_sem_t done;
+} echo_t;
+
+static void echo_task(void *arg)
+{
+    echo_t *e = (echo_t *)arg;
+    for (int i = 0; i < BENCH_PINGS; i++) {
+        e->enqueue(e->pong, e->dequeue(e->ping, SPSC_QUEUE_MAX_TIMEOUT), SPSC_QUEUE_MAX_TIMEOUT);
+    }
+    osi_sem_give(&e->done);
+    vTaskDelete(NULL);
+}
+
+static double run_ping_pong(echo_t *e)
+{
+    osi_sem_new(&e->done, 1, 0);
+    xTaskCreate(echo_task, "echo", TASK_STACK_SIZE, e, TASK_PRIORITY, NULL);
+    uint64_t start = test_osi_now_ns();
+    for (int i = 0; i < BENCH_PINGS; i++) {
+        e->enqueue(e->ping, ITEM(i), SPSC_QUEUE_MAX_TIMEOUT);
+        e->dequeue(e->pong, SPSC_QUEUE_MAX_TIMEOUT);
+    }
+    uint64_t ns = test_osi_now_ns() - start;
+    osi_sem_take(&e->done, OSI_SEM_MAX_TIMEOUT);
+    osi_sem_free(&e->done);
+    return (double)ns / BENCH_PINGS;
+}
+
+static void bench_latency(void)
+{
+    echo_t e = {
+        .ping = spsc_queue_new(1), .pong = spsc_queue_new(1),
+        .enqueue = spsc_enqueue, .dequeue = spsc_dequeue,
+    };
+    double spsc_ns = run_ping_pong(&e);
+    spsc_queue_free(e.ping, NULL);
+    spsc_queue_free(e.pong, NULL);
+
+    e = (echo_t) {
+        .ping = fixed_queue_new(1), .pong = fixed_queue_new(1),
+        .enqueue = fixed_enqueue, .dequeue = fixed_dequeue,
+    };
+    double fixed_ns = run_ping_pong(&e);
+    fixed_queue_free(e.ping, NULL);
+    fixed_queue_free(e.pong, NULL);
+
+    printf("{\"bench\": \"queue_round_trip\", \"pings\": %d, "
+           "\"fixed_queue_us\": %.2f, \"spsc_queue_us\": %.2f}\n",
+           BENCH_PINGS, fixed_ns / 1000.0, spsc_ns / 1000.0);
+}
+
+void run_spsc_queue_tests(void)
+{
+    RUN_TEST(test_spsc_queue_fifo_and_bounds);
+    RUN_TEST(test_spsc_queue_timeout);
+    RUN_TEST(test_spsc_queue_free_cb);
+    RUN_TEST(test_spsc_queue_stress);
+    RUN_TEST(bench_throughput);
+    RUN_TEST(bench_latency);
+}
@@ -0,0 +1,228 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "unity.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "osi/semaphore.h"
+#include "osi/thread.h"
+#include "test_osi.h"
+
+#define THREAD_STACK_SIZE   4096
+#define THREAD_PRIORITY     5
+#define ORDER_ITEMS         6
+#define BENCH_BURSTS        400
+#define BENCH_FLOOD_ITEMS   200000
+
+static osi_sem_t s_gate;
+static osi_sem_t s_done;
+static volatile uint32_t s_order[3 * ORDER_ITEMS];
+static volatile uint32_t s_ran;
+
+/* Holds the thread until the test opens the gate, so work piles up behind it */
+static void wait_gate(void *context)
+{
+    osi_sem_take(&s_gate, OSI_SEM_MAX_TIMEOUT);
+}
+
+static void record(void *context)
+{
+    s_order[s_ran++] = (uint32_t)(uintptr_t)context;
+}
+
+static void signal_done(void *context)
+{
+    osi_sem_give(&s_done);
+}
+
+static osi_thread_t *new_thread(const size_t *queue_len, uint8_t queue_num)
+{
+    osi_sem_new(&s_gate, 1, 0);
+    osi_sem_new(&s_done, 1, 0);
+    s_ran = 0;
+    return osi_thread_create("osi_test", THREAD_STACK_SIZE, THREAD_PRIORITY, OSI_THREAD_CORE_0, queue_num, queue_len);
+}
+
+static void close_gate(osi_thread_t *thread)
+{
+    TEST_ASSERT_NOT_NULL(thread);
+    TEST_ASSERT_TRUE(osi_thread_post(thread, wait_gate, NULL, 0, OSI_THREAD_MAX_TIMEOUT));
+    /* until the thread has taken the gate item */
+    while (osi_thread_queue_wait_size(thread, 0) != 0) {
+        vTaskDelay(1);
+    }
+}
+
+static void free_thread(osi_thread_t *thread)
+{
+    osi_thread_free(thread);
+    osi_sem_free(&s_gate);
+    osi_sem_free(&s_done);
+}
+
+static void test_thread_runs_queues_by_priority(void)
+{
+    const size_t queue_len[3] = { 0, 0, 0 };
+    osi_thread_t *thread = new_thread(queue_len, 3);
+    close_gate(thread);
+
+    for (int i = 0; i < ORDER_ITEMS; i++) {
+        for (int q = 2; q >= 0; q--) {
+            TEST_ASSERT_TRUE(osi_thread_post(thread, record, (void *)(uintptr_t)(q * 100 + i), q, 0));
+        }
+    }
+    TEST_ASSERT_EQUAL(ORDER_ITEMS, osi_thread_queue_wait_size(thread, 1));
+    TEST_ASSERT_TRUE(osi_thread_post(thread, signal_done, NULL, 2, 0));
+    osi_sem_give(&s_gate);
+    osi_sem_take(&s_done, OSI_SEM_MAX_TIMEOUT);
+
+    /* each queue fits in one batch, so they run strictly by priority and in order */
+    TEST_ASSERT_EQUAL(3 * ORDER_ITEMS, s_ran);
+    for (int q = 0; q < 3; q++) {
+        for (int i = 0; i < ORDER_ITEMS; i++) {
+            TEST_ASSERT_EQUAL(q * 100 + i, s_order[q * ORDER_ITEMS + i]);
+        }
+    }
+
+    osi_thread_queue_stats_t stats;
+    TEST_ASSERT_TRUE(osi_thread_get_queue_stats(thread, 1, &stats));
+    TEST_ASSERT_EQUAL(ORDER_ITEMS, stats.items);
+    TEST_ASSERT_EQUAL(1, stats.batches);
+    TEST_ASSERT_EQUAL(ORDER_ITEMS, stats.max_depth);
+    TEST_ASSERT_FALSE(osi_thread_get_queue_stats(thread, 3, &stats));
+    free_thread(thread);
+}
+
+static void test_thread_post_waits_for_room(void)
+{
+    const size_t queue_len[1] = { 2 };
+    osi_thread_t *thread = new_thread(queue_len, 1);
+    close_gate(thread);
+
+    TEST_ASSERT_TRUE(osi_thread_post(thread, record, (void *)1, 0, 0));
+    TEST_ASSERT_TRUE(osi_thread_post(thread, record, (void *)2, 0, 0));
+    TEST_ASSERT_FALSE(osi_thread_post(thread, record, (void *)3, 0, 0));
+    uint64_t start = test_osi_now_ns();
+    TEST_ASSERT_FALSE(osi_thread_post(thread, record, (void *)3, 0, 50));
+    TEST_ASSERT_GREATER_OR_EQUAL(40 * 1000000ull, test_osi_now_ns() - start);
+
+    /* opening the gate makes room for the blocked post */
+    osi_sem_give(&s_gate);
+    TEST_ASSERT_TRUE(osi_thread_post(thread, record, (void *)3, 0, OSI_THREAD_MAX_TIMEOUT));
+    TEST_ASSERT_TRUE(osi_thread_post(thread, signal_done, NULL, 0, OSI_THREAD_MAX_TIMEOUT));
+    osi_sem_take(&s_done, OSI_SEM_MAX_TIMEOUT);
+    TEST_ASSERT_EQUAL(3, s_ran);
+    TEST_ASSERT_EQUAL(3, s_order[2]);
+    free_thread(thread);
+}
+
+static void test_thread_event_runs_once(void)
+{
+    const size_t queue_len[2] = { 0, 0 };
+    osi_thread_t *thread = new_thread(queue_len, 2);
+    close_gate(thread);
+    struct osi_event *event = osi_event_create(record, (void *)7);
+    TEST_ASSERT_TRUE(osi_event_bind(event, thread, 1));
+
+    TEST_ASSERT_TRUE(osi_thread_post_event(event, 0));
+    TEST_ASSERT_FALSE(osi_thread_post_event(event, 0));
+    TEST_ASSERT_TRUE(osi_thread_post(thread, signal_done, NULL, 1, 0));
+    osi_sem_give(&s_gate);
+    osi_sem_take(&s_done, OSI_SEM_MAX_TIMEOUT);
+    TEST_ASSERT_EQUAL(1, s_ran);
+
+    osi_event_delete(event);
+    free_thread(thread);
+}
+
+static volatile uint32_t s_work_sink;
+
+/* a few hundred nanoseconds of work, like decoding a short HCI event */
+static void synthetic_work(void *context)
+{
+    for (uint32_t i = 0; i < 64; i++) {
+        s_work_sink += i * (uint32_t)(uintptr_t)context;
+    }
+}
+
+static uint32_t hist_percentile(const uint32_t *hist, uint32_t total, double fraction)
+{
+    uint32_t seen = 0;
+    for (int i = 0; i < OSI_THREAD_HIST_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen >= total * fraction) {
+            return i == 0 ? 0 : 1u << i;
+        }
+    }
+    return UINT32_MAX;
+}
+
+static void print_load(const char *load, osi_thread_t *thread, int burst, uint32_t messages, uint64_t ns)
+{
+    osi_thread_queue_stats_t stats;
+    osi_thread_get_queue_stats(thread, 1, &stats);
+    TEST_ASSERT_EQUAL(messages, stats.items);
+
+    printf("{\"bench\": \"thread_dispatch\", \"load\": \"%s\", \"burst\": %d, \"messages\": %" PRIu32 ", "
+           "\"wakeups_per_message\": %.3f, \"locks_per_message\": %.3f, \"max_depth\": %" PRIu32 ", "
+           "\"p50_latency_us\": %" PRIu32 ", \"p99_latency_us\": %" PRIu32 ", \"max_latency_us\": %" PRIu32 ", "
+           "\"mmsg_per_s\": %.3f}\n",
+           load, burst, messages, (double)osi_thread_get_wakeups(thread) / messages,
+           (double)stats.batches / messages, stats.max_depth,
+           hist_percentile(stats.latency_hist, stats.items, 0.5), hist_percentile(stats.latency_hist, stats.items, 0.99),
+           stats.max_latency_us, messages * 1000.0 / ns);
+}
+
+/* Posts bursts of messages with a pause after each, as the controller delivers
+ * HCI packets, and counts the wakeups of the thread per message */
+static void bench_context_switches(void)
+{
+    const size_t queue_len[3] = { 0, 0, 0 };
+    const int bursts[] = { 1, 4, 16, 64 };
+
+    for (int b = 0; b < sizeof(bursts) / sizeof(bursts[0]); b++) {
+        osi_sem_new(&s_done, 1, 0);
+        osi_thread_t *thread = osi_thread_create("osi_bench", THREAD_STACK_SIZE, THREAD_PRIORITY, OSI_THREAD_CORE_0,
+                                                 3, queue_len);
+        uint64_t start = test_osi_now_ns();
+        for (int i = 0; i < BENCH_BURSTS; i++) {
+            for (int j = 0; j < bursts[b]; j++) {
+                osi_thread_post(thread, synthetic_work, (void *)(uintptr_t)j, 1, OSI_THREAD_MAX_TIMEOUT);
+            }
+            vTaskDelay(1);
+        }
+        osi_thread_post(thread, signal_done, NULL, 2, OSI_THREAD_MAX_TIMEOUT);
+        osi_sem_take(&s_done, OSI_SEM_MAX_TIMEOUT);
+        print_load("bursts", thread, bursts[b], BENCH_BURSTS * bursts[b], test_osi_now_ns() - start);
+        osi_thread_free(thread);
+        osi_sem_free(&s_done);
+    }
+
+    /* a producer which never pauses, the queue stays full */
+    osi_sem_new(&s_done, 1, 0);
+    osi_thread_t *thread = osi_thread_create("osi_bench", THREAD_STACK_SIZE, THREAD_PRIORITY, OSI_THREAD_CORE_0,
+                                             3, queue_len);
+    uint64_t start = test_osi_now_ns();
+    for (int i = 0; i < BENCH_FLOOD_ITEMS; i++) {
+        osi_thread_post(thread, synthetic_work, (void *)(uintptr_t)i, 1, OSI_THREAD_MAX_TIMEOUT);
+    }
+    osi_thread_post(thread, signal_done, NULL, 2, OSI_THREAD_MAX_TIMEOUT);
+    osi_sem_take(&s_done, OSI_SEM_MAX_TIMEOUT);
+    print_load("flood", thread, 0, BENCH_FLOOD_ITEMS, test_osi_now_ns() - start);
+    osi_thread_free(thread);
+    osi_sem_free(&s_done);
+}
+
+void run_thread_tests(void)
+{
+    RUN_TEST(test_thread_runs_queues_by_priority);
+    RUN_TEST(test_thread_post_waits_for_room);
+    RUN_TEST(test_thread_event_runs_once);
+    RUN_TEST(bench_context_switches);
+}
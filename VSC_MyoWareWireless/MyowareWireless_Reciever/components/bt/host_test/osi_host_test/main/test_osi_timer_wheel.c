@@ -0,0 +1,325 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include "unity.h"
+#include "osi/timer_wheel.h"
+#include "test_osi.h"
+
+#define EXACT_ENTRIES       2000
+#define BENCH_ENTRIES       1024
+#define BENCH_REARMS        1000000
+#define ACCURACY_ENTRIES    500
+#define ACCURACY_MAX_MS     1000
+
+#define TURN_TICKS          (1ULL << (TIMER_WHEEL_LEVEL_BITS * TIMER_WHEEL_LEVELS))
+
+typedef struct {
+    timer_wheel_entry_t entry;
+    uint32_t fired;
+    uint64_t fired_at;
+} test_timer_t;
+
+typedef struct {
+    timer_wheel_t *wheel;
+    uint64_t last_fired;
+    uint32_t fired;
+    uint32_t errors;
+    uint64_t period;
+} fire_log_t;
+
+static uint32_t s_rand_state;
+
+static uint32_t test_rand(void)
+{
+    s_rand_state ^= s_rand_state << 13;
+    s_rand_state ^= s_rand_state >> 17;
+    s_rand_state ^= s_rand_state << 5;
+    return s_rand_state;
+}
+
+static void log_fire(timer_wheel_entry_t *entry, void *context)
+{
+    fire_log_t *log = (fire_log_t *)context;
+    test_timer_t *timer = (test_timer_t *)entry;
+
+    /* on its exact tick, in order, and only once */
+    if (entry->expiry != log->wheel->now || entry->expiry < log->last_fired || timer->fired) {
+        log->errors++;
+    }
+    timer->fired++;
+    timer->fired_at = log->wheel->now;
+    log->last_fired = entry->expiry;
+    log->fired++;
+}
+
+static uint64_t first_pending_expiry(const test_timer_t *timers, int count)
+{
+    uint64_t first = UINT64_MAX;
+    for (int i = 0; i < count; i++) {
+        if (timer_wheel_entry_is_pending(&timers[i].entry) && timers[i].entry.expiry < first) {
+            first = timers[i].entry.expiry;
+        }
+    }
+    return first;
+}
+
+static void test_timer_wheel_exact_expiry(void)
+{
+    static test_timer_t timers[EXACT_ENTRIES];
+    timer_wheel_t wheel;
+    const uint64_t start = 12345;
+    timer_wheel_init(&wheel, start);
+    s_rand_state = 0x2545f491;
+
+    /* timeouts from one tick to hours, so entries start on every level */
+    for (int i = 0; i < EXACT_ENTRIES; i++) {
+        timer_wheel_entry_init(&timers[i].entry);
+        timers[i].fired = 0;
+        uint64_t timeout = 1 + test_rand() % (1u << (4 + (i % 6) * 4));
+        timer_wheel_add(&wheel, &timers[i].entry, start + timeout);
+        TEST_ASSERT_TRUE(timer_wheel_entry_is_pending(&timers[i].entry));
+    }
+    TEST_ASSERT_EQUAL(EXACT_ENTRIES, wheel.count);
+
+    fire_log_t log = { .wheel = &wheel };
+    uint64_t now = start;
+    while (wheel.count) {
+        TEST_ASSERT_TRUE(timer_wheel_next_tick(&wheel) <= first_pending_expiry(timers, EXACT_ENTRIES));
+        /* both small steps and big jumps over many expiries */
+        now += (test_rand() % 4) ? 1 + test_rand() % 64 : test_rand() % (1u << 22);
+        timer_wheel_advance(&wheel, now, log_fire, &log);
+        TEST_ASSERT_TRUE(first_pending_expiry(timers, EXACT_ENTRIES) > now);
+    }
+    TEST_ASSERT_EQUAL(0, log.errors);
+    TEST_ASSERT_EQUAL(EXACT_ENTRIES, log.fired);
+    TEST_ASSERT_EQUAL(UINT64_MAX, timer_wheel_next_tick(&wheel));
+}
+
+static void rearm_fire(timer_wheel_entry_t *entry, void *context)
+{
+    fire_log_t *log = (fire_log_t *)context;
+    test_timer_t *timer = (test_timer_t *)entry;
+
+    timer->fired++;
+    log->fired++;
+    if (entry->expiry != log->wheel->now) {
+        log->errors++;
+    }
+    timer_wheel_add(log->wheel, entry, entry->expiry + log->period);
+}
+
+static void test_timer_wheel_remove_and_rearm(void)
+{
+    test_timer_t timers[4];
+    timer_wheel_t wheel;
+    timer_wheel_init(&wheel, 0);
+    for (int i = 0; i < 4; i++) {
+        timer_wheel_entry_init(&timers[i].entry);
+        timers[i].fired = 0;
+    }
+
+    /* expiries which aren't in the future expire on the next tick */
+    timer_wheel_add(&wheel, &timers[0].entry, 0);
+    TEST_ASSERT_EQUAL(1, timer_wheel_next_tick(&wheel));
+    timer_wheel_remove(&wheel, &timers[0].entry);
+    timer_wheel_remove(&wheel, &timers[0].entry);
+    TEST_ASSERT_FALSE(timer_wheel_entry_is_pending(&timers[0].entry));
+    TEST_ASSERT_EQUAL(UINT64_MAX, timer_wheel_next_tick(&wheel));
+
+    /* two entries share a slot, removing one keeps the other */
+    timer_wheel_add(&wheel, &timers[0].entry, 5000);
+    timer_wheel_add(&wheel, &timers[1].entry, 5000);
+    timer_wheel_add(&wheel, &timers[2].entry, 70);
+    timer_wheel_remove(&wheel, &timers[0].entry);
+    timer_wheel_remove(&wheel, &timers[2].entry);
+    TEST_ASSERT_TRUE(timer_wheel_next_tick(&wheel) <= 5000);
+
+    /* an entry added again from its callback expires each period */
+    fire_log_t log = { .wheel = &wheel, .period = 7 };
+    timer_wheel_add(&wheel, &timers[3].entry, 3);
+    timer_wheel_advance(&wheel, 4999, rearm_fire, &log);
+    TEST_ASSERT_EQUAL(0, timers[1].fired);
+    TEST_ASSERT_EQUAL((4999 - 3) / 7 + 1, timers[3].fired);
+    timer_wheel_advance(&wheel, 5000, rearm_fire, &log);
+    TEST_ASSERT_EQUAL(1, timers[1].fired);
+    TEST_ASSERT_EQUAL(0, log.errors);
+    TEST_ASSERT_EQUAL(2, wheel.count);
+}
+
+static void test_timer_wheel_next_turn(void)
+{
+    test_timer_t timers[3];
+    timer_wheel_t wheel;
+    const uint64_t start = TURN_TICKS - 10;
+    const uint64_t expiries[3] = { TURN_TICKS + 5, 2 * TURN_TICKS + 3, start + 9 };
+    timer_wheel_init(&wheel, start);
+    for (int i = 0; i < 3; i++) {
+        timer_wheel_entry_init(&timers[i].entry);
+        timers[i].fired = 0;
+        timer_wheel_add(&wheel, &timers[i].entry, expiries[i]);
+    }
+
+    fire_log_t log = { .wheel = &wheel };
+    timer_wheel_advance(&wheel, TURN_TICKS + 4, log_fire, &log);
+    TEST_ASSERT_EQUAL(1, log.fired);
+    timer_wheel_advance(&wheel, 3 * TURN_TICKS, log_fire, &log);
+    TEST_ASSERT_EQUAL(3, log.fired);
+    TEST_ASSERT_EQUAL(0, log.errors);
+    for (int i = 0; i < 3; i++) {
+        TEST_ASSERT_EQUAL(expiries[i], timers[i].fired_at);
+    }
+}
+
+/* esp_timer keeps its armed timers in a list sorted by expiry, this is the same */
+typedef struct sorted_timer_t {
+    struct sorted_timer_t *next;
+    struct sorted_timer_t **pprev;
+    uint64_t expiry;
+} sorted_timer_t;
+
+static void sorted_add(sorted_timer_t **head, sorted_timer_t *timer, uint64_t expiry)
+{
+    timer->expiry = expiry;
+    sorted_timer_t **pos = head;
+    while (*pos && (*pos)->expiry <= expiry) {
+        pos = &(*pos)->next;
+    }
+    timer->next = *pos;
+    if (timer->next) {
+        timer->next->pprev = &timer->next;
+    }
+    timer->pprev = pos;
+    *pos = timer;
+}
+
+static void sorted_remove(sorted_timer_t *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+}
+
+static void count_fire(timer_wheel_entry_t *entry, void *context)
+{
+    (*(uint32_t *)context)++;
+}
+
+/* Re-arms random alarms of a set that stays armed, like the per-packet timers of
+ * a busy link, with timeouts up to 30 s */
+static void bench_arm_cancel(void)
+{
+    static test_timer_t timers[BENCH_ENTRIES];
+    static sorted_timer_t sorted[BENCH_ENTRIES];
+    timer_wheel_t wheel;
+    sorted_timer_t *sorted_head = NULL;
+    timer_wheel_init(&wheel, 0);
+    s_rand_state = 0x9e3779b9;
+
+    for (int i = 0; i < BENCH_ENTRIES; i++) {
+        uint64_t expiry = 1 + test_rand() % 30000;
+        timer_wheel_entry_init(&timers[i].entry);
+        timer_wheel_add(&wheel, &timers[i].entry, expiry);
+        sorted_add(&sorted_head, &sorted[i], expiry);
+    }
+
+    uint64_t start = test_osi_now_ns();
+    for (int i = 0; i < BENCH_REARMS; i++) {
+        test_timer_t *timer = &timers[test_rand() % BENCH_ENTRIES];
+        timer_wheel_remove(&wheel, &timer->entry);
+        timer_wheel_add(&wheel, &timer->entry, 1 + test_rand() % 30000);
+    }
+    uint64_t wheel_ns = test_osi_now_ns() - start;
+
+    start = test_osi_now_ns();
+    for (int i = 0; i < BENCH_REARMS; i++) {
+        sorted_timer_t *timer = &sorted[test_rand() % BENCH_ENTRIES];
+        sorted_remove(timer);
+        sorted_add(&sorted_head, timer, 1 + test_rand() % 30000);
+    }
+    uint64_t sorted_ns = test_osi_now_ns() - start;
+
+    uint32_t fired = 0;
+    uint32_t wakeups = 0;
+    start = test_osi_now_ns();
+    while (wheel.count) {
+        timer_wheel_advance(&wheel, timer_wheel_next_tick(&wheel), count_fire, &fired);
+        wakeups++;
+    }
+    uint64_t expire_ns = test_osi_now_ns() - start;
+    TEST_ASSERT_EQUAL(BENCH_ENTRIES, fired);
+
+    printf("{\"bench\": \"alarm_rearm\", \"armed\": %d, \"rearms\": %d, "
+           "\"sorted_list_ns\": %.1f, \"timer_wheel_ns\": %.1f, \"expire_ns\": %.1f, \"wakeups\": %" PRIu32 "}\n",
+           BENCH_ENTRIES, BENCH_REARMS, (double)sorted_ns / BENCH_REARMS, (double)wheel_ns / BENCH_REARMS,
+           (double)expire_ns / BENCH_ENTRIES, wakeups);
+}
+
+typedef struct {
+    timer_wheel_t *wheel;
+    uint64_t base_ns;
+    uint64_t total_late_us;
+    uint64_t max_late_us;
+    uint32_t early;
+    uint32_t fired;
+} accuracy_t;
+
+static void measure_fire(timer_wheel_entry_t *entry, void *context)
+{
+    accuracy_t *acc = (accuracy_t *)context;
+    int64_t late_us = ((int64_t)(test_osi_now_ns() - acc->base_ns) - (int64_t)entry->expiry * 1000000) / 1000;
+    if (late_us < 0) {
+        acc->early++;
+        return;
+    }
+    acc->total_late_us += late_us;
+    acc->max_late_us = (uint64_t)late_us > acc->max_late_us ? (uint64_t)late_us : acc->max_late_us;
+    acc->fired++;
+}
+
+/* Drives the wheel with millisecond ticks off the monotonic clock, sleeping
+ * until the next tick it asks for, as the alarm timer does */
+static void bench_expiry_accuracy(void)
+{
+    static test_timer_t timers[ACCURACY_ENTRIES];
+    timer_wheel_t wheel;
+    timer_wheel_init(&wheel, 0);
+    s_rand_state = 0x6b43a9b5;
+
+    accuracy_t acc = { .wheel = &wheel, .base_ns = test_osi_now_ns() };
+    for (int i = 0; i < ACCURACY_ENTRIES; i++) {
+        timer_wheel_entry_init(&timers[i].entry);
+        timer_wheel_add(&wheel, &timers[i].entry, 1 + test_rand() % ACCURACY_MAX_MS);
+    }
+
+    uint32_t wakeups = 0;
+    for (uint64_t tick = timer_wheel_next_tick(&wheel); tick != UINT64_MAX; tick = timer_wheel_next_tick(&wheel)) {
+        uint64_t wake_ns = acc.base_ns + tick * 1000000;
+        struct timespec ts = { .tv_sec = wake_ns / 1000000000, .tv_nsec = wake_ns % 1000000000 };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        timer_wheel_advance(&wheel, (test_osi_now_ns() - acc.base_ns) / 1000000, measure_fire, &acc);
+        wakeups++;
+    }
+
+    TEST_ASSERT_EQUAL(0, acc.early);
+    TEST_ASSERT_EQUAL(ACCURACY_ENTRIES, acc.fired);
+    printf("{\"bench\": \"alarm_accuracy\", \"alarms\": %d, \"wakeups\": %" PRIu32 ", "
+           "\"mean_late_us\": %.1f, \"max_late_us\": %" PRIu64 "}\n",
+           ACCURACY_ENTRIES, wakeups, (double)acc.total_late_us / acc.fired, acc.max_late_us);
+}
+
+void run_timer_wheel_tests(void)
+{
+    RUN_TEST(test_timer_wheel_exact_expiry);
+    RUN_TEST(test_timer_wheel_remove_and_rearm);
+    RUN_TEST(test_timer_wheel_next_turn);
+    RUN_TEST(bench_arm_cancel);
+    RUN_TEST(bench_expiry_accuracy);
+}
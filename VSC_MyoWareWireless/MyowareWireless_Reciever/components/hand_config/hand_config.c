@@ -0,0 +1,72 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "hand_config.h"
+
+/* GPIO of an ADC channel on the ESP32 */
+#define HAND_ADC1_GPIO(ch) ((ch) == 0 ? 36 : (ch) == 1 ? 37 : (ch) == 2 ? 38 : (ch) == 3 ? 39 : \
+                            (ch) == 4 ? 32 : (ch) == 5 ? 33 : (ch) == 6 ? 34 : (ch) == 7 ? 35 : -1)
+#define HAND_ADC2_GPIO(ch) ((ch) == 0 ? 4 : (ch) == 1 ? 0 : (ch) == 2 ? 2 : (ch) == 3 ? 15 : (ch) == 4 ? 13 : \
+                            (ch) == 5 ? 12 : (ch) == 6 ? 14 : (ch) == 7 ? 27 : (ch) == 8 ? 25 : (ch) == 9 ? 26 : -1)
+#define HAND_ADC_GPIO(unit, ch) ((unit) == 1 ? HAND_ADC1_GPIO(ch) : (unit) == 2 ? HAND_ADC2_GPIO(ch) : -1)
+#define HAND_LEDC_CHANNEL_NUM 8
+
+/*
+ * Every pin and LEDC channel becomes an enumerator, so a pin or channel listed twice
+ * in HAND_FINGER_TABLE is a redeclaration and fails to compile.
+ */
+#define HAND_PIN_ITEM(name, gpio, ledc, sense_gpio, sense_unit, sense_ch, open, closed, inverted) \
+    HAND_PIN_IS_USED_IO##gpio, HAND_PIN_IS_USED_IO##sense_gpio,
+enum { HAND_FINGER_TABLE(HAND_PIN_ITEM) };
+#undef HAND_PIN_ITEM
+
+#define HAND_LEDC_ITEM(name, gpio, ledc, sense_gpio, sense_unit, sense_ch, open, closed, inverted) \
+    HAND_LEDC_IS_USED_CH##ledc,
+enum { HAND_FINGER_TABLE(HAND_LEDC_ITEM) };
+#undef HAND_LEDC_ITEM
+
+#define HAND_CHECK_ITEM(name, gpio, ledc, sense_gpio, sense_unit, sense_ch, open, closed, inverted) \
+    _Static_assert((gpio) < 34 && ((gpio) < 6 || (gpio) > 11), #name ": servo GPIO is input only or a flash pin"); \
+    _Static_assert((ledc) < HAND_LEDC_CHANNEL_NUM, #name ": LEDC channel out of range"); \
+    _Static_assert(HAND_ADC_GPIO(sense_unit, sense_ch) == (sense_gpio), #name ": sense GPIO is not on the given ADC channel"); \
+    _Static_assert((open) >= 0 && (open) <= 180 && (closed) >= 0 && (closed) <= 180, #name ": angle out of range"); \
+    _Static_assert((open) != (closed), #name ": open and closed angle are equal");
+HAND_FINGER_TABLE(HAND_CHECK_ITEM)
+#undef HAND_CHECK_ITEM
+
+const hand_finger_desc_t hand_fingers[HAND_FINGER_NUM] = {
+#define HAND_DESC_ITEM(name_, gpio_, ledc_, sense_gpio_, sense_unit_, sense_ch_, open_, closed_, inverted_) \
+    [HAND_FINGER_##name_] = {                 \
+        .name = #name_,                       \
+        .gpio = gpio_,                        \
+        .ledc_channel = ledc_,                \
+        .sense_gpio = sense_gpio_,            \
+        .sense_unit = sense_unit_,            \
+        .sense_channel = sense_ch_,           \
+        .open_deg = open_,                    \
+        .closed_deg = closed_,                \
+        .inverted = inverted_,                \
+    },
+    HAND_FINGER_TABLE(HAND_DESC_ITEM)
+#undef HAND_DESC_ITEM
+};
+
+float hand_finger_servo_angle(hand_finger_t finger, float angle)
+{
+    if ((unsigned)finger >= HAND_FINGER_NUM) {
+        return angle;
+    }
+
+    const hand_finger_desc_t *f = &hand_fingers[finger];
+    float lo = f->open_deg < f->closed_deg ? f->open_deg : f->closed_deg;
+    float hi = f->open_deg < f->closed_deg ? f->closed_deg : f->open_deg;
+    if (angle < lo) {
+        angle = lo;
+    } else if (angle > hi) {
+        angle = hi;
+    }
+    return f->inverted ? 180.0f - angle : angle;
+}
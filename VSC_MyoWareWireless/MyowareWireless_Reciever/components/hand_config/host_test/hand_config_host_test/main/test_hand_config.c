@@ -0,0 +1,99 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "unity.h"
+#include "hand_config.h"
+
+static const uint8_t s_gpios[] = HAND_SERVO_GPIOS;
+static const uint8_t s_channels[] = HAND_SERVO_CHANNELS;
+static const float s_open[] = HAND_OPEN_ANGLES;
+static const float s_closed[] = HAND_CLOSED_ANGLES;
+
+void test_tables_cover_all_fingers(void)
+{
+    TEST_ASSERT_EQUAL(5, HAND_FINGER_NUM);
+    TEST_ASSERT_EQUAL(HAND_FINGER_NUM, sizeof(s_gpios) / sizeof(s_gpios[0]));
+    TEST_ASSERT_EQUAL(HAND_FINGER_NUM, sizeof(s_channels) / sizeof(s_channels[0]));
+    TEST_ASSERT_EQUAL(HAND_FINGER_NUM, sizeof(s_open) / sizeof(s_open[0]));
+    TEST_ASSERT_EQUAL(HAND_FINGER_NUM, sizeof(s_closed) / sizeof(s_closed[0]));
+
+    for (int i = 0; i < HAND_FINGER_NUM; i++) {
+        TEST_ASSERT_NOT_NULL(hand_fingers[i].name);
+        TEST_ASSERT_EQUAL(hand_fingers[i].gpio, s_gpios[i]);
+        TEST_ASSERT_EQUAL(hand_fingers[i].ledc_channel, s_channels[i]);
+        TEST_ASSERT_EQUAL_FLOAT(hand_fingers[i].open_deg, s_open[i]);
+        TEST_ASSERT_EQUAL_FLOAT(hand_fingers[i].closed_deg, s_closed[i]);
+    }
+}
+
+void test_pins_match_the_wiring(void)
+{
+    // Pin out of the README and the Arduino sketch, the middle finger moved from IO0 to IO16
+    TEST_ASSERT_EQUAL(15, hand_fingers[HAND_FINGER_PINKY].gpio);
+    TEST_ASSERT_EQUAL(2, hand_fingers[HAND_FINGER_RING].gpio);
+    TEST_ASSERT_EQUAL(16, hand_fingers[HAND_FINGER_MIDDLE].gpio);
+    TEST_ASSERT_EQUAL(5, hand_fingers[HAND_FINGER_POINTER].gpio);
+    TEST_ASSERT_EQUAL(18, hand_fingers[HAND_FINGER_THUMB].gpio);
+    TEST_ASSERT_EQUAL_STRING("MIDDLE", hand_fingers[HAND_FINGER_MIDDLE].name);
+}
+
+void test_pins_and_channels_are_unique(void)
+{
+    uint64_t pins = 0;
+    uint32_t channels = 0;
+
+    for (int i = 0; i < HAND_FINGER_NUM; i++) {
+        const hand_finger_desc_t *f = &hand_fingers[i];
+        TEST_ASSERT_FALSE(pins & (1ULL << f->gpio));
+        pins |= 1ULL << f->gpio;
+        TEST_ASSERT_FALSE(pins & (1ULL << f->sense_gpio));
+        pins |= 1ULL << f->sense_gpio;
+        TEST_ASSERT_FALSE(channels & (1U << f->ledc_channel));
+        channels |= 1U << f->ledc_channel;
+        TEST_ASSERT_TRUE(f->sense_unit == 1 || f->sense_unit == 2);
+    }
+}
+
+void test_output_mask_holds_exactly_the_servo_pins(void)
+{
+    uint64_t mask = 0;
+    for (int i = 0; i < HAND_FINGER_NUM; i++) {
+        mask |= 1ULL << hand_fingers[i].gpio;
+    }
+    TEST_ASSERT_TRUE(mask == HAND_GPIO_OUTPUT_PIN_SEL);
+    TEST_ASSERT_EQUAL(HAND_FINGER_NUM, __builtin_popcountll(HAND_GPIO_OUTPUT_PIN_SEL));
+}
+
+void test_servo_angle_is_limited(void)
+{
+    // The thumb cannot be opened to 0 deg
+    TEST_ASSERT_EQUAL_FLOAT(5.0f, hand_finger_servo_angle(HAND_FINGER_THUMB, 0.0f));
+    TEST_ASSERT_EQUAL_FLOAT(90.0f, hand_finger_servo_angle(HAND_FINGER_THUMB, 90.0f));
+    TEST_ASSERT_EQUAL_FLOAT(180.0f, hand_finger_servo_angle(HAND_FINGER_PINKY, 200.0f));
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, hand_finger_servo_angle(HAND_FINGER_PINKY, -10.0f));
+    TEST_ASSERT_EQUAL_FLOAT(-10.0f, hand_finger_servo_angle(HAND_FINGER_NUM, -10.0f));
+
+    for (int i = 0; i < HAND_FINGER_NUM; i++) {
+        const hand_finger_desc_t *f = &hand_fingers[i];
+        float expect = f->inverted ? 180.0f - f->closed_deg : f->closed_deg;
+        TEST_ASSERT_EQUAL_FLOAT(expect, hand_finger_servo_angle(i, f->closed_deg));
+    }
+}
+
+/* The Linux FreeRTOS port provides main and runs app_main in a task */
+void app_main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_tables_cover_all_fingers);
+    RUN_TEST(test_pins_match_the_wiring);
+    RUN_TEST(test_pins_and_channels_are_unique);
+    RUN_TEST(test_output_mask_holds_exactly_the_servo_pins);
+    RUN_TEST(test_servo_angle_is_limited);
+    exit(UNITY_END());
+}
@@ -0,0 +1,99 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _HAND_CONFIG_H_
+#define _HAND_CONFIG_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief The hand, one line per finger. Everything else in this file is generated from it.
+ *
+ * name:       finger identifier, becomes HAND_FINGER_<name>
+ * gpio:       servo PWM output, must be an output capable GPIO
+ * ledc:       LEDC channel driving the servo
+ * sense_gpio: current sense input, must be an ADC pin
+ * sense_unit: ADC unit of sense_gpio (1 or 2)
+ * sense_ch:   ADC channel of sense_gpio
+ * open:       servo angle with the finger stretched
+ * closed:     servo angle with the finger bent
+ * inverted:   servo is mounted mirrored, angles are written as 180 - angle
+ *
+ * GPIOs and LEDC channels have to be numeric literals, a pin or channel used twice fails to compile.
+ */
+#define HAND_FINGER_TABLE(X) \
+    /*  name     gpio ledc sense_gpio sense_unit sense_ch open closed inverted */ \
+    X(PINKY,     15,  0,   35,        1,         7,       0,   180,   false)     \
+    X(RING,      2,   1,   34,        1,         6,       0,   180,   false)     \
+    X(MIDDLE,    16,  2,   32,        1,         4,       0,   180,   false)     \
+    X(POINTER,   5,   3,   33,        1,         5,       0,   180,   false)     \
+    X(THUMB,     18,  4,   27,        2,         7,       5,   180,   false)
+
+/**
+ * @brief Finger index, in table order
+ *
+ */
+typedef enum {
+#define HAND_FINGER_ENUM(name, gpio, ledc, sense_gpio, sense_unit, sense_ch, open, closed, inverted) HAND_FINGER_##name,
+    HAND_FINGER_TABLE(HAND_FINGER_ENUM)
+#undef HAND_FINGER_ENUM
+    HAND_FINGER_NUM,
+} hand_finger_t;
+
+/**
+ * @brief Descriptor of one finger
+ *
+ */
+typedef struct {
+    const char *name;
+    uint8_t gpio;                /**< Servo PWM output */
+    uint8_t ledc_channel;        /**< LEDC channel driving the servo */
+    uint8_t sense_gpio;          /**< Current sense input */
+    uint8_t sense_unit;          /**< ADC unit of the sense input, 1 or 2 */
+    uint8_t sense_channel;       /**< ADC channel of the sense input */
+    float open_deg;              /**< Angle of the stretched finger */
+    float closed_deg;            /**< Angle of the bent finger */
+    bool inverted;               /**< Written angles are mirrored */
+} hand_finger_desc_t;
+
+/* Initializers for per finger arrays, e.g. the servo_config_t pin and channel lists */
+#define HAND_FINGER_GPIO_ITEM(name, gpio, ledc, sense_gpio, sense_unit, sense_ch, open, closed, inverted) gpio,
+#define HAND_FINGER_LEDC_ITEM(name, gpio, ledc, sense_gpio, sense_unit, sense_ch, open, closed, inverted) ledc,
+#define HAND_FINGER_OPEN_ITEM(name, gpio, ledc, sense_gpio, sense_unit, sense_ch, open, closed, inverted) open,
+#define HAND_FINGER_CLOSED_ITEM(name, gpio, ledc, sense_gpio, sense_unit, sense_ch, open, closed, inverted) closed,
+#define HAND_FINGER_GPIO_MASK_ITEM(name, gpio, ledc, sense_gpio, sense_unit, sense_ch, open, closed, inverted) | (1ULL << (gpio))
+
+#define HAND_SERVO_GPIOS     { HAND_FINGER_TABLE(HAND_FINGER_GPIO_ITEM) }
+#define HAND_SERVO_CHANNELS  { HAND_FINGER_TABLE(HAND_FINGER_LEDC_ITEM) }
+#define HAND_OPEN_ANGLES     { HAND_FINGER_TABLE(HAND_FINGER_OPEN_ITEM) }
+#define HAND_CLOSED_ANGLES   { HAND_FINGER_TABLE(HAND_FINGER_CLOSED_ITEM) }
+#define HAND_GPIO_OUTPUT_PIN_SEL  (0ULL HAND_FINGER_TABLE(HAND_FINGER_GPIO_MASK_ITEM))
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Descriptors of all fingers, indexed by hand_finger_t
+ */
+extern const hand_finger_desc_t hand_fingers[HAND_FINGER_NUM];
+
+/**
+ * @brief Limit an angle to the range of the finger and apply the mounting
+ *
+ * @param finger Finger index
+ * @param angle Angle between the open and the closed position
+ *
+ * @return Angle to write to the servo, the unchanged angle for an invalid finger
+ */
+float hand_finger_servo_angle(hand_finger_t finger, float angle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HAND_CONFIG_H_ */
@@ -0,0 +1,356 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include "unity.h"
+#include "jitter_buffer.h"
+
+#define SEND_PERIOD_US   20000
+#define TICK_PERIOD_US   20000
+#define BASE_TRANSIT_US  8000
+#define TRACE_FRAMES     1500
+#define WARMUP_TICKS     50
+#define PI_F             3.14159265f
+
+typedef struct {
+    jitter_frame_t frame;
+    int64_t arrival_us;
+    bool lost;
+} arrival_t;
+
+typedef struct {
+    uint32_t jitter_us;      /**< Uniform extra transit in [0, jitter_us) */
+    uint32_t loss_permille;  /**< Probability a frame starts a loss burst */
+    uint8_t loss_burst;      /**< Frames lost per burst */
+} trace_config_t;
+
+typedef struct {
+    float jb_roughness;      /**< RMS of the second difference of the jitter buffer output */
+    float naive_roughness;   /**< Same for applying each frame as it arrives */
+    float max_error;         /**< Largest deviation from the sent signal at the playout time */
+    float mean_delay_us;     /**< Mean playout delay on top of the base transit */
+    uint32_t empty;          /**< Playouts without output after warmup */
+} trace_result_t;
+
+static arrival_t s_trace[TRACE_FRAMES];
+static uint32_t s_rng;
+
+static uint32_t rng_next(void)
+{
+    s_rng = s_rng * 1664525u + 1013904223u;
+    return s_rng >> 8;
+}
+
+static float signal_at(int64_t t_us, uint8_t ch)
+{
+    return 90.0f + 80.0f * sinf(2.0f * PI_F * ((float)t_us / 1e6f + ch * 0.1f));
+}
+
+static void build_trace(const trace_config_t *cfg, uint32_t seed)
+{
+    s_rng = seed;
+    uint8_t burst = 0;
+    for (uint32_t i = 0; i < TRACE_FRAMES; i++) {
+        arrival_t *a = &s_trace[i];
+        a->frame.seq = i;
+        a->frame.timestamp_us = (int64_t)i * SEND_PERIOD_US;
+        for (uint8_t ch = 0; ch < JITTER_BUFFER_MAX_CHANNELS; ch++) {
+            a->frame.values[ch] = signal_at(a->frame.timestamp_us, ch);
+        }
+        a->arrival_us = a->frame.timestamp_us + BASE_TRANSIT_US;
+        if (cfg->jitter_us) {
+            a->arrival_us += rng_next() % cfg->jitter_us;
+        }
+        if (burst == 0 && cfg->loss_permille && rng_next() % 1000 < cfg->loss_permille) {
+            burst = cfg->loss_burst;
+        }
+        a->lost = burst > 0;
+        if (burst) {
+            burst--;
+        }
+    }
+}
+
+static const arrival_t *next_arrival(int64_t before_us, bool *used)
+{
+    const arrival_t *best = NULL;
+    for (uint32_t i = 0; i < TRACE_FRAMES; i++) {
+        if (!used[i] && s_trace[i].arrival_us <= before_us && (best == NULL || s_trace[i].arrival_us < best->arrival_us)) {
+            best = &s_trace[i];
+        }
+    }
+    if (best) {
+        used[best - s_trace] = true;
+    }
+    return best;
+}
+
+static void run_trace(jitter_buffer_t *jb, trace_result_t *res)
+{
+    static bool used[TRACE_FRAMES];
+    memset(used, 0, sizeof(used));
+    memset(res, 0, sizeof(*res));
+
+    float out[JITTER_BUFFER_MAX_CHANNELS] = {0};
+    float naive = 0, prev[2] = {0}, naive_prev[2] = {0};
+    double rough = 0, naive_rough = 0, delay = 0;
+    uint32_t samples = 0;
+    uint32_t ticks = (uint32_t)((int64_t)TRACE_FRAMES * SEND_PERIOD_US / TICK_PERIOD_US) - 10;
+
+    for (uint32_t t = 0; t < ticks; t++) {
+        int64_t now = (int64_t)t * TICK_PERIOD_US + 3000;
+        const arrival_t *a;
+        while ((a = next_arrival(now, used)) != NULL) {
+            if (!a->lost) {
+                jitter_buffer_push(jb, &a->frame, a->arrival_us);
+                naive = a->frame.values[0];
+            }
+        }
+        jitter_buffer_playout_t p = jitter_buffer_pop(jb, now, out);
+        if (t < WARMUP_TICKS) {
+            naive_prev[1] = naive_prev[0];
+            naive_prev[0] = naive;
+            prev[1] = prev[0];
+            prev[0] = out[0];
+            continue;
+        }
+        if (p == JITTER_BUFFER_PLAYOUT_EMPTY) {
+            res->empty++;
+            continue;
+        }
+
+        float d2 = out[0] - 2 * prev[0] + prev[1];
+        float n2 = naive - 2 * naive_prev[0] + naive_prev[1];
+        rough += d2 * d2;
+        naive_rough += n2 * n2;
+        float err = fabsf(out[0] - signal_at(jb->playout_us, 0));
+        if (err > res->max_error) {
+            res->max_error = err;
+        }
+        jitter_buffer_stats_t stats;
+        jitter_buffer_get_stats(jb, &stats);
+        delay += stats.delay_us;
+        samples++;
+
+        prev[1] = prev[0];
+        prev[0] = out[0];
+        naive_prev[1] = naive_prev[0];
+        naive_prev[0] = naive;
+    }
+
+    res->jb_roughness = sqrtf(rough / samples);
+    res->naive_roughness = sqrtf(naive_rough / samples);
+    res->mean_delay_us = delay / samples;
+}
+
+static void print_result(const char *name, const jitter_buffer_t *jb, const trace_result_t *res)
+{
+    jitter_buffer_stats_t stats;
+    jitter_buffer_get_stats(jb, &stats);
+    printf("[%s] roughness jb=%.3f naive=%.3f max_err=%.2f mean_delay=%.1fms jitter=%.1fms "
+           "interp=%u pred=%u held=%u late=%u\n",
+           name, res->jb_roughness, res->naive_roughness, res->max_error, res->mean_delay_us / 1000.0f,
+           stats.jitter_us / 1000.0f, (unsigned)stats.interpolated, (unsigned)stats.predicted,
+           (unsigned)stats.held, (unsigned)stats.late);
+}
+
+static void init_default(jitter_buffer_t *jb)
+{
+    jitter_buffer_config_t cfg = JITTER_BUFFER_DEFAULT_CONFIG();
+    TEST_ASSERT_EQUAL(ESP_OK, jitter_buffer_init(jb, &cfg));
+}
+
+void test_init_rejects_invalid_config(void)
+{
+    jitter_buffer_t jb;
+    jitter_buffer_config_t cfg = JITTER_BUFFER_DEFAULT_CONFIG();
+
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, jitter_buffer_init(NULL, &cfg));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, jitter_buffer_init(&jb, NULL));
+
+    cfg.channel_number = JITTER_BUFFER_MAX_CHANNELS + 1;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, jitter_buffer_init(&jb, &cfg));
+
+    cfg = (jitter_buffer_config_t)JITTER_BUFFER_DEFAULT_CONFIG();
+    cfg.min_delay_us = cfg.max_delay_us + 1;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, jitter_buffer_init(&jb, &cfg));
+
+    cfg = (jitter_buffer_config_t)JITTER_BUFFER_DEFAULT_CONFIG();
+    cfg.alpha = 0.0f;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, jitter_buffer_init(&jb, &cfg));
+}
+
+void test_pop_before_first_frame_is_empty(void)
+{
+    jitter_buffer_t jb;
+    float out[JITTER_BUFFER_MAX_CHANNELS] = {0};
+    init_default(&jb);
+
+    TEST_ASSERT_EQUAL(JITTER_BUFFER_PLAYOUT_EMPTY, jitter_buffer_pop(&jb, 1000, out));
+
+    jitter_frame_t f = { .seq = 0, .timestamp_us = 0, .values = {10, 10, 10, 10, 10} };
+    TEST_ASSERT_EQUAL(ESP_OK, jitter_buffer_push(&jb, &f, 5000));
+    // The frame is only due after the minimum playout delay
+    TEST_ASSERT_EQUAL(JITTER_BUFFER_PLAYOUT_EMPTY, jitter_buffer_pop(&jb, 6000, out));
+    TEST_ASSERT_NOT_EQUAL(JITTER_BUFFER_PLAYOUT_EMPTY, jitter_buffer_pop(&jb, 5000 + 20000, out));
+    TEST_ASSERT_EQUAL_FLOAT(10.0f, out[0]);
+}
+
+void test_steady_arrivals_are_interpolated(void)
+{
+    jitter_buffer_t jb;
+    trace_result_t res;
+    trace_config_t trace = { 0 };
+    init_default(&jb);
+    build_trace(&trace, 1);
+
+    run_trace(&jb, &res);
+    print_result("steady", &jb, &res);
+
+    jitter_buffer_stats_t stats;
+    jitter_buffer_get_stats(&jb, &stats);
+    TEST_ASSERT_EQUAL(0, res.empty);
+    TEST_ASSERT_EQUAL(0, stats.predicted);
+    TEST_ASSERT_EQUAL(0, stats.late);
+    TEST_ASSERT_EQUAL(jb.cfg.min_delay_us, stats.delay_us);
+    TEST_ASSERT_TRUE(res.max_error < 1.0f);
+}
+
+void test_jittered_arrivals_are_smoothed(void)
+{
+    jitter_buffer_t jb;
+    trace_result_t res;
+    trace_config_t trace = { .jitter_us = 60000 };
+    init_default(&jb);
+    build_trace(&trace, 2);
+
+    run_trace(&jb, &res);
+    print_result("jitter", &jb, &res);
+
+    jitter_buffer_stats_t stats;
+    jitter_buffer_get_stats(&jb, &stats);
+    TEST_ASSERT_EQUAL(0, res.empty);
+    // Applying frames on arrival stutters, the playout must be several times smoother
+    TEST_ASSERT_TRUE(res.jb_roughness * 4 < res.naive_roughness);
+    // The delay adapts to the jitter, but stays well below the configured maximum
+    TEST_ASSERT_TRUE(res.mean_delay_us > jb.cfg.min_delay_us);
+    TEST_ASSERT_TRUE(res.mean_delay_us < 100000);
+    TEST_ASSERT_TRUE(stats.late * 20 < stats.received);
+    TEST_ASSERT_TRUE(res.max_error < 5.0f);
+}
+
+void test_lossy_arrivals_are_predicted(void)
+{
+    jitter_buffer_t jb;
+    trace_result_t res;
+    trace_config_t trace = { .jitter_us = 10000, .loss_permille = 50, .loss_burst = 3 };
+    init_default(&jb);
+    build_trace(&trace, 3);
+
+    run_trace(&jb, &res);
+    print_result("lossy", &jb, &res);
+
+    jitter_buffer_stats_t stats;
+    jitter_buffer_get_stats(&jb, &stats);
+    TEST_ASSERT_EQUAL(0, res.empty);
+    TEST_ASSERT_TRUE(stats.predicted > 0);
+    TEST_ASSERT_TRUE(res.jb_roughness * 2 < res.naive_roughness);
+    // Three lost frames are 60 ms of extrapolation, the prediction has to stay close to the signal
+    TEST_ASSERT_TRUE(res.max_error < 30.0f);
+}
+
+void test_delay_shrinks_after_jitter_subsides(void)
+{
+    jitter_buffer_t jb;
+    trace_result_t res;
+    trace_config_t noisy = { .jitter_us = 80000 };
+    trace_config_t calm = { 0 };
+    jitter_buffer_stats_t stats;
+    init_default(&jb);
+
+    build_trace(&noisy, 4);
+    run_trace(&jb, &res);
+    jitter_buffer_get_stats(&jb, &stats);
+    uint32_t noisy_delay = stats.delay_us;
+
+    // The calm trace restarts the sender clock, a real reconnect resets the buffer as well
+    jitter_buffer_reset(&jb);
+    build_trace(&calm, 5);
+    run_trace(&jb, &res);
+    jitter_buffer_get_stats(&jb, &stats);
+    printf("[recover] delay noisy=%.1fms calm=%.1fms\n", noisy_delay / 1000.0f, stats.delay_us / 1000.0f);
+
+    TEST_ASSERT_TRUE(noisy_delay > 2 * jb.cfg.min_delay_us);
+    TEST_ASSERT_EQUAL(jb.cfg.min_delay_us, stats.delay_us);
+}
+
+void test_duplicate_and_late_frames_are_dropped(void)
+{
+    jitter_buffer_t jb;
+    float out[JITTER_BUFFER_MAX_CHANNELS];
+    jitter_buffer_stats_t stats;
+    init_default(&jb);
+
+    jitter_frame_t f0 = { .seq = 0, .timestamp_us = 0, .values = {0} };
+    jitter_frame_t f1 = { .seq = 1, .timestamp_us = 20000, .values = {20} };
+    jitter_frame_t f2 = { .seq = 2, .timestamp_us = 40000, .values = {40} };
+    TEST_ASSERT_EQUAL(ESP_OK, jitter_buffer_push(&jb, &f0, 1000));
+    TEST_ASSERT_EQUAL(ESP_OK, jitter_buffer_push(&jb, &f2, 41000));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, jitter_buffer_push(&jb, &f2, 41500));
+
+    // Playout has moved past f1 when it finally shows up
+    TEST_ASSERT_EQUAL(JITTER_BUFFER_PLAYOUT_INTERPOLATED, jitter_buffer_pop(&jb, 51000, out));
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 30.0f, out[0]);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, jitter_buffer_push(&jb, &f1, 52000));
+
+    jitter_buffer_get_stats(&jb, &stats);
+    TEST_ASSERT_EQUAL(2, stats.received);
+    TEST_ASSERT_EQUAL(1, stats.duplicate);
+    TEST_ASSERT_EQUAL(1, stats.late);
+}
+
+void test_prediction_is_bounded_by_horizon(void)
+{
+    jitter_buffer_t jb;
+    float out[JITTER_BUFFER_MAX_CHANNELS];
+    init_default(&jb);
+
+    // A steady ramp of 0.1 degree per ms, then the sender goes silent
+    for (uint32_t i = 0; i < 30; i++) {
+        jitter_frame_t f = { .seq = i, .timestamp_us = i * 20000, .values = {30.0f + i * 2} };
+        jitter_buffer_push(&jb, &f, f.timestamp_us + 1000);
+        jitter_buffer_pop(&jb, f.timestamp_us + 1000, out);
+    }
+
+    int64_t now = 29 * 20000 + 1000 + jb.cfg.min_delay_us + 50000;
+    TEST_ASSERT_EQUAL(JITTER_BUFFER_PLAYOUT_PREDICTED, jitter_buffer_pop(&jb, now, out));
+    TEST_ASSERT_FLOAT_WITHIN(2.0f, 88.0f + 5.0f, out[0]);
+
+    now += jb.cfg.max_predict_us;
+    TEST_ASSERT_EQUAL(JITTER_BUFFER_PLAYOUT_HELD, jitter_buffer_pop(&jb, now, out));
+    float held = out[0];
+    TEST_ASSERT_EQUAL(JITTER_BUFFER_PLAYOUT_HELD, jitter_buffer_pop(&jb, now + 100000, out));
+    TEST_ASSERT_EQUAL_FLOAT(held, out[0]);
+    TEST_ASSERT_FLOAT_WITHIN(3.0f, 88.0f + 15.0f, held);
+}
+
+/* The Linux FreeRTOS port provides main and runs app_main in a task */
+void app_main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_init_rejects_invalid_config);
+    RUN_TEST(test_pop_before_first_frame_is_empty);
+    RUN_TEST(test_steady_arrivals_are_interpolated);
+    RUN_TEST(test_jittered_arrivals_are_smoothed);
+    RUN_TEST(test_lossy_arrivals_are_predicted);
+    RUN_TEST(test_delay_shrinks_after_jitter_subsides);
+    RUN_TEST(test_duplicate_and_late_frames_are_dropped);
+    RUN_TEST(test_prediction_is_bounded_by_horizon);
+    exit(UNITY_END());
+}
@@ -0,0 +1,171 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _JITTER_BUFFER_H_
+#define _JITTER_BUFFER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define JITTER_BUFFER_MAX_CHANNELS  5    /**< One channel per finger */
+#define JITTER_BUFFER_CAPACITY      16   /**< Frames held while waiting for their playout time */
+
+/**
+ * @brief One received frame, stamped with the sender clock
+ *
+ */
+typedef struct {
+    uint32_t seq;                                /**< Sender sequence number, used to drop duplicates */
+    int64_t timestamp_us;                        /**< Sender time the values were sampled at */
+    float values[JITTER_BUFFER_MAX_CHANNELS];    /**< Finger targets carried by the frame */
+} jitter_frame_t;
+
+/**
+ * @brief Configuration of the jitter buffer
+ *
+ */
+typedef struct {
+    uint8_t channel_number;      /**< Number of used entries in jitter_frame_t::values */
+    uint32_t min_delay_us;       /**< Lower bound of the adaptive playout delay */
+    uint32_t max_delay_us;       /**< Upper bound of the adaptive playout delay */
+    float jitter_factor;         /**< Target delay is jitter_factor times the measured interarrival jitter */
+    uint32_t max_predict_us;     /**< Maximum extrapolation horizon for late frames, the output is held afterwards */
+    float alpha;                 /**< Position gain of the alpha-beta predictor (0..1] */
+    float beta;                  /**< Velocity gain of the alpha-beta predictor (0..2) */
+    float out_min;               /**< Outputs are clamped to [out_min, out_max] */
+    float out_max;
+} jitter_buffer_config_t;
+
+#define JITTER_BUFFER_DEFAULT_CONFIG() {   \
+    .channel_number = JITTER_BUFFER_MAX_CHANNELS, \
+    .min_delay_us = 20000,                 \
+    .max_delay_us = 400000,                \
+    .jitter_factor = 3.0f,                 \
+    .max_predict_us = 150000,              \
+    .alpha = 0.9f,                         \
+    .beta = 0.5f,                          \
+    .out_min = 0.0f,                       \
+    .out_max = 180.0f,                     \
+}
+
+/**
+ * @brief How the values returned by jitter_buffer_pop() were produced
+ *
+ */
+typedef enum {
+    JITTER_BUFFER_PLAYOUT_EMPTY = 0,     /**< Nothing received yet, output untouched */
+    JITTER_BUFFER_PLAYOUT_INTERPOLATED,  /**< Interpolated between two received frames */
+    JITTER_BUFFER_PLAYOUT_PREDICTED,     /**< Next frame is late, extrapolated by the predictor */
+    JITTER_BUFFER_PLAYOUT_HELD,          /**< Prediction horizon exceeded or no progress, last output repeated */
+} jitter_buffer_playout_t;
+
+/**
+ * @brief Counters and current state of the jitter buffer
+ *
+ */
+typedef struct {
+    uint32_t received;       /**< Frames accepted into the buffer */
+    uint32_t late;           /**< Frames that arrived after their playout time */
+    uint32_t duplicate;      /**< Frames dropped because their sequence number was already buffered */
+    uint32_t overflow;       /**< Frames dropped because the buffer was full */
+    uint32_t interpolated;   /**< Playouts per jitter_buffer_playout_t */
+    uint32_t predicted;
+    uint32_t held;
+    uint32_t delay_us;       /**< Current playout delay on top of the minimum transit time */
+    uint32_t jitter_us;      /**< Smoothed interarrival jitter */
+} jitter_buffer_stats_t;
+
+/**
+ * @brief Jitter buffer state, all storage is inline so it can live in static memory
+ *
+ */
+typedef struct {
+    jitter_buffer_config_t cfg;
+    jitter_frame_t frames[JITTER_BUFFER_CAPACITY];  /**< Sorted by timestamp, oldest first */
+    uint8_t count;
+    bool synced;                   /**< Set once the first frame established the clock offset */
+    int64_t offset_us;             /**< Minimum observed (arrival - sender timestamp) */
+    int64_t last_transit_us;
+    float jitter_us;
+    float delay_us;
+    int64_t last_pop_us;           /**< Local time of the previous jitter_buffer_pop() */
+    int64_t playout_us;            /**< Sender time of the last playout */
+    bool played;
+    int64_t pred_ts_us;            /**< Sender time of the last predictor update */
+    bool pred_valid;
+    float pred_x[JITTER_BUFFER_MAX_CHANNELS];
+    float pred_v[JITTER_BUFFER_MAX_CHANNELS];   /**< Per microsecond */
+    float last_out[JITTER_BUFFER_MAX_CHANNELS];
+    jitter_buffer_stats_t stats;
+} jitter_buffer_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Initialize a jitter buffer
+ *
+ * @param jb Jitter buffer to initialize
+ * @param config Pointer of jitter buffer configure struct
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_ARG Parameter error
+ */
+esp_err_t jitter_buffer_init(jitter_buffer_t *jb, const jitter_buffer_config_t *config);
+
+/**
+ * @brief Forget all buffered frames and the clock synchronisation, keep the configuration
+ *
+ * @param jb Jitter buffer
+ */
+void jitter_buffer_reset(jitter_buffer_t *jb);
+
+/**
+ * @brief Insert a received frame
+ *
+ * @note This API is not thread-safe, push and pop have to be serialized by the caller
+ *
+ * @param jb Jitter buffer
+ * @param frame Received frame
+ * @param arrival_us Local time the frame arrived at
+ *
+ * @return
+ *     - ESP_OK Frame buffered
+ *     - ESP_ERR_INVALID_ARG Parameter error
+ *     - ESP_ERR_INVALID_STATE Frame is a duplicate or arrived after its playout time, it only updated the predictor
+ */
+esp_err_t jitter_buffer_push(jitter_buffer_t *jb, const jitter_frame_t *frame, int64_t arrival_us);
+
+/**
+ * @brief Produce the finger targets for the local time now_us
+ *
+ * Meant to be called at a fixed rate. The returned values are interpolated between
+ * the frames bracketing the playout time, or extrapolated if the next frame is late.
+ *
+ * @param jb Jitter buffer
+ * @param now_us Local time of the playout
+ * @param[out] values At least config.channel_number entries, left untouched for JITTER_BUFFER_PLAYOUT_EMPTY
+ *
+ * @return How the values were produced
+ */
+jitter_buffer_playout_t jitter_buffer_pop(jitter_buffer_t *jb, int64_t now_us, float *values);
+
+/**
+ * @brief Read the jitter buffer counters
+ *
+ * @param jb Jitter buffer
+ * @param[out] stats Counters
+ */
+void jitter_buffer_get_stats(const jitter_buffer_t *jb, jitter_buffer_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _JITTER_BUFFER_H_ */
@@ -0,0 +1,216 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+#include "jitter_buffer.h"
+
+/* Smoothing of the interarrival jitter estimate, same gain as RFC 3550 */
+#define JITTER_GAIN_SHIFT   4
+/* The minimum transit estimate creeps upwards by 1/2^n of the excess per frame to follow clock drift */
+#define OFFSET_DRIFT_SHIFT  10
+/* The playout clock runs at most 1/n faster or slower than real time while the delay adapts */
+#define DELAY_SLEW_DIV      4
+
+static float clampf(float v, float lo, float hi)
+{
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+static float target_delay(const jitter_buffer_t *jb)
+{
+    return clampf(jb->cfg.jitter_factor * jb->jitter_us, (float)jb->cfg.min_delay_us, (float)jb->cfg.max_delay_us);
+}
+
+static void remove_front(jitter_buffer_t *jb, uint8_t n)
+{
+    memmove(&jb->frames[0], &jb->frames[n], (jb->count - n) * sizeof(jitter_frame_t));
+    jb->count -= n;
+}
+
+static void predictor_update(jitter_buffer_t *jb, const jitter_frame_t *frame)
+{
+    if (!jb->pred_valid) {
+        for (uint8_t ch = 0; ch < jb->cfg.channel_number; ch++) {
+            jb->pred_x[ch] = frame->values[ch];
+            jb->pred_v[ch] = 0.0f;
+        }
+        jb->pred_ts_us = frame->timestamp_us;
+        jb->pred_valid = true;
+        return;
+    }
+    if (frame->timestamp_us <= jb->pred_ts_us) {
+        return;
+    }
+
+    float dt = (float)(frame->timestamp_us - jb->pred_ts_us);
+    for (uint8_t ch = 0; ch < jb->cfg.channel_number; ch++) {
+        float xp = jb->pred_x[ch] + jb->pred_v[ch] * dt;
+        float r = frame->values[ch] - xp;
+        jb->pred_x[ch] = xp + jb->cfg.alpha * r;
+        jb->pred_v[ch] += jb->cfg.beta * r / dt;
+    }
+    jb->pred_ts_us = frame->timestamp_us;
+}
+
+esp_err_t jitter_buffer_init(jitter_buffer_t *jb, const jitter_buffer_config_t *config)
+{
+    if (jb == NULL || config == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (config->channel_number == 0 || config->channel_number > JITTER_BUFFER_MAX_CHANNELS
+            || config->min_delay_us > config->max_delay_us
+            || config->alpha <= 0.0f || config->alpha > 1.0f
+            || config->beta < 0.0f || config->beta >= 2.0f
+            || config->out_min >= config->out_max) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    jb->cfg = *config;
+    jitter_buffer_reset(jb);
+    return ESP_OK;
+}
+
+void jitter_buffer_reset(jitter_buffer_t *jb)
+{
+    jitter_buffer_config_t cfg = jb->cfg;
+    memset(jb, 0, sizeof(*jb));
+    jb->cfg = cfg;
+    jb->delay_us = (float)cfg.min_delay_us;
+    jb->last_pop_us = INT64_MIN;
+}
+
+esp_err_t jitter_buffer_push(jitter_buffer_t *jb, const jitter_frame_t *frame, int64_t arrival_us)
+{
+    if (jb == NULL || frame == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    int64_t transit = arrival_us - frame->timestamp_us;
+    if (!jb->synced) {
+        jb->offset_us = transit;
+        jb->last_transit_us = transit;
+        jb->synced = true;
+    } else {
+        int64_t d = transit - jb->last_transit_us;
+        jb->last_transit_us = transit;
+        jb->jitter_us += ((float)(d < 0 ? -d : d) - jb->jitter_us) / (1 << JITTER_GAIN_SHIFT);
+        if (transit < jb->offset_us) {
+            jb->offset_us = transit;
+        } else {
+            jb->offset_us += (transit - jb->offset_us) >> OFFSET_DRIFT_SHIFT;
+        }
+    }
+
+    for (uint8_t i = 0; i < jb->count; i++) {
+        if (jb->frames[i].seq == frame->seq) {
+            jb->stats.duplicate++;
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+
+    if (jb->played && frame->timestamp_us <= jb->playout_us) {
+        // Too late to be played, but still the freshest information for the predictor
+        predictor_update(jb, frame);
+        jb->stats.late++;
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (jb->count == JITTER_BUFFER_CAPACITY) {
+        remove_front(jb, 1);
+        jb->stats.overflow++;
+    }
+
+    uint8_t pos = jb->count;
+    while (pos > 0 && jb->frames[pos - 1].timestamp_us > frame->timestamp_us) {
+        jb->frames[pos] = jb->frames[pos - 1];
+        pos--;
+    }
+    jb->frames[pos] = *frame;
+    jb->count++;
+    jb->stats.received++;
+    return ESP_OK;
+}
+
+jitter_buffer_playout_t jitter_buffer_pop(jitter_buffer_t *jb, int64_t now_us, float *values)
+{
+    if (jb == NULL || values == NULL || !jb->synced) {
+        return JITTER_BUFFER_PLAYOUT_EMPTY;
+    }
+
+    // Move the playout delay towards the jitter target without letting the playout clock jump
+    float target = target_delay(jb);
+    if (jb->last_pop_us != INT64_MIN && now_us > jb->last_pop_us) {
+        float max_step = (float)(now_us - jb->last_pop_us) / DELAY_SLEW_DIV;
+        jb->delay_us += clampf(target - jb->delay_us, -max_step, max_step);
+    }
+    jb->last_pop_us = now_us;
+
+    int64_t play = now_us - jb->offset_us - (int64_t)jb->delay_us;
+    if (jb->played && play < jb->playout_us) {
+        play = jb->playout_us;
+    }
+
+    // Every frame that is due feeds the predictor, only the newest due frame is kept for interpolation
+    uint8_t due = 0;
+    while (due < jb->count && jb->frames[due].timestamp_us <= play) {
+        predictor_update(jb, &jb->frames[due]);
+        due++;
+    }
+    if (due > 1) {
+        remove_front(jb, due - 1);
+        due = 1;
+    }
+
+    jitter_buffer_playout_t result;
+    uint8_t n = jb->cfg.channel_number;
+    if (due == 1 && jb->count >= 2) {
+        const jitter_frame_t *a = &jb->frames[0];
+        const jitter_frame_t *b = &jb->frames[1];
+        float t = (float)(play - a->timestamp_us) / (float)(b->timestamp_us - a->timestamp_us);
+        for (uint8_t ch = 0; ch < n; ch++) {
+            values[ch] = a->values[ch] + (b->values[ch] - a->values[ch]) * t;
+        }
+        result = JITTER_BUFFER_PLAYOUT_INTERPOLATED;
+        jb->stats.interpolated++;
+    } else if (jb->pred_valid && (due == 1 || jb->count == 0)) {
+        int64_t horizon = play - jb->pred_ts_us;
+        result = JITTER_BUFFER_PLAYOUT_PREDICTED;
+        if (horizon > (int64_t)jb->cfg.max_predict_us) {
+            horizon = jb->cfg.max_predict_us;
+            result = JITTER_BUFFER_PLAYOUT_HELD;
+        }
+        for (uint8_t ch = 0; ch < n; ch++) {
+            values[ch] = jb->pred_x[ch] + jb->pred_v[ch] * (float)horizon;
+        }
+        if (result == JITTER_BUFFER_PLAYOUT_PREDICTED) {
+            jb->stats.predicted++;
+        } else {
+            jb->stats.held++;
+        }
+    } else if (jb->played) {
+        memcpy(values, jb->last_out, n * sizeof(float));
+        result = JITTER_BUFFER_PLAYOUT_HELD;
+        jb->stats.held++;
+    } else {
+        // The first frame is still waiting for its playout time
+        return JITTER_BUFFER_PLAYOUT_EMPTY;
+    }
+
+    for (uint8_t ch = 0; ch < n; ch++) {
+        values[ch] = clampf(values[ch], jb->cfg.out_min, jb->cfg.out_max);
+        jb->last_out[ch] = values[ch];
+    }
+    jb->playout_us = play;
+    jb->played = true;
+    return result;
+}
+
+void jitter_buffer_get_stats(const jitter_buffer_t *jb, jitter_buffer_stats_t *stats)
+{
+    *stats = jb->stats;
+    stats->delay_us = (uint32_t)jb->delay_us;
+    stats->jitter_us = (uint32_t)jb->jitter_us;
+}
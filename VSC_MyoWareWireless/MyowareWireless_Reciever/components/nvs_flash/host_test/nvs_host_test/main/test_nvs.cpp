@@ -17,6 +17,7 @@
 #include <string.h>
 #include <string>
 #include <random>
+#include <map>
 #include "test_fixtures.hpp"
 
 #define TEST_ESP_ERR(rc, res) CHECK((rc) == (res))
@@ -247,17 +248,9 @@ TEST_CASE("Page validates blob size", "[nvs]")
     TEST_ESP_OK(page.writeItem(1, nvs::ItemType::BLOB, "2", buf, nvs::Page::CHUNK_MAX_SIZE));
 }
 
-class HashListTestHelper : public nvs::HashList {
-public:
-    size_t getBlockCount()
-    {
-        return mBlockList.size();
-    }
-};
-
 TEST_CASE("HashList is cleaned up as soon as items are erased", "[nvs]")
 {
-    HashListTestHelper hashlist;
+    nvs::HashList hashlist;
     // Add items
     const size_t count = 128;
     for (size_t i = 0; i < count; ++i) {
@@ -266,13 +259,13 @@ TEST_CASE("HashList is cleaned up as soon as items are erased", "[nvs]")
         nvs::Item item(1, nvs::ItemType::U32, 1, key);
         hashlist.insert(item, i);
     }
-    INFO("Added " << count << " items, " << hashlist.getBlockCount() << " blocks");
+    INFO("Added " << count << " items, " << hashlist.getMemorySize() << " bytes");
     // Remove them in reverse order
     for (size_t i = count; i > 0; --i) {
         // Make sure that the element existed before it's erased
         CHECK(hashlist.erase(i - 1) == true);
     }
-    CHECK(hashlist.getBlockCount() == 0);
+    CHECK(hashlist.getMemorySize() == 0);
     // Add again
     for (size_t i = 0; i < count; ++i) {
         char key[16];
@@ -280,12 +273,54 @@ TEST_CASE("HashList is cleaned up as soon as items are erased", "[nvs]")
         nvs::Item item(1, nvs::ItemType::U32, 1, key);
         hashlist.insert(item, i);
     }
-    INFO("Added " << count << " items, " << hashlist.getBlockCount() << " blocks");
+    INFO("Added " << count << " items, " << hashlist.getMemorySize() << " bytes");
     // Remove them in the same order
     for (size_t i = 0; i < count; ++i) {
         CHECK(hashlist.erase(i) == true);
     }
-    CHECK(hashlist.getBlockCount() == 0);
+    CHECK(hashlist.getMemorySize() == 0);
+}
+
+TEST_CASE("HashList finds the first entry at or after start", "[nvs]")
+{
+    nvs::HashList hashlist;
+    nvs::Item a(1, nvs::ItemType::U32, 1, "a");
+    nvs::Item b(1, nvs::ItemType::U32, 1, "b");
+    TEST_ESP_OK(hashlist.insert(a, 5));
+    TEST_ESP_OK(hashlist.insert(b, 6));
+    TEST_ESP_OK(hashlist.insert(a, 9));
+    CHECK(hashlist.find(0, a) == 5);
+    CHECK(hashlist.find(6, a) == 9);
+    CHECK(hashlist.find(10, a) == SIZE_MAX);
+    CHECK(hashlist.find(0, b) == 6);
+    CHECK(hashlist.find(0, nvs::Item(2, nvs::ItemType::U32, 1, "a")) == SIZE_MAX);
+    CHECK(hashlist.erase(5) == true);
+    CHECK(hashlist.find(0, a) == 9);
+    CHECK(hashlist.erase(5) == false);
+}
+
+TEST_CASE("HashList tells apart items sharing the lower 24 bits of the hash", "[nvs]")
+{
+    // birthday search for two keys whose hashes only differ in the upper byte
+    std::map<uint32_t, std::pair<uint32_t, std::string> > seen;
+    char key[16];
+    std::string first;
+    for (int i = 0; first.empty(); ++i) {
+        snprintf(key, sizeof(key), "c%d", i);
+        uint32_t hash = nvs::Item(1, nvs::ItemType::U32, 1, key).calculateCrc32WithoutValue();
+        auto it = seen.find(hash & 0xffffff);
+        if (it == seen.end()) {
+            seen[hash & 0xffffff] = std::make_pair(hash, std::string(key));
+        } else if (it->second.first != hash) {
+            first = it->second.second;
+        }
+    }
+
+    nvs::HashList hashlist;
+    TEST_ESP_OK(hashlist.insert(nvs::Item(1, nvs::ItemType::U32, 1, first.c_str()), 0));
+    TEST_ESP_OK(hashlist.insert(nvs::Item(1, nvs::ItemType::U32, 1, key), 100));
+    CHECK(hashlist.find(0, nvs::Item(1, nvs::ItemType::U32, 1, key)) == 100);
+    CHECK(hashlist.find(0, nvs::Item(1, nvs::ItemType::U32, 1, first.c_str())) == 0);
 }
 
 TEST_CASE("can init PageManager in empty flash", "[nvs]")
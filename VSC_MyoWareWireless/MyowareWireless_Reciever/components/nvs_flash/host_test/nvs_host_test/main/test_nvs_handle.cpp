@@ -266,3 +266,172 @@ TEST_CASE("NVSHandleSimple correctly sets/gets char enum", "[partition_mgr]")
 
     REQUIRE(nvs::NVSPartitionManager::get_instance()->deinit_partition(NVS_DEFAULT_PART_NAME) == ESP_OK);
 }
+
+static size_t count_writes_of_eight_values(const char *prefix, bool transaction, uint32_t offset)
+{
+    nvs::NVSHandleSimple *handle;
+    REQUIRE(nvs::NVSPartitionManager::get_instance()->open_handle(NVS_DEFAULT_PART_NAME, "ns_1", NVS_READWRITE, &handle) == ESP_OK);
+
+    esp_partition_clear_stats();
+    if (transaction) {
+        CHECK(handle->begin_transaction() == ESP_OK);
+    }
+    for (uint32_t i = 0; i < 8; ++i) {
+        std::string key = prefix + std::to_string(i);
+        CHECK(handle->set_item(key.c_str(), offset + i) == ESP_OK);
+    }
+    CHECK(handle->commit() == ESP_OK);
+    size_t writes = esp_partition_get_write_ops();
+
+    for (uint32_t i = 0; i < 8; ++i) {
+        std::string key = prefix + std::to_string(i);
+        uint32_t value = 0;
+        CHECK(handle->get_item(key.c_str(), value) == ESP_OK);
+        CHECK(value == offset + i);
+    }
+    delete handle;
+    return writes;
+}
+
+TEST_CASE("NVSHandleSimple transaction writes all values at once", "[partition_mgr]")
+{
+    PartitionEmulationFixture f(0, 10);
+
+    const uint32_t NVS_FLASH_SECTOR = 6;
+    const uint32_t NVS_FLASH_SECTOR_COUNT_MIN = 3;
+
+    REQUIRE(nvs::NVSPartitionManager::get_instance()->init_custom(f.part(), NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT_MIN)
+            == ESP_OK);
+
+    // new values: an entry and a state word each, against one write of all entries and the
+    // state words they span
+    size_t single = count_writes_of_eight_values("single", false, 0);
+    size_t batched = count_writes_of_eight_values("key", true, 0);
+    CHECK(single == 16);
+    CHECK(batched <= 3);
+
+    // replaced values: the erased entries of the old values share their state words too,
+    // eight entries span two words at most
+    single = count_writes_of_eight_values("single", false, 200);
+    batched = count_writes_of_eight_values("key", true, 300);
+    CHECK(single == 24);
+    CHECK(batched <= 5);
+
+    nvs::NVSHandleSimple *handle;
+    REQUIRE(nvs::NVSPartitionManager::get_instance()->open_handle(NVS_DEFAULT_PART_NAME, "ns_1", NVS_READWRITE, &handle) == ESP_OK);
+
+    uint32_t value = 0;
+    CHECK(handle->begin_transaction() == ESP_OK);
+    CHECK(handle->begin_transaction() == ESP_ERR_NVS_INVALID_STATE);
+    CHECK(handle->set_item("key0", 1000u) == ESP_OK);
+    CHECK(handle->set_item("key0", 1001u) == ESP_OK);
+    CHECK(handle->set_string("str", "staged") == ESP_OK);
+    CHECK(handle->set_blob("blob", &value, sizeof(value)) == ESP_ERR_NOT_SUPPORTED);
+    CHECK(handle->erase_item("key1") == ESP_ERR_NVS_INVALID_STATE);
+    CHECK(handle->erase_all() == ESP_ERR_NVS_INVALID_STATE);
+
+    // nothing is visible before the commit
+    CHECK(handle->get_item("key0", value) == ESP_OK);
+    CHECK(value == 300);
+    CHECK(handle->commit() == ESP_OK);
+    CHECK(handle->get_item("key0", value) == ESP_OK);
+    CHECK(value == 1001);
+    char str[16];
+    CHECK(handle->get_string("str", str, sizeof(str)) == ESP_OK);
+    CHECK(strcmp(str, "staged") == 0);
+
+    // dropped values are never written
+    CHECK(handle->begin_transaction() == ESP_OK);
+    CHECK(handle->set_item("key0", 2000u) == ESP_OK);
+    CHECK(handle->abort_transaction() == ESP_OK);
+    CHECK(handle->abort_transaction() == ESP_ERR_NVS_INVALID_STATE);
+    CHECK(handle->get_item("key0", value) == ESP_OK);
+    CHECK(value == 1001);
+
+    // the values of a transaction have to fit into one page
+    char big[nvs::Page::CHUNK_MAX_SIZE / 2];
+    memset(big, 'x', sizeof(big));
+    big[sizeof(big) - 1] = 0;
+    CHECK(handle->begin_transaction() == ESP_OK);
+    CHECK(handle->set_string("big1", big) == ESP_OK);
+    CHECK(handle->set_string("big1", big) == ESP_OK);
+    CHECK(handle->set_string("big2", big) == ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+    CHECK(handle->commit() == ESP_OK);
+    size_t size = 0;
+    CHECK(handle->get_item_size(nvs::ItemType::SZ, "big1", size) == ESP_OK);
+    CHECK(size == sizeof(big));
+
+    delete handle;
+
+    REQUIRE(nvs::NVSPartitionManager::get_instance()->deinit_partition(NVS_DEFAULT_PART_NAME) == ESP_OK);
+}
+
+TEST_CASE("NVSHandleSimple transaction is stored completely or not at all on power loss", "[partition_mgr]")
+{
+    const uint32_t NVS_FLASH_SECTOR = 0;
+    const uint32_t NVS_FLASH_SECTOR_COUNT_MIN = 3;
+    const int COUNT = 8;
+    const size_t PAD_ENTRIES = 110;
+
+    // without padding the old values are on the page of the new ones, with padding on the page before
+    for (int pad = 0; pad < 2; ++pad) {
+        const size_t padEntries = pad ? PAD_ENTRIES : 0;
+        for (size_t errDelay = 0; ; ++errDelay) {
+            INFO("pad " << pad << " errDelay " << errDelay);
+            PartitionEmulationFixture f(0, 3);
+            REQUIRE(nvs::NVSPartitionManager::get_instance()->init_custom(f.part(), NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT_MIN)
+                    == ESP_OK);
+
+            nvs::NVSHandleSimple *handle;
+            REQUIRE(nvs::NVSPartitionManager::get_instance()->open_handle(NVS_DEFAULT_PART_NAME, "ns_1", NVS_READWRITE, &handle) == ESP_OK);
+            for (int i = 0; i < COUNT; ++i) {
+                std::string key = "key" + std::to_string(i);
+                REQUIRE(handle->set_item(key.c_str(), i) == ESP_OK);
+            }
+            REQUIRE(handle->set_string("name", "old") == ESP_OK);
+            if (pad) {
+                std::string padding((PAD_ENTRIES - 1) * 32 - 1, 'p');
+                REQUIRE(handle->set_string("pad", padding.c_str()) == ESP_OK);
+            }
+
+            esp_partition_fail_after(errDelay, ESP_PARTITION_FAIL_AFTER_MODE_BOTH);
+            REQUIRE(handle->begin_transaction() == ESP_OK);
+            for (int i = 0; i < COUNT; ++i) {
+                std::string key = "key" + std::to_string(i);
+                REQUIRE(handle->set_item(key.c_str(), 100 + i) == ESP_OK);
+            }
+            REQUIRE(handle->set_string("name", "a new name longer than one entry") == ESP_OK);
+            esp_err_t err = handle->commit();
+            esp_partition_fail_after(SIZE_MAX, ESP_PARTITION_FAIL_AFTER_MODE_BOTH);
+            delete handle;
+            REQUIRE(nvs::NVSPartitionManager::get_instance()->deinit_partition(NVS_DEFAULT_PART_NAME) == ESP_OK);
+
+            REQUIRE(nvs::NVSPartitionManager::get_instance()->init_custom(f.part(), NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT_MIN)
+                    == ESP_OK);
+            REQUIRE(nvs::NVSPartitionManager::get_instance()->open_handle(NVS_DEFAULT_PART_NAME, "ns_1", NVS_READWRITE, &handle) == ESP_OK);
+            int value = 0;
+            REQUIRE(handle->get_item("key0", value) == ESP_OK);
+            const int offset = value;
+            CHECK((offset == 0 || offset == 100));
+            for (int i = 0; i < COUNT; ++i) {
+                std::string key = "key" + std::to_string(i);
+                CHECK(handle->get_item(key.c_str(), value) == ESP_OK);
+                CHECK(value == offset + i);
+            }
+            char name[40];
+            CHECK(handle->get_string("name", name, sizeof(name)) == ESP_OK);
+            CHECK(strcmp(name, offset == 0 ? "old" : "a new name longer than one entry") == 0);
+            // no copy of an old value is left behind
+            size_t used = 0;
+            CHECK(handle->get_used_entry_count(used) == ESP_OK);
+            CHECK(used == COUNT + (offset == 0 ? 2 : 3) + padEntries);
+
+            delete handle;
+            REQUIRE(nvs::NVSPartitionManager::get_instance()->deinit_partition(NVS_DEFAULT_PART_NAME) == ESP_OK);
+
+            if (err == ESP_OK) {
+                break;
+            }
+        }
+    }
+}
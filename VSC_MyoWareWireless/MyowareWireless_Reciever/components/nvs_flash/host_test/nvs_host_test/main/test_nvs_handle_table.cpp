@@ -0,0 +1,141 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "catch.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+#include "nvs.h"
+#include "intrusive_list.h"
+#include "nvs_handle_table.hpp"
+#include "nvs_partition_manager.hpp"
+#include "test_fixtures.hpp"
+
+#define TEST_ESP_ERR(rc, res) CHECK((rc) == (res))
+#define TEST_ESP_OK(rc) CHECK((rc) == ESP_OK)
+
+static const uint32_t NVS_FLASH_SECTOR = 6;
+static const uint32_t NVS_FLASH_SECTOR_COUNT = 3;
+
+TEST_CASE("closed handles stay invalid when their slot is reused", "[nvs][handle_table]")
+{
+    const char *OTHER_PARTITION_NAME = "other_part";
+    PartitionEmulationFixture f(0, 10);
+    PartitionEmulationFixture f_other(0, 10, OTHER_PARTITION_NAME);
+    REQUIRE(nvs::NVSPartitionManager::get_instance()->init_custom(f.part(), NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT)
+            == ESP_OK);
+    REQUIRE(nvs::NVSPartitionManager::get_instance()->init_custom(f_other.part(), NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT)
+            == ESP_OK);
+
+    nvs_handle_t first;
+    TEST_ESP_OK(nvs_open("ns", NVS_READWRITE, &first));
+    CHECK(first != 0);
+    TEST_ESP_OK(nvs_set_u8(first, "key", 1));
+    nvs_close(first);
+
+    // the new handle takes the slot of the closed one, the old value must not reach it
+    nvs_handle_t second;
+    TEST_ESP_OK(nvs_open("ns", NVS_READWRITE, &second));
+    CHECK(second != first);
+    uint8_t value = 0;
+    TEST_ESP_ERR(nvs_get_u8(first, "key", &value), ESP_ERR_NVS_INVALID_HANDLE);
+    TEST_ESP_OK(nvs_get_u8(second, "key", &value));
+    CHECK(value == 1);
+    nvs_close(first);
+    TEST_ESP_OK(nvs_get_u8(second, "key", &value));
+
+    TEST_ESP_ERR(nvs_get_u8(0, "key", &value), ESP_ERR_NVS_INVALID_HANDLE);
+    TEST_ESP_ERR(nvs_get_u8(0xffffffff, "key", &value), ESP_ERR_NVS_INVALID_HANDLE);
+
+    nvs_handle_t other;
+    TEST_ESP_OK(nvs_open_from_partition(OTHER_PARTITION_NAME, "ns", NVS_READWRITE, &other));
+
+    // deinit closes the handles of its partition only
+    const size_t open = nvs::NVSPartitionManager::get_instance()->open_handles_size();
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+    CHECK(nvs::NVSPartitionManager::get_instance()->open_handles_size() == open - 1);
+    TEST_ESP_ERR(nvs_get_u8(second, "key", &value), ESP_ERR_NVS_INVALID_HANDLE);
+    TEST_ESP_OK(nvs_set_u8(other, "key", 2));
+
+    nvs_close(second);
+    nvs_close(other);
+    CHECK(nvs::NVSPartitionManager::get_instance()->open_handles_size() == open - 2);
+    TEST_ESP_OK(nvs_flash_deinit_partition(OTHER_PARTITION_NAME));
+}
+
+/* The list of entries nvs_api.cpp searched before, one node per open handle. */
+struct ListedHandle : public intrusive_list_node<ListedHandle> {
+    nvs_handle_t mHandle;
+    nvs::NVSHandleSimple* mHandlePtr;
+};
+
+TEST_CASE("handle lookup cost doesn't grow with the number of open handles", "[nvs][handle_table][bench]")
+{
+    const int ROUNDS = 20000;
+    const size_t counts[] = { 1, 16, 128, 512 };
+
+    std::cout << "handles  table find ns  list find ns  deinit us" << std::endl;
+    for (size_t count : counts) {
+        PartitionEmulationFixture f(0, 10);
+        REQUIRE(nvs::NVSPartitionManager::get_instance()->init_custom(f.part(), NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT)
+                == ESP_OK);
+
+        // the same handles in the table and in the list, the table owns them
+        nvs::HandleTable table;
+        std::vector<ListedHandle> listed(count);
+        intrusive_list<ListedHandle> list;
+        for (size_t i = 0; i < count; ++i) {
+            nvs::NVSHandleSimple* handle;
+            REQUIRE(nvs::NVSPartitionManager::get_instance()->open_handle(NVS_DEFAULT_PART_NAME, "ns", NVS_READWRITE, &handle)
+                    == ESP_OK);
+            REQUIRE(table.insert(handle, listed[i].mHandle) == ESP_OK);
+            listed[i].mHandlePtr = handle;
+            list.push_back(&listed[i]);
+        }
+
+        // the handle opened last was at the end of the list
+        const nvs_handle_t last = listed[count - 1].mHandle;
+        nvs::NVSHandleSimple* volatile found = nullptr;
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < ROUNDS; ++r) {
+            found = table.find(last);
+        }
+        auto tableNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / (double) ROUNDS;
+        CHECK(found == listed[count - 1].mHandlePtr);
+
+        found = nullptr;
+        start = std::chrono::steady_clock::now();
+        for (int r = 0; r < ROUNDS; ++r) {
+            auto it = std::find_if(list.begin(), list.end(), [=](ListedHandle& e) -> bool {
+                return e.mHandle == last;
+            });
+            found = (it != list.end()) ? it->mHandlePtr : nullptr;
+        }
+        auto listNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / (double) ROUNDS;
+        CHECK(found == listed[count - 1].mHandlePtr);
+        list.clear();
+        CHECK(table.eraseStorage(listed[0].mHandlePtr->get_storage()) == count);
+
+        // deinit closes the handles of the C API in one pass over the table
+        std::vector<nvs_handle_t> handles(count);
+        for (size_t i = 0; i < count; ++i) {
+            REQUIRE(nvs_open("ns", NVS_READWRITE, &handles[i]) == ESP_OK);
+        }
+        start = std::chrono::steady_clock::now();
+        REQUIRE(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME) == ESP_OK);
+        auto deinitUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        CHECK(nvs::NVSPartitionManager::get_instance()->open_handles_size() == 0);
+        uint32_t value = 0;
+        for (nvs_handle_t handle : handles) {
+            CHECK(nvs_get_u32(handle, "key", &value) == ESP_ERR_NVS_INVALID_HANDLE);
+        }
+
+        char line[80];
+        snprintf(line, sizeof(line), "%7zu  %13.1f  %12.1f  %9lld", count, tableNs, listNs, (long long) deinitUs);
+        std::cout << line << std::endl;
+    }
+}
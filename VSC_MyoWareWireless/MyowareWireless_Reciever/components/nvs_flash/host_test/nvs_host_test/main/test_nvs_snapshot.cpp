@@ -0,0 +1,244 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "catch.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "nvs.h"
+#include "nvs_partition_manager.hpp"
+#include "test_fixtures.hpp"
+
+#define TEST_ESP_ERR(rc, res) CHECK((rc) == (res))
+#define TEST_ESP_OK(rc) CHECK((rc) == ESP_OK)
+
+static const uint32_t NVS_FLASH_SECTOR = 6;
+static const uint32_t NVS_FLASH_SECTOR_COUNT = 4;
+
+TEST_CASE("snapshot reads the values of its namespace", "[nvs][snapshot]")
+{
+    PartitionEmulationFixture f(0, 10);
+    REQUIRE(nvs::NVSPartitionManager::get_instance()->init_custom(f.part(), NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT)
+            == ESP_OK);
+
+    const uint8_t blob[5] = {0x1, 0x2, 0x3, 0x4, 0x5};
+    nvs_handle_t handle;
+    TEST_ESP_OK(nvs_open("snap", NVS_READWRITE, &handle));
+    TEST_ESP_OK(nvs_set_i8(handle, "i8", -8));
+    TEST_ESP_OK(nvs_set_u16(handle, "u16", 1600));
+    TEST_ESP_OK(nvs_set_u32(handle, "u32", 32000000));
+    TEST_ESP_OK(nvs_set_i64(handle, "i64", -64000000000LL));
+    TEST_ESP_OK(nvs_set_str(handle, "str", "servo"));
+    TEST_ESP_OK(nvs_set_blob(handle, "blob", blob, sizeof(blob)));
+
+    nvs_handle_t other;
+    TEST_ESP_OK(nvs_open("other", NVS_READWRITE, &other));
+    TEST_ESP_OK(nvs_set_u32(other, "foreign", 1));
+
+    TEST_ESP_ERR(nvs_snapshot_open(nullptr, "missing", nullptr), ESP_ERR_INVALID_ARG);
+    nvs_snapshot_t snapshot;
+    TEST_ESP_ERR(nvs_snapshot_open(nullptr, "missing", &snapshot), ESP_ERR_NVS_NOT_FOUND);
+    TEST_ESP_OK(nvs_snapshot_open(nullptr, "snap", &snapshot));
+    CHECK(nvs_snapshot_is_current(snapshot));
+
+    int8_t i8 = 0;
+    uint16_t u16 = 0;
+    uint32_t u32 = 0;
+    int64_t i64 = 0;
+    TEST_ESP_OK(nvs_snapshot_get_i8(snapshot, "i8", &i8));
+    TEST_ESP_OK(nvs_snapshot_get_u16(snapshot, "u16", &u16));
+    TEST_ESP_OK(nvs_snapshot_get_u32(snapshot, "u32", &u32));
+    TEST_ESP_OK(nvs_snapshot_get_i64(snapshot, "i64", &i64));
+    CHECK(i8 == -8);
+    CHECK(u16 == 1600);
+    CHECK(u32 == 32000000);
+    CHECK(i64 == -64000000000LL);
+
+    size_t length = 0;
+    TEST_ESP_OK(nvs_snapshot_get_str(snapshot, "str", nullptr, &length));
+    CHECK(length == 6);
+    char str[6];
+    length = 3;
+    TEST_ESP_ERR(nvs_snapshot_get_str(snapshot, "str", str, &length), ESP_ERR_NVS_INVALID_LENGTH);
+    CHECK(length == 6);
+    TEST_ESP_OK(nvs_snapshot_get_str(snapshot, "str", str, &length));
+    CHECK(strcmp(str, "servo") == 0);
+
+    uint8_t blob_read[8];
+    length = sizeof(blob_read);
+    TEST_ESP_OK(nvs_snapshot_get_blob(snapshot, "blob", blob_read, &length));
+    CHECK(length == sizeof(blob));
+    CHECK(memcmp(blob, blob_read, sizeof(blob)) == 0);
+
+    TEST_ESP_ERR(nvs_snapshot_get_u32(snapshot, "i8", &u32), ESP_ERR_NVS_TYPE_MISMATCH);
+    TEST_ESP_ERR(nvs_snapshot_get_blob(snapshot, "str", blob_read, &length), ESP_ERR_NVS_TYPE_MISMATCH);
+    TEST_ESP_ERR(nvs_snapshot_get_u32(snapshot, "foreign", &u32), ESP_ERR_NVS_NOT_FOUND);
+    TEST_ESP_ERR(nvs_snapshot_get_u32(snapshot, nullptr, &u32), ESP_ERR_INVALID_ARG);
+
+    // a write to the namespace makes the snapshot outdated until it is refreshed
+    TEST_ESP_OK(nvs_set_u32(handle, "u32", 33));
+    CHECK_FALSE(nvs_snapshot_is_current(snapshot));
+    TEST_ESP_ERR(nvs_snapshot_get_u32(snapshot, "u32", &u32), ESP_ERR_NVS_INVALID_STATE);
+    TEST_ESP_OK(nvs_snapshot_refresh(snapshot));
+    TEST_ESP_OK(nvs_snapshot_get_u32(snapshot, "u32", &u32));
+    CHECK(u32 == 33);
+
+    TEST_ESP_OK(nvs_erase_key(handle, "i8"));
+    TEST_ESP_OK(nvs_snapshot_refresh(snapshot));
+    TEST_ESP_ERR(nvs_snapshot_get_i8(snapshot, "i8", &i8), ESP_ERR_NVS_NOT_FOUND);
+
+    nvs_close(other);
+    nvs_close(handle);
+
+    // the snapshot outlives the partition, but can't be refreshed without it
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+    CHECK_FALSE(nvs_snapshot_is_current(snapshot));
+    TEST_ESP_ERR(nvs_snapshot_get_u32(snapshot, "u32", &u32), ESP_ERR_NVS_INVALID_STATE);
+    TEST_ESP_ERR(nvs_snapshot_refresh(snapshot), ESP_ERR_NVS_NOT_INITIALIZED);
+    TEST_ESP_ERR(nvs_snapshot_get_u32(snapshot, "u32", &u32), ESP_ERR_NVS_INVALID_STATE);
+
+    nvs_snapshot_close(snapshot);
+    nvs_snapshot_close(nullptr);
+}
+
+TEST_CASE("snapshot reads don't contend with writers", "[nvs][snapshot][bench]")
+{
+    const int READERS = 4;
+    const int KEYS = 8;
+    const auto DURATION = std::chrono::milliseconds(300);
+
+    PartitionEmulationFixture f(0, 10);
+    REQUIRE(nvs::NVSPartitionManager::get_instance()->init_custom(f.part(), NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT)
+            == ESP_OK);
+
+    nvs_handle_t handle;
+    REQUIRE(nvs_open("cfg", NVS_READWRITE, &handle) == ESP_OK);
+    char key[16];
+    for (int k = 0; k < KEYS; ++k) {
+        snprintf(key, sizeof(key), "gain%d", k);
+        REQUIRE(nvs_set_u32(handle, key, 0) == ESP_OK);
+    }
+
+    // the values keep growing over both runs
+    uint32_t value = 0;
+    std::cout << "readers  path      reads/s  refreshes  writes" << std::endl;
+    for (int useSnapshot = 0; useSnapshot < 2; ++useSnapshot) {
+        std::atomic<bool> stop(false);
+        std::atomic<uint32_t> written(0);
+        uint32_t first = value;
+        std::atomic<uint64_t> reads(0);
+        std::atomic<uint64_t> refreshes(0);
+        std::atomic<int> errors(0);
+
+        // a read-mostly load: the writer updates one value about every 500 us
+        std::thread writer([&]() {
+            char writerKey[16];
+            while (!stop.load()) {
+                ++value;
+                snprintf(writerKey, sizeof(writerKey), "gain%d", (int) (value % KEYS));
+                if (nvs_set_u32(handle, writerKey, value) != ESP_OK) {
+                    errors.fetch_add(1);
+                }
+                written.store(value);
+                std::this_thread::sleep_for(std::chrono::microseconds(500));
+            }
+        });
+
+        std::vector<std::thread> readers;
+        for (int r = 0; r < READERS; ++r) {
+            readers.emplace_back([&, r]() {
+                nvs_snapshot_t snapshot = nullptr;
+                nvs_handle_t readHandle = 0;
+                if (useSnapshot) {
+                    if (nvs_snapshot_open(nullptr, "cfg", &snapshot) != ESP_OK) {
+                        errors.fetch_add(1);
+                        return;
+                    }
+                } else if (nvs_open("cfg", NVS_READONLY, &readHandle) != ESP_OK) {
+                    errors.fetch_add(1);
+                    return;
+                }
+
+                // every value only grows, a reader must never see it go back
+                uint32_t last[KEYS] = {};
+                char readerKey[16];
+                uint64_t count = 0;
+                for (int i = r; !stop.load(); ++i) {
+                    int k = i % KEYS;
+                    snprintf(readerKey, sizeof(readerKey), "gain%d", k);
+                    uint32_t value = 0;
+                    esp_err_t err;
+                    if (useSnapshot) {
+                        err = nvs_snapshot_get_u32(snapshot, readerKey, &value);
+                        if (err == ESP_ERR_NVS_INVALID_STATE) {
+                            refreshes.fetch_add(1);
+                            err = nvs_snapshot_refresh(snapshot);
+                            if (err == ESP_OK) {
+                                err = nvs_snapshot_get_u32(snapshot, readerKey, &value);
+                            }
+                        }
+                    } else {
+                        err = nvs_get_u32(readHandle, readerKey, &value);
+                    }
+                    if (err != ESP_OK && err != ESP_ERR_NVS_INVALID_STATE) {
+                        errors.fetch_add(1);
+                        continue;
+                    }
+                    if (err == ESP_OK) {
+                        if (value < last[k]) {
+                            errors.fetch_add(1);
+                        }
+                        last[k] = value;
+                        ++count;
+                    }
+                }
+                reads.fetch_add(count);
+
+                if (useSnapshot) {
+                    nvs_snapshot_close(snapshot);
+                } else {
+                    nvs_close(readHandle);
+                }
+            });
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(DURATION);
+        stop.store(true);
+        for (auto &reader : readers) {
+            reader.join();
+        }
+        writer.join();
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        CHECK(errors.load() == 0);
+        CHECK(reads.load() > 0);
+
+        char line[80];
+        snprintf(line, sizeof(line), "%7d  %-8s  %7.0f  %9llu  %6u", READERS, useSnapshot ? "snapshot" : "locked",
+                 reads.load() / seconds, (unsigned long long) refreshes.load(), (unsigned) (written.load() - first));
+        std::cout << line << std::endl;
+    }
+
+    // after the last write a fresh snapshot sees exactly what the locked path reads
+    nvs_snapshot_t snapshot;
+    REQUIRE(nvs_snapshot_open(nullptr, "cfg", &snapshot) == ESP_OK);
+    for (int k = 0; k < KEYS; ++k) {
+        snprintf(key, sizeof(key), "gain%d", k);
+        uint32_t locked = 0;
+        uint32_t cached = 0;
+        CHECK(nvs_get_u32(handle, key, &locked) == ESP_OK);
+        CHECK(nvs_snapshot_get_u32(snapshot, key, &cached) == ESP_OK);
+        CHECK(locked == cached);
+    }
+    nvs_snapshot_close(snapshot);
+
+    nvs_close(handle);
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+}
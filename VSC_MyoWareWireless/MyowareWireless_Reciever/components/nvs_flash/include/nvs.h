@@ -90,6 +90,7 @@ typedef enum {
     NVS_TYPE_I64   = 0x18,  /*!< Type int64_t */
     NVS_TYPE_STR   = 0x21,  /*!< Type string */
     NVS_TYPE_BLOB  = 0x42,  /*!< Type blob */
+    NVS_TYPE_COUNTER = 0x84, /*!< Type uint32_t counter, see nvs_counter_inc */
     NVS_TYPE_ANY   = 0xff   /*!< Must be last */
 } nvs_type_t;
 
@@ -107,6 +108,36 @@ typedef struct {
  */
 typedef struct nvs_opaque_iterator_t *nvs_iterator_t;
 
+/**
+ * Opaque pointer type representing a snapshot of one namespace
+ */
+typedef struct nvs_opaque_snapshot_t *nvs_snapshot_t;
+
+/**
+ * Opaque pointer type representing a read-only view on a stored blob
+ */
+typedef struct nvs_opaque_blob_view_t *nvs_blob_view_t;
+
+/**
+ * Opaque pointer type representing a blob being written in pieces
+ */
+typedef struct nvs_opaque_blob_writer_t *nvs_blob_writer_t;
+
+/**
+ * Opaque pointer type representing a blob being read in pieces
+ */
+typedef struct nvs_opaque_blob_reader_t *nvs_blob_reader_t;
+
+/**
+ * Buffer size of a blob writer opened with buffer_size 0
+ */
+#define NVS_BLOB_WRITER_DEFAULT_BUFFER_SIZE 1024
+
+/**
+ * Smallest buffer size of a blob writer, which limits the blob to about 63 KB
+ */
+#define NVS_BLOB_WRITER_MIN_BUFFER_SIZE 512
+
 /**
  * @brief      Open non-volatile storage with a given namespace from the default NVS partition
  *
@@ -325,6 +356,56 @@ esp_err_t nvs_set_str (nvs_handle_t handle, const char* key, const char* value);
  */
 esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length);
 
+/**
+ * @brief      Add one to a counter
+ *
+ * Meant for values which change often and only ever count up, like boot or usage counters.
+ * Instead of writing a new entry on every update like \c nvs_set_u32, a counter takes 4
+ * entries and every increment programs a single bit of the erased ones, so a counter is
+ * written anew once every 768 increments only. After a power loss during the increment the
+ * counter holds either the previous or the new value.
+ * On encrypted partitions a counter takes one entry and every increment writes it anew.
+ *
+ * A counter which doesn't exist yet is created with the value 1. The value wraps around like
+ * an uint32_t. Read a counter with \c nvs_counter_get, nvs_erase_key resets it.
+ *
+ * @param[in]  handle     Handle obtained from nvs_open function.
+ *                        Handles that were opened read only cannot be used.
+ * @param[in]  key        Key name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn't be empty.
+ * @param[out] out_value  The new value of the counter, may be NULL.
+ *
+ * @return
+ *             - ESP_OK if the counter was incremented
+ *             - ESP_FAIL if there is an internal error; most likely due to corrupted
+ *               NVS partition (only if NVS assertion checks are disabled)
+ *             - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
+ *             - ESP_ERR_NVS_READ_ONLY if storage handle was opened as read only
+ *             - ESP_ERR_NVS_INVALID_NAME if key name doesn't satisfy constraints
+ *             - ESP_ERR_NVS_KEY_TOO_LONG if the key name is too long
+ *             - ESP_ERR_NVS_TYPE_MISMATCH if the key holds a value which isn't a counter
+ *             - ESP_ERR_NVS_NOT_ENOUGH_SPACE if there is not enough space in the
+ *               underlying storage to write the counter anew
+ *             - ESP_ERR_NVS_REMOVE_FAILED if the counter was written anew, but the old one
+ *               couldn't be erased. It is erased after re-initialization of nvs.
+ */
+esp_err_t nvs_counter_inc(nvs_handle_t handle, const char* key, uint32_t* out_value);
+
+/**
+ * @brief      Get the value of a counter
+ *
+ * @param[in]  handle     Handle obtained from nvs_open function.
+ * @param[in]  key        Key name. Maximum length is (NVS_KEY_NAME_MAX_SIZE-1) characters. Shouldn't be empty.
+ * @param[out] out_value  The value of the counter.
+ *
+ * @return
+ *             - ESP_OK if the value was retrieved successfully
+ *             - ESP_ERR_NVS_NOT_FOUND if the requested key doesn't exist or isn't a counter
+ *             - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
+ *             - ESP_ERR_NVS_INVALID_NAME if key name doesn't satisfy constraints
+ *             - ESP_ERR_INVALID_ARG if out_value is NULL
+ */
+esp_err_t nvs_counter_get(nvs_handle_t handle, const char* key, uint32_t* out_value);
+
 /**@{*/
 /**
  * @brief      get int8_t value for given key
@@ -481,6 +562,212 @@ esp_err_t nvs_get_str (nvs_handle_t handle, const char* key, char* out_value, si
 esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length);
 /**@}*/
 
+/**
+ * @brief      Open a read-only view on a blob without copying it into RAM
+ *
+ * Useful for large blobs, which are read after boot and then only read, like lookup
+ * tables or classifier models. The blob is stored in chunks, one per NVS page it spans.
+ * On unencrypted partitions the view maps the flash holding the chunks into the data
+ * address space and hands out one span per chunk. On encrypted partitions the blob is
+ * read into a single buffer instead.
+ *
+ * The view becomes invalid as soon as the namespace may have changed: any write or erase
+ * in it, or the deinitialization of the partition. Getting a span then fails with
+ * ESP_ERR_NVS_INVALID_STATE, pointers to spans obtained before must not be used anymore.
+ * Open a new view in this case.
+ *
+ * @param[in]  handle    Handle obtained from nvs_open function.
+ * @param[in]  key       Key name of the blob.
+ * @param[out] out_view  View, release it with nvs_blob_view_release.
+ *
+ * @return
+ *             - ESP_OK if the view was opened
+ *             - ESP_ERR_NVS_NOT_FOUND if the requested key doesn't exist
+ *             - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
+ *             - ESP_ERR_NO_MEM if memory for the view can't be allocated
+ *             - ESP_ERR_INVALID_ARG if key or out_view is NULL
+ *             - other error codes from the underlying storage driver
+ */
+esp_err_t nvs_get_blob_view(nvs_handle_t handle, const char* key, nvs_blob_view_t* out_view);
+
+/**
+ * @brief      Get the data of one chunk of a blob view
+ *
+ * @param[in]  view        View obtained from nvs_get_blob_view.
+ * @param[in]  index       Index of the span, starting at 0.
+ * @param[out] out_data    Pointer to the data, valid until the view becomes invalid.
+ * @param[out] out_length  Length of the span in bytes.
+ *
+ * @return
+ *             - ESP_OK if the span was returned
+ *             - ESP_ERR_NVS_NOT_FOUND if index is past the last span
+ *             - ESP_ERR_NVS_INVALID_STATE if the view isn't valid anymore
+ *             - ESP_ERR_INVALID_ARG if one of the parameters is NULL
+ */
+esp_err_t nvs_blob_view_get_span(nvs_blob_view_t view, size_t index, const void** out_data, size_t* out_length);
+
+/**
+ * @brief      Get the number of spans of a blob view, one per chunk of a mapped blob
+ */
+size_t nvs_blob_view_get_span_count(nvs_blob_view_t view);
+
+/**
+ * @brief      Get the length of the blob in bytes
+ */
+size_t nvs_blob_view_get_size(nvs_blob_view_t view);
+
+/**
+ * @brief      Check whether the spans of the view may still be read
+ */
+bool nvs_blob_view_is_valid(nvs_blob_view_t view);
+
+/**
+ * @brief      Check whether the spans point into mapped flash instead of a copy
+ */
+bool nvs_blob_view_is_mapped(nvs_blob_view_t view);
+
+/**
+ * @brief      Release a blob view and its mapping or copy
+ *
+ * @param[in]  view  View obtained from nvs_get_blob_view, NULL is allowed.
+ */
+void nvs_blob_view_release(nvs_blob_view_t view);
+
+/**
+ * @brief      Start writing a blob in pieces of any size
+ *
+ * For blobs which are produced piece by piece and are too large to be held in RAM at once,
+ * like recorded EMG templates. The pieces are collected in a buffer of buffer_size bytes,
+ * which is written to flash as a chunk of the blob whenever it is full. Pieces of at least
+ * buffer_size bytes are written without the copy. A blob consists of at most 127 chunks, each
+ * at most the size of a page, so buffer_size limits it to about 127 * buffer_size bytes. Choose
+ * buffer_size of at least 1/127 of the largest blob expected, otherwise nvs_blob_writer_write
+ * fails with ESP_ERR_NVS_VALUE_TOO_LONG only once the chunks run out.
+ *
+ * The blob stored under key stays readable until nvs_blob_writer_commit writes the new one,
+ * after a power loss before that the chunks written are erased by nvs_flash_init. While the
+ * writer is open, nvs_set_blob fails for key with ESP_ERR_NVS_INVALID_STATE and so does
+ * opening another writer for it.
+ *
+ * @param[in]  handle       Handle obtained from nvs_open function, opened read-write.
+ * @param[in]  key          Key name of the blob.
+ * @param[in]  buffer_size  Size of the buffer in bytes, at least NVS_BLOB_WRITER_MIN_BUFFER_SIZE,
+ *                          NVS_BLOB_WRITER_DEFAULT_BUFFER_SIZE if 0.
+ * @param[out] out_writer   Writer, end it with nvs_blob_writer_commit or nvs_blob_writer_abort.
+ *
+ * @return
+ *             - ESP_OK if the writer was opened
+ *             - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
+ *             - ESP_ERR_NVS_READ_ONLY if handle was opened as read only
+ *             - ESP_ERR_NVS_KEY_TOO_LONG if the key name is too long
+ *             - ESP_ERR_NVS_INVALID_STATE if a writer for key is open already
+ *             - ESP_ERR_NOT_SUPPORTED if a transaction is in progress on handle
+ *             - ESP_ERR_NO_MEM if memory for the writer can't be allocated
+ *             - ESP_ERR_INVALID_ARG if key or out_writer is NULL, or buffer_size isn't 0 and
+ *               below NVS_BLOB_WRITER_MIN_BUFFER_SIZE
+ *             - other error codes from the underlying storage driver
+ */
+esp_err_t nvs_blob_writer_open(nvs_handle_t handle, const char* key, size_t buffer_size, nvs_blob_writer_t* out_writer);
+
+/**
+ * @brief      Append data to a blob being written
+ *
+ * If writing to flash fails, the chunks written so far are erased, the writer can only be
+ * aborted then.
+ *
+ * @param[in]  writer  Writer obtained from nvs_blob_writer_open.
+ * @param[in]  data    Data to append.
+ * @param[in]  length  Length of data in bytes.
+ *
+ * @return
+ *             - ESP_OK if the data was appended
+ *             - ESP_ERR_NVS_VALUE_TOO_LONG if the blob would get longer than the partition
+ *               allows, or has too many chunks; nothing is appended in the first case
+ *             - ESP_ERR_NVS_NOT_ENOUGH_SPACE if there is not enough space left
+ *             - ESP_ERR_NVS_INVALID_STATE if writing failed before or the partition was deinitialized
+ *             - ESP_ERR_INVALID_ARG if writer is NULL or data is NULL while length isn't 0
+ *             - other error codes from the underlying storage driver
+ */
+esp_err_t nvs_blob_writer_write(nvs_blob_writer_t writer, const void* data, size_t length);
+
+/**
+ * @brief      Write the rest of the blob and replace the one stored under the key with it
+ *
+ * The new blob becomes visible at once, the previous one is erased afterwards. The writer is
+ * released in any case, on failure the chunks written are erased.
+ *
+ * @param[in]  writer  Writer obtained from nvs_blob_writer_open.
+ *
+ * @return
+ *             - ESP_OK if the blob was stored
+ *             - ESP_ERR_NVS_INVALID_STATE if writing failed before, the partition was deinitialized
+ *               or chunks were erased with the namespace meanwhile
+ *             - ESP_ERR_NVS_NOT_ENOUGH_SPACE if there is not enough space left
+ *             - ESP_ERR_NVS_REMOVE_FAILED if the previous blob couldn't be erased, it is
+ *               erased by the next nvs_flash_init
+ *             - ESP_ERR_INVALID_ARG if writer is NULL
+ *             - other error codes from the underlying storage driver
+ */
+esp_err_t nvs_blob_writer_commit(nvs_blob_writer_t writer);
+
+/**
+ * @brief      Erase what was written and release the writer, the stored blob stays as it is
+ *
+ * @param[in]  writer  Writer obtained from nvs_blob_writer_open, NULL is allowed.
+ */
+void nvs_blob_writer_abort(nvs_blob_writer_t writer);
+
+/**
+ * @brief      Start reading a blob in pieces of any size
+ *
+ * Unlike nvs_get_blob, the blob doesn't have to fit into RAM. The data CRC of every chunk
+ * is checked when its last byte is read, data of a damaged chunk has been handed out by then.
+ * Like a blob view, the reader becomes invalid as soon as the namespace may have changed.
+ *
+ * @param[in]  handle      Handle obtained from nvs_open function.
+ * @param[in]  key         Key name of the blob.
+ * @param[out] out_reader  Reader, release it with nvs_blob_reader_release.
+ *
+ * @return
+ *             - ESP_OK if the reader was opened
+ *             - ESP_ERR_NVS_NOT_FOUND if the requested key doesn't exist
+ *             - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
+ *             - ESP_ERR_NVS_KEY_TOO_LONG if the key name is too long
+ *             - ESP_ERR_NO_MEM if memory for the reader can't be allocated
+ *             - ESP_ERR_INVALID_ARG if key or out_reader is NULL
+ *             - other error codes from the underlying storage driver
+ */
+esp_err_t nvs_blob_reader_open(nvs_handle_t handle, const char* key, nvs_blob_reader_t* out_reader);
+
+/**
+ * @brief      Get the length of the blob in bytes
+ */
+size_t nvs_blob_reader_get_size(nvs_blob_reader_t reader);
+
+/**
+ * @brief      Read the next bytes of a blob
+ *
+ * @param[in]  reader      Reader obtained from nvs_blob_reader_open.
+ * @param[out] out_data    Buffer for the data.
+ * @param[in]  length      Number of bytes to read.
+ * @param[out] out_length  Number of bytes read, less than length only at the end of the blob.
+ *
+ * @return
+ *             - ESP_OK if the bytes were read
+ *             - ESP_ERR_INVALID_CRC if a chunk read up to its end is damaged
+ *             - ESP_ERR_NVS_INVALID_STATE if the reader isn't valid anymore
+ *             - ESP_ERR_INVALID_ARG if one of the parameters is NULL
+ *             - other error codes from the underlying storage driver
+ */
+esp_err_t nvs_blob_reader_read(nvs_blob_reader_t reader, void* out_data, size_t length, size_t* out_length);
+
+/**
+ * @brief      Release a blob reader
+ *
+ * @param[in]  reader  Reader obtained from nvs_blob_reader_open, NULL is allowed.
+ */
+void nvs_blob_reader_release(nvs_blob_reader_t reader);
+
 /**
  * @brief      Lookup key-value pair with given key name.
  *
@@ -778,6 +1065,102 @@ esp_err_t nvs_entry_info(const nvs_iterator_t iterator, nvs_entry_info_t *out_in
  */
 void nvs_release_iterator(nvs_iterator_t iterator);
 
+/**
+ * @brief      Copy all values of a namespace into RAM for reading without the NVS lock
+ *
+ * Reads through nvs_snapshot_get_* functions don't take the lock which serializes all
+ * other NVS calls, so tasks which poll configuration values don't wait for flash writes
+ * or erases of other tasks. Every write, erase, init or deinit of the partition may make
+ * the snapshot outdated, the get functions then return ESP_ERR_NVS_INVALID_STATE and
+ * the owner calls nvs_snapshot_refresh.
+ *
+ * Several tasks may read one snapshot at the same time, but nvs_snapshot_refresh and
+ * nvs_snapshot_close must not be called while another task reads it. Give every task
+ * its own snapshot if more than one of them refreshes.
+ *
+ * @param[in]  part_name       Label (name) of the partition, NULL for the default NVS partition
+ * @param[in]  namespace_name  Namespace name, which has to exist already
+ * @param[out] out_snapshot    Snapshot, close it with nvs_snapshot_close
+ *
+ * @return
+ *             - ESP_OK if the snapshot was created and filled
+ *             - ESP_ERR_NVS_NOT_INITIALIZED if the partition is not initialized
+ *             - ESP_ERR_NVS_NOT_FOUND if the namespace doesn't exist
+ *             - ESP_ERR_NO_MEM if memory for the copy can't be allocated
+ *             - ESP_ERR_INVALID_ARG if namespace_name or out_snapshot is NULL
+ *             - other error codes from the underlying storage driver
+ */
+esp_err_t nvs_snapshot_open(const char *part_name, const char *namespace_name, nvs_snapshot_t *out_snapshot);
+
+/**
+ * @brief      Copy the current values of the namespace into the snapshot again
+ *
+ * @param[in]  snapshot  Snapshot obtained from nvs_snapshot_open
+ *
+ * @return
+ *             - ESP_OK if the snapshot is current again
+ *             - ESP_ERR_NVS_NOT_INITIALIZED if the partition was deinitialized
+ *             - ESP_ERR_NVS_NOT_FOUND if the namespace was erased
+ *             - ESP_ERR_INVALID_ARG if snapshot is NULL
+ *             - other error codes from the underlying storage driver
+ */
+esp_err_t nvs_snapshot_refresh(nvs_snapshot_t snapshot);
+
+/**
+ * @brief      Check whether the snapshot still holds the values stored in flash
+ *
+ * @param[in]  snapshot  Snapshot obtained from nvs_snapshot_open
+ *
+ * @return     true if no write since the last refresh could have changed the namespace
+ */
+bool nvs_snapshot_is_current(nvs_snapshot_t snapshot);
+
+/**@{*/
+/**
+ * @brief      get int8_t value for given key from a snapshot, without taking the NVS lock
+ *
+ * Works like nvs_get_i8 and friends.
+ *
+ * @param[in]     snapshot   Snapshot obtained from nvs_snapshot_open
+ * @param[in]     key        Key name
+ * @param         out_value  Pointer to the output value
+ *
+ * @return
+ *             - ESP_OK if the value was retrieved successfully
+ *             - ESP_ERR_NVS_INVALID_STATE if the snapshot is outdated, call nvs_snapshot_refresh
+ *             - ESP_ERR_NVS_NOT_FOUND if the requested key doesn't exist
+ *             - ESP_ERR_NVS_TYPE_MISMATCH if the key is stored with another type
+ *             - ESP_ERR_INVALID_ARG if one of the parameters is NULL
+ */
+esp_err_t nvs_snapshot_get_i8 (nvs_snapshot_t snapshot, const char* key, int8_t* out_value);
+esp_err_t nvs_snapshot_get_u8 (nvs_snapshot_t snapshot, const char* key, uint8_t* out_value);
+esp_err_t nvs_snapshot_get_i16(nvs_snapshot_t snapshot, const char* key, int16_t* out_value);
+esp_err_t nvs_snapshot_get_u16(nvs_snapshot_t snapshot, const char* key, uint16_t* out_value);
+esp_err_t nvs_snapshot_get_i32(nvs_snapshot_t snapshot, const char* key, int32_t* out_value);
+esp_err_t nvs_snapshot_get_u32(nvs_snapshot_t snapshot, const char* key, uint32_t* out_value);
+esp_err_t nvs_snapshot_get_i64(nvs_snapshot_t snapshot, const char* key, int64_t* out_value);
+esp_err_t nvs_snapshot_get_u64(nvs_snapshot_t snapshot, const char* key, uint64_t* out_value);
+/**@}*/
+
+/**@{*/
+/**
+ * @brief      get string or blob value for given key from a snapshot, without taking the NVS lock
+ *
+ * Works like nvs_get_str and nvs_get_blob, including the query of the length with
+ * out_value set to NULL. Additionally returns ESP_ERR_NVS_INVALID_STATE if the
+ * snapshot is outdated.
+ */
+esp_err_t nvs_snapshot_get_str (nvs_snapshot_t snapshot, const char* key, char* out_value, size_t* length);
+esp_err_t nvs_snapshot_get_blob(nvs_snapshot_t snapshot, const char* key, void* out_value, size_t* length);
+/**@}*/
+
+/**
+ * @brief      Free a snapshot
+ *
+ * @param[in]  snapshot  Snapshot obtained from nvs_snapshot_open, NULL is allowed
+ */
+void nvs_snapshot_close(nvs_snapshot_t snapshot);
+
 
 #ifdef __cplusplus
 } // extern "C"
@@ -26,6 +26,7 @@ class NVS_Constants:
             0x41: 'blob',
             0x42: 'blob_data',
             0x48: 'blob_index',
+            0x84: 'counter',
         }
         self.page_status = {
             0xFFFFFFFF: 'Empty',
@@ -99,7 +100,8 @@ class NVS_Page:
             'version': 256 - page_data[8],
             'crc': {
                 'original': int.from_bytes(page_data[28:32], byteorder='little'),
-                'computed': crc32(page_data[4:28], 0xFFFFFFFF),
+                # the page summary in bytes 9 to 27 is written later and not covered
+                'computed': crc32(page_data[4:9] + b'\xff' * 19, 0xFFFFFFFF),
             },
         }
 
@@ -189,6 +191,9 @@ class NVS_Entry:
                     size = int.from_bytes(data[:2], byteorder='little')
                     crc = int.from_bytes(data[4:8], byteorder='little')
                     return {'value': [size, crc], 'size': size, 'crc': crc}
+                if nvs_const.item_type[i_type] == 'counter':
+                    # base value, the programmed bits of the data entries are added to it
+                    return {'value': int.from_bytes(data[:4], byteorder='little')}
                 if nvs_const.item_type[i_type] == 'blob_index':
                     size = int.from_bytes(data[:4], byteorder='little')
                     chunk_count = data[4]
@@ -268,6 +273,13 @@ class NVS_Entry:
         children_data = bytearray()
         for entry in self.children:
             children_data += entry.raw
+        if self.metadata['type'] == 'counter':
+            # one programmed bit per increment, the data of a counter has no crc
+            if self.data:
+                count = sum(8 - bin(b).count('1') for b in children_data)
+                self.data['value'] = (self.data['value'] + count) & 0xFFFFFFFF
+            self.metadata['crc']['data_computed'] = self.metadata['crc']['data_original']
+            return
         if self.data:
             children_data = children_data[: self.data['size']]  # Discard padding
         self.metadata['crc']['data_computed'] = crc32(children_data, 0xFFFFFFFF)
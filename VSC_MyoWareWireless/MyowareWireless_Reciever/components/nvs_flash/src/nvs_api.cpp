@@ -13,6 +13,10 @@
 #include "esp_partition.h"
 #include <functional>
 #include "nvs_handle_simple.hpp"
+#include "nvs_handle_table.hpp"
+#include "nvs_snapshot.hpp"
+#include "nvs_blob_view.hpp"
+#include "nvs_blob_stream.hpp"
 #include "nvs_memory_management.hpp"
 #include "esp_err.h"
 #include <esp_rom_crc.h>
@@ -29,36 +33,26 @@ static const char* TAG = "nvs";
  */
 static nvs_sec_scheme_t nvs_sec_default_scheme_cfg;
 
-class NVSHandleEntry : public intrusive_list_node<NVSHandleEntry>, public ExceptionlessAllocatable {
-public:
-    NVSHandleEntry(nvs::NVSHandleSimple *handle, const char* part_name)
-        : nvs_handle(handle),
-        mHandle(++s_nvs_next_handle),
-        handle_part_name(part_name) { }
-
-    ~NVSHandleEntry() {
-        delete nvs_handle;
-    }
-
-    nvs::NVSHandleSimple *nvs_handle;
-    nvs_handle_t mHandle;
-    const char* handle_part_name;
-private:
-    static uint32_t s_nvs_next_handle;
-};
-
-uint32_t NVSHandleEntry::s_nvs_next_handle;
-
 extern "C" void nvs_dump(const char *partName);
 
 #ifndef LINUX_TARGET
 SemaphoreHandle_t nvs::Lock::mSemaphore = nullptr;
+SemaphoreHandle_t nvs::GcLock::mSemaphore = nullptr;
+#else
+std::mutex nvs::Lock::mMutex;
+std::mutex nvs::GcLock::mMutex;
 #endif // ! LINUX_TARGET
 
 using namespace std;
 using namespace nvs;
 
-static intrusive_list<NVSHandleEntry> s_nvs_handles;
+static HandleTable s_nvs_handles;
+
+static intrusive_list<NVSBlobView> s_nvs_blob_views;
+
+static intrusive_list<NVSBlobWriter> s_nvs_blob_writers;
+
+static intrusive_list<NVSBlobReader> s_nvs_blob_readers;
 
 static nvs::Storage* lookup_storage_from_name(const char *name)
 {
@@ -80,15 +74,26 @@ extern "C" void nvs_dump(const char *partName)
 
 static esp_err_t close_handles_and_deinit(const char* part_name)
 {
-    auto belongs_to_part = [=](NVSHandleEntry& e) -> bool {
-        return strncmp(e.nvs_handle->get_partition_name(), part_name, NVS_PART_NAME_MAX_SIZE) == 0;
-    };
-
-    auto it = find_if(begin(s_nvs_handles), end(s_nvs_handles), belongs_to_part);
-
-    while (it != end(s_nvs_handles)) {
-        s_nvs_handles.erase(it);
-        it = find_if(begin(s_nvs_handles), end(s_nvs_handles), belongs_to_part);
+    nvs::Storage* storage = lookup_storage_from_name(part_name);
+    if (storage != nullptr) {
+        s_nvs_handles.eraseStorage(storage);
+
+        // the mappings of blob views need the partition, their owners release the views later
+        for (auto& view : s_nvs_blob_views) {
+            if (view.get_storage() == storage) {
+                view.release();
+            }
+        }
+        for (auto& writer : s_nvs_blob_writers) {
+            if (writer.get_storage() == storage) {
+                writer.release();
+            }
+        }
+        for (auto& reader : s_nvs_blob_readers) {
+            if (reader.get_storage() == storage) {
+                reader.release();
+            }
+        }
     }
 
     // Deinit partition
@@ -101,6 +106,7 @@ extern "C" esp_err_t nvs_flash_init_partition_ptr(const esp_partition_t *partiti
     if (lock_result != ESP_OK) {
         return lock_result;
     }
+    GcLock gc_lock;
     Lock lock;
 
     if (partition == nullptr) {
@@ -186,6 +192,7 @@ extern "C" esp_err_t nvs_flash_erase_partition(const char *part_name)
     if (lock_result != ESP_OK) {
         return lock_result;
     }
+    GcLock gc_lock;
     Lock lock;
 
     // if the partition is initialized, uninitialize it first
@@ -213,6 +220,7 @@ extern "C" esp_err_t nvs_flash_erase_partition_ptr(const esp_partition_t *partit
     if (lock_result != ESP_OK) {
         return lock_result;
     }
+    GcLock gc_lock;
     Lock lock;
 
     if (partition == nullptr) {
@@ -244,6 +252,7 @@ extern "C" esp_err_t nvs_flash_deinit_partition(const char* partition_name)
     if (lock_result != ESP_OK) {
         return lock_result;
     }
+    GcLock gc_lock;
     Lock lock;
 
     return close_handles_and_deinit(partition_name);
@@ -254,15 +263,52 @@ extern "C" esp_err_t nvs_flash_deinit(void)
     return nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME);
 }
 
+extern "C" esp_err_t nvs_flash_set_background_erase(const char* partition_label, bool enable)
+{
+    Lock lock;
+
+    nvs::Storage* pStorage = lookup_storage_from_name((partition_label == nullptr) ? NVS_DEFAULT_PART_NAME : partition_label);
+    if (pStorage == nullptr) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    pStorage->setBackgroundErase(enable);
+    return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_flash_collect_garbage(const char* partition_label)
+{
+    GcLock gc_lock;
+    nvs::Storage* pStorage;
+    nvs::Page* page;
+    {
+        Lock lock;
+
+        pStorage = lookup_storage_from_name((partition_label == nullptr) ? NVS_DEFAULT_PART_NAME : partition_label);
+        if (pStorage == nullptr) {
+            return ESP_ERR_NVS_NOT_INITIALIZED;
+        }
+
+        page = pStorage->takePageToErase();
+        if (page == nullptr) {
+            return pStorage->collectGarbage();
+        }
+    }
+
+    // the page is on neither page list, reads and writes go on while its sector is erased
+    esp_err_t err = page->eraseSector();
+
+    Lock lock;
+    return pStorage->returnErasedPage(page, err);
+}
+
 static esp_err_t nvs_find_ns_handle(nvs_handle_t c_handle, NVSHandleSimple** handle)
 {
-    auto it = find_if(begin(s_nvs_handles), end(s_nvs_handles), [=](NVSHandleEntry& e) -> bool {
-        return e.mHandle == c_handle;
-    });
-    if (it == end(s_nvs_handles)) {
+    NVSHandleSimple* found = s_nvs_handles.find(c_handle);
+    if (found == nullptr) {
         return ESP_ERR_NVS_INVALID_HANDLE;
     }
-    *handle = it->nvs_handle;
+    *handle = found;
     return ESP_OK;
 }
 
@@ -274,13 +320,9 @@ extern "C" esp_err_t nvs_open_from_partition(const char *part_name, const char*
     NVSHandleSimple *handle;
     esp_err_t result = NVSPartitionManager::get_instance()->open_handle(part_name, namespace_name, open_mode, &handle);
     if (result == ESP_OK) {
-        NVSHandleEntry *entry = new (std::nothrow) NVSHandleEntry(handle, part_name);
-        if (entry) {
-            s_nvs_handles.push_back(entry);
-            *out_handle = entry->mHandle;
-        } else {
+        result = s_nvs_handles.insert(handle, *out_handle);
+        if (result != ESP_OK) {
             delete handle;
-            return ESP_ERR_NO_MEM;
         }
     }
 
@@ -296,14 +338,7 @@ extern "C" void nvs_close(nvs_handle_t handle)
 {
     Lock lock;
     ESP_LOGD(TAG, "%s %d", __func__, static_cast<int>(handle));
-    auto it = find_if(begin(s_nvs_handles), end(s_nvs_handles), [=](NVSHandleEntry& e) -> bool {
-        return e.mHandle == handle;
-    });
-    if (it == end(s_nvs_handles)) {
-        return;
-    }
-    s_nvs_handles.erase(it);
-    delete static_cast<NVSHandleEntry*>(it);
+    s_nvs_handles.erase(handle);
 }
 
 extern "C" esp_err_t nvs_find_key(nvs_handle_t c_handle, const char* key, nvs_type_t* out_type)
@@ -495,6 +530,39 @@ extern "C" esp_err_t nvs_get_u64 (nvs_handle_t c_handle, const char* key, uint64
     return nvs_get(c_handle, key, out_value);
 }
 
+extern "C" esp_err_t nvs_counter_inc(nvs_handle_t c_handle, const char* key, uint32_t* out_value)
+{
+    Lock lock;
+    ESP_LOGD(TAG, "%s %s", __func__, key);
+    NVSHandleSimple *handle;
+    auto err = nvs_find_ns_handle(c_handle, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    uint32_t value = 0;
+    err = handle->counter_inc(key, value);
+    if (err == ESP_OK && out_value != nullptr) {
+        *out_value = value;
+    }
+    return err;
+}
+
+extern "C" esp_err_t nvs_counter_get(nvs_handle_t c_handle, const char* key, uint32_t* out_value)
+{
+    if (out_value == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    Lock lock;
+    ESP_LOGD(TAG, "%s %s", __func__, key);
+    NVSHandleSimple *handle;
+    auto err = nvs_find_ns_handle(c_handle, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return handle->get_typed_item(nvs::ItemType::COUNTER, key, out_value, sizeof(*out_value));
+}
+
 static esp_err_t nvs_get_str_or_blob(nvs_handle_t c_handle, nvs::ItemType type, const char* key, void* out_value, size_t* length)
 {
     Lock lock;
@@ -535,6 +603,218 @@ extern "C" esp_err_t nvs_get_blob(nvs_handle_t c_handle, const char* key, void*
     return nvs_get_str_or_blob(c_handle, nvs::ItemType::BLOB, key, out_value, length);
 }
 
+extern "C" esp_err_t nvs_get_blob_view(nvs_handle_t c_handle, const char* key, nvs_blob_view_t* out_view)
+{
+    if (key == nullptr || out_view == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *out_view = nullptr;
+
+    Lock lock;
+    ESP_LOGD(TAG, "%s %s", __func__, key);
+    NVSHandleSimple *handle;
+    auto err = nvs_find_ns_handle(c_handle, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    NVSBlobView *view = new (std::nothrow) NVSBlobView();
+    if (view == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    err = handle->open_blob_view(key, *view);
+    if (err != ESP_OK) {
+        delete view;
+        return err;
+    }
+
+    s_nvs_blob_views.push_back(view);
+    *out_view = reinterpret_cast<nvs_blob_view_t>(view);
+    return ESP_OK;
+}
+
+static NVSBlobView *blob_view_of(nvs_blob_view_t view)
+{
+    return reinterpret_cast<NVSBlobView*>(view);
+}
+
+extern "C" esp_err_t nvs_blob_view_get_span(nvs_blob_view_t view, size_t index, const void** out_data, size_t* out_length)
+{
+    if (view == nullptr || out_data == nullptr || out_length == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return blob_view_of(view)->get_span(index, out_data, out_length);
+}
+
+extern "C" size_t nvs_blob_view_get_span_count(nvs_blob_view_t view)
+{
+    return (view == nullptr) ? 0 : blob_view_of(view)->get_span_count();
+}
+
+extern "C" size_t nvs_blob_view_get_size(nvs_blob_view_t view)
+{
+    return (view == nullptr) ? 0 : blob_view_of(view)->get_size();
+}
+
+extern "C" bool nvs_blob_view_is_valid(nvs_blob_view_t view)
+{
+    return view != nullptr && blob_view_of(view)->is_valid();
+}
+
+extern "C" bool nvs_blob_view_is_mapped(nvs_blob_view_t view)
+{
+    return view != nullptr && blob_view_of(view)->is_mapped();
+}
+
+extern "C" void nvs_blob_view_release(nvs_blob_view_t view)
+{
+    if (view == nullptr) {
+        return;
+    }
+
+    Lock lock;
+    s_nvs_blob_views.erase(blob_view_of(view));
+    delete blob_view_of(view);
+}
+
+extern "C" esp_err_t nvs_blob_writer_open(nvs_handle_t c_handle, const char* key, size_t buffer_size, nvs_blob_writer_t* out_writer)
+{
+    if (key == nullptr || out_writer == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *out_writer = nullptr;
+    // a smaller buffer runs out of chunks after a few KB, long after the caller started writing
+    if (buffer_size != 0 && buffer_size < NVS_BLOB_WRITER_MIN_BUFFER_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    Lock lock;
+    ESP_LOGD(TAG, "%s %s %d", __func__, key, static_cast<int>(buffer_size));
+    NVSHandleSimple *handle;
+    auto err = nvs_find_ns_handle(c_handle, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    NVSBlobWriter *writer = new (std::nothrow) NVSBlobWriter();
+    if (writer == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    err = handle->open_blob_writer(key, (buffer_size == 0) ? NVS_BLOB_WRITER_DEFAULT_BUFFER_SIZE : buffer_size, *writer);
+    if (err != ESP_OK) {
+        delete writer;
+        return err;
+    }
+
+    s_nvs_blob_writers.push_back(writer);
+    *out_writer = reinterpret_cast<nvs_blob_writer_t>(writer);
+    return ESP_OK;
+}
+
+static NVSBlobWriter *blob_writer_of(nvs_blob_writer_t writer)
+{
+    return reinterpret_cast<NVSBlobWriter*>(writer);
+}
+
+extern "C" esp_err_t nvs_blob_writer_write(nvs_blob_writer_t writer, const void* data, size_t length)
+{
+    if (writer == nullptr || (data == nullptr && length > 0)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    Lock lock;
+    return blob_writer_of(writer)->write(data, length);
+}
+
+static void delete_blob_writer(nvs_blob_writer_t writer)
+{
+    s_nvs_blob_writers.erase(blob_writer_of(writer));
+    delete blob_writer_of(writer);
+}
+
+extern "C" esp_err_t nvs_blob_writer_commit(nvs_blob_writer_t writer)
+{
+    if (writer == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    Lock lock;
+    esp_err_t err = blob_writer_of(writer)->commit();
+    delete_blob_writer(writer);
+    return err;
+}
+
+extern "C" void nvs_blob_writer_abort(nvs_blob_writer_t writer)
+{
+    if (writer == nullptr) {
+        return;
+    }
+
+    Lock lock;
+    delete_blob_writer(writer);
+}
+
+extern "C" esp_err_t nvs_blob_reader_open(nvs_handle_t c_handle, const char* key, nvs_blob_reader_t* out_reader)
+{
+    if (key == nullptr || out_reader == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *out_reader = nullptr;
+
+    Lock lock;
+    ESP_LOGD(TAG, "%s %s", __func__, key);
+    NVSHandleSimple *handle;
+    auto err = nvs_find_ns_handle(c_handle, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    NVSBlobReader *reader = new (std::nothrow) NVSBlobReader();
+    if (reader == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    err = handle->open_blob_reader(key, *reader);
+    if (err != ESP_OK) {
+        delete reader;
+        return err;
+    }
+
+    s_nvs_blob_readers.push_back(reader);
+    *out_reader = reinterpret_cast<nvs_blob_reader_t>(reader);
+    return ESP_OK;
+}
+
+static NVSBlobReader *blob_reader_of(nvs_blob_reader_t reader)
+{
+    return reinterpret_cast<NVSBlobReader*>(reader);
+}
+
+extern "C" size_t nvs_blob_reader_get_size(nvs_blob_reader_t reader)
+{
+    return (reader == nullptr) ? 0 : blob_reader_of(reader)->get_size();
+}
+
+extern "C" esp_err_t nvs_blob_reader_read(nvs_blob_reader_t reader, void* out_data, size_t length, size_t* out_length)
+{
+    if (reader == nullptr || (out_data == nullptr && length > 0) || out_length == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    Lock lock;
+    return blob_reader_of(reader)->read(out_data, length, *out_length);
+}
+
+extern "C" void nvs_blob_reader_release(nvs_blob_reader_t reader)
+{
+    if (reader == nullptr) {
+        return;
+    }
+
+    Lock lock;
+    s_nvs_blob_readers.erase(blob_reader_of(reader));
+    delete blob_reader_of(reader);
+}
+
 extern "C" esp_err_t nvs_get_stats(const char* part_name, nvs_stats_t* nvs_stats)
 {
     Lock lock;
@@ -878,3 +1158,122 @@ extern "C" void nvs_release_iterator(nvs_iterator_t it)
 {
     free(it);
 }
+
+static nvs::NVSSnapshot *snapshot_of(nvs_snapshot_t snapshot)
+{
+    return reinterpret_cast<nvs::NVSSnapshot*>(snapshot);
+}
+
+extern "C" esp_err_t nvs_snapshot_open(const char *part_name, const char *namespace_name, nvs_snapshot_t *out_snapshot)
+{
+    if (namespace_name == nullptr || out_snapshot == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *out_snapshot = nullptr;
+
+    esp_err_t lock_result = Lock::init();
+    if (lock_result != ESP_OK) {
+        return lock_result;
+    }
+    Lock lock;
+
+    nvs::NVSSnapshot *snapshot = new (std::nothrow) nvs::NVSSnapshot((part_name == nullptr) ? NVS_DEFAULT_PART_NAME : part_name,
+            namespace_name);
+    if (snapshot == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = snapshot->refresh();
+    if (err != ESP_OK) {
+        delete snapshot;
+        return err;
+    }
+
+    *out_snapshot = reinterpret_cast<nvs_snapshot_t>(snapshot);
+    return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_snapshot_refresh(nvs_snapshot_t snapshot)
+{
+    if (snapshot == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    Lock lock;
+    return snapshot_of(snapshot)->refresh();
+}
+
+extern "C" bool nvs_snapshot_is_current(nvs_snapshot_t snapshot)
+{
+    return snapshot != nullptr && snapshot_of(snapshot)->is_current();
+}
+
+template<typename T>
+static esp_err_t nvs_snapshot_get(nvs_snapshot_t snapshot, const char* key, T* out_value)
+{
+    if (snapshot == nullptr || key == nullptr || out_value == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return snapshot_of(snapshot)->get_item(key, *out_value);
+}
+
+extern "C" esp_err_t nvs_snapshot_get_i8 (nvs_snapshot_t snapshot, const char* key, int8_t* out_value)
+{
+    return nvs_snapshot_get(snapshot, key, out_value);
+}
+
+extern "C" esp_err_t nvs_snapshot_get_u8 (nvs_snapshot_t snapshot, const char* key, uint8_t* out_value)
+{
+    return nvs_snapshot_get(snapshot, key, out_value);
+}
+
+extern "C" esp_err_t nvs_snapshot_get_i16(nvs_snapshot_t snapshot, const char* key, int16_t* out_value)
+{
+    return nvs_snapshot_get(snapshot, key, out_value);
+}
+
+extern "C" esp_err_t nvs_snapshot_get_u16(nvs_snapshot_t snapshot, const char* key, uint16_t* out_value)
+{
+    return nvs_snapshot_get(snapshot, key, out_value);
+}
+
+extern "C" esp_err_t nvs_snapshot_get_i32(nvs_snapshot_t snapshot, const char* key, int32_t* out_value)
+{
+    return nvs_snapshot_get(snapshot, key, out_value);
+}
+
+extern "C" esp_err_t nvs_snapshot_get_u32(nvs_snapshot_t snapshot, const char* key, uint32_t* out_value)
+{
+    return nvs_snapshot_get(snapshot, key, out_value);
+}
+
+extern "C" esp_err_t nvs_snapshot_get_i64(nvs_snapshot_t snapshot, const char* key, int64_t* out_value)
+{
+    return nvs_snapshot_get(snapshot, key, out_value);
+}
+
+extern "C" esp_err_t nvs_snapshot_get_u64(nvs_snapshot_t snapshot, const char* key, uint64_t* out_value)
+{
+    return nvs_snapshot_get(snapshot, key, out_value);
+}
+
+extern "C" esp_err_t nvs_snapshot_get_str(nvs_snapshot_t snapshot, const char* key, char* out_value, size_t* length)
+{
+    if (snapshot == nullptr || key == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return snapshot_of(snapshot)->get_str_or_blob(nvs::ItemType::SZ, key, out_value, length);
+}
+
+extern "C" esp_err_t nvs_snapshot_get_blob(nvs_snapshot_t snapshot, const char* key, void* out_value, size_t* length)
+{
+    if (snapshot == nullptr || key == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return snapshot_of(snapshot)->get_str_or_blob(nvs::ItemType::BLOB, key, out_value, length);
+}
+
+extern "C" void nvs_snapshot_close(nvs_snapshot_t snapshot)
+{
+    delete snapshot_of(snapshot);
+}
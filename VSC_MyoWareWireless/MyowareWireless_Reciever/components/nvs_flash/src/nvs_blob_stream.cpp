@@ -0,0 +1,231 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "nvs_blob_stream.hpp"
+#include "nvs_crc.hpp"
+#if __has_include(<bsd/string.h>)
+// for strlcpy
+#include <bsd/string.h>
+#endif
+#include <cstdlib>
+#include <cstring>
+
+namespace nvs {
+
+NVSBlobWriter::~NVSBlobWriter()
+{
+    abort();
+    free(mBuffer);
+}
+
+esp_err_t NVSBlobWriter::open(Storage *storage, uint8_t nsIndex, const char *key, size_t bufferSize)
+{
+    if (mStorage != nullptr || bufferSize == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    free(mBuffer);
+    mBuffer = static_cast<uint8_t*>(malloc(bufferSize));
+    if (mBuffer == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = storage->beginBlob(nsIndex, key, mChunkStart);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    mStorage = storage;
+    mNsIndex = nsIndex;
+    strlcpy(mKey, key, sizeof(mKey));
+    mBufferSize = bufferSize;
+    mBuffered = 0;
+    mSize = 0;
+    mChunkCount = 0;
+    return ESP_OK;
+}
+
+esp_err_t NVSBlobWriter::write(const void *data, size_t length)
+{
+    if (mStorage == nullptr) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+    if (length > mStorage->getMaxBlobSize() - mSize) {
+        return ESP_ERR_NVS_VALUE_TOO_LONG;
+    }
+
+    const uint8_t *src = static_cast<const uint8_t*>(data);
+    mSize += length;
+
+    if (mBuffered > 0) {
+        size_t copied = (length < mBufferSize - mBuffered) ? length : mBufferSize - mBuffered;
+        memcpy(mBuffer + mBuffered, src, copied);
+        mBuffered += copied;
+        src += copied;
+        length -= copied;
+        if (mBuffered < mBufferSize) {
+            return ESP_OK;
+        }
+        esp_err_t err = writeChunks(mBuffer, mBuffered);
+        if (err != ESP_OK) {
+            return err;
+        }
+        mBuffered = 0;
+    }
+
+    // the chunks of a large piece are written from it directly
+    if (length >= mBufferSize) {
+        return writeChunks(src, length);
+    }
+    memcpy(mBuffer, src, length);
+    mBuffered = length;
+    return ESP_OK;
+}
+
+esp_err_t NVSBlobWriter::commit()
+{
+    if (mStorage == nullptr) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+
+    // an empty blob still has a chunk, like one written by Storage::writeItem
+    if (mBuffered > 0 || mChunkCount == 0) {
+        esp_err_t err = writeChunks(mBuffer, mBuffered);
+        if (err != ESP_OK) {
+            return err;
+        }
+        mBuffered = 0;
+    }
+
+    esp_err_t err = mStorage->endBlob(mNsIndex, mKey, mChunkStart, mChunkCount, mSize, true);
+    mStorage = nullptr;
+    return err;
+}
+
+void NVSBlobWriter::abort()
+{
+    if (mStorage != nullptr) {
+        mStorage->endBlob(mNsIndex, mKey, mChunkStart, mChunkCount, mSize, false);
+        mStorage = nullptr;
+    }
+}
+
+void NVSBlobWriter::release()
+{
+    mStorage = nullptr;
+}
+
+esp_err_t NVSBlobWriter::writeChunks(const uint8_t *data, size_t size)
+{
+    esp_err_t err = mStorage->writeBlobChunks(mNsIndex, mKey, data, size, mChunkStart, mChunkCount);
+    if (err != ESP_OK) {
+        abort();
+    }
+    return (err == ESP_ERR_NVS_PAGE_FULL) ? ESP_ERR_NVS_NOT_ENOUGH_SPACE : err;
+}
+
+esp_err_t NVSBlobReader::open(Storage *storage, uint8_t nsIndex, const char *key)
+{
+    if (strlen(key) > Item::MAX_KEY_LENGTH) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+
+    esp_err_t err = storage->getItemDataSize(nsIndex, ItemType::BLOB, key, mSize);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // nothing can be written while the caller holds the lock
+    mGeneration = Storage::getGeneration(nsIndex);
+    mStorage = storage;
+    mNsIndex = nsIndex;
+    strlcpy(mKey, key, sizeof(mKey));
+    mPosition = 0;
+    mChunkNum = 0;
+    mChunkPosition = 0;
+    mChunkCrc = UINT32_MAX;
+    mEntriesSize = 0;
+    return ESP_OK;
+}
+
+bool NVSBlobReader::is_valid() const
+{
+    return mStorage != nullptr && Storage::getGeneration(mNsIndex) == mGeneration;
+}
+
+esp_err_t NVSBlobReader::read(void *data, size_t length, size_t &readLength)
+{
+    readLength = 0;
+    if (!is_valid()) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+
+    uint8_t *dst = static_cast<uint8_t*>(data);
+    while (readLength < length && mPosition < mSize) {
+        esp_err_t err = mStorage->findBlobChunk(mNsIndex, mKey, mChunkNum, mChunk);
+        if (err != ESP_OK) {
+            return err;
+        }
+
+        size_t wanted = length - readLength;
+        wanted = (wanted < mChunk.size - mChunkPosition) ? wanted : mChunk.size - mChunkPosition;
+        size_t chunkRead = 0;
+        err = readChunk(mChunk.offset, dst + readLength, wanted, chunkRead);
+        if (err != ESP_OK) {
+            return err;
+        }
+        mChunkCrc = Crc32::calculate(mChunkCrc, dst + readLength, chunkRead);
+        readLength += chunkRead;
+        mPosition += chunkRead;
+        mChunkPosition += chunkRead;
+
+        if (mChunkPosition == mChunk.size) {
+            if (mChunkCrc != mChunk.crc32) {
+                return ESP_ERR_INVALID_CRC;
+            }
+            ++mChunkNum;
+            mChunkPosition = 0;
+            mChunkCrc = UINT32_MAX;
+            mEntriesSize = 0;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t NVSBlobReader::readChunk(uint32_t offset, uint8_t *data, size_t length, size_t &readLength)
+{
+    readLength = 0;
+    if (length == 0) {
+        return ESP_OK;
+    }
+    Partition *partition = const_cast<Partition*>(mStorage->getPart());
+
+    // whole entries straight into the caller's buffer, partitions read words
+    if (mChunkPosition % Page::ENTRY_SIZE == 0 && length >= Page::ENTRY_SIZE
+            && reinterpret_cast<uintptr_t>(data) % sizeof(uint32_t) == 0) {
+        readLength = length - length % Page::ENTRY_SIZE;
+        return partition->read(offset + mChunkPosition, data, readLength);
+    }
+
+    // the buffer holds entries of the current chunk, from mEntriesOffset within it
+    if (mChunkPosition < mEntriesOffset || mChunkPosition >= mEntriesOffset + mEntriesSize) {
+        mEntriesOffset = mChunkPosition - mChunkPosition % Page::ENTRY_SIZE;
+        size_t entries = (mChunk.size - mEntriesOffset + Page::ENTRY_SIZE - 1) / Page::ENTRY_SIZE;
+        entries = (entries < BUFFER_ENTRIES) ? entries : BUFFER_ENTRIES;
+        esp_err_t err = partition->read(offset + mEntriesOffset, mEntries, entries * Page::ENTRY_SIZE);
+        if (err != ESP_OK) {
+            mEntriesSize = 0;
+            return err;
+        }
+        mEntriesSize = entries * Page::ENTRY_SIZE;
+    }
+
+    const size_t available = mEntriesOffset + mEntriesSize - mChunkPosition;
+    readLength = (length < available) ? length : available;
+    memcpy(data, reinterpret_cast<const uint8_t*>(mEntries) + (mChunkPosition - mEntriesOffset), readLength);
+    return ESP_OK;
+}
+
+} // nvs
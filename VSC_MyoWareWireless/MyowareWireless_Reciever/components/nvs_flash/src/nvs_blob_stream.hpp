@@ -0,0 +1,181 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef NVS_BLOB_STREAM_HPP_
+#define NVS_BLOB_STREAM_HPP_
+
+#include "intrusive_list.h"
+#include "nvs_storage.hpp"
+#include "nvs_memory_management.hpp"
+
+namespace nvs {
+
+/**
+ * @brief Writes a blob from pieces of any size, holding only one buffer of them in RAM.
+ *
+ * The data is collected in a buffer of the size given to open() and written as a chunk of
+ * the blob whenever the buffer is full, pieces of at least that size are written without
+ * the copy. A chunk ends at the end of a page, too. The chunks carry the other version than
+ * the stored blob, which stays readable until commit() writes the index of the new chunks
+ * and erases it. Chunks without index are erased by Storage::init after a power loss.
+ *
+ * A blob has at most (Page::CHUNK_ANY - 1) / 2 chunks, so the buffer size limits the
+ * size of the blob. All methods are called with nvs::Lock held.
+ */
+class NVSBlobWriter : public intrusive_list_node<NVSBlobWriter>, public ExceptionlessAllocatable {
+public:
+    NVSBlobWriter() { }
+
+    /**
+     * Erases the chunks written so far unless the writer was committed.
+     */
+    ~NVSBlobWriter();
+
+    esp_err_t open(Storage *storage, uint8_t nsIndex, const char *key, size_t bufferSize);
+
+    esp_err_t write(const void *data, size_t length);
+
+    /**
+     * Write what is left in the buffer and the index. The writer is closed afterwards,
+     * if anything failed the chunks written are erased.
+     */
+    esp_err_t commit();
+
+    /**
+     * Erase the chunks written so far and close the writer.
+     */
+    void abort();
+
+    /**
+     * Forget the storage, which is about to be deinitialized. The chunks written so far are
+     * erased as orphans by the next Storage::init.
+     */
+    void release();
+
+    bool is_open() const
+    {
+        return mStorage != nullptr;
+    }
+
+    size_t get_size() const
+    {
+        return mSize;
+    }
+
+    const Storage *get_storage() const
+    {
+        return mStorage;
+    }
+
+private:
+    NVSBlobWriter(const NVSBlobWriter &other);
+    const NVSBlobWriter &operator=(const NVSBlobWriter &rhs);
+
+    esp_err_t writeChunks(const uint8_t *data, size_t size);
+
+
+    Storage *mStorage = nullptr;
+
+    uint8_t *mBuffer = nullptr;
+
+    size_t mBufferSize = 0;
+
+    size_t mBuffered = 0;
+
+    size_t mSize = 0;
+
+    char mKey[Item::MAX_KEY_LENGTH + 1];
+
+    uint8_t mNsIndex = 0;
+
+    VerOffset mChunkStart = VerOffset::VER_0_OFFSET;
+
+    uint8_t mChunkCount = 0;
+};
+
+/**
+ * @brief Reads a blob in pieces of any size without holding it in RAM.
+ *
+ * Every read() looks up the chunk it reads from again, so the reader follows the chunks when
+ * garbage collection moves them. The data CRC of a chunk is checked when its end is read.
+ * Like NVSBlobView, the reader becomes invalid as soon as the namespace may have been
+ * changed (see Storage::getGeneration). All methods are called with nvs::Lock held.
+ */
+class NVSBlobReader : public intrusive_list_node<NVSBlobReader>, public ExceptionlessAllocatable {
+public:
+    NVSBlobReader() { }
+
+    esp_err_t open(Storage *storage, uint8_t nsIndex, const char *key);
+
+    /**
+     * Read up to length bytes following the ones read before, readLength is set to the number
+     * read, which is less than length only at the end of the blob.
+     */
+    esp_err_t read(void *data, size_t length, size_t &readLength);
+
+    /**
+     * Forget the storage, which is about to be deinitialized.
+     */
+    void release()
+    {
+        mStorage = nullptr;
+    }
+
+    bool is_valid() const;
+
+    size_t get_size() const
+    {
+        return mSize;
+    }
+
+    const Storage *get_storage() const
+    {
+        return mStorage;
+    }
+
+private:
+    static const size_t BUFFER_ENTRIES = 4;
+
+    NVSBlobReader(const NVSBlobReader &other);
+    const NVSBlobReader &operator=(const NVSBlobReader &rhs);
+
+    /**
+     * Read from the current chunk, which starts at offset in the partition.
+     */
+    esp_err_t readChunk(uint32_t offset, uint8_t *data, size_t length, size_t &readLength);
+
+    Storage *mStorage = nullptr;
+
+    char mKey[Item::MAX_KEY_LENGTH + 1];
+
+    uint8_t mNsIndex = 0;
+
+    uint32_t mGeneration = 0;
+
+    size_t mSize = 0;
+
+    size_t mPosition = 0;
+
+    size_t mChunkNum = 0;
+
+    Storage::BlobChunk mChunk;
+
+    size_t mChunkPosition = 0;
+
+    uint32_t mChunkCrc = 0;
+
+    /**
+     * Entries around the position, for reads which don't cover whole entries.
+     */
+    Item mEntries[BUFFER_ENTRIES];
+
+    size_t mEntriesOffset = 0;
+
+    size_t mEntriesSize = 0;
+};
+
+} // nvs
+
+#endif // NVS_BLOB_STREAM_HPP_
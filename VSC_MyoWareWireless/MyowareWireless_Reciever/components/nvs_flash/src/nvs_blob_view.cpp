@@ -0,0 +1,168 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <cstdlib>
+#include <new>
+#include "nvs_blob_view.hpp"
+
+namespace nvs {
+
+NVSBlobView::~NVSBlobView()
+{
+    release();
+}
+
+void NVSBlobView::release()
+{
+    if (mMapped && mPartition != nullptr) {
+        mPartition->munmap(mMapHandle);
+    }
+    mPartition = nullptr;
+    mMapped = false;
+    free(mCopy);
+    mCopy = nullptr;
+    delete [] mSpans;
+    mSpans = nullptr;
+    mSpanCount = 0;
+    mSize = 0;
+    mValid = false;
+}
+
+esp_err_t NVSBlobView::open(Storage *storage, uint8_t nsIndex, const char *key)
+{
+    release();
+    mStorage = storage;
+    mNsIndex = nsIndex;
+
+    size_t count = 0;
+    esp_err_t err = storage->findBlobChunks(nsIndex, key, nullptr, 0, count);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    Storage::BlobChunk *chunks = nullptr;
+    if (count > 0) {
+        chunks = new (std::nothrow) Storage::BlobChunk[count];
+        mSpans = new (std::nothrow) Span[count];
+        if (chunks == nullptr || mSpans == nullptr) {
+            delete [] chunks;
+            release();
+            return ESP_ERR_NO_MEM;
+        }
+        err = storage->findBlobChunks(nsIndex, key, chunks, count, count);
+    }
+
+    if (err == ESP_OK) {
+        // nothing can be written while the caller holds the lock
+        mGeneration = Storage::getGeneration(nsIndex);
+        mRelocationEpoch = Storage::getRelocationEpoch();
+
+        err = map(chunks, count);
+        if (err != ESP_OK) {
+            err = copy(nsIndex, key);
+        }
+    }
+
+    delete [] chunks;
+    if (err != ESP_OK) {
+        release();
+        return err;
+    }
+
+    mValid = true;
+    return ESP_OK;
+}
+
+esp_err_t NVSBlobView::map(const Storage::BlobChunk *chunks, size_t count)
+{
+    if (count == 0) {
+        return ESP_OK;
+    }
+
+    // chunks lie in different pages, one mapping covers all of them
+    uint32_t start = chunks[0].offset;
+    uint32_t end = chunks[0].offset + chunks[0].size;
+    for (size_t i = 1; i < count; ++i) {
+        start = (chunks[i].offset < start) ? chunks[i].offset : start;
+        end = (chunks[i].offset + chunks[i].size > end) ? chunks[i].offset + chunks[i].size : end;
+    }
+
+    Partition *partition = const_cast<Partition*>(mStorage->getPart());
+    const void *base = nullptr;
+    esp_err_t err = partition->mmap(start, end - start, &base, &mMapHandle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    mPartition = partition;
+    mMapped = true;
+
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t *data = static_cast<const uint8_t*>(base) + (chunks[i].offset - start);
+        // a damaged chunk is handled by the copying read, which drops it
+        if (Item::calculateCrc32(data, chunks[i].size) != chunks[i].crc32) {
+            partition->munmap(mMapHandle);
+            mPartition = nullptr;
+            mMapped = false;
+            mSpanCount = 0;
+            mSize = 0;
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+        mSpans[i].mData = data;
+        mSpans[i].mSize = chunks[i].size;
+        mSize += chunks[i].size;
+    }
+    mSpanCount = count;
+    return ESP_OK;
+}
+
+esp_err_t NVSBlobView::copy(uint8_t nsIndex, const char *key)
+{
+    size_t dataSize = 0;
+    esp_err_t err = mStorage->getItemDataSize(nsIndex, ItemType::BLOB, key, dataSize);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (dataSize == 0) {
+        return ESP_OK;
+    }
+
+    mCopy = static_cast<uint8_t*>(malloc(dataSize));
+    if (mCopy == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    err = mStorage->readItem(nsIndex, ItemType::BLOB, key, mCopy, dataSize);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    mSpans[0].mData = mCopy;
+    mSpans[0].mSize = dataSize;
+    mSpanCount = 1;
+    mSize = dataSize;
+    return ESP_OK;
+}
+
+bool NVSBlobView::is_valid() const
+{
+    // a copy stays good when garbage collection moves the chunks, a mapping doesn't
+    return mValid && Storage::getGeneration(mNsIndex) == mGeneration &&
+           (!mMapped || Storage::getRelocationEpoch() == mRelocationEpoch);
+}
+
+esp_err_t NVSBlobView::get_span(size_t index, const void **data, size_t *length) const
+{
+    if (!is_valid()) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+    if (index >= mSpanCount) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    *data = mSpans[index].mData;
+    *length = mSpans[index].mSize;
+    return ESP_OK;
+}
+
+} // nvs
@@ -0,0 +1,113 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef NVS_BLOB_VIEW_HPP_
+#define NVS_BLOB_VIEW_HPP_
+
+#include "intrusive_list.h"
+#include "nvs_storage.hpp"
+#include "nvs_memory_management.hpp"
+
+namespace nvs {
+
+/**
+ * @brief Read-only access to a stored blob without copying it into RAM.
+ *
+ * A blob is stored in chunks, one per page it spans, and the data of every chunk is
+ * contiguous in flash. If the partition supports Partition::mmap(), the view maps the
+ * region holding all chunks and hands out one span per chunk. Otherwise, e.g. for
+ * encrypted partitions, it reads the blob into a single buffer.
+ *
+ * The data CRC of every chunk is checked once when the view is opened. The view becomes
+ * invalid as soon as the namespace may have been changed (see Storage::getGeneration), and
+ * a mapped view also as soon as garbage collection erased a page of the partition for a write
+ * to any namespace (see Storage::getRelocationEpoch), because the pages it points into may be
+ * erased and reused. Reading spans doesn't take
+ * nvs::Lock, open() and release() are called with the lock held.
+ */
+class NVSBlobView : public intrusive_list_node<NVSBlobView>, public ExceptionlessAllocatable {
+public:
+    NVSBlobView() { }
+
+    ~NVSBlobView();
+
+    esp_err_t open(Storage *storage, uint8_t nsIndex, const char *key);
+
+    /**
+     * Drop the mapping or copy, the view stays invalid until it is opened again.
+     */
+    void release();
+
+    bool is_valid() const;
+
+    /**
+     * True if the spans point into flash, false if they point into a copy.
+     */
+    bool is_mapped() const
+    {
+        return mMapped;
+    }
+
+    size_t get_size() const
+    {
+        return mSize;
+    }
+
+    size_t get_span_count() const
+    {
+        return mSpanCount;
+    }
+
+    esp_err_t get_span(size_t index, const void **data, size_t *length) const;
+
+    const Storage *get_storage() const
+    {
+        return mStorage;
+    }
+
+private:
+    struct Span {
+        const uint8_t *mData;
+        size_t mSize;
+    };
+
+    NVSBlobView(const NVSBlobView &other);
+    const NVSBlobView &operator=(const NVSBlobView &rhs);
+
+    esp_err_t map(const Storage::BlobChunk *chunks, size_t count);
+
+    esp_err_t copy(uint8_t nsIndex, const char *key);
+
+    Storage *mStorage = nullptr;
+
+    Partition *mPartition = nullptr;
+
+    Span *mSpans = nullptr;
+
+    size_t mSpanCount = 0;
+
+    size_t mSize = 0;
+
+    /**
+     * The blob read into RAM, if the partition can't be mapped.
+     */
+    uint8_t *mCopy = nullptr;
+
+    uint32_t mMapHandle = 0;
+
+    bool mMapped = false;
+
+    uint8_t mNsIndex = 0;
+
+    uint32_t mGeneration = 0;
+
+    uint32_t mRelocationEpoch = 0;
+
+    bool mValid = false;
+};
+
+} // nvs
+
+#endif // NVS_BLOB_VIEW_HPP_
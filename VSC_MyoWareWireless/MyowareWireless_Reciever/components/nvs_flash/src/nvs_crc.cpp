@@ -0,0 +1,134 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "nvs_crc.hpp"
+
+#include "esp_rom_crc.h"
+
+namespace nvs
+{
+
+#ifdef NVS_CRC_SLICE_BY_8
+
+namespace
+{
+
+/* mTable[0] is the usual byte table, mTable[k][b] is the CRC of b followed by k zero bytes. */
+struct Tables {
+    Tables()
+    {
+        for (uint32_t b = 0; b < 256; ++b) {
+            uint32_t crc = b;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+            }
+            mTable[0][b] = crc;
+        }
+        for (uint32_t b = 0; b < 256; ++b) {
+            for (int k = 1; k < 8; ++k) {
+                mTable[k][b] = (mTable[k - 1][b] >> 8) ^ mTable[0][mTable[k - 1][b] & 0xff];
+            }
+        }
+    }
+
+    uint32_t mTable[8][256];
+};
+
+const Tables& tables()
+{
+    static const Tables sTables;
+    return sTables;
+}
+
+inline uint32_t load32(const uint8_t* p)
+{
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8)
+           | (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+/* The steps work on the inverted CRC. */
+inline uint32_t step1(const Tables& t, uint32_t crc, uint8_t byte)
+{
+    return (crc >> 8) ^ t.mTable[0][(crc ^ byte) & 0xff];
+}
+
+inline uint32_t step4(const Tables& t, uint32_t crc, const uint8_t* p)
+{
+    const uint32_t word = crc ^ load32(p);
+    return t.mTable[3][word & 0xff] ^ t.mTable[2][(word >> 8) & 0xff]
+           ^ t.mTable[1][(word >> 16) & 0xff] ^ t.mTable[0][word >> 24];
+}
+
+inline uint32_t step8(const Tables& t, uint32_t crc, const uint8_t* p)
+{
+    const uint32_t low = crc ^ load32(p);
+    const uint32_t high = load32(p + 4);
+    return t.mTable[7][low & 0xff] ^ t.mTable[6][(low >> 8) & 0xff]
+           ^ t.mTable[5][(low >> 16) & 0xff] ^ t.mTable[4][low >> 24]
+           ^ t.mTable[3][high & 0xff] ^ t.mTable[2][(high >> 8) & 0xff]
+           ^ t.mTable[1][(high >> 16) & 0xff] ^ t.mTable[0][high >> 24];
+}
+
+} // namespace
+
+uint32_t Crc32::calculate(uint32_t crc, const void* data, size_t size)
+{
+    const Tables& t = tables();
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    for (; size >= 8; size -= 8, p += 8) {
+        crc = step8(t, crc, p);
+    }
+    for (; size > 0; --size, ++p) {
+        crc = step1(t, crc, *p);
+    }
+    return ~crc;
+}
+
+uint32_t Crc32::calculateEntry(const uint8_t* entry)
+{
+    const Tables& t = tables();
+    uint32_t crc = 0; // ~UINT32_MAX
+    crc = step4(t, crc, entry);
+    crc = step8(t, crc, entry + 8);
+    crc = step8(t, crc, entry + 16);
+    crc = step8(t, crc, entry + 24);
+    return ~crc;
+}
+
+uint32_t Crc32::calculateEntryKey(const uint8_t* entry)
+{
+    const Tables& t = tables();
+    uint32_t crc = 0; // ~UINT32_MAX
+    crc = step1(t, crc, entry[0]);
+    crc = step8(t, crc, entry + 8);
+    crc = step8(t, crc, entry + 16);
+    crc = step1(t, crc, entry[3]);
+    return ~crc;
+}
+
+#else // NVS_CRC_SLICE_BY_8
+
+uint32_t Crc32::calculate(uint32_t crc, const void* data, size_t size)
+{
+    return esp_rom_crc32_le(crc, static_cast<const uint8_t*>(data), size);
+}
+
+uint32_t Crc32::calculateEntry(const uint8_t* entry)
+{
+    uint32_t crc = esp_rom_crc32_le(UINT32_MAX, entry, 4);
+    return esp_rom_crc32_le(crc, entry + 8, 24);
+}
+
+uint32_t Crc32::calculateEntryKey(const uint8_t* entry)
+{
+    uint32_t crc = esp_rom_crc32_le(UINT32_MAX, entry, 1);
+    crc = esp_rom_crc32_le(crc, entry + 8, 16);
+    return esp_rom_crc32_le(crc, entry + 3, 1);
+}
+
+#endif // NVS_CRC_SLICE_BY_8
+
+} // namespace nvs
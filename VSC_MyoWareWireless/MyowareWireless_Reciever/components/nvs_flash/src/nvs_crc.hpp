@@ -0,0 +1,52 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef nvs_crc_hpp
+#define nvs_crc_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include "sdkconfig.h"
+
+#if defined(LINUX_TARGET) || defined(CONFIG_NVS_CRC_SLICE_BY_8)
+#define NVS_CRC_SLICE_BY_8 1
+#endif
+
+namespace nvs
+{
+
+/**
+ * CRC-32 of items, page headers and data, with the same results as esp_rom_crc32_le.
+ *
+ * With NVS_CRC_SLICE_BY_8 (always on the Linux target, CONFIG_NVS_CRC_SLICE_BY_8 otherwise)
+ * eight bytes are processed per step using eight tables of 256 words, built on first use.
+ * Otherwise the ROM routine is used. The entry functions compute the CRC of the fields of an
+ * Item in one pass instead of one call per field.
+ */
+class Crc32
+{
+public:
+    /**
+     * Same as esp_rom_crc32_le(crc, data, size). Start with UINT32_MAX, pass the result on
+     * to continue.
+     */
+    static uint32_t calculate(uint32_t crc, const void* data, size_t size);
+
+    /**
+     * CRC of the 32 byte entry without bytes 4 to 7, like Item::calculateCrc32.
+     */
+    static uint32_t calculateEntry(const uint8_t* entry);
+
+    /**
+     * CRC of byte 0, the 16 bytes from 8 and byte 3 of the entry, like
+     * Item::calculateCrc32WithoutValue.
+     */
+    static uint32_t calculateEntryKey(const uint8_t* entry);
+}; // class Crc32
+
+} // namespace nvs
+
+#endif /* nvs_crc_hpp */
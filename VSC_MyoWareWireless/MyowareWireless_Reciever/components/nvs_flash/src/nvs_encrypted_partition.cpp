@@ -31,31 +31,40 @@ esp_err_t NVSEncryptedPartition::init(nvs_sec_cfg_t* cfg)
     return ESP_OK;
 }
 
+/**
+ * En- or decrypt size bytes in place which are stored at offset. Every entry is a data unit of its
+ * own, numbered by its relative address instead of the absolute one (relocatable), so that
+ * host-generated encrypted nvs images can be used.
+ */
+static int crypt_entries(mbedtls_aes_xts_context* ctx, int mode, size_t offset, uint8_t* data, size_t size)
+{
+    //sector num required as an arr by mbedtls. Should have been just uint64/32.
+    uint8_t data_unit[16];
+    memset(data_unit, 0, sizeof(data_unit));
+
+    for (size_t done = 0; done < size; done += sizeof(Item)) {
+        uint32_t relAddr = offset + done;
+        memcpy(data_unit, &relAddr, sizeof(relAddr));
+        size_t length = (size - done < sizeof(Item)) ? size - done : sizeof(Item);
+        int result = mbedtls_aes_crypt_xts(ctx, mode, length, data_unit, data + done, data + done);
+        if (result != 0) {
+            return result;
+        }
+    }
+    return 0;
+}
+
 esp_err_t NVSEncryptedPartition::read(size_t src_offset, void* dst, size_t size)
 {
-    /** Currently upper layer of NVS reads entries one by one even for variable size
-    * multi-entry data types. So length should always be equal to size of an entry.*/
-    if (size != sizeof(Item)) return ESP_ERR_INVALID_SIZE;
+    // whole entries only, a run of them is read at once and decrypted in place
+    if (size % sizeof(Item) != 0) return ESP_ERR_INVALID_SIZE;
 
-    // read data
     esp_err_t read_result = esp_partition_read(mESPPartition, src_offset, dst, size);
     if (read_result != ESP_OK) {
         return read_result;
     }
 
-    // decrypt data
-    //sector num required as an arr by mbedtls. Should have been just uint64/32.
-    uint8_t data_unit[16];
-
-    uint32_t relAddr = src_offset;
-
-    memset(data_unit, 0, sizeof(data_unit));
-
-    memcpy(data_unit, &relAddr, sizeof(relAddr));
-
-    uint8_t *destination = reinterpret_cast<uint8_t*>(dst);
-
-    if (mbedtls_aes_crypt_xts(&mDctxt, MBEDTLS_AES_DECRYPT, size, data_unit, destination, destination) != 0)  {
+    if (crypt_entries(&mDctxt, MBEDTLS_AES_DECRYPT, src_offset, reinterpret_cast<uint8_t*>(dst), size) != 0) {
         return ESP_ERR_NVS_XTS_DECR_FAILED;
     }
 
@@ -66,48 +75,30 @@ esp_err_t NVSEncryptedPartition::write(size_t addr, const void* src, size_t size
 {
     if (size % ESP_ENCRYPT_BLOCK_SIZE != 0) return ESP_ERR_INVALID_SIZE;
 
-    // copy data to buffer for encryption
-    uint8_t* buf = new (std::nothrow) uint8_t [size];
-
-    if (!buf) return ESP_ERR_NO_MEM;
-
-    memcpy(buf, src, size);
-
-    // encrypt data
-    uint8_t entrySize = sizeof(Item);
-
-    //sector num required as an arr by mbedtls. Should have been just uint64/32.
-    uint8_t data_unit[16];
-
-    /* Use relative address instead of absolute address (relocatable), so that host-generated
-     * encrypted nvs images can be used*/
-    uint32_t relAddr = addr;
-
-    memset(data_unit, 0, sizeof(data_unit));
-
-    for(uint8_t entry = 0; entry < (size/entrySize); entry++)
-    {
-        uint32_t offset = entry * entrySize;
-        uint32_t *addr_loc = (uint32_t*) &data_unit[0];
-
-        *addr_loc = relAddr + offset;
-        if (mbedtls_aes_crypt_xts(&mEctxt,
-                                  MBEDTLS_AES_ENCRYPT,
-                                  entrySize,
-                                  data_unit,
-                                  buf + offset,
-                                  buf + offset) != 0)  {
-            delete [] buf;
-            return ESP_ERR_NVS_XTS_ENCR_FAILED;
+    // encrypt a copy of the data, a few entries at a time
+    uint8_t buf[WRITE_BUFFER_SIZE];
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(src);
+    for (size_t done = 0; done < size; done += sizeof(buf)) {
+        size_t length = (size - done < sizeof(buf)) ? size - done : sizeof(buf);
+        memcpy(buf, data + done, length);
+        esp_err_t result = write_in_place(addr + done, buf, length);
+        if (result != ESP_OK) {
+            return result;
         }
     }
 
-    // write data
-    esp_err_t result = esp_partition_write(mESPPartition, addr, buf, size);
+    return ESP_OK;
+}
+
+esp_err_t NVSEncryptedPartition::write_in_place(size_t addr, void* src, size_t size)
+{
+    if (size % ESP_ENCRYPT_BLOCK_SIZE != 0) return ESP_ERR_INVALID_SIZE;
 
-    delete [] buf;
+    if (crypt_entries(&mEctxt, MBEDTLS_AES_ENCRYPT, addr, reinterpret_cast<uint8_t*>(src), size) != 0) {
+        return ESP_ERR_NVS_XTS_ENCR_FAILED;
+    }
 
-    return result;
+    return esp_partition_write(mESPPartition, addr, src, size);
 }
 
 } // nvs
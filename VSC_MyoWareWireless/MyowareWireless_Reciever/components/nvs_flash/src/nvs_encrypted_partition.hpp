@@ -29,11 +29,42 @@ public:
 
     esp_err_t init(nvs_sec_cfg_t* cfg);
 
+    /**
+     * Read and decrypt whole entries, any number of them at once.
+     *
+     * @return ESP_ERR_INVALID_SIZE if size isn't a multiple of the entry size
+     */
     esp_err_t read(size_t src_offset, void* dst, size_t size) override;
 
+    /**
+     * Encrypt a copy of the data, WRITE_BUFFER_SIZE bytes at a time, and write it.
+     */
     esp_err_t write(size_t dst_offset, const void* src, size_t size) override;
 
+    /**
+     * Encrypt the data in src and write it without a copy.
+     */
+    esp_err_t write_in_place(size_t dst_offset, void* src, size_t size) override;
+
+    /**
+     * The flash holds the XTS encrypted data, it can't be read in place.
+     *
+     * @return ESP_ERR_NOT_SUPPORTED
+     */
+    esp_err_t mmap(size_t src_offset, size_t size, const void** out_ptr, uint32_t* out_handle) override
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    bool get_encrypted() override
+    {
+        return true;
+    }
+
 protected:
+    // bytes of the stack buffer write() encrypts into, a few entries
+    static const size_t WRITE_BUFFER_SIZE = 128;
+
     mbedtls_aes_xts_context mEctxt;
     mbedtls_aes_xts_context mDctxt;
 };
@@ -0,0 +1,106 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <cstring>
+#include <new>
+#include "nvs_handle_table.hpp"
+
+namespace nvs
+{
+
+HandleTable::~HandleTable()
+{
+    for (size_t i = 0; i < mCapacity; ++i) {
+        delete mSlots[i].mHandle;
+    }
+    delete [] mSlots;
+}
+
+esp_err_t HandleTable::grow()
+{
+    size_t capacity = (mCapacity == 0) ? MIN_CAPACITY : mCapacity * 2;
+    if (capacity > MAX_HANDLES) {
+        capacity = MAX_HANDLES;
+    }
+    if (capacity == mCapacity) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    Slot* slots = new (std::nothrow) Slot[capacity];
+    if (slots == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (mCapacity > 0) {
+        memcpy(slots, mSlots, mCapacity * sizeof(Slot));
+    }
+
+    // the new slots are all free, the list of free slots is empty when the table is full
+    for (size_t i = mCapacity; i < capacity; ++i) {
+        slots[i].mHandle = nullptr;
+        slots[i].mGeneration = 1;
+        slots[i].mNextFree = (i + 1 < capacity) ? static_cast<uint16_t>(i + 1) : NO_SLOT;
+    }
+    mFirstFree = static_cast<uint16_t>(mCapacity);
+
+    delete [] mSlots;
+    mSlots = slots;
+    mCapacity = capacity;
+    return ESP_OK;
+}
+
+esp_err_t HandleTable::insert(NVSHandleSimple* handle, nvs_handle_t& outHandle)
+{
+    if (mFirstFree == NO_SLOT) {
+        esp_err_t err = grow();
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    const size_t index = mFirstFree;
+    Slot& slot = mSlots[index];
+    mFirstFree = slot.mNextFree;
+    slot.mHandle = handle;
+    ++mCount;
+
+    outHandle = (static_cast<nvs_handle_t>(slot.mGeneration) << GENERATION_SHIFT) | static_cast<nvs_handle_t>(index);
+    return ESP_OK;
+}
+
+void HandleTable::release(size_t index)
+{
+    Slot& slot = mSlots[index];
+    delete slot.mHandle;
+    slot.mHandle = nullptr;
+    if (++slot.mGeneration == 0) {
+        slot.mGeneration = 1;
+    }
+    slot.mNextFree = mFirstFree;
+    mFirstFree = static_cast<uint16_t>(index);
+    --mCount;
+}
+
+bool HandleTable::erase(nvs_handle_t handle)
+{
+    if (find(handle) == nullptr) {
+        return false;
+    }
+    release(handle & INDEX_MASK);
+    return true;
+}
+
+size_t HandleTable::eraseStorage(const Storage* storage)
+{
+    size_t erased = 0;
+    for (size_t i = 0; i < mCapacity && mCount > 0; ++i) {
+        if (mSlots[i].mHandle != nullptr && mSlots[i].mHandle->get_storage() == storage) {
+            release(i);
+            ++erased;
+        }
+    }
+    return erased;
+}
+
+} // namespace nvs
@@ -0,0 +1,159 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "nvs_item_index.hpp"
+#include <new>
+
+namespace nvs
+{
+
+ItemIndex::ItemIndex()
+{
+}
+
+ItemIndex::~ItemIndex()
+{
+    delete[] mRecords;
+}
+
+void ItemIndex::clear()
+{
+    delete[] mRecords;
+    mRecords = nullptr;
+    mCapacity = 0;
+    mShift = 32;
+    mCount = 0;
+    mValid = true;
+}
+
+bool ItemIndex::grow()
+{
+    size_t capacity = mCapacity ? mCapacity * 2 : MIN_CAPACITY;
+    Record* records = new (std::nothrow) Record[capacity];
+    if (!records) {
+        return false;
+    }
+    for (size_t i = 0; i < capacity; ++i) {
+        records[i].mPage = nullptr;
+    }
+
+    Record* old = mRecords;
+    size_t oldCapacity = mCapacity;
+    mRecords = records;
+    mCapacity = capacity;
+    mShift = 32 - __builtin_ctz(capacity);
+    for (size_t i = 0; i < oldCapacity; ++i) {
+        if (old[i].mPage == nullptr) {
+            continue;
+        }
+        size_t pos = home(old[i].mHash);
+        while (mRecords[pos].mPage != nullptr) {
+            pos = (pos + 1) & (mCapacity - 1);
+        }
+        mRecords[pos] = old[i];
+    }
+    delete[] old;
+    return true;
+}
+
+void ItemIndex::insert(const Item& item, Page* page)
+{
+    if (!mValid) {
+        return;
+    }
+
+    const uint32_t hash_24 = hashOf(item);
+    if (mCapacity) {
+        for (size_t pos = home(hash_24); mRecords[pos].mPage != nullptr; pos = (pos + 1) & (mCapacity - 1)) {
+            if (mRecords[pos].mPage == page && mRecords[pos].mHash == hash_24) {
+                // a page has at most Page::ENTRY_COUNT entries, the counter can't overflow
+                mRecords[pos].mCount++;
+                return;
+            }
+        }
+    }
+
+    // keep the load factor below 3/4 so probe sequences stay short
+    if ((mCount + 1) * 4 > mCapacity * 3 && !grow()) {
+        clear();
+        mValid = false;
+        return;
+    }
+
+    size_t pos = home(hash_24);
+    while (mRecords[pos].mPage != nullptr) {
+        pos = (pos + 1) & (mCapacity - 1);
+    }
+    mRecords[pos].mPage = page;
+    mRecords[pos].mHash = hash_24;
+    mRecords[pos].mCount = 1;
+    mCount++;
+}
+
+void ItemIndex::eraseAt(size_t pos)
+{
+    // backward shift deletion, moves every record of the cluster that can't be
+    // reached from its home slot any more without the removed one
+    const size_t mask = mCapacity - 1;
+    size_t hole = pos;
+    for (size_t next = (hole + 1) & mask; mRecords[next].mPage != nullptr; next = (next + 1) & mask) {
+        size_t h = home(mRecords[next].mHash);
+        if (((next - h) & mask) >= ((next - hole) & mask)) {
+            mRecords[hole] = mRecords[next];
+            hole = next;
+        }
+    }
+    mRecords[hole].mPage = nullptr;
+    mCount--;
+}
+
+void ItemIndex::erase(const Item& item, Page* page)
+{
+    if (!mCapacity) {
+        return;
+    }
+
+    const uint32_t hash_24 = hashOf(item);
+    for (size_t pos = home(hash_24); mRecords[pos].mPage != nullptr; pos = (pos + 1) & (mCapacity - 1)) {
+        if (mRecords[pos].mPage == page && mRecords[pos].mHash == hash_24) {
+            if (--mRecords[pos].mCount == 0) {
+                eraseAt(pos);
+            }
+            return;
+        }
+    }
+}
+
+void ItemIndex::erasePage(Page* page)
+{
+    for (size_t pos = 0; pos < mCapacity; ++pos) {
+        // the shift may move another record of this page into pos
+        while (mRecords[pos].mPage == page) {
+            eraseAt(pos);
+        }
+    }
+}
+
+size_t ItemIndex::find(const Item& item, Page** pages, size_t maxCount) const
+{
+    if (!mCapacity) {
+        return 0;
+    }
+
+    const uint32_t hash_24 = hashOf(item);
+    size_t count = 0;
+    for (size_t pos = home(hash_24); mRecords[pos].mPage != nullptr; pos = (pos + 1) & (mCapacity - 1)) {
+        if (mRecords[pos].mHash == hash_24) {
+            if (count < maxCount) {
+                pages[count] = mRecords[pos].mPage;
+            }
+            count++;
+        }
+    }
+    return count;
+}
+
+} // namespace nvs
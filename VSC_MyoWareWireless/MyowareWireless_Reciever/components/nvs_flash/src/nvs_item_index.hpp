@@ -0,0 +1,93 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef nvs_item_index_hpp
+#define nvs_item_index_hpp
+
+#include "nvs.h"
+#include "nvs_types.hpp"
+
+namespace nvs
+{
+
+class Page;
+
+/**
+ * Partition wide index from the item hash to the pages holding an item with that hash.
+ *
+ * The hash is the lower 24 bits of the CRC the per-page HashList uses: namespace index,
+ * key and chunk index. The item type is not part of it, so lookups of ItemType::ANY and
+ * the TYPE_MISMATCH handling of Page::findItem keep working. A record counts the entries
+ * of one page with the hash, the table uses open addressing with linear probing.
+ *
+ * The index may hold more pages than actually have the item, but never less: Page::findItem
+ * still verifies every candidate against flash. If the table can't be grown the index is
+ * dropped and Storage falls back to searching every page.
+ */
+class ItemIndex
+{
+public:
+    ItemIndex();
+    ~ItemIndex();
+
+    void clear();
+    void insert(const Item& item, Page* page);
+    void erase(const Item& item, Page* page);
+    void erasePage(Page* page);
+
+    /**
+     * Store up to maxCount pages holding the hash of item in pages.
+     * Returns the number of such pages, which may be larger than maxCount.
+     */
+    size_t find(const Item& item, Page** pages, size_t maxCount) const;
+
+    bool isValid() const
+    {
+        return mValid;
+    }
+
+    size_t size() const
+    {
+        return mCount;
+    }
+
+    static uint32_t hashOf(const Item& item)
+    {
+        return item.calculateCrc32WithoutValue() & 0xffffff;
+    }
+
+private:
+    ItemIndex(const ItemIndex& other);
+    const ItemIndex& operator= (const ItemIndex& rhs);
+
+protected:
+    struct Record {
+        Page* mPage;
+        uint32_t mHash  : 24;
+        uint32_t mCount : 8;
+    };
+
+    static const size_t MIN_CAPACITY = 64;
+
+    bool grow();
+    void eraseAt(size_t pos);
+
+    size_t home(uint32_t hash) const
+    {
+        // CRCs of keys that differ in one character differ in few bits, spread them over the table
+        return static_cast<uint32_t>(hash * 0x9e3779b1u) >> mShift;
+    }
+
+    Record* mRecords = nullptr;
+    size_t mCapacity = 0;
+    uint32_t mShift = 32;
+    size_t mCount = 0;
+    bool mValid = true;
+}; // class ItemIndex
+
+} // namespace nvs
+
+#endif /* nvs_item_index_hpp */
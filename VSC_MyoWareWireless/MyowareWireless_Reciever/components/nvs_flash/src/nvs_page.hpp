@@ -16,12 +16,33 @@
 #include "compressed_enum_table.hpp"
 #include "intrusive_list.h"
 #include "nvs_item_hash_list.hpp"
+#include "nvs_item_index.hpp"
 #include "nvs_memory_management.hpp"
 #include "partition.hpp"
 
 namespace nvs
 {
 
+class Page;
+
+/**
+ * Item staged by a transaction of NVSHandleSimple, see Storage::writeItems.
+ */
+struct PendingItem : public intrusive_list_node<PendingItem>, public ExceptionlessAllocatable {
+    ~PendingItem()
+    {
+        delete[] data;
+    }
+
+    ItemType datatype;
+    char key[Item::MAX_KEY_LENGTH + 1];
+    uint8_t* data = nullptr;
+    size_t dataSize = 0;
+    bool unchanged = false;     // the same value is stored already
+    Page* oldPage = nullptr;    // page holding the previous value
+};
+
+typedef intrusive_list<PendingItem> TPendingItemList;
 
 class Page : public intrusive_list_node<Page>, public ExceptionlessAllocatable
 {
@@ -42,6 +63,12 @@ public:
 
     static const size_t CHUNK_MAX_SIZE = ENTRY_SIZE * (ENTRY_COUNT - 1);
 
+    /**
+     * Erased entries after the header of a counter, each increment programs one of their bits.
+     * Counters of encrypted partitions have none, every increment writes them again.
+     */
+    static const size_t COUNTER_DATA_ENTRIES = 3;
+
     static const uint8_t NS_INDEX = 0;
     static const uint8_t NS_ANY = 255;
 
@@ -65,6 +92,7 @@ public:
         // Page was found to be in a corrupt and unrecoverable state.
         // Instead of being erased immediately, it will be kept for diagnostics and data recovery.
         // It will be erased once we run out out free pages.
+        // Freed pages are left in this state as well when their erase is done in the background.
         CORRUPT       = FREEING & ~PSB_CORRUPT,
 
         // Page object wasn't loaded from flash memory
@@ -78,7 +106,7 @@ public:
         return mState;
     }
 
-    esp_err_t load(Partition *partition, uint32_t sectorNumber);
+    esp_err_t load(Partition *partition, uint32_t sectorNumber, ItemIndex *itemIndex = nullptr);
 
     esp_err_t getSeqNumber(uint32_t& seqNumber) const;
 
@@ -88,16 +116,38 @@ public:
 
     esp_err_t writeItem(uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize, uint8_t chunkIdx = CHUNK_ANY);
 
+    /**
+     * Write all items which aren't marked unchanged into consecutive entries with one flash write,
+     * then mark them written with one entry table update per word. Until the entry table word of
+     * the first entry is written, loading the page discards all of them.
+     */
+    esp_err_t writeItems(uint8_t nsIndex, TPendingItemList& items);
+
+    static size_t getEntriesForItem(ItemType datatype, size_t dataSize);
+
     esp_err_t readItem(uint8_t nsIndex, ItemType datatype, const char* key, void* data, size_t dataSize, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
 
     esp_err_t cmpItem(uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
 
     esp_err_t eraseItem(uint8_t nsIndex, ItemType datatype, const char* key, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
 
+    /**
+     * Add one to a counter by programming the next erased bit of its data entries and set value
+     * to the new count. If no bit is left, value is set to the current count and
+     * ESP_ERR_NVS_NOT_ENOUGH_SPACE is returned, the counter has to be written anew then.
+     */
+    esp_err_t incrementCounter(uint8_t nsIndex, const char* key, uint32_t& value);
+
     esp_err_t findItem(uint8_t nsIndex, ItemType datatype, const char* key, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
 
     esp_err_t findItem(uint8_t nsIndex, ItemType datatype, const char* key, size_t &itemIndex, Item& item, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
 
+    /**
+     * Find a string, blob or blob chunk and store the partition offset of its data, which is
+     * contiguous in the entries after the item. The data CRC is not checked.
+     */
+    esp_err_t findItemData(uint8_t nsIndex, ItemType datatype, const char* key, uint32_t& dataOffset, Item& item, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
+
     template<typename T>
     esp_err_t writeItem(uint8_t nsIndex, const char* key, const T& value)
     {
@@ -133,37 +183,112 @@ public:
     }
     size_t getVarDataTailroom() const ;
 
+    /**
+     * Mark the page full. With CONFIG_NVS_PAGE_SUMMARY, the summary of its items is written
+     * into the header as well, see Summary.
+     */
     esp_err_t markFull();
 
+    /**
+     * Mark a page which holds no live items any more, because they were copied away or erased,
+     * as CORRUPT. It is skipped on load and erased before it gets used again.
+     */
+    esp_err_t markForErase();
+
     esp_err_t markFreeing();
 
     esp_err_t copyItems(Page& other);
 
     esp_err_t erase();
 
+    /**
+     * The two halves of erase(). eraseSector only touches the flash sector of the page, so a page
+     * which is on no page list can be erased without nvs::Lock. markErased drops the page from
+     * the item index and needs the lock again.
+     */
+    esp_err_t eraseSector();
+
+    void markErased();
+
     void debugDump() const;
 
     esp_err_t calcEntries(nvs_stats_t &nvsStats);
 
+    /**
+     * Collect entry state changes in RAM until writeDeferredEntryStates, so erasing several items
+     * updates each word of the entry table once.
+     */
+    void deferEntryStates();
+
+    esp_err_t writeDeferredEntryStates();
+
 protected:
 
+    /**
+     * Written into the reserved bytes of the header when the page becomes full, all 0xff before.
+     *
+     * It marks the entries which start an item at that time. The item headers of a full page
+     * don't change any more, only bits of counter data get programmed, and its entries only go
+     * from written to erased, so loading the page can read all item headers at once and doesn't
+     * have to tell them apart from data or half written entries. If the entry table doesn't match the summary, e.g. because an erase was
+     * interrupted, the page is scanned entry by entry.
+     */
+    class Summary
+    {
+    public:
+        uint8_t mItemStarts[16];    // bit per entry, the two bits past ENTRY_COUNT are cleared
+        uint8_t mCrc[3];            // low 24 bits of the crc of mItemStarts
+
+        void updateCrc();
+
+        bool isValid() const;
+
+        bool isItemStart(size_t index) const
+        {
+            return (mItemStarts[index / 8] >> (index % 8)) & 1;
+        }
+
+    protected:
+        uint32_t calculateCrc32() const;
+    };
+
     class Header
     {
     public:
         Header()
         {
-            std::fill_n(mReserved, sizeof(mReserved)/sizeof(mReserved[0]), UINT8_MAX);
+            std::fill_n(reinterpret_cast<uint8_t*>(&mSummary), sizeof(mSummary), UINT8_MAX);
         }
 
         PageState mState;       // page state
         uint32_t mSeqNumber;    // sequence number of this page
         uint8_t mVersion;       // nvs format version
-        uint8_t mReserved[19];  // unused, must be 0xff
-        uint32_t mCrc32;        // crc of everything except mState
+        Summary mSummary;       // written when the page becomes full, 0xff before
+        uint32_t mCrc32;        // crc of everything except mState and mSummary
 
         uint32_t calculateCrc32();
     };
 
+    /**
+     * Kinds of items the brute force searches of Storage::init look for. A page keeps track of
+     * the kinds it holds, so that these searches skip the other pages without reading them.
+     */
+    static const uint8_t ITEM_KIND_NAMESPACE = 0x1;
+    static const uint8_t ITEM_KIND_BLOB_INDEX = 0x2;
+    static const uint8_t ITEM_KIND_BLOB_DATA = 0x4;
+
+    static uint8_t itemKind(uint8_t nsIndex, ItemType datatype)
+    {
+        if (nsIndex == NS_INDEX) {
+            return ITEM_KIND_NAMESPACE;
+        } else if (datatype == ItemType::BLOB_IDX) {
+            return ITEM_KIND_BLOB_INDEX;
+        } else if (datatype == ItemType::BLOB_DATA) {
+            return ITEM_KIND_BLOB_DATA;
+        }
+        return 0;
+    }
+
     enum class EntryState {
         EMPTY   = 0x3, // 0b11, default state after flash erase
         WRITTEN = EMPTY & ~ESB_WRITTEN, // entry was written
@@ -172,7 +297,39 @@ protected:
         INVALID = 0x4 // entry is in inconsistent state (write started but ESB_WRITTEN has not been set yet)
     };
 
-    esp_err_t mLoadEntryTable();
+    // entries read at once by the loops over the entries of a page, kept on the stack
+    static const size_t READ_AHEAD_ENTRIES = 4;
+
+    /**
+     * Read-ahead for mLoadEntryTable, which reads the entries of a page in ascending order.
+     * It reads READ_AHEAD_ENTRIES of them at a time, on an encrypted partition all of them
+     * are decrypted at once. The cached data stays valid while the page is loaded since
+     * erasing an entry changes the entry table only.
+     */
+    class EntryReader
+    {
+    public:
+        EntryReader(const Page& page, size_t end) : mPage(page), mEnd(end) { }
+
+        esp_err_t read(size_t index, Item& item);
+
+    protected:
+        const Page& mPage;
+        size_t mEnd;
+        size_t mFirst = 0;
+        size_t mCount = 0;
+        Item mItems[READ_AHEAD_ENTRIES];
+    };
+
+    esp_err_t mLoadEntryTable(const Summary& summary);
+
+    /**
+     * Load the items of a full page marked in its summary. Sets loaded to false, without
+     * touching the hash list, if the summary is missing or doesn't match the entry table.
+     */
+    esp_err_t loadSummarizedItems(const Summary& summary, bool& loaded);
+
+    esp_err_t writeSummary();
 
     esp_err_t initialize();
 
@@ -180,14 +337,29 @@ protected:
 
     esp_err_t alterEntryRangeState(size_t begin, size_t end, EntryState state);
 
+    esp_err_t writeEntryStateWord(size_t wordIndex);
+
     esp_err_t alterPageState(PageState state);
 
     esp_err_t readEntry(size_t index, Item& dst) const;
 
+    /**
+     * Read count consecutive entries with one partition read, entry by entry only if the
+     * partition doesn't read several at once.
+     */
+    esp_err_t readEntries(size_t index, Item* dst, size_t count) const;
+
     esp_err_t writeEntry(const Item& item);
 
     esp_err_t writeEntryData(const uint8_t* data, size_t size);
 
+    /**
+     * Value of the counter at index: the base in its header plus the programmed bits of its
+     * data entries. nextAddress is set to the first data word with an erased bit left and
+     * nextWord to its content, nextAddress is INVALID_ENTRY if all bits are programmed.
+     */
+    esp_err_t readCounter(size_t index, const Item& item, uint32_t& value, uint32_t& nextAddress, uint32_t& nextWord) const;
+
     esp_err_t eraseEntryAndSpan(size_t index);
 
     esp_err_t updateFirstUsedEntry(size_t index, size_t span);
@@ -218,12 +390,20 @@ protected:
     size_t mFirstUsedEntry = INVALID_ENTRY;
     uint16_t mUsedEntryCount = 0;
     uint16_t mErasedEntryCount = 0;
+    bool mDeferEntryStates = false;
+    uint8_t mItemKinds = 0;         // ITEM_KIND_* bits of the items written since the last erase
+    uint32_t mDeferredWords = 0;    // entry table words changed while deferring
 
     /**
      * This hash list stores hashes of namespace index, key, and ChunkIndex for quick lookup when searching items.
      */
     HashList mHashList;
 
+    /**
+     * Partition wide index owned by the PageManager, updated together with mHashList. May be null.
+     */
+    ItemIndex *mItemIndex = nullptr;
+
     Partition *mPartition;
 
     static const uint32_t HEADER_OFFSET = 0;
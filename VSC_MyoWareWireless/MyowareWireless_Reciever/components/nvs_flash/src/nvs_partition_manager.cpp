@@ -214,14 +214,14 @@ esp_err_t NVSPartitionManager::open_handle(const char *part_name,
 }
 
 esp_err_t NVSPartitionManager::close_handle(NVSHandleSimple* handle) {
-    for (auto it = nvs_handles.begin(); it != nvs_handles.end(); ++it) {
-        if (it == intrusive_list<NVSHandleSimple>::iterator(handle)) {
-            nvs_handles.erase(it);
-            return ESP_OK;
-        }
+    // every valid handle is in the list, deinit_partition() removes the ones it invalidates
+    if (!handle->valid) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
     }
 
-    return ESP_ERR_NVS_INVALID_HANDLE;
+    nvs_handles.erase(handle);
+    handle->valid = false;
+    return ESP_OK;
 }
 
 size_t NVSPartitionManager::open_handles_size()
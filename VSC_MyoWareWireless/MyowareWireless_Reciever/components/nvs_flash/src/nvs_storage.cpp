@@ -23,9 +23,20 @@
 namespace nvs
 {
 
+std::atomic<uint32_t> Storage::mGenerations[Storage::GENERATION_BUCKETS];
+
 Storage::~Storage()
 {
+    bumpAllGenerations();
     clearNamespaces();
+    mReservedBlobs.clearAndFreeNodes();
+}
+
+void Storage::bumpAllGenerations()
+{
+    for (auto& generation : mGenerations) {
+        generation.fetch_add(1, std::memory_order_acq_rel);
+    }
 }
 
 void Storage::clearNamespaces()
@@ -92,6 +103,7 @@ void Storage::eraseOrphanDataBlobs(TBlobIndexList& blobIdxList)
 
 esp_err_t Storage::init(uint32_t baseSector, uint32_t sectorCount)
 {
+    bumpAllGenerations();
     auto err = mPageManager.load(mPartition, baseSector, sectorCount);
     if (err != ESP_OK) {
         mState = StorageState::INVALID;
@@ -162,6 +174,38 @@ bool Storage::isValid() const
 
 esp_err_t Storage::findItem(uint8_t nsIndex, ItemType datatype, const char* key, Page* &page, Item& item, uint8_t chunkIdx, VerOffset chunkStart)
 {
+    /* The item index is filled while the page manager loads the pages in init() and follows
+     * every write, erase and page move from then on. Only the pages it names can hold the
+     * item, all others would fail on their own hash list. */
+    const ItemIndex& index = mPageManager.itemIndex();
+    if (nsIndex != Page::NS_ANY && key != nullptr && index.isValid()) {
+        const size_t MAX_CANDIDATES = 8;
+        Page* candidates[MAX_CANDIDATES];
+        size_t count = index.find(Item(nsIndex, datatype, 0, key, chunkIdx), candidates, MAX_CANDIDATES);
+        if (count <= MAX_CANDIDATES) {
+            // search in page list order, which is the order of sequence numbers
+            uint32_t seqNumbers[MAX_CANDIDATES];
+            for (size_t i = 0; i < count; ++i) {
+                if (candidates[i]->getSeqNumber(seqNumbers[i]) != ESP_OK) {
+                    seqNumbers[i] = UINT32_MAX;
+                }
+                for (size_t j = i; j > 0 && seqNumbers[j - 1] > seqNumbers[j]; --j) {
+                    std::swap(seqNumbers[j - 1], seqNumbers[j]);
+                    std::swap(candidates[j - 1], candidates[j]);
+                }
+            }
+            for (size_t i = 0; i < count; ++i) {
+                size_t itemIndex = 0;
+                auto err = candidates[i]->findItem(nsIndex, datatype, key, itemIndex, item, chunkIdx, chunkStart);
+                if (err == ESP_OK) {
+                    page = candidates[i];
+                    return ESP_OK;
+                }
+            }
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+    }
+
     for (auto it = std::begin(mPageManager); it != std::end(mPageManager); ++it) {
         size_t itemIndex = 0;
         auto err = it->findItem(nsIndex, datatype, key, itemIndex, item, chunkIdx, chunkStart);
@@ -173,14 +217,8 @@ esp_err_t Storage::findItem(uint8_t nsIndex, ItemType datatype, const char* key,
     return ESP_ERR_NVS_NOT_FOUND;
 }
 
-esp_err_t Storage::writeMultiPageBlob(uint8_t nsIndex, const char* key, const void* data, size_t dataSize, VerOffset chunkStart)
+size_t Storage::getMaxBlobSize()
 {
-    uint8_t chunkCount = 0;
-    TUsedPageList usedPages;
-    size_t remainingSize = dataSize;
-    size_t offset = 0;
-    esp_err_t err = ESP_OK;
-
     /* Check how much maximum data can be accommodated**/
     uint32_t max_pages = mPageManager.getPageCount() - 1;
 
@@ -188,15 +226,24 @@ esp_err_t Storage::writeMultiPageBlob(uint8_t nsIndex, const char* key, const vo
        max_pages = (Page::CHUNK_ANY-1)/2;
     }
 
-    if (dataSize > max_pages * Page::CHUNK_MAX_SIZE) {
-        return ESP_ERR_NVS_VALUE_TOO_LONG;
-    }
+    return max_pages * Page::CHUNK_MAX_SIZE;
+}
+
+esp_err_t Storage::writeBlobChunks(uint8_t nsIndex, const char* key, const uint8_t* data, size_t size, VerOffset chunkStart, uint8_t& chunkCount)
+{
+    size_t remainingSize = size;
+    bool firstChunk = true;
+    esp_err_t err = ESP_OK;
 
     do {
+        if (chunkCount >= (Page::CHUNK_ANY-1)/2) {
+            return ESP_ERR_NVS_VALUE_TOO_LONG;
+        }
+
         Page& page = getCurrentPage();
         size_t tailroom = page.getVarDataTailroom();
         size_t chunkSize = 0;
-        if (chunkCount == 0U && ((tailroom < dataSize) || (tailroom == 0 && dataSize == 0)) && tailroom < Page::CHUNK_MAX_SIZE/10) {
+        if (firstChunk && ((tailroom < remainingSize) || (tailroom == 0 && remainingSize == 0)) && tailroom < Page::CHUNK_MAX_SIZE/10) {
             /** This is the first chunk and tailroom is too small ***/
             if (page.state() != Page::PageState::FULL) {
                 err = page.markFull();
@@ -214,9 +261,9 @@ esp_err_t Storage::writeMultiPageBlob(uint8_t nsIndex, const char* key, const vo
                 continue;
             }
         } else if (!tailroom) {
-            err = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
-            break;
+            return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
         }
+        firstChunk = false;
 
         /* Split the blob into two and store the chunk of available size onto the current page */
         NVS_ASSERT_OR_RETURN(tailroom != 0, ESP_FAIL);
@@ -225,64 +272,202 @@ esp_err_t Storage::writeMultiPageBlob(uint8_t nsIndex, const char* key, const vo
         remainingSize -= chunkSize;
 
         err = page.writeItem(nsIndex, ItemType::BLOB_DATA, key,
-                static_cast<const uint8_t*> (data) + offset, chunkSize, static_cast<uint8_t> (chunkStart) + chunkCount);
-        chunkCount++;
-
+                data, chunkSize, static_cast<uint8_t> (chunkStart) + chunkCount);
         if (err != ESP_OK) {
             NVS_ASSERT_OR_RETURN(err != ESP_ERR_NVS_PAGE_FULL, err);
-            break;
-        } else {
-            UsedPageNode* node = new (std::nothrow) UsedPageNode();
-            if (!node) {
-                err = ESP_ERR_NO_MEM;
-                break;
-            }
-            node->mPage = &page;
-            usedPages.push_back(node);
-            if (remainingSize || (tailroom - chunkSize) < Page::ENTRY_SIZE) {
-                if (page.state() != Page::PageState::FULL) {
-                    err = page.markFull();
-                    if (err != ESP_OK) {
-                        break;
-                    }
-                }
-                err = mPageManager.requestNewPage();
+            return err;
+        }
+        chunkCount++;
+        data += chunkSize;
+
+        if (remainingSize || (tailroom - chunkSize) < Page::ENTRY_SIZE) {
+            if (page.state() != Page::PageState::FULL) {
+                err = page.markFull();
                 if (err != ESP_OK) {
-                    break;
+                    return err;
                 }
             }
+            err = mPageManager.requestNewPage();
+            if (err != ESP_OK) {
+                return err;
+            }
         }
-        offset += chunkSize;
-        if (!remainingSize) {
-            /* All pages are stored. Now store the index.*/
-            Item item;
-            std::fill_n(item.data, sizeof(item.data), 0xff);
-            item.blobIndex.dataSize = dataSize;
-            item.blobIndex.chunkCount = chunkCount;
-            item.blobIndex.chunkStart = chunkStart;
+    } while (remainingSize);
 
-            err = getCurrentPage().writeItem(nsIndex, ItemType::BLOB_IDX, key, item.data, sizeof(item.data));
-            NVS_ASSERT_OR_RETURN(err != ESP_ERR_NVS_PAGE_FULL, err);
-            break;
+    return ESP_OK;
+}
+
+esp_err_t Storage::writeBlobIndex(uint8_t nsIndex, const char* key, size_t dataSize, VerOffset chunkStart, uint8_t chunkCount)
+{
+    Item item;
+    std::fill_n(item.data, sizeof(item.data), 0xff);
+    item.blobIndex.dataSize = dataSize;
+    item.blobIndex.chunkCount = chunkCount;
+    item.blobIndex.chunkStart = chunkStart;
+
+    Page& page = getCurrentPage();
+    esp_err_t err = page.writeItem(nsIndex, ItemType::BLOB_IDX, key, item.data, sizeof(item.data));
+    if (err == ESP_ERR_NVS_PAGE_FULL) {
+        // other items may have filled the page since the last chunk was written
+        if (page.state() != Page::PageState::FULL) {
+            err = page.markFull();
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+        err = mPageManager.requestNewPage();
+        if (err != ESP_OK) {
+            return err;
+        }
+        err = getCurrentPage().writeItem(nsIndex, ItemType::BLOB_IDX, key, item.data, sizeof(item.data));
+        NVS_ASSERT_OR_RETURN(err != ESP_ERR_NVS_PAGE_FULL, err);
+    }
+    return err;
+}
+
+void Storage::eraseBlobChunks(uint8_t nsIndex, const char* key, VerOffset chunkStart, uint8_t chunkCount)
+{
+    Item item;
+    Page* findPage = nullptr;
+    for (uint8_t chunkNum = 0; chunkNum < chunkCount; chunkNum++) {
+        const uint8_t chunkIdx = static_cast<uint8_t> (chunkStart) + chunkNum;
+        if (findItem(nsIndex, ItemType::BLOB_DATA, key, findPage, item, chunkIdx) == ESP_OK) {
+            findPage->eraseItem(nsIndex, ItemType::BLOB_DATA, key, chunkIdx);
         }
-    } while (1);
+    }
+}
+
+esp_err_t Storage::writeMultiPageBlob(uint8_t nsIndex, const char* key, const void* data, size_t dataSize, VerOffset chunkStart)
+{
+    if (dataSize > getMaxBlobSize()) {
+        return ESP_ERR_NVS_VALUE_TOO_LONG;
+    }
+
+    uint8_t chunkCount = 0;
+    esp_err_t err = writeBlobChunks(nsIndex, key, static_cast<const uint8_t*>(data), dataSize, chunkStart, chunkCount);
+    if (err == ESP_OK) {
+        /* All pages are stored. Now store the index.*/
+        err = writeBlobIndex(nsIndex, key, dataSize, chunkStart, chunkCount);
+    }
 
     if (err != ESP_OK) {
         /* Anything failed, then we should erase all the written chunks*/
-        int ii=0;
-        for (auto it = std::begin(usedPages); it != std::end(usedPages); it++) {
-            it->mPage->eraseItem(nsIndex, ItemType::BLOB_DATA, key, ii++);
-        }
+        eraseBlobChunks(nsIndex, key, chunkStart, chunkCount);
     }
-    usedPages.clearAndFreeNodes();
     return err;
 }
 
+Storage::TBlobIndexList::iterator Storage::findReservedBlob(uint8_t nsIndex, const char* key)
+{
+    return std::find_if(mReservedBlobs.begin(), mReservedBlobs.end(), [=] (const BlobIndexNode& e) -> bool {
+        return e.nsIndex == nsIndex && strncmp(e.key, key, sizeof(e.key) - 1) == 0;
+    });
+}
+
+esp_err_t Storage::beginBlob(uint8_t nsIndex, const char* key, VerOffset& chunkStart)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    if (strlen(key) > Item::MAX_KEY_LENGTH) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    if (findReservedBlob(nsIndex, key) != mReservedBlobs.end()) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+
+    Item item;
+    Page* findPage = nullptr;
+    esp_err_t err = findItem(nsIndex, ItemType::BLOB_IDX, key, findPage, item);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        return err;
+    }
+    /* Toggle the version of a stored blob, like writeItem */
+    chunkStart = (err == ESP_OK && item.blobIndex.chunkStart != VerOffset::VER_1_OFFSET)
+                 ? VerOffset::VER_1_OFFSET : VerOffset::VER_0_OFFSET;
+
+    BlobIndexNode* node = new (std::nothrow) BlobIndexNode;
+    if (!node) {
+        return ESP_ERR_NO_MEM;
+    }
+    strlcpy(node->key, key, sizeof(node->key));
+    node->nsIndex = nsIndex;
+    node->chunkStart = chunkStart;
+    node->chunkCount = 0;
+    mReservedBlobs.push_back(node);
+    return ESP_OK;
+}
+
+esp_err_t Storage::endBlob(uint8_t nsIndex, const char* key, VerOffset chunkStart, uint8_t chunkCount, size_t dataSize, bool commit)
+{
+    auto reserved = findReservedBlob(nsIndex, key);
+    if (reserved != mReservedBlobs.end()) {
+        BlobIndexNode* node = reserved;
+        mReservedBlobs.erase(reserved);
+        delete node;
+    }
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    if (!commit) {
+        eraseBlobChunks(nsIndex, key, chunkStart, chunkCount);
+        return ESP_OK;
+    }
+    bumpGeneration(nsIndex);
+
+    // the chunks are erased with their namespace, check they are all there before they get an index
+    Item item;
+    Page* findPage = nullptr;
+    esp_err_t err = ESP_OK;
+    for (uint8_t chunkNum = 0; chunkNum < chunkCount && err == ESP_OK; chunkNum++) {
+        err = findItem(nsIndex, ItemType::BLOB_DATA, key, findPage, item, static_cast<uint8_t> (chunkStart) + chunkNum);
+    }
+    if (err != ESP_OK) {
+        eraseBlobChunks(nsIndex, key, chunkStart, chunkCount);
+        return (err == ESP_ERR_NVS_NOT_FOUND) ? ESP_ERR_NVS_INVALID_STATE : err;
+    }
+
+    err = findItem(nsIndex, ItemType::BLOB_IDX, key, findPage, item);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        eraseBlobChunks(nsIndex, key, chunkStart, chunkCount);
+        return err;
+    }
+    const bool hasPrevious = (err == ESP_OK);
+    const VerOffset prevStart = item.blobIndex.chunkStart;
+    NVS_ASSERT_OR_RETURN(!hasPrevious || prevStart != chunkStart, ESP_FAIL);
+
+    err = writeBlobIndex(nsIndex, key, dataSize, chunkStart, chunkCount);
+    if (err != ESP_OK) {
+        eraseBlobChunks(nsIndex, key, chunkStart, chunkCount);
+        return (err == ESP_ERR_NVS_PAGE_FULL) ? ESP_ERR_NVS_NOT_ENOUGH_SPACE : err;
+    }
+
+    if (hasPrevious) {
+        /* Erase the blob with earlier version*/
+        err = eraseMultiPageBlob(nsIndex, key, prevStart);
+        return (err == ESP_ERR_FLASH_OP_FAIL) ? ESP_ERR_NVS_REMOVE_FAILED : err;
+    }
+
+    /* Support for earlier versions where BLOBS were stored without index */
+    err = findItem(nsIndex, ItemType::BLOB, key, findPage, item);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        return ESP_OK;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    return findPage->eraseItem(nsIndex, ItemType::BLOB, key);
+}
+
 esp_err_t Storage::writeItem(uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize)
 {
     if (mState != StorageState::ACTIVE) {
         return ESP_ERR_NVS_NOT_INITIALIZED;
     }
+    if (datatype == ItemType::BLOB && findReservedBlob(nsIndex, key) != mReservedBlobs.end()) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+    bumpGeneration(nsIndex);
 
     Page* findPage = nullptr;
     bool matchedTypePageFound = false;
@@ -433,6 +618,153 @@ esp_err_t Storage::writeItem(uint8_t nsIndex, ItemType datatype, const char* key
     return ESP_OK;
 }
 
+esp_err_t Storage::writeItems(uint8_t nsIndex, TPendingItemList& items)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    bumpGeneration(nsIndex);
+
+    esp_err_t err;
+    Item item;
+    size_t entriesCount = 0;
+    for (auto it = items.begin(); it != items.end(); ++it) {
+        NVS_ASSERT_OR_RETURN(it->datatype != ItemType::BLOB, ESP_ERR_NOT_SUPPORTED);
+        it->oldPage = nullptr;
+        it->unchanged = false;
+#ifdef CONFIG_NVS_LEGACY_DUP_KEYS_COMPATIBILITY
+        err = findItem(nsIndex, it->datatype, it->key, it->oldPage, item);
+#else
+        err = findItem(nsIndex, ItemType::ANY, it->key, it->oldPage, item);
+#endif
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            it->oldPage = nullptr;
+        } else if (err != ESP_OK) {
+            return err;
+        } else if (it->datatype == item.datatype &&
+                it->oldPage->cmpItem(nsIndex, it->datatype, it->key, it->data, it->dataSize) == ESP_OK) {
+            // same as a single write, don't spend flash on a value that is stored already
+            it->unchanged = true;
+            it->oldPage = nullptr;
+            continue;
+        }
+        entriesCount += Page::getEntriesForItem(it->datatype, it->dataSize);
+    }
+
+    if (entriesCount == 0) {
+        return ESP_OK;
+    }
+    if (entriesCount > Page::ENTRY_COUNT) {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+
+    Page& page = getCurrentPage();
+    err = page.writeItems(nsIndex, items);
+    if (err == ESP_ERR_NVS_PAGE_FULL) {
+        if (page.state() != Page::PageState::FULL) {
+            err = page.markFull();
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+        err = mPageManager.requestNewPage();
+        if (err != ESP_OK) {
+            return err;
+        }
+
+        err = getCurrentPage().writeItems(nsIndex, items);
+        if (err == ESP_ERR_NVS_PAGE_FULL) {
+            return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        }
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // garbage collection may have moved the previous values to another page
+    for (auto it = items.begin(); it != items.end(); ++it) {
+        if (it->oldPage && (it->oldPage->state() == Page::PageState::UNINITIALIZED ||
+                it->oldPage->state() == Page::PageState::INVALID)) {
+#ifdef CONFIG_NVS_LEGACY_DUP_KEYS_COMPATIBILITY
+            err = findItem(nsIndex, it->datatype, it->key, it->oldPage, item);
+#else
+            err = findItem(nsIndex, ItemType::ANY, it->key, it->oldPage, item);
+#endif
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+    }
+
+    // erase the previous values page by page, so each word of the entry state table is written once
+    for (auto it = items.begin(); it != items.end(); ++it) {
+        Page* oldPage = it->oldPage;
+        if (!oldPage) {
+            continue;
+        }
+        oldPage->deferEntryStates();
+        for (auto jt = it; jt != items.end(); ++jt) {
+            if (jt->oldPage != oldPage) {
+                continue;
+            }
+#ifdef CONFIG_NVS_LEGACY_DUP_KEYS_COMPATIBILITY
+            err = oldPage->eraseItem(nsIndex, jt->datatype, jt->key);
+#else
+            err = oldPage->eraseItem(nsIndex, ItemType::ANY, jt->key);
+#endif
+            if (err != ESP_OK) {
+                break;
+            }
+            jt->oldPage = nullptr;
+        }
+        esp_err_t flushErr = oldPage->writeDeferredEntryStates();
+        if (err == ESP_OK) {
+            err = flushErr;
+        }
+        if (err == ESP_ERR_FLASH_OP_FAIL) {
+            return ESP_ERR_NVS_REMOVE_FAILED;
+        }
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+#ifdef DEBUG_STORAGE
+    debugCheck();
+#endif
+    return ESP_OK;
+}
+
+esp_err_t Storage::incrementCounter(uint8_t nsIndex, const char* key, uint32_t& value)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    Page* findPage = nullptr;
+    Item item;
+    esp_err_t err = findItem(nsIndex, ItemType::ANY, key, findPage, item);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        value = 1;
+        return writeItem(nsIndex, ItemType::COUNTER, key, &value, sizeof(value));
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (item.datatype != ItemType::COUNTER) {
+        return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+
+    bumpGeneration(nsIndex);
+    err = findPage->incrementCounter(nsIndex, key, value);
+    if (err == ESP_ERR_NVS_NOT_ENOUGH_SPACE) {
+        // all bits are programmed, the next value goes into a new item and the old one is
+        // erased after it is written, like any other update
+        ++value;
+        return writeItem(nsIndex, ItemType::COUNTER, key, &value, sizeof(value));
+    }
+    return err;
+}
+
 esp_err_t Storage::createOrOpenNamespace(const char* nsName, bool canCreate, uint8_t& nsIndex)
 {
     if (mState != StorageState::ACTIVE) {
@@ -643,6 +975,7 @@ esp_err_t Storage::eraseItem(uint8_t nsIndex, ItemType datatype, const char* key
     if (mState != StorageState::ACTIVE) {
         return ESP_ERR_NVS_NOT_INITIALIZED;
     }
+    bumpGeneration(nsIndex);
 
     if (datatype == ItemType::BLOB) {
         return eraseMultiPageBlob(nsIndex, key);
@@ -667,6 +1000,7 @@ esp_err_t Storage::eraseNamespace(uint8_t nsIndex)
     if (mState != StorageState::ACTIVE) {
         return ESP_ERR_NVS_NOT_INITIALIZED;
     }
+    bumpGeneration(nsIndex);
 
     for (auto it = std::begin(mPageManager); it != std::end(mPageManager); ++it) {
         while (true) {
@@ -728,6 +1062,96 @@ esp_err_t Storage::getItemDataSize(uint8_t nsIndex, ItemType datatype, const cha
     return ESP_OK;
 }
 
+esp_err_t Storage::findBlobChunks(uint8_t nsIndex, const char* key, BlobChunk* chunks, size_t maxChunks, size_t& chunkCount)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    Item item;
+    Page* findPage = nullptr;
+    auto err = findItem(nsIndex, ItemType::BLOB_IDX, key, findPage, item);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        // blobs written by earlier versions are a single item without index
+        err = findItem(nsIndex, ItemType::BLOB, key, findPage, item);
+        if (err != ESP_OK) {
+            return err;
+        }
+        chunkCount = 1;
+        if (chunks == nullptr || maxChunks == 0) {
+            return ESP_OK;
+        }
+        err = findPage->findItemData(nsIndex, ItemType::BLOB, key, chunks[0].offset, item);
+        chunks[0].size = item.varLength.dataSize;
+        chunks[0].crc32 = item.varLength.dataCrc32;
+        return err;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    chunkCount = item.blobIndex.chunkCount;
+    if (chunks == nullptr) {
+        return ESP_OK;
+    }
+
+    const VerOffset chunkStart = item.blobIndex.chunkStart;
+    const size_t dataSize = item.blobIndex.dataSize;
+    size_t offset = 0;
+    for (uint8_t chunkNum = 0; chunkNum < chunkCount && chunkNum < maxChunks; chunkNum++) {
+        const uint8_t chunkIdx = static_cast<uint8_t>(chunkStart) + chunkNum;
+        err = findItem(nsIndex, ItemType::BLOB_DATA, key, findPage, item, chunkIdx);
+        if (err != ESP_OK) {
+            return err;
+        }
+        err = findPage->findItemData(nsIndex, ItemType::BLOB_DATA, key, chunks[chunkNum].offset, item, chunkIdx);
+        if (err != ESP_OK) {
+            return err;
+        }
+        chunks[chunkNum].size = item.varLength.dataSize;
+        chunks[chunkNum].crc32 = item.varLength.dataCrc32;
+        offset += item.varLength.dataSize;
+    }
+    NVS_ASSERT_OR_RETURN(maxChunks < chunkCount || offset == dataSize, ESP_FAIL);
+
+    return ESP_OK;
+}
+
+esp_err_t Storage::findBlobChunk(uint8_t nsIndex, const char* key, size_t chunkNum, BlobChunk& chunk)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    Item item;
+    Page* findPage = nullptr;
+    auto err = findItem(nsIndex, ItemType::BLOB_IDX, key, findPage, item);
+    ItemType datatype = ItemType::BLOB_DATA;
+    uint8_t chunkIdx = Page::CHUNK_ANY;
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        // blobs written by earlier versions are a single item without index
+        if (chunkNum != 0) {
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+        datatype = ItemType::BLOB;
+    } else if (err != ESP_OK) {
+        return err;
+    } else if (chunkNum >= item.blobIndex.chunkCount) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    } else {
+        chunkIdx = static_cast<uint8_t>(item.blobIndex.chunkStart) + chunkNum;
+    }
+
+    err = findItem(nsIndex, datatype, key, findPage, item, chunkIdx);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = findPage->findItemData(nsIndex, datatype, key, chunk.offset, item, chunkIdx);
+    chunk.size = item.varLength.dataSize;
+    chunk.crc32 = item.varLength.dataCrc32;
+    return err;
+}
+
 void Storage::debugDump()
 {
     for (auto p = mPageManager.begin(); p != mPageManager.end(); ++p) {
@@ -768,6 +1192,22 @@ esp_err_t Storage::fillStats(nvs_stats_t& nvsStats)
     return mPageManager.fillStats(nvsStats);
 }
 
+esp_err_t Storage::collectGarbage()
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    return mPageManager.collectGarbage();
+}
+
+Page* Storage::takePageToErase()
+{
+    if (mState != StorageState::ACTIVE) {
+        return nullptr;
+    }
+    return mPageManager.takePageToErase();
+}
+
 esp_err_t Storage::calcEntriesInNamespace(uint8_t nsIndex, size_t& usedEntries)
 {
     usedEntries = 0;
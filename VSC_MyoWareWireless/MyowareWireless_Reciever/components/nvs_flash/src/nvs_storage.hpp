@@ -8,6 +8,7 @@
 
 #include <memory>
 #include <cstdlib>
+#include <atomic>
 #include <unordered_map>
 #include "nvs.hpp"
 #include "nvs_types.hpp"
@@ -36,12 +37,6 @@ class Storage : public intrusive_list_node<Storage>, public ExceptionlessAllocat
 
     typedef intrusive_list<NamespaceEntry> TNamespaces;
 
-    struct UsedPageNode: public intrusive_list_node<UsedPageNode>, public ExceptionlessAllocatable {
-        public: Page* mPage;
-    };
-
-    typedef intrusive_list<UsedPageNode> TUsedPageList;
-
     struct BlobIndexNode: public intrusive_list_node<BlobIndexNode>, public ExceptionlessAllocatable {
         public:
             char key[Item::MAX_KEY_LENGTH + 1];
@@ -53,6 +48,15 @@ class Storage : public intrusive_list_node<Storage>, public ExceptionlessAllocat
     typedef intrusive_list<BlobIndexNode> TBlobIndexList;
 
 public:
+    /**
+     * Location of one blob chunk in the partition.
+     */
+    struct BlobChunk {
+        uint32_t offset;
+        uint32_t size;
+        uint32_t crc32;
+    };
+
     ~Storage();
 
     Storage(Partition *partition) : mPartition(partition) {
@@ -69,12 +73,34 @@ public:
 
     esp_err_t writeItem(uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize);
 
+    /**
+     * Write all items of the list with a single flash write into one page, then erase
+     * their previous values. Items with an unchanged value are skipped.
+     *
+     * The new values become visible on flash all at once, after a power loss either all or
+     * none of them are found. Keys must be unique in the list, blobs are not supported.
+     */
+    esp_err_t writeItems(uint8_t nsIndex, TPendingItemList& items);
+
+    /**
+     * Add one to the counter stored under key, or create it with the value 1, and set value
+     * to the new count. See Page::incrementCounter.
+     */
+    esp_err_t incrementCounter(uint8_t nsIndex, const char* key, uint32_t& value);
+
     esp_err_t readItem(uint8_t nsIndex, ItemType datatype, const char* key, void* data, size_t dataSize);
 
     esp_err_t findKey(const uint8_t nsIndex, const char* key, ItemType* datatype);
 
     esp_err_t getItemDataSize(uint8_t nsIndex, ItemType datatype, const char* key, size_t& dataSize);
 
+    /**
+     * Find where the data of a blob lies in the partition, one chunk per page it spans.
+     * chunkCount is set to the number of chunks, up to maxChunks of them are stored in
+     * chunks. With chunks == nullptr only the count is looked up.
+     */
+    esp_err_t findBlobChunks(uint8_t nsIndex, const char* key, BlobChunk* chunks, size_t maxChunks, size_t& chunkCount);
+
     esp_err_t eraseItem(uint8_t nsIndex, ItemType datatype, const char* key);
 
     template<typename T>
@@ -119,12 +145,78 @@ public:
 
     esp_err_t eraseMultiPageBlob(uint8_t nsIndex, const char* key, VerOffset chunkStart = VerOffset::VER_ANY);
 
+    /**
+     * Largest blob which fits into the partition, one page stays free for garbage collection.
+     */
+    size_t getMaxBlobSize();
+
+    /**
+     * Start writing the blob stored under key in pieces, see NVSBlobWriter. The key is reserved
+     * until endBlob, writeItem doesn't write a blob under it meanwhile. chunkStart is set to the
+     * version the chunks are written with, the other one than that of the stored blob.
+     */
+    esp_err_t beginBlob(uint8_t nsIndex, const char* key, VerOffset& chunkStart);
+
+    /**
+     * Write size bytes of a blob begun with beginBlob as one or more chunks, following the
+     * chunkCount chunks written before. chunkCount is advanced past the new ones.
+     */
+    esp_err_t writeBlobChunks(uint8_t nsIndex, const char* key, const uint8_t* data, size_t size, VerOffset chunkStart, uint8_t& chunkCount);
+
+    /**
+     * Release the key reserved by beginBlob. With commit, write the index of the chunks and
+     * erase the previous version of the blob, otherwise erase the chunks.
+     */
+    esp_err_t endBlob(uint8_t nsIndex, const char* key, VerOffset chunkStart, uint8_t chunkCount, size_t dataSize, bool commit);
+
+    /**
+     * Find chunk chunkNum of the blob stored under key, see findBlobChunks.
+     */
+    esp_err_t findBlobChunk(uint8_t nsIndex, const char* key, size_t chunkNum, BlobChunk& chunk);
+
     void debugDump();
 
     void debugCheck();
 
     esp_err_t fillStats(nvs_stats_t& nvsStats);
 
+    /**
+     * Counter of changes to the namespaces which share a bucket with nsIndex, in all partitions.
+     * Every write bumps it and so do init and deinit, so a snapshot can find out without taking
+     * nvs::Lock that its copy is outdated. A change of another namespace in the same bucket or of
+     * another partition only costs a needless refresh.
+     */
+    static uint32_t getGeneration(uint8_t nsIndex)
+    {
+        return mGenerations[nsIndex % GENERATION_BUCKETS].load(std::memory_order_acquire);
+    }
+
+    /**
+     * See PageManager::getRelocationEpoch. Snapshots and readers don't need it, they only hold
+     * copies of the data.
+     */
+    static uint32_t getRelocationEpoch()
+    {
+        return PageManager::getRelocationEpoch();
+    }
+
+    void setBackgroundErase(bool enable)
+    {
+        mPageManager.setBackgroundErase(enable);
+    }
+
+    esp_err_t collectGarbage();
+
+    /**
+     * See PageManager::takePageToErase, returns nullptr unless the storage is active.
+     */
+    Page* takePageToErase();
+
+    esp_err_t returnErasedPage(Page* page, esp_err_t err)
+    {
+        return mPageManager.returnErasedPage(page, err);
+    }
+
     esp_err_t calcEntriesInNamespace(uint8_t nsIndex, size_t& usedEntries);
 
     bool findEntry(nvs_opaque_iterator_t* it, const char* name);
@@ -142,6 +234,19 @@ protected:
 
     void clearNamespaces();
 
+    static void bumpGeneration(uint8_t nsIndex)
+    {
+        mGenerations[nsIndex % GENERATION_BUCKETS].fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    static void bumpAllGenerations();
+
+    esp_err_t writeBlobIndex(uint8_t nsIndex, const char* key, size_t dataSize, VerOffset chunkStart, uint8_t chunkCount);
+
+    void eraseBlobChunks(uint8_t nsIndex, const char* key, VerOffset chunkStart, uint8_t chunkCount);
+
+    TBlobIndexList::iterator findReservedBlob(uint8_t nsIndex, const char* key);
+
     esp_err_t populateBlobIndices(TBlobIndexList&);
 
     void eraseOrphanDataBlobs(TBlobIndexList&);
@@ -157,6 +262,12 @@ protected:
     TNamespaces mNamespaces;
     CompressedEnumTable<bool, 1, 256> mNamespaceUsage;
     StorageState mState = StorageState::INVALID;
+
+    // blobs which are written by beginBlob and endBlob
+    TBlobIndexList mReservedBlobs;
+
+    static const size_t GENERATION_BUCKETS = 16;
+    static std::atomic<uint32_t> mGenerations[GENERATION_BUCKETS];
 };
 
 } // namespace nvs
@@ -95,6 +95,28 @@ esp_err_t esp_partition_write_raw(const esp_partition_t* partition,
     return ESP_OK;
 }
 
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size,
+                             esp_partition_mmap_memory_t memory,
+                             const void** out_ptr, esp_partition_mmap_handle_t* out_handle)
+{
+    if (!s_emulator) {
+        return ESP_ERR_FLASH_OP_TIMEOUT;
+    }
+
+    const uint8_t* ptr = s_emulator->map(offset, size);
+    if (ptr == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    *out_ptr = ptr;
+    *out_handle = 0;
+    return ESP_OK;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle)
+{
+}
+
 // timing data for ESP8266, 160MHz CPU frequency, 80MHz flash requency
 // all values in microseconds
 // values are for block sizes starting at 4 bytes and going up to 4096 bytes
@@ -84,6 +84,18 @@ public:
         return ESP_OK;
     }
 
+    esp_err_t mmap(size_t src_offset, size_t size, const void** out_ptr, uint32_t* out_handle) override
+    {
+        const uint8_t* ptr = flash_emu->map(src_offset, size);
+        if (ptr == nullptr) {
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        *out_ptr = ptr;
+        *out_handle = 0;
+        return ESP_OK;
+    }
+
     uint32_t get_address() override
     {
         return address;
@@ -0,0 +1,221 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "catch.hpp"
+#include "nvs.hpp"
+#include "nvs_partition_manager.hpp"
+#include "nvs_storage.hpp"
+#include "spi_flash_emulation.h"
+#include "test_fixtures.hpp"
+#include <cstdio>
+#include <iostream>
+
+#define TEST_ESP_ERR(rc, res) CHECK((rc) == (res))
+#define TEST_ESP_OK(rc) CHECK((rc) == ESP_OK)
+
+using namespace nvs;
+
+static const uint32_t ENTRY_TABLE_OFFSET = 32;
+
+// a counter item holds this many increments before it is written anew
+static const uint32_t COUNTER_BITS = Page::COUNTER_DATA_ENTRIES * Page::ENTRY_SIZE * 8;
+
+TEST_CASE("counter counts across rewrites and remounts", "[nvs][counter]")
+{
+    const uint32_t NVS_FLASH_SECTOR = 0;
+    const uint32_t NVS_FLASH_SECTOR_COUNT = 4;
+    PartitionEmulationFixture f(NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT);
+    REQUIRE(NVSPartitionManager::get_instance()->init_custom(&f.part, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT)
+            == ESP_OK);
+
+    nvs_handle_t handle;
+    TEST_ESP_OK(nvs_open("usage", NVS_READWRITE, &handle));
+    uint32_t value = 0;
+    TEST_ESP_ERR(nvs_counter_get(handle, "boots", &value), ESP_ERR_NVS_NOT_FOUND);
+    TEST_ESP_ERR(nvs_counter_get(handle, "boots", nullptr), ESP_ERR_INVALID_ARG);
+
+    const uint32_t COUNT = 3 * COUNTER_BITS + 10;
+    for (uint32_t i = 1; i <= COUNT; ++i) {
+        REQUIRE(nvs_counter_inc(handle, "boots", &value) == ESP_OK);
+        REQUIRE(value == i);
+    }
+    TEST_ESP_OK(nvs_counter_inc(handle, "boots", nullptr));
+    TEST_ESP_OK(nvs_counter_get(handle, "boots", &value));
+    CHECK(value == COUNT + 1);
+
+    // a counter is no uint32_t and the other way around
+    TEST_ESP_ERR(nvs_get_u32(handle, "boots", &value), ESP_ERR_NVS_NOT_FOUND);
+    TEST_ESP_OK(nvs_set_u32(handle, "plain", 5));
+    TEST_ESP_ERR(nvs_counter_inc(handle, "plain", &value), ESP_ERR_NVS_TYPE_MISMATCH);
+    TEST_ESP_ERR(nvs_counter_inc(handle, "a_very_long_key_name", &value), ESP_ERR_NVS_KEY_TOO_LONG);
+
+    nvs_iterator_t it = nullptr;
+    TEST_ESP_OK(nvs_entry_find_in_handle(handle, NVS_TYPE_COUNTER, &it));
+    nvs_entry_info_t info;
+    TEST_ESP_OK(nvs_entry_info(it, &info));
+    CHECK(std::string(info.key) == "boots");
+    CHECK(info.type == NVS_TYPE_COUNTER);
+    nvs_release_iterator(it);
+    nvs_close(handle);
+
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+    REQUIRE(NVSPartitionManager::get_instance()->init_custom(&f.part, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT)
+            == ESP_OK);
+    TEST_ESP_OK(nvs_open("usage", NVS_READONLY, &handle));
+    TEST_ESP_OK(nvs_counter_get(handle, "boots", &value));
+    CHECK(value == COUNT + 1);
+    TEST_ESP_ERR(nvs_counter_inc(handle, "boots", &value), ESP_ERR_NVS_READ_ONLY);
+    nvs_close(handle);
+
+    TEST_ESP_OK(nvs_open("usage", NVS_READWRITE, &handle));
+    TEST_ESP_OK(nvs_erase_key(handle, "boots"));
+    TEST_ESP_OK(nvs_counter_inc(handle, "boots", &value));
+    CHECK(value == 1);
+    nvs_close(handle);
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+}
+
+TEST_CASE("counter survives power loss while it is incremented or written anew", "[nvs][counter]")
+{
+    const uint32_t SECTORS = 3;
+    // the last increments run out of bits and write the counter anew
+    const uint32_t START = COUNTER_BITS - 5;
+    const uint32_t INCREMENTS = 12;
+
+    for (uint32_t failAfter = 0; failAfter < 120; ++failAfter) {
+        PartitionEmulationFixture f(0, SECTORS);
+        uint8_t ns;
+        uint32_t value = 0;
+        uint32_t stored = 0;
+        {
+            Storage storage(&f.part);
+            REQUIRE(storage.init(0, SECTORS) == ESP_OK);
+            REQUIRE(storage.createOrOpenNamespace("usage", true, ns) == ESP_OK);
+            for (uint32_t i = 0; i < START; ++i) {
+                REQUIRE(storage.incrementCounter(ns, "boots", value) == ESP_OK);
+            }
+            stored = value;
+
+            f.emu.failAfter(failAfter);
+            for (uint32_t i = 0; i < INCREMENTS; ++i) {
+                if (storage.incrementCounter(ns, "boots", value) != ESP_OK) {
+                    break;
+                }
+                stored = value;
+            }
+            f.emu.failAfter(UINT32_MAX);
+        }
+
+        // the increment which was cut off is either lost or complete
+        Storage storage(&f.part);
+        REQUIRE(storage.init(0, SECTORS) == ESP_OK);
+        REQUIRE(storage.createOrOpenNamespace("usage", false, ns) == ESP_OK);
+        REQUIRE(storage.readItem(ns, ItemType::COUNTER, "boots", &value, sizeof(value)) == ESP_OK);
+        CHECK((value == stored || value == stored + 1));
+
+        const uint32_t reloaded = value;
+        for (uint32_t i = 1; i <= INCREMENTS; ++i) {
+            REQUIRE(storage.incrementCounter(ns, "boots", value) == ESP_OK);
+            CHECK(value == reloaded + i);
+        }
+    }
+}
+
+TEST_CASE("counter writes its item anew on encrypted partitions", "[nvs][counter]")
+{
+    const uint32_t NVS_FLASH_SECTOR = 6;
+    const uint32_t NVS_FLASH_SECTOR_COUNT = 4;
+
+    nvs_sec_cfg_t xts_cfg;
+    for (int count = 0; count < NVS_KEY_SIZE; count++) {
+        xts_cfg.eky[count] = 0x11;
+        xts_cfg.tky[count] = 0x22;
+    }
+    EncryptedPartitionFixture fixture(&xts_cfg, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT);
+    for (uint32_t i = NVS_FLASH_SECTOR; i < NVS_FLASH_SECTOR + NVS_FLASH_SECTOR_COUNT; ++i) {
+        fixture.emu.erase(i);
+    }
+    REQUIRE(NVSPartitionManager::get_instance()->init_custom(&fixture.part, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT)
+            == ESP_OK);
+
+    nvs_handle_t handle;
+    TEST_ESP_OK(nvs_open("usage", NVS_READWRITE, &handle));
+    uint32_t value = 0;
+    for (uint32_t i = 1; i <= 600; ++i) {
+        REQUIRE(nvs_counter_inc(handle, "boots", &value) == ESP_OK);
+        REQUIRE(value == i);
+    }
+
+    // without data entries the counter takes a single one
+    size_t used = 0;
+    TEST_ESP_OK(nvs_get_used_entry_count(handle, &used));
+    CHECK(used == 1);
+    nvs_close(handle);
+
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+    REQUIRE(NVSPartitionManager::get_instance()->init_custom(&fixture.part, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT)
+            == ESP_OK);
+    TEST_ESP_OK(nvs_open("usage", NVS_READWRITE, &handle));
+    TEST_ESP_OK(nvs_counter_get(handle, "boots", &value));
+    CHECK(value == 600);
+    nvs_close(handle);
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+}
+
+/* Entries which aren't empty any more, including those of the pages erased since clearStats(). */
+static size_t consumed_entries(const SpiFlashEmulator& emu, uint32_t sectors)
+{
+    size_t count = emu.getEraseOps() * Page::ENTRY_COUNT;
+    for (uint32_t sector = 0; sector < sectors; ++sector) {
+        const uint32_t* table = emu.words() + (sector * SPI_FLASH_SEC_SIZE + ENTRY_TABLE_OFFSET) / 4;
+        for (size_t entry = 0; entry < Page::ENTRY_COUNT; ++entry) {
+            if (((table[entry / 16] >> (entry % 16 * 2)) & 3) != 3) {
+                ++count;
+            }
+        }
+    }
+    return count;
+}
+
+TEST_CASE("counter consumes fewer entries than a rewritten uint32_t", "[nvs][counter][bench]")
+{
+    const uint32_t NVS_FLASH_SECTOR = 0;
+    const uint32_t NVS_FLASH_SECTOR_COUNT = 8;
+    const uint32_t INCREMENTS = 10000;
+
+    std::cout << "type      entries  sector erases  write KB  flash us" << std::endl;
+    size_t consumed[2];
+    for (int pass = 0; pass < 2; ++pass) {
+        PartitionEmulationFixture f(NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT);
+        REQUIRE(NVSPartitionManager::get_instance()->init_custom(&f.part, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT)
+                == ESP_OK);
+        nvs_handle_t handle;
+        REQUIRE(nvs_open("usage", NVS_READWRITE, &handle) == ESP_OK);
+
+        f.emu.clearStats();
+        const size_t before = consumed_entries(f.emu, NVS_FLASH_SECTOR_COUNT);
+        for (uint32_t i = 1; i <= INCREMENTS; ++i) {
+            if (pass == 0) {
+                REQUIRE(nvs_counter_inc(handle, "boots", nullptr) == ESP_OK);
+            } else {
+                REQUIRE(nvs_set_u32(handle, "boots", i) == ESP_OK);
+            }
+        }
+        consumed[pass] = consumed_entries(f.emu, NVS_FLASH_SECTOR_COUNT) - before;
+
+        uint32_t value = 0;
+        CHECK(((pass == 0) ? nvs_counter_get(handle, "boots", &value) : nvs_get_u32(handle, "boots", &value)) == ESP_OK);
+        CHECK(value == INCREMENTS);
+
+        char line[80];
+        snprintf(line, sizeof(line), "%-8s  %7zu  %13zu  %8zu  %8zu", (pass == 0) ? "counter" : "u32",
+                 consumed[pass], f.emu.getEraseOps(), f.emu.getWriteBytes() / 1024, f.emu.getTotalTime());
+        std::cout << line << std::endl;
+
+        nvs_close(handle);
+        REQUIRE(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME) == ESP_OK);
+    }
+    CHECK(consumed[0] * 50 < consumed[1]);
+}
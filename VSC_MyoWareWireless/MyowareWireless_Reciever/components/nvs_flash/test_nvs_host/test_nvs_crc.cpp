@@ -0,0 +1,63 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "catch.hpp"
+#include "nvs_crc.hpp"
+#include "nvs_types.hpp"
+#include "esp_rom_crc.h"
+#include <cstddef>
+#include <random>
+#include <vector>
+
+using namespace nvs;
+
+TEST_CASE("crc matches the rom routine for any length, alignment and start value", "[nvs][crc]")
+{
+    std::mt19937 gen(42);
+    std::vector<uint8_t> data(4200);
+    for (auto& byte : data) {
+        byte = static_cast<uint8_t>(gen());
+    }
+
+    const uint32_t starts[] = { 0xffffffff, 0, 0x12345678 };
+    for (uint32_t start : starts) {
+        for (size_t offset = 0; offset < 8; ++offset) {
+            for (size_t size = 0; size <= 70; ++size) {
+                REQUIRE(Crc32::calculate(start, data.data() + offset, size)
+                        == esp_rom_crc32_le(start, data.data() + offset, size));
+            }
+            CHECK(Crc32::calculate(start, data.data() + offset, 4000)
+                  == esp_rom_crc32_le(start, data.data() + offset, 4000));
+        }
+    }
+
+    // passing the result on continues the CRC
+    uint32_t crc = Crc32::calculate(0xffffffff, data.data(), 13);
+    crc = Crc32::calculate(crc, data.data() + 13, 1000);
+    CHECK(crc == esp_rom_crc32_le(0xffffffff, data.data(), 1013));
+}
+
+TEST_CASE("item crc in one pass matches the crc of its fields", "[nvs][crc]")
+{
+    std::mt19937 gen(7);
+    for (int i = 0; i < 1000; ++i) {
+        Item item;
+        for (auto& byte : item.rawData) {
+            byte = static_cast<uint8_t>(gen());
+        }
+        const uint8_t* p = item.rawData;
+
+        uint32_t crc = esp_rom_crc32_le(0xffffffff, p + offsetof(Item, nsIndex),
+                                        offsetof(Item, crc32) - offsetof(Item, nsIndex));
+        crc = esp_rom_crc32_le(crc, p + offsetof(Item, key), sizeof(item.key));
+        crc = esp_rom_crc32_le(crc, p + offsetof(Item, data), sizeof(item.data));
+        REQUIRE(item.calculateCrc32() == crc);
+
+        crc = esp_rom_crc32_le(0xffffffff, p + offsetof(Item, nsIndex), sizeof(item.nsIndex));
+        crc = esp_rom_crc32_le(crc, p + offsetof(Item, key), sizeof(item.key));
+        crc = esp_rom_crc32_le(crc, p + offsetof(Item, chunkIndex), sizeof(item.chunkIndex));
+        REQUIRE(item.calculateCrc32WithoutValue() == crc);
+    }
+}
@@ -0,0 +1,255 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "catch.hpp"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "nvs_partition_manager.hpp"
+#include "nvs_storage.hpp"
+#include "spi_flash_emulation.h"
+#include "test_fixtures.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+using namespace nvs;
+
+struct WriteLatency {
+    size_t maxTime = 0;
+    size_t totalTime = 0;
+    size_t erasingWrites = 0;
+    size_t backgroundTime = 0;
+};
+
+/* Overwrite a set of keys like a settings store does and take the emulated flash time of every
+ * write. With background erase, the garbage collection runs between two writes and its time is
+ * counted separately. */
+static WriteLatency measure_writes(bool backgroundErase, int writes)
+{
+    const uint32_t PAGES = 8;
+    const int KEYS = 24;
+    PartitionEmulationFixture f(0, PAGES);
+    Storage storage(&f.part);
+    REQUIRE(storage.init(0, PAGES) == ESP_OK);
+    storage.setBackgroundErase(backgroundErase);
+
+    WriteLatency latency;
+    char key[16];
+    char str[48];
+    for (int i = 0; i < writes; ++i) {
+        snprintf(key, sizeof(key), "key%d", i % KEYS);
+        f.emu.clearStats();
+        if (i % 3 == 0) {
+            snprintf(str, sizeof(str), "calibration value %d", i);
+            REQUIRE(storage.writeItem(1, ItemType::SZ, key, str, strlen(str) + 1) == ESP_OK);
+        } else {
+            REQUIRE(storage.writeItem(1, key, i) == ESP_OK);
+        }
+        latency.maxTime = std::max(latency.maxTime, f.emu.getTotalTime());
+        latency.totalTime += f.emu.getTotalTime();
+        if (f.emu.getEraseOps() != 0) {
+            latency.erasingWrites++;
+        }
+
+        if (backgroundErase) {
+            f.emu.clearStats();
+            esp_err_t err;
+            while ((err = storage.collectGarbage()) == ESP_OK) {
+            }
+            REQUIRE(err == ESP_ERR_NVS_NOT_FOUND);
+            latency.backgroundTime += f.emu.getTotalTime();
+        }
+    }
+    return latency;
+}
+
+TEST_CASE("background erase keeps sector erases out of the write latency", "[nvs][gc][bench]")
+{
+    const int WRITES = 5000;
+    WriteLatency sync = measure_writes(false, WRITES);
+    WriteLatency background = measure_writes(true, WRITES);
+
+    std::cout << "mode        worst write us  mean write us  erasing writes  background us" << std::endl;
+    const struct {
+        const char *name;
+        const WriteLatency &latency;
+    } rows[] = {
+        { "in write", sync },
+        { "background", background },
+    };
+    for (auto& row : rows) {
+        char line[100];
+        snprintf(line, sizeof(line), "%-10s  %14zu  %13zu  %14zu  %13zu", row.name, row.latency.maxTime,
+                 row.latency.totalTime / WRITES, row.latency.erasingWrites, row.latency.backgroundTime);
+        std::cout << line << std::endl;
+    }
+
+    // a sector erase takes tens of milliseconds, with the erase model of the emulator 37 ms
+    CHECK(sync.erasingWrites > 0);
+    CHECK(sync.maxTime > 30000);
+    CHECK(background.erasingWrites == 0);
+    CHECK(background.maxTime < 30000);
+}
+
+static const int SLOW_ERASE_MS = 30;
+
+/* Flash with a sector erase that takes real time. The emulator isn't thread safe, so every
+ * operation holds a mutex, but the erase time is spent outside of it: the bench shows how long
+ * writes wait for NVS, not for the flash chip. */
+class SlowErasePartition : public PartitionEmulation {
+public:
+    SlowErasePartition(SpiFlashEmulator *emu, uint32_t size)
+        : PartitionEmulation(emu, 0, size, "gc_bench") { }
+
+    esp_err_t read_raw(size_t src_offset, void* dst, size_t size) override
+    {
+        std::lock_guard<std::mutex> guard(mFlash);
+        return PartitionEmulation::read_raw(src_offset, dst, size);
+    }
+
+    esp_err_t read(size_t src_offset, void* dst, size_t size) override
+    {
+        std::lock_guard<std::mutex> guard(mFlash);
+        return PartitionEmulation::read(src_offset, dst, size);
+    }
+
+    esp_err_t write_raw(size_t dst_offset, const void* src, size_t size) override
+    {
+        std::lock_guard<std::mutex> guard(mFlash);
+        return PartitionEmulation::write_raw(dst_offset, src, size);
+    }
+
+    esp_err_t write(size_t dst_offset, const void* src, size_t size) override
+    {
+        std::lock_guard<std::mutex> guard(mFlash);
+        return PartitionEmulation::write(dst_offset, src, size);
+    }
+
+    esp_err_t erase_range(size_t dst_offset, size_t size) override
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(SLOW_ERASE_MS));
+        std::lock_guard<std::mutex> guard(mFlash);
+        ++erases;
+        return PartitionEmulation::erase_range(dst_offset, size);
+    }
+
+    std::atomic<int> erases{0};
+
+private:
+    std::mutex mFlash;
+};
+
+struct ConcurrentLatency {
+    int64_t worstWriteUs = 0;
+    int writerErases = 0;
+    int gcErases = 0;
+};
+
+/* A writer thread overwrites settings every few milliseconds and takes the wall clock time of
+ * each nvs_set_* call. With background erase, this thread runs garbage collection meanwhile. */
+static ConcurrentLatency measure_concurrent_writes(bool backgroundErase, int writes)
+{
+    const uint32_t PAGES = 4;
+    SpiFlashEmulator emu(PAGES);
+    SlowErasePartition part(&emu, PAGES * SPI_FLASH_SEC_SIZE);
+    REQUIRE(nvs::NVSPartitionManager::get_instance()->init_custom(&part, 0, PAGES) == ESP_OK);
+    REQUIRE(nvs_flash_set_background_erase("gc_bench", backgroundErase) == ESP_OK);
+
+    nvs_handle_t handle;
+    REQUIRE(nvs_open_from_partition("gc_bench", "settings", NVS_READWRITE, &handle) == ESP_OK);
+
+    ConcurrentLatency latency;
+    std::atomic<bool> done{false};
+    std::atomic<int> writerErases{0};
+    std::atomic<int64_t> worstWriteUs{0};
+    std::atomic<bool> failed{false};
+    std::thread writer([&]() {
+        char key[16];
+        char str[48];
+        for (int i = 0; i < writes && !failed; ++i) {
+            snprintf(key, sizeof(key), "key%d", i % 24);
+            int erasesBefore = part.erases;
+            auto start = std::chrono::steady_clock::now();
+            esp_err_t err;
+            if (i % 3 == 0) {
+                snprintf(str, sizeof(str), "calibration value %d", i);
+                err = nvs_set_str(handle, key, str);
+            } else {
+                err = nvs_set_i32(handle, key, i);
+            }
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+            if (err != ESP_OK) {
+                failed = true;
+            }
+            if (us > worstWriteUs) {
+                worstWriteUs = us;
+            }
+            if (!backgroundErase && part.erases != erasesBefore) {
+                ++writerErases;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        done = true;
+    });
+
+    int gcErases = 0;
+    while (!done) {
+        if (!backgroundErase) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        int erasesBefore = part.erases;
+        esp_err_t err = nvs_flash_collect_garbage("gc_bench");
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        } else if (err != ESP_OK) {
+            failed = true;
+        }
+        gcErases += part.erases - erasesBefore;
+    }
+    writer.join();
+
+    nvs_close(handle);
+    REQUIRE(nvs_flash_deinit_partition("gc_bench") == ESP_OK);
+    CHECK_FALSE(failed);
+
+    latency.worstWriteUs = worstWriteUs;
+    latency.writerErases = writerErases;
+    latency.gcErases = gcErases;
+    return latency;
+}
+
+TEST_CASE("garbage collection in another thread doesn't hold off writes for a sector erase", "[nvs][gc][bench]")
+{
+    const int WRITES = 1000;
+    ConcurrentLatency sync = measure_concurrent_writes(false, WRITES);
+    ConcurrentLatency background = measure_concurrent_writes(true, WRITES);
+
+    std::cout << "mode        worst write us  erases in writes  erases in gc" << std::endl;
+    const struct {
+        const char *name;
+        const ConcurrentLatency &latency;
+    } rows[] = {
+        { "in write", sync },
+        { "concurrent", background },
+    };
+    for (auto& row : rows) {
+        char line[100];
+        snprintf(line, sizeof(line), "%-10s  %14lld  %16d  %12d", row.name,
+                 static_cast<long long>(row.latency.worstWriteUs), row.latency.writerErases, row.latency.gcErases);
+        std::cout << line << std::endl;
+    }
+
+    const int64_t ERASE_US = SLOW_ERASE_MS * 1000;
+    CHECK(sync.writerErases > 0);
+    CHECK(sync.worstWriteUs >= ERASE_US);
+    CHECK(background.gcErases > 0);
+    CHECK(background.worstWriteUs < ERASE_US);
+}
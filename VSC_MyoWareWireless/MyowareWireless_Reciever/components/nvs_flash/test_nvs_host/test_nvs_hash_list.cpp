@@ -0,0 +1,85 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "catch.hpp"
+#include "nvs_page.hpp"
+#include "spi_flash_emulation.h"
+#include "test_fixtures.hpp"
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <string>
+
+using namespace nvs;
+
+/* The list of 128 byte blocks used before, as laid out on the ESP32: an 8 byte list node,
+ * a 4 byte count and 29 nodes of 4 bytes per block. */
+static size_t block_list_size(size_t entries)
+{
+    const size_t nodesPerBlock = (128 - 8 - 4) / 4;
+    return (entries + nodesPerBlock - 1) / nodesPerBlock * 128;
+}
+
+/* Two keys whose 32-bit hashes share the lower 24 bits, the list used before couldn't tell them apart */
+static void find_colliding_keys(std::string& first, std::string& second)
+{
+    std::map<uint32_t, std::pair<uint32_t, std::string> > seen;
+    char key[16];
+    for (int i = 0; first.empty(); ++i) {
+        snprintf(key, sizeof(key), "c%d", i);
+        uint32_t hash = Item(1, ItemType::U32, 1, key).calculateCrc32WithoutValue();
+        auto it = seen.find(hash & 0xffffff);
+        if (it == seen.end()) {
+            seen[hash & 0xffffff] = std::make_pair(hash, std::string(key));
+        } else if (it->second.first != hash) {
+            first = it->second.second;
+            second = key;
+        }
+    }
+}
+
+TEST_CASE("hash list memory per page and flash reads per lookup", "[nvs][hashlist][bench]")
+{
+    std::cout << "entries  block list bytes  table bytes" << std::endl;
+    const size_t counts[] = { 1, 16, 32, 64, 96, 126 };
+    for (size_t count : counts) {
+        HashList list;
+        for (size_t i = 0; i < count; ++i) {
+            char key[16];
+            snprintf(key, sizeof(key), "k%d", (int) i);
+            REQUIRE(list.insert(Item(1, ItemType::U32, 1, key), i) == ESP_OK);
+        }
+        char line[80];
+        snprintf(line, sizeof(line), "%7zu  %16zu  %11zu", count, block_list_size(count), list.getMemorySize());
+        std::cout << line << std::endl;
+    }
+
+    std::string first;
+    std::string second;
+    find_colliding_keys(first, second);
+
+    // the colliding key is written first, the one looked up last
+    PartitionEmulationFixture f(0, 1);
+    Page page;
+    REQUIRE(page.load(&f.part, 0) == ESP_OK);
+    REQUIRE(page.writeItem<uint32_t>(1, first.c_str(), 1) == ESP_OK);
+    for (int i = 0; i < 120; ++i) {
+        char key[16];
+        snprintf(key, sizeof(key), "f%d", i);
+        REQUIRE(page.writeItem<uint32_t>(1, key, i) == ESP_OK);
+    }
+    REQUIRE(page.writeItem<uint32_t>(1, second.c_str(), 2) == ESP_OK);
+
+    f.emu.clearStats();
+    size_t itemIndex = 0;
+    Item item;
+    CHECK(page.findItem(1, ItemType::U32, second.c_str(), itemIndex, item) == ESP_OK);
+    CHECK(itemIndex == 121);
+    size_t reads = f.emu.getReadOps();
+    CHECK(reads == 1);
+
+    // with 24-bit hashes the search started at the first key and read every entry up to the second
+    std::cout << "lookup behind a 24-bit collision: " << itemIndex + 1 << " flash reads before, " << reads << " now" << std::endl;
+}
@@ -0,0 +1,272 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "catch.hpp"
+#include "nvs_pagemanager.hpp"
+#include "nvs_storage.hpp"
+#include "spi_flash_emulation.h"
+#include "test_fixtures.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using namespace nvs;
+
+// the summary takes the reserved bytes of the page header between version and crc
+static const uint32_t SUMMARY_OFFSET = 9;
+static const uint32_t SUMMARY_SIZE = 19;
+static const uint32_t ENTRY_TABLE_OFFSET = 32;
+static const uint32_t ENTRY_DATA_OFFSET = 64;
+
+static uint32_t header_state(const SpiFlashEmulator& emu, uint32_t sector)
+{
+    return emu.words()[sector * SPI_FLASH_SEC_SIZE / 4];
+}
+
+static bool is_full(const SpiFlashEmulator& emu, uint32_t sector)
+{
+    return header_state(emu, sector) == static_cast<uint32_t>(Page::PageState::FULL);
+}
+
+/* Full pages with something written into the summary bytes of their header. */
+static size_t summarized_pages(const SpiFlashEmulator& emu, uint32_t sectors)
+{
+    size_t count = 0;
+    for (uint32_t sector = 0; sector < sectors; ++sector) {
+        const uint8_t* summary = emu.bytes() + sector * SPI_FLASH_SEC_SIZE + SUMMARY_OFFSET;
+        if (is_full(emu, sector) && std::any_of(summary, summary + SUMMARY_SIZE, [](uint8_t b) {
+                return b != 0xff;
+            })) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+/* Clear the last word of every summary, its crc doesn't match any more. */
+static void invalidate_summaries(SpiFlashEmulator& emu, uint32_t sectors)
+{
+    const uint32_t zero = 0;
+    for (uint32_t sector = 0; sector < sectors; ++sector) {
+        if (is_full(emu, sector)) {
+            REQUIRE(emu.write(sector * SPI_FLASH_SEC_SIZE + SUMMARY_OFFSET + SUMMARY_SIZE - sizeof(zero), &zero, sizeof(zero)));
+        }
+    }
+}
+
+static void key_name(char *key, size_t size, int i)
+{
+    snprintf(key, size, "k%05d", i);
+}
+
+static void check_items(Storage& storage, uint8_t ns, int count, const std::vector<uint8_t>& blob)
+{
+    char key[16];
+    for (int i = 0; i < count; ++i) {
+        key_name(key, sizeof(key), i);
+        int value = -1;
+        if (i % 50 == 7) {
+            CHECK(storage.readItem(ns, key, value) == ESP_ERR_NVS_NOT_FOUND);
+        } else {
+            CHECK(storage.readItem(ns, key, value) == ESP_OK);
+            CHECK(value == ((i % 50 == 9) ? -i : i));
+        }
+    }
+    std::vector<uint8_t> read(blob.size());
+    CHECK(storage.readItem(ns, ItemType::BLOB, "blob", read.data(), read.size()) == ESP_OK);
+    CHECK(read == blob);
+}
+
+TEST_CASE("full pages are loaded from their summary", "[nvs][page_summary]")
+{
+    const uint32_t SECTORS = 8;
+    const int COUNT = 400;
+    PartitionEmulationFixture f(0, SECTORS);
+    std::vector<uint8_t> blob(5000);
+    for (size_t i = 0; i < blob.size(); ++i) {
+        blob[i] = static_cast<uint8_t>(i * 13);
+    }
+
+    uint8_t ns;
+    {
+        Storage storage(&f.part);
+        REQUIRE(storage.init(0, SECTORS) == ESP_OK);
+        REQUIRE(storage.createOrOpenNamespace("summary", true, ns) == ESP_OK);
+        char key[16];
+        for (int i = 0; i < COUNT; ++i) {
+            key_name(key, sizeof(key), i);
+            REQUIRE(storage.writeItem(ns, key, i) == ESP_OK);
+        }
+        REQUIRE(storage.writeItem(ns, ItemType::BLOB, "blob", blob.data(), blob.size()) == ESP_OK);
+
+        // erasing and overwriting items of full pages changes their entry table only
+        for (int i = 0; i < COUNT; ++i) {
+            key_name(key, sizeof(key), i);
+            if (i % 50 == 7) {
+                REQUIRE(storage.eraseItem(ns, key) == ESP_OK);
+            } else if (i % 50 == 9) {
+                REQUIRE(storage.writeItem(ns, key, -i) == ESP_OK);
+            }
+        }
+    }
+    CHECK(summarized_pages(f.emu, SECTORS) >= 3);
+
+    // Storage::init runs the debug check on the host, which compares the loaded used entry
+    // counts with the items it finds
+    f.emu.clearStats();
+    {
+        Storage storage(&f.part);
+        REQUIRE(storage.init(0, SECTORS) == ESP_OK);
+        check_items(storage, ns, COUNT, blob);
+    }
+
+    PageManager summarized;
+    f.emu.clearStats();
+    REQUIRE(summarized.load(&f.part, 0, SECTORS) == ESP_OK);
+    const size_t summaryReads = f.emu.getReadOps();
+
+    invalidate_summaries(f.emu, SECTORS);
+    CHECK(summarized_pages(f.emu, SECTORS) >= 3);
+    PageManager scanned;
+    f.emu.clearStats();
+    REQUIRE(scanned.load(&f.part, 0, SECTORS) == ESP_OK);
+    const size_t scanReads = f.emu.getReadOps();
+    // the scan reads a few entries at a time, the summary all item headers of a page at once
+    CHECK(summaryReads * 2 < scanReads);
+
+    Storage storage(&f.part);
+    REQUIRE(storage.init(0, SECTORS) == ESP_OK);
+    check_items(storage, ns, COUNT, blob);
+}
+
+TEST_CASE("a full page whose entries don't match its summary is scanned", "[nvs][page_summary]")
+{
+    const uint32_t SECTORS = 5;
+    PartitionEmulationFixture f(0, SECTORS);
+    uint8_t ns;
+    char key[16];
+    {
+        Storage storage(&f.part);
+        REQUIRE(storage.init(0, SECTORS) == ESP_OK);
+        REQUIRE(storage.createOrOpenNamespace("summary", true, ns) == ESP_OK);
+        const char str[] = "a string which takes a few entries of the page to be stored";
+        REQUIRE(storage.writeItem(ns, ItemType::SZ, "str", str, sizeof(str)) == ESP_OK);
+        for (int i = 0; i < 250; ++i) {
+            key_name(key, sizeof(key), i);
+            REQUIRE(storage.writeItem(ns, key, i) == ESP_OK);
+        }
+    }
+    REQUIRE(summarized_pages(f.emu, SECTORS) >= 1);
+
+    // power went off after the first entry of the string was erased, the data entries are still written
+    bool found = false;
+    for (uint32_t sector = 0; sector < SECTORS && !found; ++sector) {
+        if (!is_full(f.emu, sector)) {
+            continue;
+        }
+        for (uint32_t entry = 0; entry < Page::ENTRY_COUNT && !found; ++entry) {
+            const uint8_t* item = f.emu.bytes() + sector * SPI_FLASH_SEC_SIZE + ENTRY_DATA_OFFSET + entry * Page::ENTRY_SIZE;
+            if (item[1] != static_cast<uint8_t>(ItemType::SZ) || strcmp(reinterpret_cast<const char*>(item + 8), "str") != 0) {
+                continue;
+            }
+            const uint32_t address = sector * SPI_FLASH_SEC_SIZE + ENTRY_TABLE_OFFSET + entry / 16 * 4;
+            const uint32_t state = f.emu.words()[address / 4] & ~(3u << (entry % 16 * 2));
+            REQUIRE(f.emu.write(address, &state, sizeof(state)));
+            found = true;
+        }
+    }
+    REQUIRE(found);
+
+    Storage storage(&f.part);
+    REQUIRE(storage.init(0, SECTORS) == ESP_OK);
+    size_t size = 0;
+    CHECK(storage.getItemDataSize(ns, ItemType::SZ, "str", size) == ESP_ERR_NVS_NOT_FOUND);
+    for (int i = 0; i < 250; ++i) {
+        key_name(key, sizeof(key), i);
+        int value = -1;
+        CHECK(storage.readItem(ns, key, value) == ESP_OK);
+        CHECK(value == i);
+    }
+    CHECK(storage.writeItem(ns, ItemType::SZ, "str", "new", 4) == ESP_OK);
+}
+
+/* Storage::writeItem without the lookup of the previous value and the debug check. */
+class FillStorage : public Storage
+{
+public:
+    FillStorage(Partition *partition) : Storage(partition) { }
+
+    esp_err_t append(uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize)
+    {
+        esp_err_t err = getCurrentPage().writeItem(nsIndex, datatype, key, data, dataSize);
+        if (err == ESP_ERR_NVS_PAGE_FULL) {
+            if (getCurrentPage().state() != Page::PageState::FULL) {
+                err = getCurrentPage().markFull();
+                if (err != ESP_OK) {
+                    return err;
+                }
+            }
+            err = mPageManager.requestNewPage();
+            if (err != ESP_OK) {
+                return err;
+            }
+            err = getCurrentPage().writeItem(nsIndex, datatype, key, data, dataSize);
+        }
+        return err;
+    }
+};
+
+TEST_CASE("loading pages with and without summaries", "[nvs][page_summary][bench]")
+{
+    // 12 KB to 1 MB, a partition needs a free page next to the written ones
+    const uint32_t sizes[] = { 3, 8, 32, 128, 256 };
+    const char str[] = "calibration of channel";
+    char key[16];
+
+    std::cout << "sectors  items   summary: reads  read KB  flash us  host us   scan: reads  read KB  flash us  host us" << std::endl;
+    for (uint32_t sectors : sizes) {
+        PartitionEmulationFixture f(0, sectors);
+        int items = 0;
+        {
+            FillStorage storage(&f.part);
+            REQUIRE(storage.init(0, sectors) == ESP_OK);
+            // mostly integers, every eighth item a string of two entries, one page stays free
+            const int capacity = (sectors - 1) * 100;
+            for (; items < capacity; ++items) {
+                key_name(key, sizeof(key), items);
+                esp_err_t err = (items % 8 == 0)
+                                ? storage.append(1, ItemType::SZ, key, str, sizeof(str))
+                                : storage.append(1, ItemType::I32, key, &items, sizeof(items));
+                REQUIRE(err == ESP_OK);
+            }
+        }
+
+        size_t reads[2], readBytes[2], flashTime[2];
+        long long hostTime[2];
+        for (int pass = 0; pass < 2; ++pass) {
+            if (pass == 1) {
+                invalidate_summaries(f.emu, sectors);
+            }
+            PageManager pageManager;
+            f.emu.clearStats();
+            auto start = std::chrono::steady_clock::now();
+            REQUIRE(pageManager.load(&f.part, 0, sectors) == ESP_OK);
+            hostTime[pass] = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+            reads[pass] = f.emu.getReadOps();
+            readBytes[pass] = f.emu.getReadBytes();
+            flashTime[pass] = f.emu.getTotalTime();
+        }
+        CHECK(reads[0] <= reads[1]);
+
+        char line[160];
+        snprintf(line, sizeof(line), "%7u  %5d  %14zu  %7zu  %8zu  %7lld  %11zu  %7zu  %8zu  %7lld",
+                 (unsigned) sectors, items, reads[0], readBytes[0] / 1024, flashTime[0], hostTime[0],
+                 reads[1], readBytes[1] / 1024, flashTime[1], hostTime[1]);
+        std::cout << line << std::endl;
+    }
+}
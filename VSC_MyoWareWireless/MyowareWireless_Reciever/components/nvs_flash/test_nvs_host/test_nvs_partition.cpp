@@ -40,3 +40,47 @@ TEST_CASE("encrypted partition write size must be mod item size", "[nvs]")
     CHECK(fix.part.write(0, foo, sizeof (foo) / 2) == ESP_OK);
     CHECK(fix.part.write(sizeof(foo) / 2, foo, sizeof (foo)) == ESP_OK);
 }
+
+TEST_CASE("encrypted partition reads and writes runs of entries", "[nvs]")
+{
+    const size_t ENTRIES = 12;
+    nvs_sec_cfg_t xts_cfg;
+    for (int count = 0; count < NVS_KEY_SIZE; count++) {
+        xts_cfg.eky[count] = 0x11;
+        xts_cfg.tky[count] = 0x22;
+    }
+    EncryptedPartitionFixture fix(&xts_cfg);
+    fix.emu.erase(0);
+
+    uint8_t data[ENTRIES * 32];
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        data[i] = static_cast<uint8_t>(i * 7 + 1);
+    }
+
+    // a run is encrypted entry by entry, as if every entry was written on its own
+    for (size_t i = 0; i < ENTRIES; ++i) {
+        REQUIRE(fix.part.write(64 + i * 32, data + i * 32, 32) == ESP_OK);
+    }
+    uint8_t single[sizeof(data)];
+    memcpy(single, fix.emu.bytes() + 64, sizeof(single));
+    CHECK(memcmp(single, data, 32) != 0);
+    fix.emu.erase(0);
+    REQUIRE(fix.part.write(64, data, sizeof(data)) == ESP_OK);
+    CHECK(memcmp(fix.emu.bytes() + 64, single, sizeof(single)) == 0);
+
+    uint8_t read[sizeof(data)];
+    fix.emu.clearStats();
+    REQUIRE(fix.part.read(64, read, sizeof(read)) == ESP_OK);
+    CHECK(fix.emu.getReadOps() == 1);
+    CHECK(memcmp(read, data, sizeof(data)) == 0);
+    REQUIRE(fix.part.read(64 + 5 * 32, read, 32) == ESP_OK);
+    CHECK(memcmp(read, data + 5 * 32, 32) == 0);
+
+    // in place, the buffer holds the encrypted data afterwards
+    uint8_t buffer[sizeof(data)];
+    memcpy(buffer, data, sizeof(data));
+    REQUIRE(fix.part.write_in_place(64 + sizeof(data), buffer, sizeof(buffer)) == ESP_OK);
+    CHECK(memcmp(buffer, fix.emu.bytes() + 64 + sizeof(data), sizeof(buffer)) == 0);
+    REQUIRE(fix.part.read(64 + sizeof(data), read, sizeof(read)) == ESP_OK);
+    CHECK(memcmp(read, data, sizeof(data)) == 0);
+}
@@ -0,0 +1,183 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "catch.hpp"
+#include "nvs_storage.hpp"
+#include "spi_flash_emulation.h"
+#include "test_fixtures.hpp"
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+using namespace nvs;
+
+/* Gives the tests access to the page list, so every lookup can be checked against
+ * a search over all pages, which is what Storage::findItem did before the item index. */
+class IndexedStorage : public Storage
+{
+public:
+    IndexedStorage(Partition *partition) : Storage(partition) { }
+
+    esp_err_t lookup(uint8_t nsIndex, ItemType datatype, const char* key, Page* &page)
+    {
+        Item item;
+        return findItem(nsIndex, datatype, key, page, item);
+    }
+
+    esp_err_t scanAllPages(uint8_t nsIndex, ItemType datatype, const char* key, Page* &page)
+    {
+        Item item;
+        for (auto it = std::begin(mPageManager); it != std::end(mPageManager); ++it) {
+            size_t itemIndex = 0;
+            if (it->findItem(nsIndex, datatype, key, itemIndex, item) == ESP_OK) {
+                page = it;
+                return ESP_OK;
+            }
+        }
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    /* Storage::writeItem without the lookup of the previous value and the debug check,
+     * which walks all items and makes filling a large partition quadratic. */
+    esp_err_t append(uint8_t nsIndex, const char* key, int value)
+    {
+        esp_err_t err = getCurrentPage().writeItem(nsIndex, key, value);
+        if (err == ESP_ERR_NVS_PAGE_FULL) {
+            if (getCurrentPage().state() != Page::PageState::FULL) {
+                err = getCurrentPage().markFull();
+                if (err != ESP_OK) {
+                    return err;
+                }
+            }
+            err = mPageManager.requestNewPage();
+            if (err != ESP_OK) {
+                return err;
+            }
+            err = getCurrentPage().writeItem(nsIndex, key, value);
+        }
+        return err;
+    }
+
+    const ItemIndex& itemIndex()
+    {
+        return mPageManager.itemIndex();
+    }
+};
+
+static void key_name(char *key, size_t size, int i)
+{
+    snprintf(key, size, "k%05d", i);
+}
+
+TEST_CASE("item index finds the same page as a search over all pages", "[nvs][index]")
+{
+    PartitionEmulationFixture f(0, 5);
+    IndexedStorage storage(&f.part);
+    CHECK(storage.init(0, 5) == ESP_OK);
+
+    // overwriting moves the items around and makes the page manager free pages
+    char key[16];
+    for (int round = 0; round < 40; ++round) {
+        for (int i = 0; i < 40; ++i) {
+            key_name(key, sizeof(key), i);
+            CHECK(storage.writeItem(1, key, round * 100 + i) == ESP_OK);
+        }
+        key_name(key, sizeof(key), round % 40);
+        CHECK(storage.eraseItem(1, key) == ESP_OK);
+    }
+    CHECK(storage.itemIndex().isValid());
+
+    for (int i = 0; i < 50; ++i) {
+        key_name(key, sizeof(key), i);
+        Page *indexed = nullptr;
+        Page *scanned = nullptr;
+        esp_err_t err = storage.scanAllPages(1, ItemType::I32, key, scanned);
+        CHECK(storage.lookup(1, ItemType::I32, key, indexed) == err);
+        CHECK(indexed == scanned);
+        // the type is checked on the page, the index only knows namespace and key
+        CHECK(storage.lookup(1, ItemType::ANY, key, indexed) == err);
+        CHECK(storage.lookup(1, ItemType::U8, key, indexed) == ESP_ERR_NVS_NOT_FOUND);
+    }
+
+    // the index is rebuilt from flash on init
+    IndexedStorage reloaded(&f.part);
+    CHECK(reloaded.init(0, 5) == ESP_OK);
+    CHECK(reloaded.itemIndex().size() > 0);
+    for (int i = 0; i < 40; ++i) {
+        key_name(key, sizeof(key), i);
+        int value = 0;
+        CHECK(reloaded.readItem(1, key, value) == (i == 39 ? ESP_ERR_NVS_NOT_FOUND : ESP_OK));
+        if (i != 39) {
+            CHECK(value == 39 * 100 + i);
+        }
+    }
+}
+
+TEST_CASE("item index lookup cost doesn't grow with the partition size", "[nvs][index][bench]")
+{
+    const int ROUNDS = 1000;
+    char key[16];
+
+    std::cout << "pages  items  lookup      index: reads  flash us  host ns   scan: reads  flash us  host ns" << std::endl;
+    for (uint32_t pages = 16; pages <= 256; pages *= 2) {
+        PartitionEmulationFixture f(0, pages);
+        IndexedStorage storage(&f.part);
+        REQUIRE(storage.init(0, pages) == ESP_OK);
+
+        int items = 0;
+        for (;; ++items) {
+            key_name(key, sizeof(key), items);
+            if (storage.append(1, key, items) != ESP_OK) {
+                break;
+            }
+        }
+        REQUIRE(items > 0);
+
+        const struct {
+            const char *name;
+            int key;
+        } cases[] = {
+            { "first", 0 },
+            { "last", items - 1 },
+            { "missing", items },
+        };
+        for (auto& c : cases) {
+            key_name(key, sizeof(key), c.key);
+            Page *indexed = nullptr;
+            Page *scanned = nullptr;
+
+            f.emu.clearStats();
+            auto start = std::chrono::steady_clock::now();
+            esp_err_t err = ESP_OK;
+            for (int r = 0; r < ROUNDS; ++r) {
+                err = storage.lookup(1, ItemType::I32, key, indexed);
+            }
+            auto indexNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / ROUNDS;
+            size_t indexReads = f.emu.getReadOps() / ROUNDS;
+            size_t indexTime = f.emu.getTotalTime() / ROUNDS;
+
+            f.emu.clearStats();
+            start = std::chrono::steady_clock::now();
+            esp_err_t scanErr = ESP_OK;
+            for (int r = 0; r < ROUNDS; ++r) {
+                scanErr = storage.scanAllPages(1, ItemType::I32, key, scanned);
+            }
+            auto scanNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / ROUNDS;
+            size_t scanReads = f.emu.getReadOps() / ROUNDS;
+            size_t scanTime = f.emu.getTotalTime() / ROUNDS;
+
+            CHECK(err == scanErr);
+            CHECK(indexed == scanned);
+            CHECK(err == (c.key < items ? ESP_OK : ESP_ERR_NVS_NOT_FOUND));
+            CHECK(indexReads <= 2);
+
+            char line[160];
+            snprintf(line, sizeof(line), "%5u  %5d  %-8s  %12zu  %8zu  %7lld  %12zu  %8zu  %7lld",
+                     (unsigned) pages, items, c.name, indexReads, indexTime, (long long) indexNs,
+                     scanReads, scanTime, (long long) scanNs);
+            std::cout << line << std::endl;
+        }
+    }
+}
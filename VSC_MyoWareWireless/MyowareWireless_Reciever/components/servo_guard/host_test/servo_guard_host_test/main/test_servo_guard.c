@@ -0,0 +1,337 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "unity.h"
+#include "servo_guard.h"
+
+#define TICK_US         20000       /* Servo update period of the receiver */
+
+/* One sample of a current trace recorded at the servo update rate */
+typedef struct {
+    float command;
+    float current_ma;
+} trace_sample_t;
+
+/*
+ * Pinky closing from 0 to 180 and opening again without an object. The inrush while moving
+ * peaks at 650 mA for about 100 ms, then the servo idles at 80 mA.
+ */
+static const trace_sample_t s_free_close_open[] = {
+    {   0,  82 }, {   0,  79 }, { 180, 310 }, { 180, 590 }, { 180, 650 }, { 180, 640 }, { 180, 520 },
+    { 180, 390 }, { 180, 360 }, { 180, 340 }, { 180, 350 }, { 180, 330 }, { 180, 210 }, { 180, 110 },
+    { 180,  85 }, { 180,  81 }, { 180,  78 }, { 180,  80 }, { 180,  83 }, { 180,  79 }, {   0, 330 },
+    {   0, 610 }, {   0, 660 }, {   0, 600 }, {   0, 480 }, {   0, 370 }, {   0, 350 }, {   0, 345 },
+    {   0, 330 }, {   0, 200 }, {   0, 100 }, {   0,  82 }, {   0,  80 }, {   0,  79 }, {   0,  81 },
+};
+
+/* Servo held at 90 with a single 1.1 A spike of 80 ms, e.g. a knock against the finger */
+static const trace_sample_t s_spike[] = {
+    {  90,  80 }, {  90,  81 }, {  90,  79 }, {  90, 400 }, {  90, 1100 }, {  90, 1100 }, {  90, 1050 },
+    {  90, 600 }, {  90, 200 }, {  90,  90 }, {  90,  82 }, {  90,  80 }, {  90,  79 }, {  90,  80 },
+    {  90,  81 }, {  90,  80 }, {  90,  80 }, {  90,  79 }, {  90,  80 }, {  90,  82 },
+};
+
+/*
+ * Servo model for the closed loop tests: the horn moves at 600 deg/s between two mechanical
+ * stops. Pressing against a stop draws current proportional to the position error, like the
+ * P controller inside a hobby servo does.
+ */
+typedef struct {
+    float pos;
+    float min_stop;
+    float max_stop;
+    uint32_t noise;
+} servo_model_t;
+
+static float servo_model_step(servo_model_t *m, float target)
+{
+    const float speed = 600.0f * TICK_US / 1000000.0f;
+    float goal = target;
+    bool moving;
+
+    if (goal > m->max_stop) {
+        goal = m->max_stop;
+    } else if (goal < m->min_stop) {
+        goal = m->min_stop;
+    }
+    moving = goal != m->pos;
+    if (goal > m->pos + speed) {
+        m->pos += speed;
+    } else if (goal < m->pos - speed) {
+        m->pos -= speed;
+    } else {
+        m->pos = goal;
+    }
+
+    float error = 0.0f;
+    if (target > m->max_stop) {
+        error = target - m->max_stop;
+    } else if (target < m->min_stop) {
+        error = m->min_stop - target;
+    }
+    float press = error * 40.0f;
+    if (press > 1100.0f) {
+        press = 1100.0f;
+    }
+    // Deterministic +-30 mA noise
+    m->noise = m->noise * 1103515245u + 12345u;
+    float noise = (float)((m->noise >> 16) % 61) - 30.0f;
+    return 80.0f + (moving ? 300.0f : 0.0f) + press + noise;
+}
+
+typedef struct {
+    float mean_ma;          /**< Mean current over the run */
+    float final_ma;         /**< Current of the last sample */
+    float final_output;     /**< Last angle written */
+} run_result_t;
+
+/* Runs one channel in closed loop against the model, commands come from a callback of the tick */
+static void run_closed_loop(servo_guard_t *sg, servo_model_t *m, float (*command)(int tick), int ticks, bool guarded, run_result_t *r)
+{
+    float output = command(0);
+    float current = servo_model_step(m, output);
+    double sum = 0.0;
+
+    for (int i = 0; i < ticks; i++) {
+        float cmd = command(i);
+        output = guarded ? servo_guard_update(sg, 0, (int64_t)i * TICK_US, cmd, current) : cmd;
+        current = servo_model_step(m, output);
+        sum += current;
+    }
+    r->mean_ma = (float)(sum / ticks);
+    r->final_ma = current;
+    r->final_output = output;
+}
+
+static void init_default(servo_guard_t *sg)
+{
+    servo_guard_config_t cfg = SERVO_GUARD_DEFAULT_CONFIG();
+    TEST_ASSERT_EQUAL(ESP_OK, servo_guard_init(sg, &cfg));
+}
+
+static void replay(servo_guard_t *sg, const trace_sample_t *trace, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        float out = servo_guard_update(sg, 0, (int64_t)i * TICK_US, trace[i].command, trace[i].current_ma);
+        TEST_ASSERT_EQUAL_FLOAT(trace[i].command, out);
+    }
+}
+
+void test_init_rejects_invalid_config(void)
+{
+    servo_guard_t sg;
+    servo_guard_config_t cfg = SERVO_GUARD_DEFAULT_CONFIG();
+
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, servo_guard_init(NULL, &cfg));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, servo_guard_init(&sg, NULL));
+
+    cfg.channel_number = SERVO_GUARD_MAX_CHANNELS + 1;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, servo_guard_init(&sg, &cfg));
+
+    cfg = (servo_guard_config_t)SERVO_GUARD_DEFAULT_CONFIG();
+    cfg.hold_current_ma = cfg.stall_current_ma;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, servo_guard_init(&sg, &cfg));
+
+    cfg = (servo_guard_config_t)SERVO_GUARD_DEFAULT_CONFIG();
+    cfg.grip_current_ma = cfg.hold_current_ma;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, servo_guard_init(&sg, &cfg));
+
+    servo_guard_status_t status;
+    init_default(&sg);
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, servo_guard_get_status(&sg, SERVO_GUARD_MAX_CHANNELS, &status));
+    TEST_ASSERT_EQUAL_FLOAT(42.0f, servo_guard_update(&sg, SERVO_GUARD_MAX_CHANNELS, 0, 42.0f, 2000.0f));
+}
+
+void test_inrush_is_not_a_stall(void)
+{
+    servo_guard_t sg;
+    servo_guard_status_t status;
+    init_default(&sg);
+
+    replay(&sg, s_free_close_open, sizeof(s_free_close_open) / sizeof(s_free_close_open[0]));
+    TEST_ASSERT_EQUAL(ESP_OK, servo_guard_get_status(&sg, 0, &status));
+    TEST_ASSERT_EQUAL(SERVO_GUARD_FREE, status.state);
+    TEST_ASSERT_EQUAL(0, status.stalls);
+}
+
+void test_short_spike_is_ignored(void)
+{
+    servo_guard_t sg;
+    servo_guard_status_t status;
+    init_default(&sg);
+
+    replay(&sg, s_spike, sizeof(s_spike) / sizeof(s_spike[0]));
+    TEST_ASSERT_EQUAL(ESP_OK, servo_guard_get_status(&sg, 0, &status));
+    TEST_ASSERT_EQUAL(0, status.stalls);
+}
+
+static float cmd_grasp(int tick)
+{
+    return tick < 5 ? 0.0f : 180.0f;
+}
+
+void test_grasp_backs_off_to_holding_angle(void)
+{
+    servo_guard_t sg;
+    servo_guard_status_t status;
+    run_result_t guarded, plain;
+    init_default(&sg);
+
+    // Object stops the finger at 110 deg, the hand keeps commanding 180 for 10 s
+    servo_model_t m = { .pos = 0, .min_stop = 0, .max_stop = 110, .noise = 1 };
+    run_closed_loop(&sg, &m, cmd_grasp, 500, true, &guarded);
+    servo_model_t m2 = { .pos = 0, .min_stop = 0, .max_stop = 110, .noise = 1 };
+    run_closed_loop(&sg, &m2, cmd_grasp, 500, false, &plain);
+    printf("[grasp] guarded mean=%.0fmA final=%.0fmA angle=%.1f, unguarded mean=%.0fmA final=%.0fmA\n",
+           guarded.mean_ma, guarded.final_ma, guarded.final_output, plain.mean_ma, plain.final_ma);
+
+    TEST_ASSERT_EQUAL(ESP_OK, servo_guard_get_status(&sg, 0, &status));
+    TEST_ASSERT_EQUAL(SERVO_GUARD_HOLDING, status.state);
+    TEST_ASSERT_EQUAL(1, status.stalls);
+    TEST_ASSERT_EQUAL_FLOAT(180.0f, status.stall_angle);
+    // Still pressing on the object, but below the holding current
+    TEST_ASSERT_TRUE(guarded.final_output > 110.0f);
+    TEST_ASSERT_TRUE(guarded.final_ma < sg.cfg.hold_current_ma + 50.0f);
+    TEST_ASSERT_TRUE(guarded.final_ma > sg.cfg.grip_current_ma - 50.0f);
+    TEST_ASSERT_TRUE(guarded.mean_ma * 2 < plain.mean_ma);
+}
+
+static float cmd_grasp_release(int tick)
+{
+    return tick < 5 ? 0.0f : tick < 200 ? 180.0f : 0.0f;
+}
+
+void test_open_command_releases(void)
+{
+    servo_guard_t sg;
+    servo_guard_status_t status;
+    run_result_t r;
+    init_default(&sg);
+
+    servo_model_t m = { .pos = 0, .min_stop = 0, .max_stop = 110, .noise = 7 };
+    run_closed_loop(&sg, &m, cmd_grasp_release, 300, true, &r);
+
+    TEST_ASSERT_EQUAL(ESP_OK, servo_guard_get_status(&sg, 0, &status));
+    TEST_ASSERT_EQUAL(SERVO_GUARD_FREE, status.state);
+    TEST_ASSERT_EQUAL(1, status.stalls);
+    TEST_ASSERT_EQUAL(1, status.releases);
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, r.final_output);
+    TEST_ASSERT_EQUAL_FLOAT(0.0f, m.pos);
+}
+
+void test_object_removed_returns_to_command(void)
+{
+    servo_guard_t sg;
+    servo_guard_status_t status;
+    run_result_t r;
+    init_default(&sg);
+
+    servo_model_t m = { .pos = 0, .min_stop = 0, .max_stop = 110, .noise = 3 };
+    run_closed_loop(&sg, &m, cmd_grasp, 200, true, &r);
+    TEST_ASSERT_EQUAL(ESP_OK, servo_guard_get_status(&sg, 0, &status));
+    TEST_ASSERT_EQUAL(SERVO_GUARD_HOLDING, status.state);
+
+    // Object pulled out of the hand, the grip closes in step by step up to the command
+    m.max_stop = 180;
+    float out = r.final_output;
+    float current = servo_model_step(&m, out);
+    for (int i = 200; i < 600 && out < 180.0f; i++) {
+        out = servo_guard_update(&sg, 0, (int64_t)i * TICK_US, 180.0f, current);
+        current = servo_model_step(&m, out);
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, servo_guard_get_status(&sg, 0, &status));
+    TEST_ASSERT_EQUAL(SERVO_GUARD_FREE, status.state);
+    TEST_ASSERT_EQUAL_FLOAT(180.0f, out);
+}
+
+static float cmd_thumb_open(int tick)
+{
+    return tick < 50 ? 90.0f : 5.0f;
+}
+
+void test_thumb_stalling_while_opening(void)
+{
+    servo_guard_t sg;
+    servo_guard_status_t status;
+    run_result_t r;
+    init_default(&sg);
+
+    // The thumb cannot be pulled below 25 deg, opening to 5 deg strains it
+    servo_model_t m = { .pos = 90, .min_stop = 25, .max_stop = 180, .noise = 5 };
+    run_closed_loop(&sg, &m, cmd_thumb_open, 400, true, &r);
+
+    TEST_ASSERT_EQUAL(ESP_OK, servo_guard_get_status(&sg, 0, &status));
+    TEST_ASSERT_EQUAL(SERVO_GUARD_HOLDING, status.state);
+    TEST_ASSERT_EQUAL_FLOAT(5.0f, status.stall_angle);
+    // Backed off upwards, close to the stop
+    TEST_ASSERT_TRUE(r.final_output < 25.0f);
+    TEST_ASSERT_TRUE(r.final_output > 5.0f);
+    TEST_ASSERT_TRUE(r.final_ma < sg.cfg.hold_current_ma + 50.0f);
+}
+
+void test_backoff_is_limited(void)
+{
+    servo_guard_t sg;
+    servo_guard_status_t status;
+    servo_guard_config_t cfg = SERVO_GUARD_DEFAULT_CONFIG();
+    cfg.max_backoff_deg = 10.0f;
+    TEST_ASSERT_EQUAL(ESP_OK, servo_guard_init(&sg, &cfg));
+
+    // A current that never drops, e.g. a broken sense line, must not open the hand
+    float out = 0.0f;
+    for (int i = 0; i < 5; i++) {
+        out = servo_guard_update(&sg, 0, (int64_t)i * TICK_US, 0.0f, 80.0f);
+    }
+    for (int i = 5; i < 200; i++) {
+        out = servo_guard_update(&sg, 0, (int64_t)i * TICK_US, 180.0f, 1500.0f);
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, servo_guard_get_status(&sg, 0, &status));
+    TEST_ASSERT_EQUAL(SERVO_GUARD_HOLDING, status.state);
+    TEST_ASSERT_EQUAL_FLOAT(170.0f, out);
+}
+
+void test_reset_frees_all_channels(void)
+{
+    servo_guard_t sg;
+    servo_guard_status_t status;
+    init_default(&sg);
+
+    for (int i = 0; i < 5; i++) {
+        servo_guard_update(&sg, 1, (int64_t)i * TICK_US, 0.0f, 80.0f);
+    }
+    for (int i = 5; i < 50; i++) {
+        servo_guard_update(&sg, 1, (int64_t)i * TICK_US, 180.0f, 1500.0f);
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, servo_guard_get_status(&sg, 1, &status));
+    TEST_ASSERT_EQUAL(SERVO_GUARD_HOLDING, status.state);
+    TEST_ASSERT_EQUAL(ESP_OK, servo_guard_get_status(&sg, 0, &status));
+    TEST_ASSERT_EQUAL(SERVO_GUARD_FREE, status.state);
+
+    servo_guard_reset(&sg);
+    TEST_ASSERT_EQUAL(ESP_OK, servo_guard_get_status(&sg, 1, &status));
+    TEST_ASSERT_EQUAL(SERVO_GUARD_FREE, status.state);
+    TEST_ASSERT_EQUAL(1, status.stalls);
+    TEST_ASSERT_EQUAL_FLOAT(90.0f, servo_guard_update(&sg, 1, 50 * TICK_US, 90.0f, 1500.0f));
+}
+
+/* The Linux FreeRTOS port provides main and runs app_main in a task */
+void app_main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_init_rejects_invalid_config);
+    RUN_TEST(test_inrush_is_not_a_stall);
+    RUN_TEST(test_short_spike_is_ignored);
+    RUN_TEST(test_grasp_backs_off_to_holding_angle);
+    RUN_TEST(test_open_command_releases);
+    RUN_TEST(test_object_removed_returns_to_command);
+    RUN_TEST(test_thumb_stalling_while_opening);
+    RUN_TEST(test_backoff_is_limited);
+    RUN_TEST(test_reset_frees_all_channels);
+    exit(UNITY_END());
+}
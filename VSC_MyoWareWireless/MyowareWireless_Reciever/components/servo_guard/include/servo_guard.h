@@ -0,0 +1,152 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _SERVO_GUARD_H_
+#define _SERVO_GUARD_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define SERVO_GUARD_MAX_CHANNELS  5    /**< One channel per finger */
+
+/**
+ * @brief Configuration of the servo supervision, shared by all channels
+ *
+ */
+typedef struct {
+    uint8_t channel_number;      /**< Number of supervised servos */
+    float filter_alpha;          /**< Weight of a new current sample in the low pass (0..1] */
+    float stall_current_ma;      /**< Filtered current above this counts as stalled */
+    uint32_t stall_time_us;      /**< Stall has to last this long, shorter peaks are inrush */
+    float hold_current_ma;       /**< While holding, back off as long as the current is above this */
+    float grip_current_ma;       /**< While holding, close in again as long as the current is below this */
+    float step_deg;              /**< Angle changed per regulation step while holding */
+    uint32_t step_interval_us;   /**< Minimum time between regulation steps, lets the servo settle */
+    float max_backoff_deg;       /**< Holding never backs off further than this from the stall angle */
+} servo_guard_config_t;
+
+#define SERVO_GUARD_DEFAULT_CONFIG() {     \
+    .channel_number = SERVO_GUARD_MAX_CHANNELS, \
+    .filter_alpha = 0.3f,                  \
+    .stall_current_ma = 700.0f,            \
+    .stall_time_us = 200000,               \
+    .hold_current_ma = 400.0f,             \
+    .grip_current_ma = 200.0f,             \
+    .step_deg = 3.0f,                      \
+    .step_interval_us = 60000,             \
+    .max_backoff_deg = 90.0f,              \
+}
+
+/**
+ * @brief Supervision state of one servo
+ *
+ */
+typedef enum {
+    SERVO_GUARD_FREE = 0,        /**< Output follows the command */
+    SERVO_GUARD_HOLDING,         /**< Stall detected, output regulated to a holding angle */
+} servo_guard_state_t;
+
+/**
+ * @brief Counters and state of one servo
+ *
+ */
+typedef struct {
+    servo_guard_state_t state;
+    float current_ma;            /**< Filtered current */
+    float output;                /**< Angle last written to the servo */
+    float stall_angle;           /**< Output at the moment the stall was detected */
+    uint32_t stalls;             /**< Stalls detected */
+    uint32_t releases;           /**< Returns to SERVO_GUARD_FREE */
+} servo_guard_status_t;
+
+/**
+ * @brief Per servo state
+ *
+ */
+typedef struct {
+    servo_guard_state_t state;
+    bool started;
+    float current_ma;
+    float command;               /**< Last command */
+    int8_t move_dir;             /**< Direction of the last commanded move, +1 towards larger angles, 0 before the first move */
+    float output;
+    float stall_angle;
+    int64_t over_since_us;       /**< Start of the current over-threshold period, INT64_MIN if below */
+    int64_t last_step_us;
+    uint32_t stalls;
+    uint32_t releases;
+} servo_guard_channel_t;
+
+/**
+ * @brief Servo supervision, all storage is inline so it can live in static memory
+ *
+ */
+typedef struct {
+    servo_guard_config_t cfg;
+    servo_guard_channel_t ch[SERVO_GUARD_MAX_CHANNELS];
+} servo_guard_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Initialize the servo supervision
+ *
+ * @param sg Servo supervision to initialize
+ * @param config Pointer of servo guard configure struct
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_ARG Parameter error
+ */
+esp_err_t servo_guard_init(servo_guard_t *sg, const servo_guard_config_t *config);
+
+/**
+ * @brief Return all channels to SERVO_GUARD_FREE and clear the filters, keep the counters
+ *
+ * @param sg Servo supervision
+ */
+void servo_guard_reset(servo_guard_t *sg);
+
+/**
+ * @brief Feed one current sample and get the angle to write to the servo
+ *
+ * Meant to be called at a fixed rate for every channel. A stall is a filtered current above
+ * stall_current_ma for stall_time_us. The output then steps back against the direction of the
+ * last move until the current drops below hold_current_ma, and closes in again if it falls
+ * below grip_current_ma, so the grip is kept at a lower current. A command back against the
+ * direction of the move releases the servo.
+ *
+ * @param sg Servo supervision
+ * @param channel Servo index
+ * @param now_us Time of the sample
+ * @param command Angle requested for the servo
+ * @param current_ma Measured servo current
+ *
+ * @return Angle to write to the servo, the command itself for an invalid channel
+ */
+float servo_guard_update(servo_guard_t *sg, uint8_t channel, int64_t now_us, float command, float current_ma);
+
+/**
+ * @brief Read the state of one servo
+ *
+ * @param sg Servo supervision
+ * @param channel Servo index
+ * @param[out] status State and counters
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_ARG Parameter error
+ */
+esp_err_t servo_guard_get_status(const servo_guard_t *sg, uint8_t channel, servo_guard_status_t *status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SERVO_GUARD_H_ */
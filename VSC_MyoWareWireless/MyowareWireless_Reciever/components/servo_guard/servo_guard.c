@@ -0,0 +1,144 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+#include "servo_guard.h"
+
+static void channel_reset(servo_guard_channel_t *c)
+{
+    c->state = SERVO_GUARD_FREE;
+    c->started = false;
+    c->move_dir = 0;
+    c->over_since_us = INT64_MIN;
+}
+
+esp_err_t servo_guard_init(servo_guard_t *sg, const servo_guard_config_t *config)
+{
+    if (sg == NULL || config == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (config->channel_number == 0 || config->channel_number > SERVO_GUARD_MAX_CHANNELS
+            || config->filter_alpha <= 0.0f || config->filter_alpha > 1.0f
+            || config->grip_current_ma >= config->hold_current_ma
+            || config->hold_current_ma >= config->stall_current_ma
+            || config->step_deg <= 0.0f) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(sg, 0, sizeof(*sg));
+    sg->cfg = *config;
+    servo_guard_reset(sg);
+    return ESP_OK;
+}
+
+void servo_guard_reset(servo_guard_t *sg)
+{
+    for (int i = 0; i < SERVO_GUARD_MAX_CHANNELS; i++) {
+        channel_reset(&sg->ch[i]);
+    }
+}
+
+static void release(servo_guard_channel_t *c)
+{
+    c->state = SERVO_GUARD_FREE;
+    c->output = c->command;
+    c->over_since_us = INT64_MIN;
+    c->releases++;
+}
+
+static void hold_regulate(const servo_guard_config_t *cfg, servo_guard_channel_t *c, int64_t now_us)
+{
+    if (now_us - c->last_step_us < (int64_t)cfg->step_interval_us) {
+        return;
+    }
+
+    if (c->current_ma > cfg->hold_current_ma) {
+        // Still pressing too hard, back off but never let go of the object completely
+        float limit = c->stall_angle - c->move_dir * cfg->max_backoff_deg;
+        c->output -= c->move_dir * cfg->step_deg;
+        if ((c->output - limit) * c->move_dir < 0) {
+            c->output = limit;
+        }
+        c->last_step_us = now_us;
+    } else if (c->current_ma < cfg->grip_current_ma) {
+        // Grip got loose, close in again. Reaching the command means the obstacle is gone
+        c->output += c->move_dir * cfg->step_deg;
+        if ((c->output - c->command) * c->move_dir >= 0) {
+            release(c);
+            return;
+        }
+        c->last_step_us = now_us;
+    }
+}
+
+float servo_guard_update(servo_guard_t *sg, uint8_t channel, int64_t now_us, float command, float current_ma)
+{
+    if (sg == NULL || channel >= sg->cfg.channel_number) {
+        return command;
+    }
+
+    const servo_guard_config_t *cfg = &sg->cfg;
+    servo_guard_channel_t *c = &sg->ch[channel];
+
+    if (!c->started) {
+        c->started = true;
+        c->current_ma = current_ma;
+        c->command = command;
+        c->output = command;
+    } else {
+        c->current_ma += cfg->filter_alpha * (current_ma - c->current_ma);
+    }
+
+    if (c->state == SERVO_GUARD_HOLDING) {
+        c->command = command;
+        // A command back against the pressing direction is the user opening the hand
+        if ((command - c->output) * c->move_dir < 0) {
+            release(c);
+        } else {
+            hold_regulate(cfg, c, now_us);
+        }
+        return c->output;
+    }
+
+    if (command != c->output) {
+        c->move_dir = command > c->output ? 1 : -1;
+    }
+    c->command = command;
+    c->output = command;
+
+    if (c->current_ma <= cfg->stall_current_ma) {
+        c->over_since_us = INT64_MIN;
+    } else if (c->over_since_us == INT64_MIN) {
+        c->over_since_us = now_us;
+    } else if (now_us - c->over_since_us >= (int64_t)cfg->stall_time_us) {
+        c->stalls++;
+        c->over_since_us = INT64_MIN;
+        // Without a previous move there is no direction to back off to, only count the stall
+        if (c->move_dir != 0) {
+            c->state = SERVO_GUARD_HOLDING;
+            c->stall_angle = c->output;
+            c->last_step_us = now_us - cfg->step_interval_us;
+            hold_regulate(cfg, c, now_us);
+        }
+    }
+    return c->output;
+}
+
+esp_err_t servo_guard_get_status(const servo_guard_t *sg, uint8_t channel, servo_guard_status_t *status)
+{
+    if (sg == NULL || status == NULL || channel >= sg->cfg.channel_number) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const servo_guard_channel_t *c = &sg->ch[channel];
+    status->state = c->state;
+    status->current_ma = c->current_ma;
+    status->output = c->output;
+    status->stall_angle = c->stall_angle;
+    status->stalls = c->stalls;
+    status->releases = c->releases;
+    return ESP_OK;
+}
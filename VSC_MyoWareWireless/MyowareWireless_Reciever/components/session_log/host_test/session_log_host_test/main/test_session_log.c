@@ -0,0 +1,329 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "unity.h"
+#include "esp_partition.h"
+#include "esp_private/partition_linux.h"
+#include "session_log.h"
+
+/* Start of the emulated log partition, the same place as in the receiver partition table */
+#define LOG_PART_ADDRESS    0x110000
+#define LOG_MAX_SECTORS     224
+
+typedef struct {
+    uint32_t id;
+    uint8_t envelope;
+    uint8_t angles[5];
+    uint8_t pad[6];
+} test_record_t;
+
+static esp_partition_t s_part;
+static session_log_t s_log;
+
+static void setup_partition(uint32_t sectors)
+{
+    const uint8_t *p_part_desc_addr_start;
+    TEST_ASSERT_EQUAL(ESP_OK, esp_partition_file_mmap(&p_part_desc_addr_start));
+    TEST_ASSERT_TRUE(sectors <= LOG_MAX_SECTORS);
+
+    memset(&s_part, 0, sizeof(s_part));
+    s_part.address = LOG_PART_ADDRESS;
+    s_part.size = sectors * SESSION_LOG_SECTOR_SIZE;
+    s_part.erase_size = SESSION_LOG_SECTOR_SIZE;
+    s_part.type = ESP_PARTITION_TYPE_DATA;
+    s_part.subtype = SESSION_LOG_PARTITION_SUBTYPE;
+    strncpy(s_part.label, "sessionlog", sizeof(s_part.label) - 1);
+    // Start from flash that held something else
+    TEST_ASSERT_EQUAL(ESP_OK, esp_partition_erase_range(&s_part, 0, s_part.size));
+    uint8_t junk[64];
+    memset(junk, 0x5A, sizeof(junk));
+    TEST_ASSERT_EQUAL(ESP_OK, esp_partition_write(&s_part, 0, junk, sizeof(junk)));
+    esp_partition_clear_stats();
+}
+
+static void append_records(uint32_t first, uint32_t count)
+{
+    for (uint32_t i = first; i < first + count; i++) {
+        test_record_t rec = {
+            .id = i,
+            .envelope = i & 0xff,
+            .angles = { 0, 45, 90, 135, 180 },
+        };
+        TEST_ASSERT_EQUAL(ESP_OK, session_log_append(&s_log, 1, &rec, sizeof(rec)));
+    }
+}
+
+/* Reads the whole log, checks the records are consecutive and returns the first and last id */
+static uint32_t read_all(uint32_t *first, uint32_t *last)
+{
+    session_log_iter_t it;
+    test_record_t rec;
+    uint16_t len, type;
+    uint32_t count = 0;
+
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_iter_init(&s_log, &it));
+    while (session_log_iter_next(&it, &type, &rec, sizeof(rec), &len) == ESP_OK) {
+        TEST_ASSERT_EQUAL(sizeof(rec), len);
+        TEST_ASSERT_EQUAL(1, type);
+        if (count == 0) {
+            *first = rec.id;
+        } else {
+            TEST_ASSERT_EQUAL(*last + 1, rec.id);
+        }
+        TEST_ASSERT_EQUAL(rec.id & 0xff, rec.envelope);
+        *last = rec.id;
+        count++;
+    }
+    return count;
+}
+
+void test_mount_rejects_bad_partition(void)
+{
+    setup_partition(4);
+    esp_partition_t small = s_part;
+    small.size = SESSION_LOG_SECTOR_SIZE;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, session_log_mount(&s_log, &small));
+    small.size = 3 * SESSION_LOG_SECTOR_SIZE + 100;
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE, session_log_mount(&s_log, &small));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, session_log_mount(&s_log, NULL));
+
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_mount(&s_log, &s_part));
+    uint8_t big[SESSION_LOG_MAX_RECORD + 1] = { 0 };
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, session_log_append(&s_log, 1, big, sizeof(big)));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, session_log_append(&s_log, 0xFFFF, big, 4));
+}
+
+void test_records_survive_remount(void)
+{
+    uint32_t first = 0, last = 0;
+    setup_partition(8);
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_mount(&s_log, &s_part));
+    TEST_ASSERT_EQUAL(0, read_all(&first, &last));
+
+    append_records(0, 500);
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_flush(&s_log));
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_mount(&s_log, &s_part));
+    TEST_ASSERT_EQUAL(500, read_all(&first, &last));
+    TEST_ASSERT_EQUAL(0, first);
+    TEST_ASSERT_EQUAL(499, last);
+
+    // Appending after the remount continues behind the last record
+    append_records(500, 10);
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_flush(&s_log));
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_mount(&s_log, &s_part));
+    TEST_ASSERT_EQUAL(510, read_all(&first, &last));
+    TEST_ASSERT_EQUAL(509, last);
+}
+
+void test_writes_are_batched_into_pages(void)
+{
+    setup_partition(8);
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_mount(&s_log, &s_part));
+    esp_partition_clear_stats();
+
+    // 200 records of 24 bytes are 4800 bytes, two sectors
+    append_records(0, 200);
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_flush(&s_log));
+    size_t writes = esp_partition_get_write_ops();
+    printf("[batching] 200 records: %u program ops, %u bytes\n", (unsigned)writes, (unsigned)esp_partition_get_write_bytes());
+    TEST_ASSERT_TRUE(writes <= 4800 / SESSION_LOG_PAGE_SIZE + 4);
+
+    // A record is not programmed until its page is full or the log is flushed
+    esp_partition_clear_stats();
+    append_records(200, 1);
+    TEST_ASSERT_EQUAL(0, esp_partition_get_write_ops());
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_flush(&s_log));
+    TEST_ASSERT_EQUAL(1, esp_partition_get_write_ops());
+}
+
+void test_wrap_keeps_newest_and_levels_wear(void)
+{
+    uint32_t first = 0, last = 0;
+    const uint32_t sectors = 6;
+    setup_partition(sectors);
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_mount(&s_log, &s_part));
+
+    // About 170 records per sector, fill the ring ten times
+    const uint32_t total = 170 * sectors * 10;
+    append_records(0, total);
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_flush(&s_log));
+
+    uint32_t count = read_all(&first, &last);
+    TEST_ASSERT_EQUAL(total - 1, last);
+    TEST_ASSERT_TRUE(count > 170 * (sectors - 1));
+    TEST_ASSERT_EQUAL(total - count, first);
+
+    // The ring uses every sector in turn, erase counts differ by one at most
+    size_t min = SIZE_MAX, max = 0;
+    for (uint32_t i = 0; i < sectors; i++) {
+        size_t erases = esp_partition_get_sector_erase_count(LOG_PART_ADDRESS / SESSION_LOG_SECTOR_SIZE + i);
+        min = erases < min ? erases : min;
+        max = erases > max ? erases : max;
+    }
+    printf("[wear] %u sectors, erases per sector %u..%u\n", (unsigned)sectors, (unsigned)min, (unsigned)max);
+    TEST_ASSERT_TRUE(max - min <= 1);
+
+    // The same records are found after a remount
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_mount(&s_log, &s_part));
+    uint32_t first2 = 0, last2 = 0;
+    TEST_ASSERT_EQUAL(count, read_all(&first2, &last2));
+    TEST_ASSERT_EQUAL(first, first2);
+    TEST_ASSERT_EQUAL(last, last2);
+}
+
+void test_mount_uses_binary_search(void)
+{
+    session_log_stats_t stats;
+    uint32_t first = 0, last = 0;
+    const uint32_t sectors = 128;
+    setup_partition(sectors);
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_mount(&s_log, &s_part));
+
+    // Head somewhere in the middle before the wrap, then after it
+    const uint32_t runs[] = { 170 * 77 + 20, 170 * 100 };
+    uint32_t id = 0;
+    for (int r = 0; r < 2; r++) {
+        append_records(id, runs[r]);
+        id += runs[r];
+        TEST_ASSERT_EQUAL(ESP_OK, session_log_flush(&s_log));
+        uint32_t seq = s_log.head_seq;
+
+        TEST_ASSERT_EQUAL(ESP_OK, session_log_mount(&s_log, &s_part));
+        session_log_get_stats(&s_log, &stats);
+        TEST_ASSERT_EQUAL(seq, stats.head_seq);
+        // log2(128) header probes, two to find the tail, then the records of one sector
+        printf("[mount] %u sectors, head seq %u: %u reads\n", (unsigned)sectors, (unsigned)seq, (unsigned)stats.mount_reads);
+        TEST_ASSERT_TRUE(stats.mount_reads < 10 + 2 * 171);
+        TEST_ASSERT_EQUAL(id - 1, (read_all(&first, &last), last));
+    }
+}
+
+void test_torn_record_is_dropped(void)
+{
+    session_log_stats_t stats;
+    uint32_t first = 0, last = 0;
+    static uint8_t sector[SESSION_LOG_SECTOR_SIZE];
+    setup_partition(4);
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_mount(&s_log, &s_part));
+    append_records(0, 21);
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_flush(&s_log));
+
+    // Power lost while the last record was programmed: the end of its payload still reads 0xFF
+    uint32_t end = s_log.wpos;
+    TEST_ASSERT_EQUAL(ESP_OK, esp_partition_read(&s_part, 0, sector, sizeof(sector)));
+    memset(&sector[end - 4], 0xFF, 4);
+    TEST_ASSERT_EQUAL(ESP_OK, esp_partition_erase_range(&s_part, 0, sizeof(sector)));
+    TEST_ASSERT_EQUAL(ESP_OK, esp_partition_write(&s_part, 0, sector, sizeof(sector)));
+
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_mount(&s_log, &s_part));
+    TEST_ASSERT_EQUAL(20, read_all(&first, &last));
+    TEST_ASSERT_EQUAL(19, last);
+
+    // Nothing is written behind the torn record, the log continues in the next sector
+    append_records(20, 5);
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_flush(&s_log));
+    TEST_ASSERT_EQUAL(1, s_log.head);
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_mount(&s_log, &s_part));
+    TEST_ASSERT_EQUAL(25, read_all(&first, &last));
+    TEST_ASSERT_EQUAL(24, last);
+    session_log_get_stats(&s_log, &stats);
+    TEST_ASSERT_EQUAL(1, stats.corrupt);
+}
+
+void test_power_loss_after_sector_erase(void)
+{
+    uint32_t first = 0, last = 0;
+    uint32_t id = 0;
+    setup_partition(4);
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_mount(&s_log, &s_part));
+
+    // Wrap once and stop with the head on the last sector
+    while (s_log.head != 3 || s_log.head_seq < 7) {
+        append_records(id++, 1);
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_flush(&s_log));
+    uint32_t count = read_all(&first, &last);
+
+    // Sector 0 is the next one to be used, it got erased but not its header written
+    TEST_ASSERT_EQUAL(ESP_OK, esp_partition_erase_range(&s_part, 0, SESSION_LOG_SECTOR_SIZE));
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_mount(&s_log, &s_part));
+    TEST_ASSERT_EQUAL(3, s_log.head);
+    TEST_ASSERT_EQUAL(7, s_log.head_seq);
+    uint32_t count2 = read_all(&first, &last);
+    TEST_ASSERT_EQUAL(id - 1, last);
+    TEST_ASSERT_TRUE(count2 < count);
+
+    // Same in the middle of the ring
+    while (s_log.head != 1) {
+        append_records(id++, 1);
+    }
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_flush(&s_log));
+    TEST_ASSERT_EQUAL(ESP_OK, esp_partition_erase_range(&s_part, 2 * SESSION_LOG_SECTOR_SIZE, SESSION_LOG_SECTOR_SIZE));
+    TEST_ASSERT_EQUAL(ESP_OK, session_log_mount(&s_log, &s_part));
+    TEST_ASSERT_EQUAL(1, s_log.head);
+    TEST_ASSERT_EQUAL(3, s_log.tail);
+    read_all(&first, &last);
+    TEST_ASSERT_EQUAL(id - 1, last);
+}
+
+void test_benchmark_throughput_and_mount(void)
+{
+    const uint32_t sizes[] = { 16, 64, 224 };
+    uint32_t first = 0, last = 0;
+    session_log_stats_t stats;
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        uint32_t sectors = sizes[i];
+        setup_partition(sectors);
+        TEST_ASSERT_EQUAL(ESP_OK, session_log_mount(&s_log, &s_part));
+
+        // Fill the ring one and a half times
+        uint32_t records = 170 * sectors * 3 / 2;
+        esp_partition_clear_stats();
+        append_records(0, records);
+        TEST_ASSERT_EQUAL(ESP_OK, session_log_flush(&s_log));
+        size_t write_us = esp_partition_get_total_time();
+        size_t write_ops = esp_partition_get_write_ops();
+        uint64_t bytes = (uint64_t)records * (SESSION_LOG_RECORD_HEADER_SIZE + sizeof(test_record_t));
+
+        esp_partition_clear_stats();
+        TEST_ASSERT_EQUAL(ESP_OK, session_log_mount(&s_log, &s_part));
+        size_t mount_us = esp_partition_get_total_time();
+        session_log_get_stats(&s_log, &stats);
+
+        // Reading every record is what a mount without the sector sequence numbers would cost
+        esp_partition_clear_stats();
+        read_all(&first, &last);
+        size_t scan_us = esp_partition_get_total_time();
+        size_t scan_reads = esp_partition_get_read_ops();
+
+        printf("[bench] sectors=%u records=%u write_ops=%u write_us=%u throughput_kBps=%.1f "
+               "mount_reads=%u mount_us=%u scan_reads=%u scan_us=%u\n",
+               (unsigned)sectors, (unsigned)records, (unsigned)write_ops, (unsigned)write_us,
+               write_us ? bytes * 1000.0 / write_us : 0.0,
+               (unsigned)stats.mount_reads, (unsigned)mount_us, (unsigned)scan_reads, (unsigned)scan_us);
+        TEST_ASSERT_EQUAL(records - 1, last);
+        TEST_ASSERT_TRUE(mount_us < scan_us);
+    }
+}
+
+/* The Linux FreeRTOS port provides main and runs app_main in a task */
+void app_main(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_mount_rejects_bad_partition);
+    RUN_TEST(test_records_survive_remount);
+    RUN_TEST(test_writes_are_batched_into_pages);
+    RUN_TEST(test_wrap_keeps_newest_and_levels_wear);
+    RUN_TEST(test_mount_uses_binary_search);
+    RUN_TEST(test_torn_record_is_dropped);
+    RUN_TEST(test_power_loss_after_sector_erase);
+    RUN_TEST(test_benchmark_throughput_and_mount);
+    exit(UNITY_END());
+}
@@ -0,0 +1,168 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _SESSION_LOG_H_
+#define _SESSION_LOG_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+#define SESSION_LOG_PARTITION_SUBTYPE  0x40   /**< Data partition subtype of the log */
+#define SESSION_LOG_SECTOR_SIZE        4096   /**< Erase unit, the log is a ring of sectors */
+#define SESSION_LOG_PAGE_SIZE          256    /**< Program unit, records are batched into pages */
+#define SESSION_LOG_SECTOR_HEADER_SIZE 16
+#define SESSION_LOG_RECORD_HEADER_SIZE 8
+#define SESSION_LOG_MAX_RECORD         1024   /**< Largest payload of a single record */
+
+/**
+ * @brief Log counters
+ *
+ */
+typedef struct {
+    uint32_t records;        /**< Records appended since mount */
+    uint32_t page_writes;    /**< Flash program operations */
+    uint32_t erases;         /**< Sectors erased since mount */
+    uint32_t mount_reads;    /**< Flash reads needed by the last mount */
+    uint32_t corrupt;        /**< Records skipped because of a bad CRC or length */
+    uint32_t head_seq;       /**< Sequence number of the sector written to, one more per sector used */
+} session_log_stats_t;
+
+/**
+ * @brief Session log state, all storage is inline so it can live in static memory
+ *
+ */
+typedef struct {
+    const esp_partition_t *part;
+    uint32_t sector_count;
+    uint32_t head;                 /**< Sector written to */
+    uint32_t head_seq;
+    uint32_t tail;                 /**< Oldest sector */
+    uint32_t wpos;                 /**< Partition offset of the next record */
+    uint32_t flushed;              /**< Partition offset up to which the page buffer is programmed */
+    uint32_t page_base;            /**< Partition offset of page[0] */
+    bool sealed;                   /**< Head sector holds a torn record, the next append starts a new sector */
+    uint8_t page[SESSION_LOG_PAGE_SIZE];
+    session_log_stats_t stats;
+} session_log_t;
+
+/**
+ * @brief Position of a reader in the log
+ *
+ */
+typedef struct {
+    session_log_t *log;
+    uint32_t sector;
+    uint32_t offset;               /**< Offset in the sector */
+    uint32_t sectors_left;         /**< Sectors after this one, including the head */
+} session_log_iter_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Mount the log, recovering the write head or formatting an empty partition
+ *
+ * The head sector is found by a binary search over the sector headers, only the
+ * records of that one sector are read.
+ *
+ * @param log Log to mount
+ * @param part Data partition, a multiple of SESSION_LOG_SECTOR_SIZE and at least two sectors
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_ARG Parameter error
+ *     - ESP_ERR_INVALID_SIZE Partition too small or not sector aligned
+ *     - Others Flash access failed
+ */
+esp_err_t session_log_mount(session_log_t *log, const esp_partition_t *part);
+
+/**
+ * @brief Erase the whole partition and start an empty log
+ *
+ * @param log Mounted log
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - Others Flash access failed
+ */
+esp_err_t session_log_format(session_log_t *log);
+
+/**
+ * @brief Append one record
+ *
+ * The record is copied into the page buffer, flash is only programmed for complete pages.
+ * When the head sector is full the oldest sector is erased and reused.
+ *
+ * @note This API is not thread-safe, the caller has to serialize access to the log
+ *
+ * @param log Mounted log
+ * @param type Application defined record type, 0xFFFF is reserved
+ * @param data Payload
+ * @param len Payload length, at most SESSION_LOG_MAX_RECORD
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_INVALID_ARG Parameter error
+ *     - Others Flash access failed
+ */
+esp_err_t session_log_append(session_log_t *log, uint16_t type, const void *data, uint16_t len);
+
+/**
+ * @brief Program the partially filled page, records appended before are then persistent
+ *
+ * @param log Mounted log
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - Others Flash access failed
+ */
+esp_err_t session_log_flush(session_log_t *log);
+
+/**
+ * @brief Start reading at the oldest record, flushes the page buffer first
+ *
+ * @param log Mounted log
+ * @param[out] it Reader
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - Others Flash access failed
+ */
+esp_err_t session_log_iter_init(session_log_t *log, session_log_iter_t *it);
+
+/**
+ * @brief Read the next record, records with a bad CRC are skipped
+ *
+ * @param it Reader
+ * @param[out] type Record type, may be NULL
+ * @param[out] data Buffer for the payload
+ * @param size Size of data
+ * @param[out] len Payload length
+ *
+ * @return
+ *     - ESP_OK Success
+ *     - ESP_ERR_NOT_FOUND No more records
+ *     - ESP_ERR_INVALID_SIZE Payload larger than size, the record is skipped
+ *     - Others Flash access failed
+ */
+esp_err_t session_log_iter_next(session_log_iter_t *it, uint16_t *type, void *data, uint16_t size, uint16_t *len);
+
+/**
+ * @brief Read the log counters
+ *
+ * @param log Mounted log
+ * @param[out] stats Counters
+ */
+void session_log_get_stats(const session_log_t *log, session_log_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SESSION_LOG_H_ */
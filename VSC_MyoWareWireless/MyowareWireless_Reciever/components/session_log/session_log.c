@@ -0,0 +1,413 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Studienarbeit Hand contributors
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "esp_rom_crc.h"
+#include "session_log.h"
+
+/*
+ * The partition is a ring of sectors. Each sector starts with a header carrying a sequence
+ * number that grows by one per sector used, followed by 4 byte aligned records:
+ *
+ *   sector header: magic, seq, version, crc32 of the first 12 bytes
+ *   record:        len (u16), type (u16), crc32 of len, type and payload, payload
+ *
+ * Unwritten flash reads as 0xFF, so a record length of 0xFFFF ends a sector. Walking the
+ * sectors from 0, the sequence numbers grow by one up to the head sector and then drop or
+ * the sectors are erased, which lets the mount find the head with a binary search.
+ */
+
+#define SESSION_LOG_MAGIC    0x474f4c53   /* "SLOG" */
+#define SESSION_LOG_VERSION  1
+#define SESSION_LOG_LEN_FREE 0xFFFF
+
+#define ALIGN4(x) (((x) + 3) & ~3U)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t version;
+    uint32_t crc;
+} sector_header_t;
+
+typedef struct {
+    uint16_t len;
+    uint16_t type;
+    uint32_t crc;
+} record_header_t;
+
+_Static_assert(sizeof(sector_header_t) == SESSION_LOG_SECTOR_HEADER_SIZE, "sector header size");
+_Static_assert(sizeof(record_header_t) == SESSION_LOG_RECORD_HEADER_SIZE, "record header size");
+_Static_assert(SESSION_LOG_SECTOR_SIZE % SESSION_LOG_PAGE_SIZE == 0, "pages have to tile a sector");
+
+static uint32_t sector_base(uint32_t sector)
+{
+    return sector * SESSION_LOG_SECTOR_SIZE;
+}
+
+static uint32_t record_crc(const record_header_t *hdr, const void *data)
+{
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)hdr, offsetof(record_header_t, crc));
+    return esp_rom_crc32_le(crc, data, hdr->len);
+}
+
+/* CRC of a record still in flash, read in small chunks to keep the stack usage low */
+static esp_err_t flash_record_crc(session_log_t *log, uint32_t offset, const record_header_t *hdr, uint32_t *crc)
+{
+    uint8_t chunk[64];
+    uint32_t c = esp_rom_crc32_le(0, (const uint8_t *)hdr, offsetof(record_header_t, crc));
+    uint32_t done = 0;
+
+    while (done < hdr->len) {
+        uint32_t n = hdr->len - done < sizeof(chunk) ? hdr->len - done : sizeof(chunk);
+        esp_err_t err = esp_partition_read(log->part, offset + done, chunk, n);
+        if (err != ESP_OK) {
+            return err;
+        }
+        log->stats.mount_reads++;
+        c = esp_rom_crc32_le(c, chunk, n);
+        done += n;
+    }
+    *crc = c;
+    return ESP_OK;
+}
+
+/* Reads the header of a sector, returns false if it is erased or damaged */
+static bool read_sector_seq(session_log_t *log, uint32_t sector, uint32_t *seq)
+{
+    sector_header_t hdr;
+    log->stats.mount_reads++;
+    if (esp_partition_read(log->part, sector_base(sector), &hdr, sizeof(hdr)) != ESP_OK) {
+        return false;
+    }
+    if (hdr.magic != SESSION_LOG_MAGIC || hdr.version != SESSION_LOG_VERSION
+            || hdr.crc != esp_rom_crc32_le(0, (const uint8_t *)&hdr, offsetof(sector_header_t, crc))) {
+        return false;
+    }
+    *seq = hdr.seq;
+    return true;
+}
+
+static esp_err_t start_sector(session_log_t *log, uint32_t sector, uint32_t seq)
+{
+    sector_header_t hdr = {
+        .magic = SESSION_LOG_MAGIC,
+        .seq = seq,
+        .version = SESSION_LOG_VERSION,
+    };
+    hdr.crc = esp_rom_crc32_le(0, (const uint8_t *)&hdr, offsetof(sector_header_t, crc));
+
+    esp_err_t err = esp_partition_erase_range(log->part, sector_base(sector), SESSION_LOG_SECTOR_SIZE);
+    if (err != ESP_OK) {
+        return err;
+    }
+    log->stats.erases++;
+    err = esp_partition_write(log->part, sector_base(sector), &hdr, sizeof(hdr));
+    if (err != ESP_OK) {
+        return err;
+    }
+    log->stats.page_writes++;
+
+    log->head = sector;
+    log->head_seq = seq;
+    log->wpos = sector_base(sector) + SESSION_LOG_SECTOR_HEADER_SIZE;
+    log->flushed = log->wpos;
+    log->page_base = sector_base(sector);
+    log->sealed = false;
+    memset(log->page, 0xFF, sizeof(log->page));
+    return ESP_OK;
+}
+
+/* Reads the records of the head sector to find the write position */
+static esp_err_t recover_head(session_log_t *log)
+{
+    uint32_t base = sector_base(log->head);
+    uint32_t off = SESSION_LOG_SECTOR_HEADER_SIZE;
+
+    log->sealed = false;
+    while (off + SESSION_LOG_RECORD_HEADER_SIZE <= SESSION_LOG_SECTOR_SIZE) {
+        record_header_t hdr;
+        log->stats.mount_reads++;
+        esp_err_t err = esp_partition_read(log->part, base + off, &hdr, sizeof(hdr));
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (hdr.len == SESSION_LOG_LEN_FREE) {
+            break;
+        }
+        if (hdr.len > SESSION_LOG_MAX_RECORD || off + sizeof(hdr) + hdr.len > SESSION_LOG_SECTOR_SIZE) {
+            log->sealed = true;
+            break;
+        }
+        uint32_t crc;
+        err = flash_record_crc(log, base + off + sizeof(hdr), &hdr, &crc);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (crc != hdr.crc) {
+            // Power was lost while this record was programmed, never write behind it
+            log->sealed = true;
+            break;
+        }
+        off += ALIGN4(sizeof(hdr) + hdr.len);
+    }
+
+    log->wpos = base + off;
+    log->flushed = log->wpos;
+    log->page_base = log->wpos & ~(SESSION_LOG_PAGE_SIZE - 1);
+    memset(log->page, 0xFF, sizeof(log->page));
+    return ESP_OK;
+}
+
+esp_err_t session_log_mount(session_log_t *log, const esp_partition_t *part)
+{
+    if (log == NULL || part == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (part->size % SESSION_LOG_SECTOR_SIZE != 0 || part->size < 2 * SESSION_LOG_SECTOR_SIZE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    memset(log, 0, sizeof(*log));
+    log->part = part;
+    log->sector_count = part->size / SESSION_LOG_SECTOR_SIZE;
+
+    uint32_t n = log->sector_count;
+    uint32_t seq0, seq;
+    if (read_sector_seq(log, 0, &seq0)) {
+        // Last sector of the run seq0, seq0 + 1, ... starting at sector 0
+        uint32_t lo = 0, hi = n - 1;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo + 1) / 2;
+            if (read_sector_seq(log, mid, &seq) && seq == seq0 + mid) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        log->head = lo;
+        log->head_seq = seq0 + lo;
+        log->tail = 0;
+    } else {
+        // Sector 0 was being erased, or the partition is new: fall back to reading every header
+        bool found = false;
+        for (uint32_t i = 1; i < n; i++) {
+            if (read_sector_seq(log, i, &seq) && (!found || (int32_t)(seq - log->head_seq) > 0)) {
+                found = true;
+                log->head = i;
+                log->head_seq = seq;
+            }
+        }
+        if (!found) {
+            return session_log_format(log);
+        }
+        log->tail = log->head;
+    }
+
+    // Once wrapped, the oldest sector follows the head, or the one after if power was lost
+    // between erasing the next sector and writing its header
+    for (uint32_t i = 1; i <= 2; i++) {
+        uint32_t s = (log->head + i) % n;
+        if (s != log->head && read_sector_seq(log, s, &seq) && (int32_t)(log->head_seq - seq) > 0) {
+            log->tail = s;
+            break;
+        }
+    }
+
+    esp_err_t err = recover_head(log);
+    log->stats.head_seq = log->head_seq;
+    return err;
+}
+
+esp_err_t session_log_format(session_log_t *log)
+{
+    esp_err_t err = esp_partition_erase_range(log->part, 0, log->part->size);
+    if (err != ESP_OK) {
+        return err;
+    }
+    log->stats.erases += log->sector_count;
+    log->tail = 0;
+    err = start_sector(log, 0, 0);
+    log->stats.head_seq = log->head_seq;
+    return err;
+}
+
+static esp_err_t program(session_log_t *log, uint32_t end)
+{
+    if (end <= log->flushed) {
+        return ESP_OK;
+    }
+    esp_err_t err = esp_partition_write(log->part, log->flushed, &log->page[log->flushed - log->page_base],
+                                        end - log->flushed);
+    if (err == ESP_OK) {
+        log->stats.page_writes++;
+        log->flushed = end;
+    }
+    return err;
+}
+
+/* Copies bytes into the page buffer, programming every page that gets full */
+static esp_err_t emit(session_log_t *log, const uint8_t *data, uint32_t len)
+{
+    while (len > 0) {
+        uint32_t in_page = log->wpos - log->page_base;
+        uint32_t n = SESSION_LOG_PAGE_SIZE - in_page;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(&log->page[in_page], data, n);
+        log->wpos += n;
+        data += n;
+        len -= n;
+        if (log->wpos - log->page_base == SESSION_LOG_PAGE_SIZE) {
+            esp_err_t err = program(log, log->wpos);
+            if (err != ESP_OK) {
+                return err;
+            }
+            log->page_base = log->wpos;
+            memset(log->page, 0xFF, sizeof(log->page));
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t session_log_append(session_log_t *log, uint16_t type, const void *data, uint16_t len)
+{
+    if (log == NULL || (data == NULL && len > 0) || len > SESSION_LOG_MAX_RECORD || type == 0xFFFF) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint32_t size = ALIGN4(SESSION_LOG_RECORD_HEADER_SIZE + len);
+    if (log->sealed || log->wpos + size > sector_base(log->head) + SESSION_LOG_SECTOR_SIZE) {
+        esp_err_t err = program(log, log->wpos);
+        if (err != ESP_OK) {
+            return err;
+        }
+        uint32_t next = (log->head + 1) % log->sector_count;
+        if (next == log->tail) {
+            // The ring is full, the oldest sector is dropped
+            log->tail = (log->tail + 1) % log->sector_count;
+        }
+        err = start_sector(log, next, log->head_seq + 1);
+        if (err != ESP_OK) {
+            return err;
+        }
+        log->stats.head_seq = log->head_seq;
+    }
+
+    record_header_t hdr = {
+        .len = len,
+        .type = type,
+    };
+    hdr.crc = record_crc(&hdr, data);
+    static const uint8_t pad[3] = { 0xFF, 0xFF, 0xFF };
+
+    esp_err_t err = emit(log, (const uint8_t *)&hdr, sizeof(hdr));
+    if (err == ESP_OK) {
+        err = emit(log, data, len);
+    }
+    if (err == ESP_OK) {
+        err = emit(log, pad, size - sizeof(hdr) - len);
+    }
+    if (err == ESP_OK) {
+        log->stats.records++;
+    }
+    return err;
+}
+
+esp_err_t session_log_flush(session_log_t *log)
+{
+    if (log == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return program(log, log->wpos);
+}
+
+esp_err_t session_log_iter_init(session_log_t *log, session_log_iter_t *it)
+{
+    if (log == NULL || it == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = session_log_flush(log);
+    if (err != ESP_OK) {
+        return err;
+    }
+    it->log = log;
+    it->sector = log->tail;
+    it->offset = SESSION_LOG_SECTOR_HEADER_SIZE;
+    it->sectors_left = (log->head + log->sector_count - log->tail) % log->sector_count;
+    return ESP_OK;
+}
+
+static bool iter_next_sector(session_log_iter_t *it)
+{
+    if (it->sectors_left == 0) {
+        return false;
+    }
+    it->sector = (it->sector + 1) % it->log->sector_count;
+    it->offset = SESSION_LOG_SECTOR_HEADER_SIZE;
+    it->sectors_left--;
+    return true;
+}
+
+esp_err_t session_log_iter_next(session_log_iter_t *it, uint16_t *type, void *data, uint16_t size, uint16_t *len)
+{
+    if (it == NULL || data == NULL || len == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    session_log_t *log = it->log;
+    while (true) {
+        uint32_t base = sector_base(it->sector);
+        uint32_t end = it->sectors_left == 0 ? log->wpos - base : SESSION_LOG_SECTOR_SIZE;
+        if (it->offset + SESSION_LOG_RECORD_HEADER_SIZE > end) {
+            if (!iter_next_sector(it)) {
+                return ESP_ERR_NOT_FOUND;
+            }
+            continue;
+        }
+
+        record_header_t hdr;
+        esp_err_t err = esp_partition_read(log->part, base + it->offset, &hdr, sizeof(hdr));
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (hdr.len == SESSION_LOG_LEN_FREE) {
+            it->offset = end;
+            continue;
+        }
+        if (hdr.len > SESSION_LOG_MAX_RECORD || it->offset + sizeof(hdr) + hdr.len > end) {
+            // The length cannot be trusted, the rest of the sector is lost
+            log->stats.corrupt++;
+            it->offset = end;
+            continue;
+        }
+        uint32_t offset = base + it->offset + sizeof(hdr);
+        it->offset += ALIGN4(sizeof(hdr) + hdr.len);
+        if (hdr.len > size) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        err = esp_partition_read(log->part, offset, data, hdr.len);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (record_crc(&hdr, data) != hdr.crc) {
+            log->stats.corrupt++;
+            continue;
+        }
+        *len = hdr.len;
+        if (type) {
+            *type = hdr.type;
+        }
+        return ESP_OK;
+    }
+}
+
+void session_log_get_stats(const session_log_t *log, session_log_stats_t *stats)
+{
+    *stats = log->stats;
+}
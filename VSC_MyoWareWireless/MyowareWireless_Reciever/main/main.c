@@ -11,60 +11,282 @@
 #include "esp_log.h"
 #include "iot_servo.h"
 #include "esp_timer.h"
+#include "jitter_buffer.h"
+#include "servo_guard.h"
+#include "hand_config.h"
+#include "session_log.h"
+#include "driver/adc.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 
 // Bluetooth Defines:
 #define SPP_TAG "SPP_RECEIVER"
 #define DEVICE_NAME "SPP_RECEIVER"
 #define SERVER_NAME "SPP_SERVER"
 
-//LEDC Defines: TODO: use this to change channel in set angle and use the gpio in the channel init 
-#define LEDC_PINKY    (15)
-#define LEDC_RING     (2)
-#define LEDC_MIDDLE   (0)
-#define LEDC_POINTER  (5)
-#define LEDC_THUMB    (18)
-
-//GPIO Defines:
-#define GPIO_PINKY    15
-#define GPIO_RING     2
-#define GPIO_MIDDLE   0
-#define GPIO_POINTER  5
-#define GPIO_THUMB    18
-#define GPIO_OUTPUT_PIN_SEL  ((1ULL<<GPIO_PINKY) | (1ULL<<GPIO_RING) | (1ULL<<GPIO_MIDDLE) | (1ULL<<GPIO_POINTER) | (1ULL<<GPIO_THUMB))
-
-//Servo Defines:
-#define SERVO_PINKY   15
-#define SERVO_RING    2
-#define SERVO_MIDDLE  0
-#define SERVO_POINTER 5
-#define SERVO_THUMB   18
+//Current sense defines: one shunt amplifier per servo, the pins are in HAND_FINGER_TABLE
+#define SENSE_FULL_SCALE_MV 3100        // 12 dB attenuation
+#define SENSE_MV_PER_A      2000        // 100 mOhm shunt, amplifier gain 20
 
 //Threshold
 #define THRESHOLD_VAL 10
 
+// SPP frame layout, has to match the sender. All fields little endian:
+// [0..1] sequence number, [2..5] sender timestamp in ms, [6] envelope value
+#define SPP_FRAME_LEN 7
+
+// Servos are updated at a fixed rate from the jitter buffer, independent of the frame arrival
+#define SERVO_UPDATE_PERIOD_US 20000
+#define SERVO_NUM HAND_FINGER_NUM
+_Static_assert(SERVO_NUM <= JITTER_BUFFER_MAX_CHANNELS && SERVO_NUM <= SERVO_GUARD_MAX_CHANNELS,
+               "jitter buffer and servo guard need a channel per finger");
+
+static jitter_buffer_t s_jitter_buffer;
+static portMUX_TYPE s_jitter_buffer_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t s_legacy_seq = 0;
+static servo_guard_t s_servo_guard;
+static volatile uint8_t s_last_envelope = 0;
+
+static const float s_open_angles[SERVO_NUM] = HAND_OPEN_ANGLES;
+static const float s_closed_angles[SERVO_NUM] = HAND_CLOSED_ANGLES;
+// Pose of the last frame, repeated while the envelope sits right on the threshold
+static const float *s_last_angles = s_open_angles;
+
+// NVS pages freed by the BT stack's writes are erased in the background, one sector per step
+#define NVS_GC_STEP_DELAY_MS 10
+#define NVS_GC_IDLE_MS       1000
+
+// Session log: one record of envelope and servo state every SESSION_LOG_EVERY servo updates
+#define SESSION_LOG_EVERY          5
+#define SESSION_LOG_FLUSH_MS       2000
+#define SESSION_LOG_QUEUE_LEN      32
+#define SESSION_RECORD_SERVO_STATE 1
+
+typedef struct {
+    uint32_t time_ms;
+    uint8_t envelope;                 // Last value received from the sender
+    uint8_t playout;                  // jitter_buffer_playout_t
+    uint8_t holding_mask;             // Bit per finger held by the servo guard
+    uint8_t angles[SERVO_NUM];        // Angle written to the servo
+    uint16_t current_ma[SERVO_NUM];   // Filtered servo current
+} session_record_t;
+
+static session_log_t s_session_log;
+static QueueHandle_t s_session_queue = NULL;
+
+static float current_sense_read_ma(int servo)
+{
+    const hand_finger_desc_t *f = &hand_fingers[servo];
+    int raw = 0;
+
+    if (f->sense_unit == 1)
+    {
+        raw = adc1_get_raw((adc1_channel_t)f->sense_channel);
+    }
+    else if (adc2_get_raw((adc2_channel_t)f->sense_channel, ADC_WIDTH_BIT_12, &raw) != ESP_OK)
+    {
+        // ADC2 busy, report no load rather than a stall
+        return 0;
+    }
+    return (float)raw * SENSE_FULL_SCALE_MV / 4095 * 1000 / SENSE_MV_PER_A;
+}
+
 void handle_data(uint8_t* data, uint16_t len)
 {
-    int val = data[0];
-    if( val >THRESHOLD_VAL )
+    int64_t now = esp_timer_get_time();
+    jitter_frame_t frame;
+    int val;
+
+    if (len >= SPP_FRAME_LEN)
+    {
+        frame.seq = data[0] | (data[1] << 8);
+        frame.timestamp_us = (int64_t)(data[2] | (data[3] << 8) | (data[4] << 16) | ((uint32_t)data[5] << 24)) * 1000;
+        val = data[6];
+    }
+    else
     {
-        iot_servo_write_angle(LEDC_LOW_SPEED_MODE, 0, 180);
-        iot_servo_write_angle(LEDC_LOW_SPEED_MODE, 1, 180);
-        iot_servo_write_angle(LEDC_LOW_SPEED_MODE, 2, 180);
-        iot_servo_write_angle(LEDC_LOW_SPEED_MODE, 3, 180);
-        iot_servo_write_angle(LEDC_LOW_SPEED_MODE, 4, 180);
+        // Old sender without header, the arrival time is the best timestamp we have
+        frame.seq = s_legacy_seq++;
+        frame.timestamp_us = now;
+        val = data[0];
+    }
 
+    s_last_envelope = val;
+    if (val > THRESHOLD_VAL)
+    {
+        s_last_angles = s_closed_angles;
     }
     else if (val < THRESHOLD_VAL)
     {
-        iot_servo_write_angle(LEDC_LOW_SPEED_MODE, 0, 0);
-        iot_servo_write_angle(LEDC_LOW_SPEED_MODE, 1, 0);
-        iot_servo_write_angle(LEDC_LOW_SPEED_MODE, 2, 0);
-        iot_servo_write_angle(LEDC_LOW_SPEED_MODE, 3, 0);
-        iot_servo_write_angle(LEDC_LOW_SPEED_MODE, 4, 5);
+        s_last_angles = s_open_angles;
     }
+    memcpy(frame.values, s_last_angles, sizeof(s_open_angles));
+
+    portENTER_CRITICAL(&s_jitter_buffer_lock);
+    jitter_buffer_push(&s_jitter_buffer, &frame, now);
+    portEXIT_CRITICAL(&s_jitter_buffer_lock);
     ESP_LOGI(SPP_TAG, " %d", val);
 }
 
+// Periodic servo update, plays out the jitter buffer at a steady rate
+static void servo_update_cb(void *arg)
+{
+    static uint32_t s_updates = 0;
+    float angles[SERVO_NUM];
+    jitter_buffer_playout_t playout;
+
+    portENTER_CRITICAL(&s_jitter_buffer_lock);
+    playout = jitter_buffer_pop(&s_jitter_buffer, esp_timer_get_time(), angles);
+    portEXIT_CRITICAL(&s_jitter_buffer_lock);
+
+    if (playout == JITTER_BUFFER_PLAYOUT_EMPTY)
+    {
+        return;
+    }
+    // Back off servos that press against an object or a mechanical stop
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < SERVO_NUM; i++)
+    {
+        float angle = servo_guard_update(&s_servo_guard, i, now, angles[i], current_sense_read_ma(i));
+        iot_servo_write_angle(LEDC_LOW_SPEED_MODE, hand_fingers[i].ledc_channel, hand_finger_servo_angle(i, angle));
+    }
+
+    if (s_session_queue != NULL && ++s_updates % SESSION_LOG_EVERY == 0)
+    {
+        session_record_t rec = {
+            .time_ms = (uint32_t)(now / 1000),
+            .envelope = s_last_envelope,
+            .playout = playout,
+        };
+        for (int i = 0; i < SERVO_NUM; i++)
+        {
+            servo_guard_status_t status;
+            servo_guard_get_status(&s_servo_guard, i, &status);
+            rec.angles[i] = (uint8_t)status.output;
+            rec.current_ma[i] = (uint16_t)status.current_ma;
+            if (status.state == SERVO_GUARD_HOLDING)
+            {
+                rec.holding_mask |= 1 << i;
+            }
+        }
+        // Never block the servo timer, a record is dropped when the log task falls behind
+        xQueueSend(s_session_queue, &rec, 0);
+    }
+}
+
+// Writes the queued records to flash, a partial page is programmed every SESSION_LOG_FLUSH_MS
+static void session_log_task(void *arg)
+{
+    session_record_t rec;
+    int64_t last_flush = esp_timer_get_time();
+
+    while (1)
+    {
+        if (xQueueReceive(s_session_queue, &rec, pdMS_TO_TICKS(SESSION_LOG_FLUSH_MS)) == pdTRUE)
+        {
+            esp_err_t err = session_log_append(&s_session_log, SESSION_RECORD_SERVO_STATE, &rec, sizeof(rec));
+            if (err != ESP_OK)
+            {
+                ESP_LOGE(SPP_TAG, "session log append failed: %s", esp_err_to_name(err));
+            }
+        }
+        if (esp_timer_get_time() - last_flush >= SESSION_LOG_FLUSH_MS * 1000LL)
+        {
+            session_log_flush(&s_session_log);
+            last_flush = esp_timer_get_time();
+        }
+    }
+}
+
+static void session_log_setup(void)
+{
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                           SESSION_LOG_PARTITION_SUBTYPE, NULL);
+    if (part == NULL)
+    {
+        ESP_LOGW(SPP_TAG, "no session log partition, logging disabled");
+        return;
+    }
+    esp_err_t err = session_log_mount(&s_session_log, part);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(SPP_TAG, "session log mount failed: %s", esp_err_to_name(err));
+        return;
+    }
+    session_log_stats_t stats;
+    session_log_get_stats(&s_session_log, &stats);
+    ESP_LOGI(SPP_TAG, "session log mounted: sector seq %"PRIu32", %"PRIu32" flash reads",
+             stats.head_seq, stats.mount_reads);
+
+    s_session_queue = xQueueCreate(SESSION_LOG_QUEUE_LEN, sizeof(session_record_t));
+    if (s_session_queue == NULL)
+    {
+        ESP_LOGE(SPP_TAG, "session log queue allocation failed");
+        return;
+    }
+    xTaskCreate(session_log_task, "session_log", 3072, NULL, 2, NULL);
+}
+
+// Erases freed NVS pages, so a write of the BT stack never waits for a sector erase
+static void nvs_gc_task(void *arg)
+{
+    while (1)
+    {
+        esp_err_t err = nvs_flash_collect_garbage(NULL);
+        if (err == ESP_OK)
+        {
+            vTaskDelay(pdMS_TO_TICKS(NVS_GC_STEP_DELAY_MS));
+            continue;
+        }
+        if (err != ESP_ERR_NVS_NOT_FOUND)
+        {
+            ESP_LOGE(SPP_TAG, "nvs garbage collection failed: %s", esp_err_to_name(err));
+        }
+        vTaskDelay(pdMS_TO_TICKS(NVS_GC_IDLE_MS));
+    }
+}
+
+static void nvs_gc_setup(void)
+{
+    ESP_ERROR_CHECK(nvs_flash_set_background_erase(NULL, true));
+    xTaskCreate(nvs_gc_task, "nvs_gc", 2048, NULL, 1, NULL);
+}
+
+static void servo_guard_setup(void)
+{
+    servo_guard_config_t sg_cfg = SERVO_GUARD_DEFAULT_CONFIG();
+    sg_cfg.channel_number = SERVO_NUM;
+    ESP_ERROR_CHECK(servo_guard_init(&s_servo_guard, &sg_cfg));
+
+    ESP_ERROR_CHECK(adc1_config_width(ADC_WIDTH_BIT_12));
+    for (int i = 0; i < SERVO_NUM; i++)
+    {
+        if (hand_fingers[i].sense_unit == 1)
+        {
+            ESP_ERROR_CHECK(adc1_config_channel_atten((adc1_channel_t)hand_fingers[i].sense_channel, ADC_ATTEN_DB_12));
+        }
+        else
+        {
+            ESP_ERROR_CHECK(adc2_config_channel_atten((adc2_channel_t)hand_fingers[i].sense_channel, ADC_ATTEN_DB_12));
+        }
+    }
+}
+
+static void jitter_buffer_setup(void)
+{
+    jitter_buffer_config_t jb_cfg = JITTER_BUFFER_DEFAULT_CONFIG();
+    jb_cfg.channel_number = SERVO_NUM;
+    ESP_ERROR_CHECK(jitter_buffer_init(&s_jitter_buffer, &jb_cfg));
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = servo_update_cb,
+        .name = "servo_update",
+    };
+    esp_timer_handle_t timer;
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(timer, SERVO_UPDATE_PERIOD_US));
+}
+
 static char *bda2str(uint8_t * bda, char *str, size_t size)
 {
     if (bda == NULL || str == NULL || size < 18) {
@@ -119,7 +341,11 @@ static void esp_spp_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param) {
     case ESP_SPP_SRV_OPEN_EVT:
         ESP_LOGI(SPP_TAG, "ESP_SPP_SRV_OPEN_EVT status:%d handle:%"PRIu32", rem_bda:[%s]", param->srv_open.status,
                 param->srv_open.handle, bda2str(param->srv_open.rem_bda, bda_str, sizeof(bda_str)));
-                break;
+        // A new connection comes with a new sender clock
+        portENTER_CRITICAL(&s_jitter_buffer_lock);
+        jitter_buffer_reset(&s_jitter_buffer);
+        portEXIT_CRITICAL(&s_jitter_buffer_lock);
+        break;
     case ESP_SPP_SRV_STOP_EVT:
         ESP_LOGI(SPP_TAG, "ESP_SPP_SRV_STOP_EVT");
         break;
@@ -198,70 +424,21 @@ static void ledc_init(void)
     };
     ESP_ERROR_CHECK(ledc_timer_config(&ledc_timer));
 
-    // Prepare and then apply the LEDC PWM channel configuration for the Pinky
-    ledc_channel_config_t ledc_channel_pinky = {
-        .speed_mode     = LEDC_LOW_SPEED_MODE,
-        .channel        = LEDC_CHANNEL_0,
-        .timer_sel      = LEDC_TIMER_0,
-        .intr_type      = LEDC_INTR_DISABLE,
-        .gpio_num       = LEDC_PINKY,            // GPIO NUMBER
-        .duty           = 0, // Set duty to 0%
-        .hpoint         = 0
-    };
-    ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel_pinky));
-    ESP_LOGI(SPP_TAG, "Pinky Init");
-
-    // Prepare and then apply the LEDC PWM channel configuration for the Ring
-    ledc_channel_config_t ledc_channel_ring = {
-        .speed_mode     = LEDC_LOW_SPEED_MODE,
-        .channel        = LEDC_CHANNEL_1,
-        .timer_sel      = LEDC_TIMER_0,
-        .intr_type      = LEDC_INTR_DISABLE,
-        .gpio_num       = LEDC_RING,            // GPIO NUMBER
-        .duty           = 0, // Set duty to 0%
-        .hpoint         = 0
-    };
-    ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel_ring));
-    ESP_LOGI(SPP_TAG, "Ring init");
-
-    // Prepare and then apply the LEDC PWM channel configuration for the middle
-    ledc_channel_config_t ledc_channel_middle = {
-        .speed_mode     = LEDC_LOW_SPEED_MODE,
-        .channel        = LEDC_CHANNEL_2,
-        .timer_sel      = LEDC_TIMER_0,
-        .intr_type      = LEDC_INTR_DISABLE,
-        .gpio_num       = LEDC_MIDDLE,            // GPIO NUMBER
-        .duty           = 0, // Set duty to 0%
-        .hpoint         = 0
-    };
-    ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel_middle));
-    ESP_LOGI(SPP_TAG, "Middle init");
-
-    // Prepare and then apply the LEDC PWM channel configuration for the pointer
-    ledc_channel_config_t ledc_channel_pointer = {
-        .speed_mode     = LEDC_LOW_SPEED_MODE,
-        .channel        = LEDC_CHANNEL_3,
-        .timer_sel      = LEDC_TIMER_0,
-        .intr_type      = LEDC_INTR_DISABLE,
-        .gpio_num       = LEDC_POINTER,            // GPIO NUMBER
-        .duty           = 0, // Set duty to 0%
-        .hpoint         = 0
-    };
-    ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel_pointer));
-    ESP_LOGI(SPP_TAG, "Pointer init");
-
-    // Prepare and then apply the LEDC PWM channel configuration for the thumb
-    ledc_channel_config_t ledc_channel_thumb = {
-        .speed_mode     = LEDC_LOW_SPEED_MODE,
-        .channel        = LEDC_CHANNEL_4,
-        .timer_sel      = LEDC_TIMER_0,
-        .intr_type      = LEDC_INTR_DISABLE,
-        .gpio_num       = LEDC_THUMB,            // GPIO NUMBER
-        .duty           = 0, // Set duty to 0%
-        .hpoint         = 0
-    };
-    ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel_thumb));
-    ESP_LOGI(SPP_TAG, "Thumn init");
+    // Prepare and then apply the LEDC PWM channel configuration for every finger
+    for (int i = 0; i < SERVO_NUM; i++)
+    {
+        ledc_channel_config_t ledc_channel = {
+            .speed_mode     = LEDC_LOW_SPEED_MODE,
+            .channel        = hand_fingers[i].ledc_channel,
+            .timer_sel      = LEDC_TIMER_0,
+            .intr_type      = LEDC_INTR_DISABLE,
+            .gpio_num       = hand_fingers[i].gpio,            // GPIO NUMBER
+            .duty           = 0, // Set duty to 0%
+            .hpoint         = 0
+        };
+        ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel));
+        ESP_LOGI(SPP_TAG, "%s init", hand_fingers[i].name);
+    }
 }
 
 static void gpio_init(void)
@@ -269,7 +446,7 @@ static void gpio_init(void)
     gpio_config_t gpio_cfg ={
         .intr_type       = GPIO_INTR_DISABLE,
         .mode            = GPIO_MODE_OUTPUT,
-        .pin_bit_mask    = GPIO_OUTPUT_PIN_SEL,
+        .pin_bit_mask    = HAND_GPIO_OUTPUT_PIN_SEL,
         .pull_down_en    = 0,
         .pull_up_en      = 0,
     };
@@ -285,32 +462,20 @@ static void servo_init(void)
         .freq = 50,
         .timer_number = LEDC_TIMER_0,
         .channels = {
-            .servo_pin = {
-                SERVO_PINKY,
-                SERVO_RING,
-                SERVO_MIDDLE,
-                SERVO_POINTER,
-                SERVO_THUMB,
-            },
-            .ch = {
-                LEDC_CHANNEL_0,
-                LEDC_CHANNEL_1,
-                LEDC_CHANNEL_2,
-                LEDC_CHANNEL_3,
-                LEDC_CHANNEL_4,
-            },
+            .servo_pin = HAND_SERVO_GPIOS,
+            .ch = HAND_SERVO_CHANNELS,
         },
-        .channel_number = 1,
+        .channel_number = SERVO_NUM,
     };
 
     ESP_ERROR_CHECK(iot_servo_init(LEDC_LOW_SPEED_MODE, &servo_cfg));
 
-    // Set all servos to 0 as starting position
-    iot_servo_write_angle(LEDC_LOW_SPEED_MODE, 0, 0);
-    iot_servo_write_angle(LEDC_LOW_SPEED_MODE, 1, 0);
-    iot_servo_write_angle(LEDC_LOW_SPEED_MODE, 2, 0);
-    iot_servo_write_angle(LEDC_LOW_SPEED_MODE, 3, 0);
-    iot_servo_write_angle(LEDC_LOW_SPEED_MODE, 4, 5);
+    // Open the hand as starting position
+    for (int i = 0; i < SERVO_NUM; i++)
+    {
+        iot_servo_write_angle(LEDC_LOW_SPEED_MODE, hand_fingers[i].ledc_channel,
+                              hand_finger_servo_angle(i, hand_fingers[i].open_deg));
+    }
 }
 
 void app_main(void)
@@ -322,6 +487,8 @@ void app_main(void)
         ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK( ret );
+    // Move the NVS sector erases to a low priority task
+    nvs_gc_setup();
 
     // Init the GPIO
     gpio_init();
@@ -329,6 +496,12 @@ void app_main(void)
     ledc_init();
     // Init the servo
     servo_init();
+    // Init the stall supervision, has to be ready before the servo updates start
+    servo_guard_setup();
+    // Mount the session log before the servo updates produce records
+    session_log_setup();
+    // Start the steady servo updates
+    jitter_buffer_setup();
 
     ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_BLE));
 